@@ -3,10 +3,54 @@
 #include <string.h>
 #include <errno.h>
 #include <math.h>
+#include <stdint.h>
+#include <unistd.h>
 #include <sys/ipc.h>
-#include <sys/msg.h>
+#include <sys/shm.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#define HAVE_URING 1
+#endif
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
 #include <stdbool.h>
+#include <time.h>
+#include <linux/futex.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__x86_64__)
+/* crc32 instruction, used when the CPU has SSE4.2 */
+#include <nmmintrin.h>
+#define HAVE_CRC32C_HW 1
+/* AVX2 kernels, used when the CPU has it */
+#include <immintrin.h>
+#define HAVE_AVX2 1
+/* AVX-512 kernels, used when the CPU has AVX-512F and BW */
+#define HAVE_AVX512 1
+#endif
 
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_XXHASH
+#include <xxhash.h>
+#endif
 #include "SDL.h"
 
 #ifdef DEBUG
@@ -18,6 +62,8 @@
 #define DIE(...)      fprintf(stderr, __VA_ARGS__)
 
 #define COUNT_OF(a) (sizeof(a) / sizeof(a[0]))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 #define precheck_range(index, array)                 \
     if (index >= sizeof(array) / sizeof(array[0])) { \
         DIE("index=%d out of range\n", index);       \
@@ -30,81 +76,243 @@
 #define MASTER 1
 #define SLAVE 2
 
-/* IPC Commands */
-#define NEXT 'a'
-#define PREV 'b'
-#define REW 'c'
-#define ZOOM_IN 'd'
-#define ZOOM_OUT 'e'
-#define QUIT 'f'
-#define Y_ONLY 'g'
-#define CB_ONLY 'h'
-#define CR_ONLY 'i'
-#define ALL_PLANES 'j'
+/* Planes of a frame, see Frame.need */
+#define PLANE_Y   1
+#define PLANE_CB  2
+#define PLANE_CR  4
+#define PLANE_ALL (PLANE_Y | PLANE_CB | PLANE_CR)
+
+/* Owners of memory pool blocks, see mem_alloc() */
+enum {
+    MEM_FRAME = 0,            /* Frame buffers */
+    MEM_SCRATCH,              /* reader, export and hash buffers */
+    MEM_THUMB,                /* contact sheet */
+    MEM_PROXY,                /* timeline */
+    MEM_CHUNK,                /* compressed input */
+    MEM_IO,                   /* io_uring, URING_ALIGN aligned */
+    MEM_SPARE,                /* freed mappings */
+    MEM_OWNERS,
+};
+
+/* One decoded frame, filled by a reader and consumed by a drawer */
+typedef struct Frame {
+    Uint8 *raw;               /* pointer towards complete frame - frame_size bytes */
+    Uint8 *y_data;            /* pointer towards luma-data */
+    Uint8 *cb_data;           /* pointer towards croma-data */
+    Uint8 *cr_data;           /* pointer towards croma-data */
+    Uint16 *deep;             /* samples of formats over 8 bit, y, cb, cr */
+    Uint32 raw_cap;           /* allocated bytes of each buffer above */
+    Uint32 y_cap;
+    Uint32 cb_cap;
+    Uint32 cr_cap;
+    Uint32 deep_cap;          /* samples */
+    Uint32 need;              /* PLANE_* the reader fills, 0 for all */
+} Frame;
+
+/* One plane of a frame as stored in the file */
+typedef struct Plane {
+    Uint32 row;               /* bytes per row, padding excluded */
+    Uint32 rows;
+    Uint32 stride;            /* bytes from one row to the next */
+    Uint32 gap;               /* bytes skipped before the plane */
+} Plane;
+
+/* Decode context: format and geometry of one stream, everything a reader
+ * needs besides the input and the frame buffers. Readers keep no other
+ * state, so any number of frames decode at the same time, each with its
+ * own FILE and Frame. setup_param() fills P.dec for the main input. */
+typedef struct Dec {
+    Uint32 format;
+    Uint32 width;             /* frame width - in pixels */
+    Uint32 height;            /* frame height - in pixels */
+    Uint32 wh;                /* width x height */
+    Uint32 frame_size;        /* decoded frame - in bytes */
+    Uint32 raw_frame_size;    /* stored frame, padding included */
+    Uint32 y_size;
+    Uint32 cb_size;
+    Uint32 cr_size;
+    Uint32 y_start_pos;       /* packed 4:2:2, first byte of each */
+    Uint32 cb_start_pos;
+    Uint32 cr_start_pos;
+    Uint32 nplanes;
+    Plane plane[3];           /* planes as stored, in file order */
+    Uint32 tail;              /* padding after the last plane - in bytes */
+    const Uint8 *lut;         /* deep samples to the 8 bit planes */
+} Dec;
 
 /* PROTOTYPES */
-Uint32 rd(Uint8 *data, Uint32 size);
-Uint32 read_planar(void);
-Uint32 read_planar_vu(void);
-Uint32 read_planar_vu_422sample(void);
-Uint32 read_planar_vu_444sample(void);
-Uint32 read_semi_planar(void);
-void de_semi_planar_tile(Uint8 *data, Uint32 tiled_width, Uint32 tiled_height);
-Uint32 read_semi_planar_tiled(Uint32 tw, Uint32 th);
-Uint32 read_semi_planar_tiled4x4(void);
-Uint32 read_semi_planar_tiled8x4(void);
-Uint32 read_semi_planar_10_tiled4x4(void);
-Uint32 read_semi_planar_vu(void);
-Uint32 read_semi_planar_10(void);
-Uint32 read_mono(void);
-Uint32 read_422(void);
-Uint32 read_y42210(void);
-Uint32 read_yv1210(void);
+Uint32 rd(FILE *fp, Uint8 *data, Uint32 size);
+Uint32 rd_rows(FILE *fp, Uint8 *dst, const Plane *pl);
+Uint32 rd_plane(const Dec *d, FILE *fp, Uint8 *dst, Uint32 p);
+bool frame_needs(const Frame *f, Uint32 planes);
+Uint32 skip_plane(const Dec *d, FILE *fp, Uint32 p);
+Uint32 rd_plane_for(const Dec *d, FILE *fp, Frame *f, Uint8 *dst, Uint32 p, Uint32 planes);
+Uint32 read_planar(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_planar_vu(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_planar_vu_422sample(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_planar_vu_444sample(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_semi_planar(const Dec *d, FILE *fp, Frame *f);
+typedef struct TileFmt TileFmt;
+Uint32 tile_index(const TileFmt *t, Uint32 x, Uint32 y, Uint32 xt, Uint32 yt);
+void tile_grid(const TileFmt *t, Uint32 p, Uint32 w, Uint32 rows,
+               Uint32 *xt, Uint32 *yt);
+Uint32 tile_frame_size(const TileFmt *t, Uint32 w, Uint32 h);
+void detile(const TileFmt *t, Uint32 p, const Uint8 *src, Uint8 *dst,
+            Uint32 w, Uint32 h);
+Uint32 read_semi_planar_tiled(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_semi_planar_vu(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_semi_planar_10(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_mono(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_422(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_y42210(const Dec *d, FILE *fp, Frame *f);
+Uint32 read_yv1210(const Dec *d, FILE *fp, Frame *f);
+Uint32 dec_read(const Dec *d, FILE *fp, Frame *f);
+typedef struct MemHdr MemHdr;
+typedef Uint64 (*MemReclaim)(Uint64 need);
+void mem_init(void);
+void mem_count(Uint32 owner, Sint64 len);
+void mem_reclaimer(Uint32 owner, MemReclaim fn);
+void mem_unmap(MemHdr h);
+Uint64 mem_drop_spares(Uint64 need);
+void mem_reclaim(Uint64 need, Uint32 owner);
+Uint32 mem_reserve(size_t len, Uint32 owner);
+MemHdr mem_take_spare(size_t len, Uint32 kind);
+void mem_put_spare(MemHdr h);
+void *mem_alloc(size_t size, Uint32 owner);
+void mem_free(void *ptr);
+Uint64 mem_cap(Uint64 size);
+Sint64 mem_thp(void);
+void mem_close(void);
+void mem_stats(void);
+void frame_free(Frame *f);
+Uint32 frame_grow(Uint8 **buf, Uint32 *cap, Uint32 size);
+Uint32 frame_alloc(const Dec *d, Frame *f);
 Uint32 check_free_memory(void);
 Uint32 allocate_memory(void);
-void draw_grid422_param(int step, int dot, int color0, int color1);
-void draw_grid420_param(int step, int dot, int color0, int color1);
-void draw_grid422(void);
-void draw_grid420(void);
+typedef struct Layer Layer;
+void layer_put(Layer *l, Uint32 p, Uint32 off, Uint8 v, Uint8 op);
+void layer_fill(Layer *l, Uint32 p, Uint32 off, Uint32 n, Uint8 v);
+void draw_grid422_param(Layer *l, int step, int dot, int color0, int color1);
+void draw_grid420_param(Layer *l, int step, int dot, int color0, int color1);
+void draw_grid422(Layer *l);
+void draw_grid420(Layer *l);
 Uint32 bitdepth(Uint32 fmt);
 bool isPlanar(Uint32 fmt);
-void luma_only(void);
-void cb_only(void);
-void cr_only(void);
+void luma_only(Layer *l);
+void cb_only(Layer *l);
+void cr_only(Layer *l);
+void mb_box(Layer *l);
+void layer_clear(Layer *l);
+void layers_free(void);
+Uint32 layers_alloc(void);
+void layer_render(Uint32 i, Uint64 key);
+void layers_draw(void);
 void pre_draw(void);
 void post_draw(void);
+Uint32 dirty_alloc(void);
+void dirty_free(void);
+void dirty_plane(Uint32 p, const Uint8 *src);
+void dirty_layers(Uint32 lo, Uint32 hi);
+void dirty_copy(Uint32 p, Uint32 x, Uint32 y, Uint32 n);
+void dirty_flush(void);
+void dirty_reset(void);
+void display_overlay(SDL_Overlay *o);
+bool dirty_same(void);
+void dirty_stats(void);
 void draw_yv12(void);
 void draw_422(void);
 void draw_420sp(void);
 Uint32 redraw(void);
 Uint32 diff_mode(void);
-void calc_psnr(Uint8 *frame0, Uint8 *frame1);
+void diff_frames(const Dec *d, Frame *dst, const Frame *a, const Frame *b,
+                 Uint32 amp);
+void calc_psnr(const Dec *d, Uint8 *frame0, Uint8 *frame1);
+bool diff_view(void);
+void diff_pair(Frame **a, Frame **b);
+typedef struct TempSlot TempSlot;
+void temp_reset(void);
+void temp_free(void);
+TempSlot *temp_get(Uint32 index, const TempSlot *keep);
+Uint32 temporal_read(void);
+void temporal_toggle(void);
+void temporal_stats(void);
+void lut_setup(Uint32 bits);
+void lut_build(void);
+void lut_apply(void);
+Uint32 lut_key(SDLKey key);
 void usage(char *name);
 void mb_loop(char *str, Uint8 *start_addr, Uint32 cols, Uint32 rows,
              Uint32 stride, Uint32 delim);
 void show_mb(Uint32 mouse_x, Uint32 mouse_y);
 void draw_frame(void);
+Uint32 view_planes(void);
 Uint32 read_frame(void);
 void setup_param(void);
+void dec_setup(Dec *d);
+void setup_planes(void);
 void check_input(void);
 Uint32 open_input(void);
-Uint32 create_message_queue(void);
-void destroy_message_queue(void);
-Uint32 connect_message_queue(void);
-Uint32 send_message(char cmd);
-Uint32 read_message(void);
-Uint32 event_dispatcher(void);
+long futex_wait(Uint32 *addr, Uint32 val, Uint32 ms);
+long futex_wake(Uint32 *addr);
+void sync_post(void);
+int sync_waiter(void *arg);
+struct sync_state;
+void sync_read(struct sync_state *s);
+Uint32 sync_attach(Uint32 mode);
+void sync_detach(void);
+void sync_publish(Uint32 frame, Uint32 quit);
+Uint32 sync_follow(Uint32 *frame);
 Uint32 event_loop(void);
+Uint32 parse_options(int *argc, char **argv);
 Uint32 parse_input(int argc, char **argv);
 Uint32 sdl_init(void);
+Uint32 sdl_overlay(void);
+Uint32 set_geometry(Uint32 width, Uint32 height, Uint32 *frame);
 Uint32 reinit(void);
 void set_caption(char *array, Uint32 frame, Uint32 bytes);
 void set_zoom_rect(void);
+void set_zoom(Sint32 zoom);
 void histogram(void);
-Uint32 ten2eight(Uint8 *src, Uint8 *dst, Uint32 length);
 Uint32 comb_byte(Uint8 a, Uint32 offset0, Uint8 b, Uint32 offset1);
-Uint32 dither(Uint32 x);
-Uint32 ten2eight_compact(Uint8 *src, Uint8 *dst, Uint32 length);
+void deep_map(const Dec *d, Frame *f, const Uint8 *lut);
+void unzip_u16(const Uint16 *src, Uint8 *lo, Uint8 *hi, Uint32 n);
+void heat_free(void);
+Uint32 heat_alloc(void);
+void heat_calc(void);
+double heat_value(Uint32 index);
+void heat_color(double t, Uint8 *y, Uint8 *u, Uint8 *v);
+Uint64 heat_key(void);
+void heat_draw(Layer *l);
+void heat_show(Uint32 mouse_x, Uint32 mouse_y);
+void crc32_init(void);
+Uint32 crc32_u8(Uint32 crc, const Uint8 *p, Uint32 n);
+Uint32 adler32_u8(Uint32 adler, const Uint8 *p, Uint32 n);
+Uint8 *put_be32(Uint8 *o, Uint32 v);
+Uint8 *put_bytes(Uint8 *o, const Uint8 *src, Uint32 n);
+Uint8 clamp_u8(Sint32 v);
+typedef struct ExportSlot ExportSlot;
+void ex_chroma(const Uint8 *src, Uint32 srows, Uint8 *dst, Uint32 cw,
+               Uint32 ch);
+Uint8 *ex_interleave(Uint8 *o, const Uint8 *a, const Uint8 *b, Uint32 n);
+Uint8 *ex_pack422(Uint8 *o, const Uint8 *y, const Uint8 *cb,
+                  const Uint8 *cr, Uint32 ypos, Uint32 cbpos, Uint32 crpos);
+Uint8 *ex_loose10(Uint8 *o, const Uint8 *src, Uint32 n);
+Uint8 *ex_compact10(Uint8 *o, const Uint8 *src, Uint32 n);
+Uint8 *ex_tile(Uint8 *o, const TileFmt *t, Uint32 p, const Uint8 *src,
+               Uint32 w, Uint32 h);
+Uint8 *ex_tiled(ExportSlot *s, Uint8 *o);
+Uint8 *ex_raw(ExportSlot *s, Uint32 srows, Uint8 *o);
+Uint8 *ex_png(ExportSlot *s, Uint32 srows, Uint8 *o);
+void ex_convert_job(void *arg, Uint32 worker);
+Uint32 ex_png_name(char *buf, Uint32 size, Uint32 index);
+Uint32 ex_write(ExportSlot *s);
+void ex_fail(void);
+ExportSlot *ex_wait(Uint32 index, Uint32 state);
+void ex_post(ExportSlot *s, Uint32 state);
+int ex_reader(void *arg);
+int ex_writer(void *arg);
+Uint32 export_setup(void);
+Uint32 export_run(void);
 
 Uint32 guess_arg(char *filename);
 int strfmtcmp(const void *p0, const void *p1);
@@ -119,6 +327,297 @@ void destoryStrFmtLst(void);
 Uint32 parse_format(char *fmtstr);
 char *showFmt(Uint32 format);
 
+/* Worker pool */
+typedef void (*JobFn)(void *arg, Uint32 worker);
+typedef struct Pool Pool;
+Uint32 cpu_count(void);
+int pool_worker(void *arg);
+Pool *pool_create(Uint32 nworker);
+void pool_destroy(Pool *pool);
+Uint32 pool_submit(Pool *pool, JobFn fn, void *arg);
+void pool_cancel(Pool *pool, JobFn fn);
+void pool_wait(Pool *pool);
+void pool_batch_job(void *arg, Uint32 worker);
+void pool_run(Pool *pool, JobFn fn, void **arg, Uint32 n);
+Pool *pool_get(void);
+
+/* one frame to decode from one input, see read_job() */
+typedef struct ReadJob {
+    const Dec *d;
+    FILE *fp;
+    Frame *f;
+    Uint32 ret;
+} ReadJob;
+void read_job(void *arg, Uint32 worker);
+
+/* io_uring frame reader */
+typedef struct UringSlot UringSlot;
+Uint64 now_ns(void);
+Uint32 uring_setup(void);
+Uint32 uring_submit(UringSlot *s);
+void uring_reap(bool wait);
+void uring_open(void);
+void uring_close(void);
+void uring_stats(void);
+UringSlot *uring_find(Uint32 index);
+void uring_fill(void);
+Uint32 uring_read(const Dec *d, Frame *f);
+
+/* Compressed input */
+typedef struct ZChunk ZChunk;
+typedef struct ZEntry ZEntry;
+typedef struct Zin Zin;
+typedef struct RevSlot RevSlot;
+Uint32 zin_magic(const Uint8 *b, size_t n);
+Uint32 get_le32(const Uint8 *p);
+Uint32 zin_index_zstd(Zin *z, Uint64 fsize);
+Uint32 zin_index_xz(Zin *z, Uint64 fsize);
+Uint32 zin_stream_init(Zin *z);
+void zin_stream_end(Zin *z);
+Uint32 zin_restart(Zin *z);
+Uint32 zin_fill(Zin *z);
+Uint32 zin_stream(Zin *z, Uint8 *out, Uint32 n);
+Uint64 zin_doff(Zin *z, Uint32 k);
+Uint32 zin_dsize(Zin *z, Uint32 k);
+Uint32 zin_nchunk(Zin *z);
+Uint32 zin_find(Zin *z, Uint64 pos);
+void zin_decode(ZEntry *e);
+void zin_job(void *arg, Uint32 worker);
+ZEntry *zin_victim(Zin *z, Uint32 lo, Uint32 hi);
+ZEntry *zin_get(Zin *z, Uint32 k);
+void zin_ahead(Zin *z);
+ssize_t zin_read(void *cookie, char *buf, size_t size);
+int zin_seek(void *cookie, off64_t *pos, int whence);
+int zin_close(void *cookie);
+FILE *zin_open(Zin *z, const char *name);
+FILE *zfopen(const char *name, bool ahead);
+
+/* Contact sheet */
+Uint32 frame_count(FILE *fp);
+off_t frame_offset(Uint32 index);
+Uint32 seek_frame(Uint32 index);
+void sheet_layout(void);
+void sheet_scale(Frame *f, Uint8 *dst);
+Uint32 sheet_evict_one(void);
+void sheet_evict(void);
+Uint64 sheet_reclaim(Uint64 need);
+void sheet_job(void *arg, Uint32 worker);
+void sheet_request(void);
+void sheet_flush(void);
+void sheet_draw(void);
+Uint32 sheet_open(Uint32 first);
+void sheet_close(void);
+Uint32 sheet_key(SDLKey key);
+Sint32 sheet_pick(Uint32 mouse_x, Uint32 mouse_y);
+
+/* Reverse play */
+void rev_job(void *arg, Uint32 worker);
+void rev_fill(Sint64 next);
+Uint32 rev_open(void);
+void rev_close(void);
+Uint32 rev_read(Uint32 index);
+
+/* Timeline */
+bool proxy_direct(void);
+Uint32 proxy_build(Uint32 index, Uint32 worker, Uint8 *dst);
+Sint64 proxy_next(void);
+void proxy_job(void *arg, Uint32 worker);
+Uint32 line_open(void);
+void line_close(void);
+Uint8 *line_pel(SDL_Overlay *o, Uint32 x, Uint32 y);
+void line_grey(SDL_Overlay *o, Uint32 y0, Uint32 y1);
+void line_bar(SDL_Overlay *o, Uint32 index);
+void line_show(Uint32 index);
+void line_scrub(Uint32 mouse_x);
+bool line_hit(Uint32 mouse_y);
+Uint32 goto_frame(Uint32 index, Uint32 *frame);
+Uint32 line_key(SDLKey key, Uint32 *frame);
+
+/* Sequence QC */
+typedef struct QcSum QcSum;
+typedef struct QcStat QcStat;
+void qc_luma(const Uint8 *y, const Uint8 *prev, Uint32 n, QcSum *s);
+void qc_frame(const Frame *f, const Frame *prev, QcStat *st);
+Sint64 qc_next(void);
+bool qc_left(void);
+void qc_job(void *arg, Uint32 worker);
+Uint32 qc_open(Uint32 first);
+void qc_close(void);
+double qc_diff(Uint32 i);
+Uint32 qc_flags(Uint32 i);
+char *qc_names(Uint32 flags, char *buf, Uint32 size);
+Uint32 qc_run(void);
+Uint32 qc_key(SDLKey key, Uint32 *frame);
+
+/* Frame hashes */
+void crc32c_init(void);
+Uint32 crc32c_sw(Uint32 crc, const Uint8 *p, size_t n);
+#ifdef HAVE_CRC32C_HW
+Uint32 crc32c_hw(Uint32 crc, const Uint8 *p, size_t n);
+#endif
+Uint64 hash_data(const Uint8 *p, size_t n);
+Uint32 file_plane(Uint32 p);
+const char *plane_name(Uint32 p);
+void hash_job(void *arg, Uint32 worker);
+Uint32 hash_scan(void);
+void hash_close(void);
+Uint32 hash_algo(const char *name);
+Uint32 hash_write(void);
+Uint32 hash_load(void);
+Uint32 hash_verify(void);
+Uint32 hash_run(void);
+void hash_show(void);
+
+/* Compare view */
+Uint32 parse_compare(int argc, char **argv);
+Uint32 cmp_open(void);
+void cmp_close(void);
+bool cmp_visible(Uint32 i);
+Uint32 cmp_reset(void);
+Uint32 cmp_layout(void);
+void cmp_clamp(void);
+Uint32 cmp_decode(Uint32 index);
+Uint32 cmp_read(void);
+
+/* columns x0..x1 of one pane at ox, oy in the overlay */
+typedef struct CmpPane {
+    Uint32 input;
+    Uint32 ox;
+    Uint32 oy;
+    Uint32 x0;
+    Uint32 x1;
+} CmpPane;
+void cmp_pane_job(void *arg, Uint32 worker);
+void cmp_draw(void);
+void cmp_refresh(void);
+Uint32 cmp_key(SDLKey key);
+void cmp_pan(Sint32 dx, Sint32 dy);
+void cmp_split(Uint32 mouse_x);
+
+/* Format detection */
+typedef struct DetectJob {
+    Uint32 first;
+    Uint32 last;
+} DetectJob;
+struct Guess;
+double detect_mad(off_t a, off_t b);
+void detect_row_job(void *arg, Uint32 worker);
+double detect_frame_cost(const struct Guess *g, off_t frame, off_t luma);
+double detect_chroma_cost(const struct Guess *g, off_t luma);
+void detect_guess_job(void *arg, Uint32 worker);
+int detect_cmp(const void *p0, const void *p1);
+void detect_run(JobFn fn, Uint32 first, Uint32 n);
+Uint32 detect_candidates(Uint32 hint);
+void detect_free(void);
+Uint32 detect_arg(char *filename, Uint32 hint);
+
+/* Kernels */
+void unpack10_c(const Uint8 *src, Uint16 *dst, Uint32 n);
+void unpack16_c(const Uint8 *src, Uint16 *dst, Uint32 n);
+void copy_u8_c(Uint8 *dst, const Uint8 *src, Uint32 n);
+void split_u8_c(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n);
+void split_u16_c(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n);
+void zip_u16_c(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n);
+void lut_u16_c(Uint8 *dst, const Uint16 *src, const Uint8 *lut, Uint32 n);
+void diff_u8_c(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+               Uint32 amp);
+Uint64 sse_u8_c(const Uint8 *a, const Uint8 *b, Uint32 n);
+Uint64 sad_u8_c(const Uint8 *a, const Uint8 *b, Uint32 n);
+void sad_sse_8x8_c(const Uint8 *a, const Uint8 *b, Uint32 stride,
+                   Uint32 nblk, Uint32 *sad, Uint32 *sse);
+void blend_u8_c(Uint8 *dst, const Uint8 *val, const Uint8 *op, Uint32 n);
+void merge_u8_c(Uint8 *cval, Uint8 *cop, const Uint8 *val, const Uint8 *op,
+                Uint32 n);
+void dirty_row_c(const Uint8 *a, const Uint8 *b, Uint32 n, Uint32 bw,
+                 Uint8 *m, Uint8 bit);
+void sub_u8_c(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n);
+void add_u8_c(Uint8 *dst, const Uint8 *src, Uint32 n);
+#ifdef __SSE2__
+void unpack10_sse2(const Uint8 *src, Uint16 *dst, Uint32 n);
+void unpack16_sse2(const Uint8 *src, Uint16 *dst, Uint32 n);
+void copy_u8_sse2(Uint8 *dst, const Uint8 *src, Uint32 n);
+void split_u8_sse2(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n);
+void split_u16_sse2(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n);
+void zip_u16_sse2(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n);
+void diff_u8_sse2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                  Uint32 amp);
+Uint64 sse_u8_sse2(const Uint8 *a, const Uint8 *b, Uint32 n);
+Uint64 sad_u8_sse2(const Uint8 *a, const Uint8 *b, Uint32 n);
+void sad_sse_8x8_sse2(const Uint8 *a, const Uint8 *b, Uint32 stride,
+                      Uint32 nblk, Uint32 *sad, Uint32 *sse);
+void blend_u8_sse2(Uint8 *dst, const Uint8 *val, const Uint8 *op, Uint32 n);
+void merge_u8_sse2(Uint8 *cval, Uint8 *cop, const Uint8 *val,
+                   const Uint8 *op, Uint32 n);
+void dirty_row_sse2(const Uint8 *a, const Uint8 *b, Uint32 n, Uint32 bw,
+                    Uint8 *m, Uint8 bit);
+void sub_u8_sse2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n);
+void add_u8_sse2(Uint8 *dst, const Uint8 *src, Uint32 n);
+#endif
+#ifdef HAVE_AVX2
+void unpack10_avx2(const Uint8 *src, Uint16 *dst, Uint32 n);
+void copy_u8_avx2(Uint8 *dst, const Uint8 *src, Uint32 n);
+void split_u8_avx2(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n);
+void zip_u16_avx2(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n);
+void lut_u16_avx2(Uint8 *dst, const Uint16 *src, const Uint8 *lut, Uint32 n);
+void diff_u8_avx2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                  Uint32 amp);
+Uint64 sse_u8_avx2(const Uint8 *a, const Uint8 *b, Uint32 n);
+Uint64 sad_u8_avx2(const Uint8 *a, const Uint8 *b, Uint32 n);
+void sub_u8_avx2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n);
+void add_u8_avx2(Uint8 *dst, const Uint8 *src, Uint32 n);
+#endif
+#ifdef HAVE_AVX512
+void split_u8_avx512(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n);
+void split_u16_avx512(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n);
+void lut_u16_avx512(Uint8 *dst, const Uint16 *src, const Uint8 *lut,
+                    Uint32 n);
+void diff_u8_avx512(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                    Uint32 amp);
+Uint64 sse_u8_avx512(const Uint8 *a, const Uint8 *b, Uint32 n);
+Uint64 sad_u8_avx512(const Uint8 *a, const Uint8 *b, Uint32 n);
+void sub_u8_avx512(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n);
+void add_u8_avx512(Uint8 *dst, const Uint8 *src, Uint32 n);
+#endif
+Uint32 kern_top(void);
+Uint32 kern_init(const char *name);
+void kern_stats(void);
+
+/* Remote view */
+typedef struct NetMsg NetMsg;
+typedef struct NetIn NetIn;
+typedef struct NetConn NetConn;
+Uint8 *put_le32(Uint8 *o, Uint32 v);
+Uint32 put_varint(Uint8 *o, Uint32 v);
+Uint32 get_varint(const Uint8 *src, Uint32 len, Uint32 *pos, Uint32 *v);
+Uint32 zero_run(const Uint8 *src, Uint32 i, Uint32 n);
+Uint32 literal_run(const Uint8 *src, Uint32 i, Uint32 n);
+Uint32 zrle_encode(const Uint8 *src, Uint32 n, Uint8 *dst, Uint32 cap);
+Uint32 zrle_apply(Uint8 *dst, Uint32 n, const Uint8 *src, Uint32 len);
+Uint32 net_send(int fd, const void *buf, size_t n, bool more);
+Uint32 net_recv(int fd, void *buf, size_t n);
+Uint32 net_put_msg(int fd, const NetMsg *m, const void *payload);
+Uint32 net_get_msg(int fd, NetMsg *m);
+Uint32 net_addr(const char *spec, char *host, Uint32 size, const char **port);
+int net_socket(const char *spec, bool listen_on);
+Uint32 net_plane_size(Uint32 w, Uint32 h, Uint32 p);
+Uint32 net_geometry(NetConn *c, const NetMsg *m);
+void net_sample(NetConn *c, Uint32 p);
+Uint32 net_put_plane(NetConn *c, Uint32 index, Uint32 p);
+Uint32 net_error(NetConn *c, const char *msg);
+Uint32 net_serve_get(NetConn *c, Uint32 index, Uint32 mask);
+int net_conn(void *arg);
+void serve_reap(bool all);
+void serve_stop(int sig);
+Uint32 serve_run(void);
+Uint32 net_connect(const char *name, NetIn *c);
+Uint32 net_arg(char *name);
+Uint32 net_fetch(NetIn *c, Uint32 index, Uint32 p);
+ssize_t net_read(void *cookie, char *buf, size_t size);
+int net_seek(void *cookie, off64_t *off, int whence);
+int net_close(void *cookie);
+FILE *net_open(const char *name);
+void net_stats(void);
+
 /* Supported YUV-formats */
 enum {
     YV12 = 0,
@@ -136,12 +635,34 @@ enum {
     NV1210 = 12,
     NV12TILED = 13,
     NV1210TILED = 14,
+    NV12TILED4X4 = 15,
+    NV12TILED16X16 = 16,
+    NV12TILED64Z32 = 17,
+    NV12TILEDY = 18,
+    NV12TILEDMT = 19,
     FORMAT_MAX,
 };
 
+/* Tile geometry of a tiled format, see detile() */
+enum {
+    TILE_ROWS = 0,            /* tile rows top to bottom, left to right */
+    TILE_ZFLIPZ,              /* 2x2 tiles Z, flipped Z, Z ... */
+};
+
+struct TileFmt {
+    Uint32 tw;                /* luma tile - in bytes */
+    Uint32 th;                /* luma tile - in rows */
+    Uint32 cw;                /* chroma tile, interleaved pairs */
+    Uint32 ch;
+    Uint32 span;              /* bytes of a tile row stored in one piece */
+    Uint32 order;             /* TILE_ROWS or TILE_ZFLIPZ */
+    Uint32 align;             /* planes padded to a multiple - in bytes */
+    bool vu;                  /* chroma pairs are V,U */
+};
+
 typedef struct {
     int overlay_fmt;
-    Uint32 (*reader)(void);
+    Uint32 (*reader)(const Dec *d, FILE *fp, Frame *f);
     void (*drawer)(void);
     char *fmtNameLst;
 } FmtMap;
@@ -167,8 +688,27 @@ FmtMap gFmtMap[] = {
     [YV16] = {SDL_YV12_OVERLAY, read_planar_vu_422sample, draw_yv12, "yv16 422p"},
     [YUV444P] = {SDL_YV12_OVERLAY, read_planar_vu_444sample, draw_yv12, "444p"},
     [NV1210] = {SDL_YV12_OVERLAY, read_semi_planar_10, draw_yv12, "nv1210 yuv420sp_10bit"},
-    [NV12TILED] = {SDL_YV12_OVERLAY, read_semi_planar_tiled8x4, draw_yv12, "yuv420sp_tiled"},
-    [NV1210TILED] = {SDL_YV12_OVERLAY, read_semi_planar_10_tiled4x4, draw_yv12, "yuv420sp_tiled_mode0_10bit"},
+    [NV12TILED] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_tiled"},
+    [NV1210TILED] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_tiled_mode0_10bit"},
+    [NV12TILED4X4] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_tiled4x4 nv12_4l4"},
+    [NV12TILED16X16] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_tiled16x16 nv12_16l16"},
+    [NV12TILED64Z32] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_tiled64z32 nv12_64z32"},
+    [NV12TILEDY] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_ytiled nv12_ytiled"},
+    [NV12TILEDMT] = {SDL_YV12_OVERLAY, read_semi_planar_tiled, draw_yv12, "yuv420sp_tiled16x32 mm21 mt21"},
+};
+
+/* tiled formats, tw is 0 for the raster ones */
+TileFmt gTileMap[FORMAT_MAX] = {
+    [NV12TILED] = {8, 4, 8, 4, 8, TILE_ROWS, 0, true},
+    [NV1210TILED] = {4, 4, 4, 4, 4, TILE_ROWS, 0, true},
+    [NV12TILED4X4] = {4, 4, 4, 4, 4, TILE_ROWS, 0, true},
+    [NV12TILED16X16] = {16, 16, 16, 16, 16, TILE_ROWS, 0, false},
+    /* Qualcomm/Samsung 64x32, planes 8 KiB aligned */
+    [NV12TILED64Z32] = {64, 32, 64, 32, 64, TILE_ZFLIPZ, 8192, false},
+    /* Intel Y-tile, 4 KiB tiles of 16 byte columns */
+    [NV12TILEDY] = {128, 32, 128, 32, 16, TILE_ROWS, 0, false},
+    /* MediaTek, 16x32 luma tiles, chroma tiles half as high */
+    [NV12TILEDMT] = {16, 32, 16, 16, 16, TILE_ROWS, 0, false},
 };
 
 char *showFmt(Uint32 format) {
@@ -186,17 +726,18 @@ const SDL_VideoInfo *info = NULL;
 Uint32 FORMAT = YV12;
 FILE *fd;
 
-struct my_msgbuf {
-    long mtype;
-    char mtext[2];
-};
-
 struct param {
     Uint32 width;             /* frame width - in pixels */
     Uint32 height;            /* frame height - in pixels */
     Uint32 wh;                /* width x height */
     Uint32 frame_size;        /* size of 1 frame - in bytes */
     Uint32 raw_frame_size;    /* original frame size - in bytes */
+    Uint32 stride;            /* --stride, luma bytes per row, 0 = tight */
+    Uint32 uv_stride;         /* --uv-stride, chroma bytes per row */
+    Uint32 plane_offset[2];   /* --plane-offset, chroma planes, 0 = packed */
+    Uint32 nplanes;
+    Plane plane[3];           /* planes as stored, in file order */
+    off_t origin;             /* byte offset of frame 0 in the file(s) */
     Sint32 zoom;              /* zoom-factor */
     Uint32 zoom_width;
     Uint32 zoom_height;
@@ -214,32 +755,447 @@ struct param {
     Uint32 y_size;            /* sizeof luma-data for 1 frame - in bytes */
     Uint32 cb_size;           /* sizeof croma-data for 1 frame - in bytes */
     Uint32 cr_size;           /* sizeof croma-data for 1 frame - in bytes */
-    Uint8 *raw;               /* pointer towards complete frame - frame_size bytes */
-    Uint8 *y_data;            /* pointer towards luma-data */
-    Uint8 *cb_data;           /* pointer towards croma-data */
-    Uint8 *cr_data;           /* pointer towards croma-data */
+    Frame frame;              /* current frame */
+    Uint32 next;              /* frame index the next read_frame() returns */
     char *filename;           /* obvious */
     char *fname_diff;         /* see above */
     Uint32 overlay_format;    /* YV12, IYUV, YUY2, UYVY or YVYU - SDL */
     Uint32 vflags;            /* HW support or SW support */
     Uint8 bpp;                /* bits per pixel */
     Uint32 mode;              /* MASTER, SLAVE or NONE - defaults to NONE */
-    struct my_msgbuf buf;
-    int msqid;
-    key_t key;
     FILE *fd2;                /* diff file */
+    Frame diff_src[2];        /* last frame decoded from fd and fd2 */
+    Uint32 diff_amp;          /* diff-mode amplification */
     bool is_change_uv;        /* exchange uv status for every frame */
     bool flip_change_uv;      /* exchange uv flag this frame */
+    Dec dec;                  /* decode context of the input(s) */
 };
 
 /* Global parameter struct */
 struct param P;
 
-Uint32 rd(Uint8 *data, Uint32 size)
+/* Compare view state, see cmp_decode() */
+#define CMP_MAX 16
+#define CMP_MAX_W 4096               /* same limits as sdl_init() */
+#define CMP_MAX_H 2176
+#define CMP_MAX_MAG 16
+
+enum {
+    CMP_TILE = 0,
+    CMP_WIPE,
+};
+
+struct cmp {
+    bool on;
+    Uint32 n;                 /* inputs */
+    char *fname[CMP_MAX];
+    FILE *fd[CMP_MAX];        /* fd[0] is the main input */
+    Frame src[CMP_MAX];       /* allocated once the input is visible */
+    Sint32 have[CMP_MAX];     /* frame index held in src[], -1 for none */
+    Uint32 nframes;           /* frames in the shortest input */
+    Uint32 index;             /* frame index the next read_frame() returns */
+    Uint32 view;              /* CMP_TILE or CMP_WIPE */
+    Uint32 wipe;              /* input right of the split */
+    Uint32 split;             /* wipe position - in overlay pels */
+    Uint32 cols;              /* panes per row */
+    Uint32 rows;              /* panes per column */
+    Uint32 div;               /* source pels per pane pel at mag 1 */
+    Uint32 pw;                /* pane width - in overlay pels */
+    Uint32 ph;                /* pane height - in overlay pels */
+    Uint32 mag;               /* magnification 1, 2, 4 .. CMP_MAX_MAG */
+    Sint32 pan_x;             /* top-left source pel shown in every pane */
+    Sint32 pan_y;
+    Uint32 *xs;               /* source column of every pane column */
+    SDL_Overlay *overlay;
+};
+
+struct cmp gCmp;
+
+/* Temporal difference state, see temporal_read() */
+#define TEMP_RING 4                  /* decoded frames kept around */
+
+struct TempSlot {
+    Frame f;
+    Sint32 index;             /* frame index held in f, -1 for none */
+    Uint32 used;              /* stamp of the last use, the oldest is reused */
+};
+
+struct temporal {
+    bool on;
+    TempSlot slot[TEMP_RING];
+    Uint32 stamp;
+    Sint32 pos;               /* frame index fd is positioned at, -1 unknown */
+    Frame *prev;              /* frames P.frame is the difference of */
+    Frame *cur;
+    Uint64 decoded;           /* frames read from the input */
+    Uint64 reused;            /* frames taken from the ring */
+};
+
+struct temporal gTemp;
+
+/* Display mapping state, see lut_build() */
+#define LUT_SIZE (1 << 16)           /* every 16 bit sample */
+#define LUT_PAD 4                    /* the gathers read 4 bytes */
+
+struct lut {
+    Uint8 base[LUT_SIZE + LUT_PAD];  /* rounded to 8 bit, what readers use */
+    Uint8 view[LUT_SIZE + LUT_PAD];  /* window, gamma and bit plane */
+    Uint32 bits;              /* bits per sample, 8 for 8 bit formats */
+    Uint32 lo;                /* window, lo and below black, hi and up white */
+    Uint32 hi;                /* 0 until set */
+    double gamma;
+    Sint32 bit;               /* bit plane shown alone, -1 for all */
+    bool custom;              /* view differs from base */
+};
+
+struct lut gLut = {.gamma = 1.0, .bit = -1};
+
+/* Kernel registry state, see kern_init() */
+enum {
+    KERN_SCALAR = 0,
+    KERN_SSE2,
+    KERN_AVX2,
+    KERN_AVX512,
+    KERN_LEVELS,
+};
+
+struct kernels {
+    void (*unpack10)(const Uint8 *src, Uint16 *dst, Uint32 n);
+    void (*unpack16)(const Uint8 *src, Uint16 *dst, Uint32 n);
+    void (*copy_u8)(Uint8 *dst, const Uint8 *src, Uint32 n);
+    void (*split_u8)(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n);
+    void (*split_u16)(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n);
+    void (*zip_u16)(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n);
+    void (*lut_u16)(Uint8 *dst, const Uint16 *src, const Uint8 *lut,
+                    Uint32 n);
+    void (*diff_u8)(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                    Uint32 amp);
+    Uint64 (*sse_u8)(const Uint8 *a, const Uint8 *b, Uint32 n);
+    Uint64 (*sad_u8)(const Uint8 *a, const Uint8 *b, Uint32 n);
+    void (*sad_sse_8x8)(const Uint8 *a, const Uint8 *b, Uint32 stride,
+                        Uint32 nblk, Uint32 *sad, Uint32 *sse);
+    void (*blend_u8)(Uint8 *dst, const Uint8 *val, const Uint8 *op,
+                     Uint32 n);
+    void (*merge_u8)(Uint8 *cval, Uint8 *cop, const Uint8 *val,
+                     const Uint8 *op, Uint32 n);
+    void (*dirty_row)(const Uint8 *a, const Uint8 *b, Uint32 n, Uint32 bw,
+                      Uint8 *m, Uint8 bit);
+    void (*sub_u8)(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n);
+    void (*add_u8)(Uint8 *dst, const Uint8 *src, Uint32 n);
+};
+
+struct kernels gKern;
+Uint32 gKernLevel;
+
+/* Export pipeline state, see export_run() */
+#define EXPORT_DEPTH 16              /* frames in flight */
+#define EXPORT_BUF (8 << 20)         /* stdio buffer of the output file */
+#define EXPORT_FPS "25:1"            /* raw input has no rate, Y4M needs one */
+
+enum {
+    EXPORT_RAW = 0,
+    EXPORT_Y4M,
+    EXPORT_PNG,
+};
+
+enum {
+    SLOT_FREE = 0,
+    SLOT_READ,                /* decoded, waiting for conversion */
+    SLOT_DONE,                /* converted, waiting for the writer */
+};
+
+struct ExportSlot {
+    Frame f;                  /* decoded frame */
+    Uint8 *out;               /* converted frame as written */
+    Uint32 out_size;
+    Uint8 *cb;                /* chroma resampled for the output */
+    Uint8 *cr;
+    Uint8 *tmp;               /* interleave, tile and PNG scanlines */
+    Uint32 index;
+    Uint32 state;
+    Uint32 ok;
+};
+
+struct export {
+    char *out;                /* --out */
+    char *to;                 /* --to */
+    char *range;              /* --range */
+    Uint32 kind;              /* EXPORT_RAW, EXPORT_Y4M or EXPORT_PNG */
+    Uint32 fmt;               /* raw output format */
+    Uint32 first;
+    Uint32 last;              /* inclusive */
+    ExportSlot slot[EXPORT_DEPTH];
+    SDL_mutex *lock;
+    SDL_cond *cond;           /* any slot changed state, or failed */
+    bool failed;
+    FILE *fp;                 /* raw and Y4M output */
+    Uint64 bytes;
+};
+
+struct export gExport;
+
+/* io_uring frame reader state, see uring_read() */
+#define URING_DEPTH 8                /* frames in flight by default */
+#define URING_MAX 64
+#define URING_ALIGN 4096             /* O_DIRECT offset, length, buffer */
+
+enum {
+    IO_IDLE = 0,
+    IO_BUSY,                  /* read in flight */
+    IO_READY,
+    IO_ERROR,
+};
+
+struct UringSlot {
+    Uint8 *buf;               /* URING_ALIGN aligned */
+    Uint32 cap;
+    Sint64 index;             /* frame held or being read, -1 for none */
+    Uint32 gen;               /* gUring.gen the read was issued at */
+    Uint32 state;
+    off_t off;                /* aligned file offset of buf[0] */
+    Uint32 skip;              /* frame starts at buf[skip] */
+    Uint32 len;               /* aligned bytes to read */
+    Uint32 done;
+    struct iovec iov;
+};
+
+struct uring {
+    bool on;
+    bool direct;              /* fd opened with O_DIRECT */
+    Uint32 depth;             /* --io uring[:N], 0 = stdio */
+    int fd;
+    int ring;
+    void *sq_map;
+    void *cq_map;
+    void *sqes;
+    size_t sq_size;
+    size_t cq_size;
+    size_t sqes_size;
+    Uint32 *sq_tail;
+    Uint32 *sq_mask;
+    Uint32 *sq_array;
+    Uint32 *cq_head;
+    Uint32 *cq_tail;
+    Uint32 *cq_mask;
+    void *cqes;
+    UringSlot slot[URING_MAX];
+    Uint32 gen;               /* bumped when the frame layout changes */
+    Uint32 next;              /* frame the next uring_read() returns */
+    Uint32 inflight;
+    Uint64 frames;            /* stats */
+    Uint64 bytes;
+    Uint64 busy_ns;           /* time with at least one read in flight */
+    Uint64 busy_start;
+    Uint64 depth_sum;         /* reads in flight, summed at each submit */
+    Uint64 submits;
+    Uint32 depth_max;
+};
+
+struct uring gUring;
+
+/* Compressed input state, see zfopen() */
+#define ZIN_CACHE 16                 /* decoded chunks kept per input */
+#define ZIN_BLOCK (4 << 20)          /* chunk of a stream without index */
+#define ZIN_MAX_CHUNK (256 << 20)    /* bigger chunks: decode as stream */
+#define ZIN_IN (1 << 20)             /* compressed bytes per read */
+#define ZIN_AHEAD 4                  /* frames decoded ahead of a read */
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+
+enum {
+    ZIN_GZIP = 1,
+    ZIN_XZ,
+    ZIN_ZSTD,
+};
+
+enum {
+    ZIN_EMPTY = 0,
+    ZIN_LOADING,
+    ZIN_READY,
+    ZIN_ERROR,
+};
+
+/* independently decodable piece of an indexed input */
+struct ZChunk {
+    Uint64 coff;              /* compressed offset and size */
+    Uint32 csize;
+    Uint64 doff;              /* decompressed offset and size */
+    Uint32 dsize;
+};
+
+struct ZEntry {
+    Zin *z;
+    Uint32 chunk;
+    Uint8 *data;
+    Uint32 size;
+    Uint32 cap;
+    Uint32 state;
+    Uint64 used;              /* LRU tick */
+};
+
+struct Zin {
+    Uint32 kind;
+    int fd;                   /* compressed file */
+    bool ahead;
+    ZChunk *chunk;            /* index, NULL for a plain stream */
+    Uint32 nchunk;
+    Uint32 xz_check;
+    Uint64 size;              /* decompressed */
+    Uint64 pos;               /* position of the FILE */
+    ZEntry cache[ZIN_CACHE];
+    Uint64 tick;
+    Uint32 jobs;              /* decode jobs queued or running */
+    SDL_mutex *lock;          /* cache and jobs */
+    SDL_cond *done;           /* an entry finished decoding */
+    SDL_mutex *slock;         /* plain stream decoder */
+    void *stream;             /* z_stream, lzma_stream or ZSTD_DCtx */
+    Uint64 sdone;             /* decoded bytes of the stream so far */
+    Uint64 cin;               /* compressed bytes read */
+    Uint8 *inbuf;
+    size_t inlen;
+    size_t inpos;
+    Uint8 *sink;              /* skipped output */
+    bool eof;
+};
+
+/* Timeline and proxy state, see proxy_job() */
+#define PROXY_CACHE_SIZE (256 << 20) /* bytes of proxies for all frames */
+#define PROXY_MIN_DIV 4
+#define PROXY_MAX_DIV 64
+#define PROXY_BATCH 8                /* frames per job */
+#define LINE_BAR 12                  /* bar height - in frame pels */
+#define EVENT_PROXY_READY 3          /* SDL_USEREVENT code */
+
+enum {
+    PROXY_EMPTY = 0,
+    PROXY_PENDING,
+    PROXY_READY,
+};
+
+struct line {
+    bool on;                  /* bar shown */
+    bool scrub;               /* left button held on the bar */
+    Uint32 scrub_index;       /* frame under the mouse while scrubbing */
+    char go[11];              /* goto digits typed so far */
+    Uint32 golen;
+    Uint32 nframes;
+    Uint32 div;               /* frame pels per proxy pel */
+    Uint32 pw;                /* proxy width and height - in pixels */
+    Uint32 ph;
+    Uint8 *proxy;             /* pw x ph luma per frame */
+    Uint8 *state;             /* PROXY_EMPTY, PROXY_PENDING or PROXY_READY */
+    Uint32 sweep;             /* background pass, next frame to build */
+    Sint64 want;              /* frame to build first, -1 for none */
+    FILE **fd;                /* one input per pool worker */
+    Frame *frame;             /* one decode buffer per pool worker */
+    Uint8 **row;              /* one luma row per pool worker */
+    Uint32 nworker;
+    Uint32 jobs;              /* proxy jobs queued or running */
+    bool stop;                /* closing, jobs return at once */
+    bool redraw_pending;      /* EVENT_PROXY_READY already queued */
+    SDL_mutex *lock;          /* everything above from sweep on */
+    SDL_cond *done;           /* a job finished */
+};
+
+struct line gLine;
+
+/* Remote view state, see serve_run() and net_open() */
+#define NET_SCHEME "yv://"
+#define NET_MAGIC 0x314E5659         /* "YVN1" */
+#define NET_MAX_CONN 256             /* viewer connections at once */
+#define NET_POLL_MS 250              /* accept loop re-checks stop this often */
+#define NET_ZRUN 4                   /* zeros that end a literal run */
+#define NET_ZMIN 4096                /* smaller tokens are sent as they are */
+#define NET_HDR 36                   /* NetMsg on the wire */
+
+enum {
+    NET_HELLO = 1,            /* magic, scale, flags, roi x, y, w, h */
+    NET_INFO,                 /* magic, w, h, frames, source w, h, format */
+    NET_GET,                  /* index, PLANE_* */
+    NET_PLANE,                /* index, plane, codec, bytes, token bytes */
+    NET_ERROR,                /* text */
+};
+
+enum {
+    NET_RAW = 0,              /* the plane itself */
+    NET_ZRLE,                 /* tokens of the difference to the last one */
+    NET_ZRLE_Z,               /* those tokens deflated */
+};
+
+#define NET_CAN_ZLIB 1       /* HELLO flags: viewer inflates */
+
+struct NetMsg {
+    Uint32 type;
+    Uint32 arg[7];            /* meaning depends on type, see above */
+    Uint32 len;               /* payload bytes that follow */
+};
+
+/* viewer end, the cookie of a yv:// FILE */
+struct NetIn {
+    int fd;
+    Uint32 w;                 /* streamed frame - in pixels */
+    Uint32 h;
+    Uint32 nframes;
+    Uint32 fsize;             /* streamed frame - in bytes */
+    Uint32 src_w;             /* served input, for the log */
+    Uint32 src_h;
+    Uint32 src_format;
+    Uint64 pos;               /* position of the FILE */
+    Uint32 index;             /* frame in buf, -1 for none */
+    Uint32 have;              /* PLANE_* of it received */
+    Uint32 used;              /* PLANE_* of it read */
+    Uint32 want;              /* PLANE_* fetched with every GET */
+    Uint8 *buf[3];            /* Y, Cb, Cr, also the base of the next */
+    Uint8 *payload;
+    Uint8 *tokens;
+};
+
+/* server end of one connection */
+struct NetConn {
+    int fd;
+    char peer[INET6_ADDRSTRLEN + 8];
+    SDL_Thread *thread;
+    FILE *in;
+    Frame f;
+    Uint32 index;             /* frame decoded in f, -1 for none */
+    Uint32 have;              /* PLANE_* of it decoded */
+    Uint32 scale;
+    Uint32 x;                 /* roi in the source - in pixels */
+    Uint32 y;
+    Uint32 w;                 /* streamed frame */
+    Uint32 h;
+    bool zlib;
+    Uint8 *last[3];           /* planes sent last, base of the next */
+    Uint8 *cur;               /* plane being sent */
+    Uint8 *delta;
+    Uint8 *tokens;
+    Uint8 *out;
+    Uint32 frames;
+    Uint64 raw;               /* plane bytes sent */
+    Uint64 wire;              /* bytes on the wire */
+    bool done;                /* thread finished, see serve_reap() */
+};
+
+struct net {
+    char *serve;              /* --serve [HOST:]PORT */
+    Uint32 scale;             /* --scale, viewer */
+    Uint32 roi[4];            /* --roi x, y, w, h, w 0 for all */
+    Uint32 nframes;           /* served */
+    volatile sig_atomic_t stop;
+    NetConn *conn[NET_MAX_CONN];
+    Uint64 gets;              /* viewer counters, all yv:// inputs */
+    Uint64 planes;
+    Uint64 raw;
+    Uint64 wire;
+    Uint64 wait_ns;
+};
+
+struct net gNet;
+
+Uint32 rd(FILE *fp, Uint8 *data, Uint32 size)
 {
     Uint32 cnt;
 
-    cnt = fread(data, sizeof(Uint8), size, fd);
+    cnt = fread(data, sizeof(Uint8), size, fp);
     if (cnt < size) {
         DIE("No more data to read!\n");
         return 0;
@@ -247,359 +1203,552 @@ Uint32 rd(Uint8 *data, Uint32 size)
     return 1;
 }
 
-Uint32 read_planar(void)
+/* Padded rows are read with one preadv() per RD_IOV / 2 rows, the
+ * padding lands in a scratch buffer instead of the frame. */
+#define RD_IOV 1024
+
+Uint32 rd_rows(FILE *fp, Uint8 *dst, const Plane *pl)
+{
+    struct iovec iov[RD_IOV];
+    Uint32 pad = pl->stride - pl->row;
+    Uint8 *sink;
+    off_t pos;
+    Uint32 ret = 0;
+
+    if (fileno(fp) < 0) {
+        /* memory stream, see uring_read() */
+        for (Uint32 r = 0; r < pl->rows; r++) {
+            if (!rd(fp, dst + (size_t)r * pl->row, pl->row)
+                || fseeko(fp, pad, SEEK_CUR) != 0) {
+                return 0;
+            }
+        }
+        return 1;
+    }
+    sink = mem_alloc(pad, MEM_SCRATCH);
+    pos = ftello(fp);
+    if (!sink || pos < 0) {
+        DIE("Error allocating memory...\n");
+        goto cleanup;
+    }
+    for (Uint32 r = 0; r < pl->rows;) {
+        size_t want = 0;
+        ssize_t got;
+        int n = 0;
+        for (; r < pl->rows && n + 2 <= RD_IOV; r++) {
+            iov[n].iov_base = dst + (size_t)r * pl->row;
+            iov[n++].iov_len = pl->row;
+            want += pl->row;
+            if (r + 1 < pl->rows) {
+                iov[n].iov_base = sink;
+                iov[n++].iov_len = pad;
+                want += pad;
+            }
+        }
+        got = preadv(fileno(fp), iov, n, pos);
+        if (got < 0 || (size_t)got != want) {
+            DIE("No more data to read!\n");
+            goto cleanup;
+        }
+        pos += got;
+    }
+    /* padding of the last row too, then stdio takes over again */
+    ret = fseeko(fp, pos + pad, SEEK_SET) == 0;
+cleanup:
+    mem_free(sink);
+    return ret;
+}
+
+/* plane p of the frame fp is in, rows packed tightly into dst */
+Uint32 rd_plane(const Dec *d, FILE *fp, Uint8 *dst, Uint32 p)
+{
+    const Plane *pl = &d->plane[p];
+
+    if (pl->gap && fseeko(fp, pl->gap, SEEK_CUR) != 0) {
+        return 0;
+    }
+    if (pl->stride == pl->row) {
+        return rd(fp, dst, pl->row * pl->rows);
+    }
+    return rd_rows(fp, dst, pl);
+}
+
+/* Lazy planes
+ * A reader only fills the planes in f->need, the others are seeked over
+ * in the file and their conversion is skipped. P.frame asks for what the
+ * view shows, see view_planes(); the planes it lacks hold stale data.
+ */
+bool frame_needs(const Frame *f, Uint32 planes)
+{
+    return !f->need || (f->need & planes);
+}
+
+/* plane p of the frame fp is in, without reading it */
+Uint32 skip_plane(const Dec *d, FILE *fp, Uint32 p)
+{
+    const Plane *pl = &d->plane[p];
+
+    return fseeko(fp, pl->gap + (off_t)pl->stride * pl->rows, SEEK_CUR) == 0;
+}
+
+/* rd_plane() if f needs any of planes, else skip_plane() */
+Uint32 rd_plane_for(const Dec *d, FILE *fp, Frame *f, Uint8 *dst, Uint32 p, Uint32 planes)
+{
+    if (!frame_needs(f, planes)) {
+        return skip_plane(d, fp, p);
+    }
+    return rd_plane(d, fp, dst, p);
+}
+
+Uint32 read_planar(const Dec *d, FILE *fp, Frame *f)
 {
-    if (!rd(P.y_data, P.y_size)) {
+    if (!rd_plane_for(d, fp, f, f->y_data, 0, PLANE_Y)) {
         return 0;
     }
-    if (!rd(P.cb_data, P.cb_size)) {
+    if (!rd_plane_for(d, fp, f, f->cb_data, 1, PLANE_CB)) {
         return 0;
     }
-    if (!rd(P.cr_data, P.cr_size)) {
+    if (!rd_plane_for(d, fp, f, f->cr_data, 2, PLANE_CR)) {
         return 0;
     }
     return 1;
 }
 
-Uint32 read_planar_vu(void)
+Uint32 read_planar_vu(const Dec *d, FILE *fp, Frame *f)
 {
-    if (!rd(P.y_data, P.y_size)) {
+    if (!rd_plane_for(d, fp, f, f->y_data, 0, PLANE_Y)) {
         return 0;
     }
-    if (!rd(P.cr_data, P.cr_size)) {
+    if (!rd_plane_for(d, fp, f, f->cr_data, 1, PLANE_CR)) {
         return 0;
     }
-    if (!rd(P.cb_data, P.cb_size)) {
+    if (!rd_plane_for(d, fp, f, f->cb_data, 2, PLANE_CB)) {
         return 0;
     }
     return 1;
 }
 
-Uint32 read_planar_vu_422sample(void)
+Uint32 read_planar_vu_422sample(const Dec *d, FILE *fp, Frame *f)
 {
-    if (!read_planar_vu()) {
+    if (!read_planar_vu(d, fp, f)) {
         return 0;
     }
     // show it with YV12, 420 sample, so drop half of Cb, Cr data
-    for (Uint32 i = 1; i < P.height / 2; i++) {
-        memcpy(P.cr_data + i * P.width / 2, P.cr_data + i * P.width, P.width / 2);
+    if (frame_needs(f, PLANE_CR)) {
+        for (Uint32 i = 1; i < d->height / 2; i++) {
+            memcpy(f->cr_data + i * d->width / 2, f->cr_data + i * d->width, d->width / 2);
+        }
     }
-    for (Uint32 i = 1; i < P.height / 2; i++) {
-        memcpy(P.cb_data + i * P.width / 2, P.cb_data + i * P.width, P.width / 2);
+    if (frame_needs(f, PLANE_CB)) {
+        for (Uint32 i = 1; i < d->height / 2; i++) {
+            memcpy(f->cb_data + i * d->width / 2, f->cb_data + i * d->width, d->width / 2);
+        }
     }
     return 1;
 }
 
-Uint32 read_planar_vu_444sample(void)
+Uint32 read_planar_vu_444sample(const Dec *d, FILE *fp, Frame *f)
 {
-    if (!read_planar_vu()) {
+    if (!read_planar_vu(d, fp, f)) {
         return 0;
     }
-    for (Uint32 i = 0; i < P.height / 2; i++) {
-        for (Uint32 j = 0; j < P.width / 2; j++) {
-            P.cr_data[i * P.width / 2 + j] = P.cr_data[i * P.width + j * 2];
+    if (frame_needs(f, PLANE_CR)) {
+        for (Uint32 i = 0; i < d->height / 2; i++) {
+            for (Uint32 j = 0; j < d->width / 2; j++) {
+                f->cr_data[i * d->width / 2 + j] = f->cr_data[i * 2 * d->width + j * 2];
+            }
         }
     }
-    for (Uint32 i = 0; i < P.height / 2; i++) {
-        for (Uint32 j = 0; j < P.width / 2; j++) {
-            P.cb_data[i * P.width / 2 + j] = P.cb_data[i * P.width + j * 2];
+    if (frame_needs(f, PLANE_CB)) {
+        for (Uint32 i = 0; i < d->height / 2; i++) {
+            for (Uint32 j = 0; j < d->width / 2; j++) {
+                f->cb_data[i * d->width / 2 + j] = f->cb_data[i * 2 * d->width + j * 2];
+            }
         }
     }
     return 1;
 }
 
-Uint32 read_mono(void) {
-    if (!rd(P.y_data, P.y_size)) {
+Uint32 read_mono(const Dec *d, FILE *fp, Frame *f) {
+    if (!rd_plane(d, fp, f->y_data, 0)) {
         return 0;
     }
-    memset(P.cb_data, 0x80, P.cb_size);
-    memset(P.cr_data, 0x80, P.cr_size);
+    memset(f->cb_data, 0x80, d->cb_size);
+    memset(f->cr_data, 0x80, d->cr_size);
     return 1;
 }
 
-Uint32 read_semi_planar_vu(void)
+Uint32 read_semi_planar_vu(const Dec *d, FILE *fp, Frame *f)
 {
-    if (!rd(P.y_data, P.y_size)) {
+    if (!rd_plane_for(d, fp, f, f->y_data, 0, PLANE_Y)) {
         return 0;
     }
 
-    if (!rd(P.raw, P.cb_size + P.cr_size)) {
+    if (!rd_plane_for(d, fp, f, f->raw, 1, PLANE_CB | PLANE_CR)) {
         return 0;
     }
-    Uint8 *cb = P.cb_data, *cr = P.cr_data;
-    for (Uint32 i = 0; i < P.cb_size; i++) {
-        *cb++ = P.raw[i * 2 + 1];
+    Uint8 *cb = f->cb_data, *cr = f->cr_data;
+    if (frame_needs(f, PLANE_CB)) {
+        for (Uint32 i = 0; i < d->cb_size; i++) {
+            *cb++ = f->raw[i * 2 + 1];
+        }
     }
-    for (Uint32 i = 0; i < P.cr_size; i++) {
-        *cr++ = P.raw[i * 2];
+    if (frame_needs(f, PLANE_CR)) {
+        for (Uint32 i = 0; i < d->cr_size; i++) {
+            *cr++ = f->raw[i * 2];
+        }
     }
     return 1;
 }
 
-Uint32 read_semi_planar(void)
+Uint32 read_semi_planar(const Dec *d, FILE *fp, Frame *f)
 {
-    if (!rd(P.y_data, P.y_size)) {
+    if (!rd_plane_for(d, fp, f, f->y_data, 0, PLANE_Y)) {
         return 0;
     }
 
-    if (!rd(P.raw, P.cb_size + P.cr_size)) {
+    if (!rd_plane_for(d, fp, f, f->raw, 1, PLANE_CB | PLANE_CR)) {
         return 0;
     }
-    Uint8 *cb = P.cb_data, *cr = P.cr_data;
-    for (Uint32 i = 0; i < P.cb_size; i++) {
-        *cb++ = P.raw[i * 2];
+    Uint8 *cb = f->cb_data, *cr = f->cr_data;
+    if (frame_needs(f, PLANE_CB)) {
+        for (Uint32 i = 0; i < d->cb_size; i++) {
+            *cb++ = f->raw[i * 2];
+        }
     }
-    for (Uint32 i = 0; i < P.cr_size; i++) {
-        *cr++ = P.raw[i * 2 + 1];
+    if (frame_needs(f, PLANE_CR)) {
+        for (Uint32 i = 0; i < d->cr_size; i++) {
+            *cr++ = f->raw[i * 2 + 1];
+        }
     }
     return 1;
 }
 
-Uint32 read_semi_planar_10(void)
+Uint32 read_semi_planar_10(const Dec *d, FILE *fp, Frame *f)
 {
     Uint32 ret = 1;
-    Uint8 *data = malloc(sizeof(Uint8) * P.y_size * 1.5);
+    Uint32 packed = (d->y_size * 3 / 2 + 1) & ~1;
+    Uint16 *y = f->deep, *cb = y + d->y_size, *cr = cb + d->cb_size;
+    /* the packed plane, then the chroma pairs unpacked */
+    Uint8 *data = mem_alloc(packed + sizeof(Uint16) * (d->cb_size + d->cr_size),
+                            MEM_SCRATCH);
+    Uint16 *pairs;
     if (!data) {
         DIE("Error allocating memory...\n");
         return 0;
     }
-    if (!rd(data, P.y_size * 10 / 8)) {
+    pairs = (Uint16 *)(data + packed);
+    if (!rd_plane_for(d, fp, f, data, 0, PLANE_Y)) {
         ret = 0;
         goto cleanup;
     }
-    ten2eight_compact(data, P.y_data, P.y_size);
+    if (frame_needs(f, PLANE_Y)) {
+        gKern.unpack10(data, y, d->y_size);
+    }
 
-    if (!rd(data, (P.cb_size + P.cr_size) * 10 / 8)) {
+    if (!rd_plane_for(d, fp, f, data, 1, PLANE_CB | PLANE_CR)) {
         ret = 0;
         goto cleanup;
     }
-    ten2eight_compact(data, P.raw, P.cb_size + P.cr_size);
-
-    Uint8 *cb = P.cb_data, *cr = P.cr_data;
-    for (Uint32 i = 0; i < P.cb_size; i++) {
-        *cb++ = P.raw[i * 2];
-    }
-    for (Uint32 i = 0; i < P.cr_size; i++) {
-        *cr++ = P.raw[i * 2 + 1];
+    if (frame_needs(f, PLANE_CB | PLANE_CR)) {
+        gKern.unpack10(data, pairs, d->cb_size + d->cr_size);
+        gKern.split_u16(pairs, cb, cr, d->cb_size);
     }
+    deep_map(d, f, d->lut);
 
 cleanup:
-    free(data);
+    mem_free(data);
     return ret;
 }
 
-#if 0
-// complexity: H * W
-void de_semi_planar_tile(Uint8 *data, Uint32 tiled_width, Uint32 tiled_height) {
-    Uint32 i, j, o, q;
-    for (i = 0; i != P.height; i++) {
-        for (j = 0; j != P.width; j++) {
-            o = i / tiled_height * tiled_height * P.width;
-            o += j / tiled_width * tiled_width * tiled_height;
-            o += i % tiled_height * tiled_width;
-            o += j % tiled_width;
-            q = i * P.width + j;
-            P.y_data[q] = data[o];
-
-            o = i / 2 / tiled_height * tiled_height * P.width;
-            o += j / tiled_width * tiled_width * tiled_height;
-            o += i / 2 % tiled_height * tiled_width;
-            o += j % tiled_width;
-            q = i / 2 * P.width / 2 + j / 2;
-            P.cr_data[q] = data[o + P.y_size];
-            P.cb_data[q] = data[o + P.y_size + 1];
-        }
-    }
-}
-#else
-// complexity: H * W / TW / TH * TH = H * W / TW
-// fast and more easy to understand
-void de_semi_planar_tile(Uint8 *data, Uint32 tiled_width, Uint32 tiled_height) {
-    Uint32 i, j, k, o, q;
-    o = 0;
-    for (i = 0; i < P.height; i += tiled_height) {
-        for (j = 0; j < P.width; j += tiled_width) {
-            // (i, j) one tile's origin
-            for (k = 0; k != tiled_height; k++) {
-                // copy TW data one time instead of byte-to-byte assign
-                memcpy(P.y_data + (i + k) * P.width + j, data + o, tiled_width);
-                o += tiled_width;
-            }
-        }
+/* Tiled layouts
+ * A tiled plane is stored as rows of tiles, each tile tw bytes x th rows
+ * in one piece, the interleaved chroma plane with its own tile size.
+ * Inside a tile the rows are cut into columns of span bytes, stored one
+ * column after the other (Y-tiles, 16 byte columns) or whole rows when
+ * span is tw. The tiles of a plane are stored row by row, or in 2x2
+ * groups ordered Z, flipped Z, Z ... with TILE_ZFLIPZ. Planes are padded
+ * to whole tiles and to a multiple of align bytes, see tile_grid().
+ */
+Uint32 tile_index(const TileFmt *t, Uint32 x, Uint32 y, Uint32 xt, Uint32 yt)
+{
+    Uint32 i;
+
+    if (t->order != TILE_ZFLIPZ) {
+        return y * xt + x;
     }
-    // convert UV semi-planer to U,V planar, cannot use memcpy way
-    for (i = 0; i != P.height; i++) {
-        for (j = 0; j != P.width; j++) {
-            o = i / 2 / tiled_height * tiled_height * P.width;
-            o += j / tiled_width * tiled_width * tiled_height;
-            o += i / 2 % tiled_height * tiled_width;
-            o += j % tiled_width;
-            q = i / 2 * P.width / 2 + j / 2;
-            P.cr_data[q] = data[o + P.y_size];
-            P.cb_data[q] = data[o + P.y_size + 1];
-        }
+    i = (y & ~1) * xt + x;
+    if (y & 1) {
+        i += (x & ~3) + 2;
+    } else if ((yt & 1) == 0 || y != yt - 1) {
+        /* a last row without a partner is stored in order */
+        i += (x + 2) & ~3;
     }
-
+    return i;
 }
-#endif
 
-Uint32 read_semi_planar_tiled(Uint32 tw, Uint32 th)
+/* tiles per row and per column of plane p (0 luma, 1 chroma), w bytes
+ * x rows of it */
+void tile_grid(const TileFmt *t, Uint32 p, Uint32 w, Uint32 rows,
+               Uint32 *xt, Uint32 *yt)
 {
-    Uint32 size = P.frame_size;
-    Uint8 *data = malloc(sizeof(Uint8) * size);
-    Uint32 ret = 0;
-    if (!rd(data, size)) {
-        goto cleanup;
+    Uint32 tw = p ? t->cw : t->tw;
+    Uint32 th = p ? t->ch : t->th;
+
+    *xt = (w + tw - 1) / tw;
+    *yt = (rows + th - 1) / th;
+    if (t->order == TILE_ZFLIPZ) {
+        /* whole 2x2 groups across */
+        *xt = (*xt + 1) & ~1;
     }
-    de_semi_planar_tile(data, tw, th);
-    ret = 1;
-cleanup:
-    free(data);
-    return ret;
 }
 
-Uint32 read_semi_planar_tiled4x4(void)
+/* bytes of both planes as stored, padding included, 8 bit samples */
+Uint32 tile_frame_size(const TileFmt *t, Uint32 w, Uint32 h)
 {
-    return read_semi_planar_tiled(4, 4);
+    Uint32 size = 0;
+
+    if (!t->tw) {
+        return 0;
+    }
+    for (Uint32 p = 0; p < 2; p++) {
+        Uint32 xt, yt;
+        tile_grid(t, p, w, p ? h / 2 : h, &xt, &yt);
+        size += xt * yt * (p ? t->cw * t->ch : t->tw * t->th);
+        if (t->align) {
+            size = (size + t->align - 1) / t->align * t->align;
+        }
+    }
+    return size;
 }
 
-Uint32 read_semi_planar_tiled8x4(void)
+/* Plane p of src into w bytes x h rows at dst. A row of tiles at a
+ * time: its th destination rows stay in cache while every tile of the
+ * row is read once, front to back, span bytes per copy. */
+void detile(const TileFmt *t, Uint32 p, const Uint8 *src, Uint8 *dst,
+            Uint32 w, Uint32 h)
 {
-    return read_semi_planar_tiled(8, 4);
+    Uint32 tw = p ? t->cw : t->tw;
+    Uint32 th = p ? t->ch : t->th;
+    Uint32 span = t->span < tw ? t->span : tw;
+    Uint32 xt, yt;
+
+    tile_grid(t, p, w, h, &xt, &yt);
+    for (Uint32 ty = 0; ty < yt; ty++) {
+        Uint32 rows = h - ty * th < th ? h - ty * th : th;
+        for (Uint32 tx = 0; tx * tw < w; tx++) {
+            const Uint8 *tile = src + (size_t)tile_index(t, tx, ty, xt, yt) * tw * th;
+            Uint8 *o = dst + (size_t)ty * th * w + tx * tw;
+            Uint32 cols = w - tx * tw < tw ? w - tx * tw : tw;
+            for (Uint32 c = 0; c < cols; c += span) {
+                Uint32 n = cols - c < span ? cols - c : span;
+                const Uint8 *in = tile + c * th;
+                for (Uint32 k = 0; k < rows; k++) {
+                    Uint8 *to = o + (size_t)k * w + c;
+                    /* narrow tiles, one move per row */
+                    if (n == 8) {
+                        memcpy(to, in + k * span, 8);
+                    } else if (n == 4) {
+                        memcpy(to, in + k * span, 4);
+                    } else {
+                        gKern.copy_u8(to, in + k * span, n);
+                    }
+                }
+            }
+        }
+    }
 }
 
-Uint32 read_semi_planar_10_tiled4x4(void)
+/* NV12 tiled as gTileMap[d->format] says, 8 or compact 10 bit. 10 bit is
+ * unpacked to 16 bit and detiled a byte at a time, low then high. */
+Uint32 read_semi_planar_tiled(const Dec *d, FILE *fp, Frame *f)
 {
-    Uint32 ret = 1;
-    Uint8 *data = malloc(sizeof(Uint8) * P.y_size * 1.5);
+    const TileFmt *t = &gTileMap[d->format];
+    bool ten = bitdepth(d->format) == 10;
+    Uint32 size = d->plane[0].row * d->plane[0].rows;
+    Uint32 csize = d->plane[1].row * d->plane[1].rows;
+    Uint16 *y = f->deep, *cb = y + d->y_size, *cr = cb + d->cb_size;
+    Uint16 *wide = NULL;
+    Uint8 *data, *lo, *hi = NULL, *hi_out = NULL;
+    Uint32 n, ret = 0;
+
+    size = size > csize ? size : csize;
+    n = size * 8 / 10;
+    /* 10 bit: the packed plane, its samples, their low and high bytes
+     * and the high bytes detiled */
+    data = mem_alloc(ten ? (size + 1) / 2 * 2 + n * 4 + d->y_size : size,
+                     MEM_SCRATCH);
     if (!data) {
         DIE("Error allocating memory...\n");
         return 0;
     }
-    if (!rd(data, P.y_size * 10 / 8)) {
-        ret = 0;
-        goto cleanup;
+    lo = data;
+    if (ten) {
+        wide = (Uint16 *)(data + (size + 1) / 2 * 2);
+        lo = (Uint8 *)(wide + n);
+        hi = lo + n;
+        hi_out = hi + n;
     }
-    ten2eight_compact(data, P.raw, P.y_size);
-    if (!rd(data, (P.cb_size + P.cr_size) * 10 / 8)) {
-        ret = 0;
+
+    if (!rd_plane_for(d, fp, f, data, 0, PLANE_Y)) {
         goto cleanup;
     }
-    ten2eight_compact(data, P.raw + P.y_size, P.cb_size + P.cr_size);
+    if (frame_needs(f, PLANE_Y)) {
+        if (ten) {
+            n = d->plane[0].row * d->plane[0].rows * 8 / 10;
+            gKern.unpack10(data, wide, n);
+            unzip_u16(wide, lo, hi, n);
+            detile(t, 0, hi, hi_out, d->width, d->height);
+        }
+        detile(t, 0, lo, f->y_data, d->width, d->height);
+        if (ten) {
+            gKern.zip_u16(y, f->y_data, hi_out, d->y_size);
+        }
+    }
 
-    // now P.raw is semi_planar_tiled4x4 format
-    de_semi_planar_tile(P.raw, 4, 4);
+    if (!rd_plane_for(d, fp, f, data, 1, PLANE_CB | PLANE_CR)) {
+        goto cleanup;
+    }
+    if (frame_needs(f, PLANE_CB | PLANE_CR)) {
+        if (ten) {
+            n = csize * 8 / 10;
+            gKern.unpack10(data, wide, n);
+            unzip_u16(wide, lo, hi, n);
+            detile(t, 1, hi, hi_out, d->width, d->height / 2);
+        }
+        /* interleaved pairs, then one plane each */
+        detile(t, 1, lo, f->raw, d->width, d->height / 2);
+        if (ten) {
+            gKern.zip_u16(wide, f->raw, hi_out, d->cb_size * 2);
+            if (t->vu) {
+                gKern.split_u16(wide, cr, cb, d->cb_size);
+            } else {
+                gKern.split_u16(wide, cb, cr, d->cb_size);
+            }
+        } else if (t->vu) {
+            gKern.split_u8(f->raw, f->cr_data, f->cb_data, d->cb_size);
+        } else {
+            gKern.split_u8(f->raw, f->cb_data, f->cr_data, d->cb_size);
+        }
+    }
+    if (ten) {
+        deep_map(d, f, d->lut);
+    }
     ret = 1;
 cleanup:
-    free(data);
+    mem_free(data);
     return ret;
 }
 
-Uint32 read_422(void)
+Uint32 read_422(const Dec *d, FILE *fp, Frame *f)
 {
-    Uint8 *y = P.y_data;
-    Uint8 *cb = P.cb_data;
-    Uint8 *cr = P.cr_data;
+    Uint8 *y = f->y_data;
+    Uint8 *cb = f->cb_data;
+    Uint8 *cr = f->cr_data;
 
-    if (!rd(P.raw, P.frame_size)) {
+    if (!rd_plane(d, fp, f->raw, 0)) {
         return 0;
     }
 
-    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-        *y++ = P.raw[i];
+    /* the drawer shows raw, the planes are for the metrics */
+    if (frame_needs(f, PLANE_Y)) {
+        for (Uint32 i = d->y_start_pos; i < d->frame_size; i += 2) {
+            *y++ = f->raw[i];
+        }
     }
-    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
-        *cb++ = P.raw[i];
+    if (frame_needs(f, PLANE_CB)) {
+        for (Uint32 i = d->cb_start_pos; i < d->frame_size; i += 4) {
+            *cb++ = f->raw[i];
+        }
     }
-    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
-        *cr++ = P.raw[i];
+    if (frame_needs(f, PLANE_CR)) {
+        for (Uint32 i = d->cr_start_pos; i < d->frame_size; i += 4) {
+            *cr++ = f->raw[i];
+        }
     }
     return 1;
 }
 
-Uint32 read_y42210(void)
+Uint32 read_y42210(const Dec *d, FILE *fp, Frame *f)
 {
     Uint32 ret = 1;
     Uint8 *data;
-    Uint8 *tmp;
 
-    data = malloc(sizeof(Uint8) * P.frame_size * 2);
+    data = mem_alloc(sizeof(Uint8) * d->frame_size * 2, MEM_SCRATCH);
     if (!data) {
         DIE("Error allocating memory...\n");
         return 0;
     }
 
-    tmp = malloc(sizeof(Uint8) * P.frame_size);
-    if (!tmp) {
-        DIE("Error allocating memory...\n");
-        ret = 0;
-        goto cleany42210;
-    }
-
-    if (!rd(data, P.frame_size * 2)) {
+    /* planar 4:2:2, 2 bytes per sample */
+    if (!rd_plane(d, fp, data, 0) || !rd_plane(d, fp, data + d->wh * 2, 1)
+        || !rd_plane(d, fp, data + d->wh * 3, 2)) {
         ret = 0;
         goto cleany42210;
     }
-    ten2eight(data, tmp, P.frame_size * 2);
-
-    /* Y  */
-    for (Uint32 i = 0, j = 0; i < P.frame_size; i += 2) {
-        P.raw[i] = tmp[j];
-        j++;
-    }
-    /* Cb */
-    for (Uint32 i = P.cb_start_pos, j = 0; i < P.frame_size; i += 4) {
-        P.raw[i] = tmp[P.wh + j];
-        j++;
-    }
-    /* Cr */
-    for (Uint32 i = P.cr_start_pos, j = 0; i < P.frame_size; i += 4) {
-        P.raw[i] = tmp[P.wh / 2 * 3 + j];
-        j++;
-    }
+    gKern.unpack16(data, f->deep, d->frame_size);
+    /* packs the frame shown and keeps the planes too, like read_422() */
+    deep_map(d, f, d->lut);
 
 cleany42210:
-    free(tmp);
-    free(data);
+    mem_free(data);
 
     return ret;
 }
 
-Uint32 read_yv1210(void)
+Uint32 read_yv1210(const Dec *d, FILE *fp, Frame *f)
 {
     Uint32 ret = 1;
+    Uint16 *y = f->deep, *cb = y + d->y_size, *cr = cb + d->cb_size;
     Uint8 *data;
 
-    data = malloc(sizeof(Uint8) * P.y_size * 2);
+    data = mem_alloc(sizeof(Uint8) * d->y_size * 2, MEM_SCRATCH);
     if (!data) {
         DIE("Error allocating memory...\n");
         return 0;
     }
 
-    if (!rd(data, P.y_size * 2)) {
+    if (!rd_plane_for(d, fp, f, data, 0, PLANE_Y)) {
         ret = 0;
         goto cleanyv1210;
     }
-    ten2eight(data, P.y_data, P.y_size * 2);
+    if (frame_needs(f, PLANE_Y)) {
+        gKern.unpack16(data, y, d->y_size);
+    }
 
-    if (!rd(data, P.cb_size * 2)) {
+    if (!rd_plane_for(d, fp, f, data, 1, PLANE_CB)) {
         ret = 0;
         goto cleanyv1210;
     }
-    ten2eight(data, P.cb_data, P.cb_size * 2);
+    if (frame_needs(f, PLANE_CB)) {
+        gKern.unpack16(data, cb, d->cb_size);
+    }
 
-    if (!rd(data, P.cr_size * 2)) {
+    if (!rd_plane_for(d, fp, f, data, 2, PLANE_CR)) {
         ret = 0;
         goto cleanyv1210;
     }
-    ten2eight(data, P.cr_data, P.cr_size * 2);
+    if (frame_needs(f, PLANE_CR)) {
+        gKern.unpack16(data, cr, d->cr_size);
+    }
+    deep_map(d, f, d->lut);
 
 cleanyv1210:
-    free(data);
+    mem_free(data);
 
     return ret;
 }
 
+/* next frame of fp into f, decoded as d says */
+Uint32 dec_read(const Dec *d, FILE *fp, Frame *f)
+{
+    precheck_range(d->format, gFmtMap);
+    if (!(gFmtMap[d->format].reader)(d, fp, f)) {
+        return 0;
+    }
+    return !d->tail || fseeko(fp, d->tail, SEEK_CUR) == 0;
+}
+
 Uint32 comb_byte(Uint8 a, Uint32 offset0, Uint8 b, Uint32 offset1) {
     // get 10bit from low bit to high bit
     // data sample: {0xf8, 0xe1, 0x87, 0x1f, 0x7e}
@@ -607,1264 +1756,10114 @@ Uint32 comb_byte(Uint8 a, Uint32 offset0, Uint8 b, Uint32 offset1) {
     // -> {0b00011111, 0b10000111, 0b11100001, 0b11111000, 0b01111110}
     // combine to 10bit
     // -> {0b0001111110, 0b0001111110, 0b0001111110, 0b0001111110}
-    // round back to 8bit
-    // -> {0b01111110, 0b01111110, 0b01111110, 0b01111110}
     // -> {0x7e, 0x7e, 0x7e, 0x7e}
     Uint32 x = a >> (8 - offset0);
     Uint32 y = b & ((1 << offset1) - 1);
     return (x | (y << offset0)) & 0x3ff;
 }
 
-Uint32 dither(Uint32 x) {
-    return (x + 0x2) >> 2;
+/* n compact 10 bit samples, 4 in 5 bytes LSB first, see comb_byte() */
+void unpack10_c(const Uint8 *src, Uint16 *dst, Uint32 n)
+{
+    for (Uint32 j = 0; j < n; src += 5, j += 4) {
+        dst[j] = comb_byte(src[0], 8, src[1], 2);
+        dst[j + 1] = comb_byte(src[1], 6, src[2], 4);
+        dst[j + 2] = comb_byte(src[2], 4, src[3], 6);
+        dst[j + 3] = comb_byte(src[3], 2, src[4], 8);
+    }
 }
 
-// Compact ten2eight
-// Every 5 bytes representation four 10-bit data
-Uint32 ten2eight_compact(Uint8 *src, Uint8 *dst, Uint32 length)
+/* n samples of 2 bytes, little endian */
+void unpack16_c(const Uint8 *src, Uint16 *dst, Uint32 n)
 {
-    Uint8 *p0, *p1;
-    for (Uint32 i = 0, j = 0; j < length; i += 5, j += 4) {
-        p0 = src + i;
-        p1 = dst + j;
-        p1[0] = dither(comb_byte(p0[0], 8, p0[1], 2));
-        p1[1] = dither(comb_byte(p0[1], 6, p0[2], 4));
-        p1[2] = dither(comb_byte(p0[2], 4, p0[3], 6));
-        p1[3] = dither(comb_byte(p0[3], 2, p0[4], 8));
+    for (Uint32 i = 0; i < n; i++) {
+        dst[i] = src[i * 2] | src[i * 2 + 1] << 8;
     }
-    return 1;
 }
 
-// Loose ten2eight
-// every two bytes representation one 10-bit data
-Uint32 ten2eight(Uint8 *src, Uint8 *dst, Uint32 length)
+#ifdef __SSE2__
+/* 5 byte groups as 40 bit little endian words, one per 64 bit lane, the
+ * 4 samples of a group shifted out of it and packed to 16 bit in place */
+void unpack10_sse2(const Uint8 *src, Uint16 *dst, Uint32 n)
 {
-    Uint16 x = 0;
+    Uint32 j = 0;
+    __m128i m = _mm_set1_epi64x(0x3ff);
+    /* the second load reads 3 bytes past the 10 used */
+    for (; j + 12 <= n; src += 10, j += 8) {
+        __m128i q = _mm_unpacklo_epi64(
+            _mm_loadl_epi64((const __m128i *)src),
+            _mm_loadl_epi64((const __m128i *)(src + 5)));
+        __m128i w = _mm_and_si128(q, m);
+        w = _mm_or_si128(w, _mm_slli_epi64(
+            _mm_and_si128(_mm_srli_epi64(q, 10), m), 16));
+        w = _mm_or_si128(w, _mm_slli_epi64(
+            _mm_and_si128(_mm_srli_epi64(q, 20), m), 32));
+        w = _mm_or_si128(w, _mm_slli_epi64(
+            _mm_and_si128(_mm_srli_epi64(q, 30), m), 48));
+        _mm_storeu_si128((__m128i *)(dst + j), w);
+    }
+    unpack10_c(src, dst + j, n - j);
+}
 
-    for (Uint32 i = 0; i < length; i += 2) {
-        x = (src[i + 1] << 8) | src[i];
-        x = (x + 2) >> 2;
-        if (x > 255) {
-            x = 255;
-        }
-        *dst++ = x;
+/* x86 is little endian, the samples are a copy */
+void unpack16_sse2(const Uint8 *src, Uint16 *dst, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_loadu_si128((const __m128i *)(src + i * 2)));
     }
+    unpack16_c(src + i * 2, dst + i, n - i);
+}
+#endif
 
-    return 1;
+#ifdef HAVE_AVX2
+/* unpack10_sse2() with four groups at a time */
+__attribute__((target("avx2")))
+void unpack10_avx2(const Uint8 *src, Uint16 *dst, Uint32 n)
+{
+    Uint32 j = 0;
+    __m256i m = _mm256_set1_epi64x(0x3ff);
+    /* the last load reads 3 bytes past the 20 used */
+    for (; j + 20 <= n; src += 20, j += 16) {
+        Sint64 g[4];
+        __m256i q, w;
+        for (Uint32 k = 0; k < 4; k++) {
+            memcpy(&g[k], src + k * 5, 8);
+        }
+        q = _mm256_set_epi64x(g[3], g[2], g[1], g[0]);
+        w = _mm256_and_si256(q, m);
+        w = _mm256_or_si256(w, _mm256_slli_epi64(
+            _mm256_and_si256(_mm256_srli_epi64(q, 10), m), 16));
+        w = _mm256_or_si256(w, _mm256_slli_epi64(
+            _mm256_and_si256(_mm256_srli_epi64(q, 20), m), 32));
+        w = _mm256_or_si256(w, _mm256_slli_epi64(
+            _mm256_and_si256(_mm256_srli_epi64(q, 30), m), 48));
+        _mm256_storeu_si256((__m256i *)(dst + j), w);
+    }
+    unpack10_c(src, dst + j, n - j);
 }
+#endif
 
-Uint32 check_free_memory(void) {
-    if (P.raw != NULL) {
-        free(P.raw);
-        P.raw = NULL;
-    }
-    if (P.y_data != NULL) {
-        free(P.y_data);
-        P.y_data = NULL;
+/* 8 bit planes of f from f->deep through lut, for the planes f needs */
+void deep_map(const Dec *d, Frame *f, const Uint8 *lut)
+{
+    const Uint16 *y = f->deep;
+    const Uint16 *cb = y + d->y_size;
+    const Uint16 *cr = cb + d->cb_size;
+
+    if (d->format == Y42210) {
+        /* packed Y V Y U is what gets displayed, the planes are kept too */
+        for (Uint32 i = 0, j = 0; i < d->frame_size; i += 2, j++) {
+            f->raw[i] = lut[y[j]];
+        }
+        for (Uint32 i = d->cb_start_pos, j = 0; i < d->frame_size; i += 4, j++) {
+            f->raw[i] = lut[cb[j]];
+        }
+        for (Uint32 i = d->cr_start_pos, j = 0; i < d->frame_size; i += 4, j++) {
+            f->raw[i] = lut[cr[j]];
+        }
     }
-    if (P.cb_data != NULL) {
-        free(P.cb_data);
-        P.cb_data = NULL;
+    if (frame_needs(f, PLANE_Y)) {
+        gKern.lut_u16(f->y_data, y, lut, d->y_size);
     }
-    if (P.cr_data != NULL) {
-        free(P.cr_data);
-        P.cr_data = NULL;
+    if (frame_needs(f, PLANE_CB)) {
+        gKern.lut_u16(f->cb_data, cb, lut, d->cb_size);
+    }
+    if (frame_needs(f, PLANE_CR)) {
+        gKern.lut_u16(f->cr_data, cr, lut, d->cr_size);
     }
-    return 1;
 }
 
-Uint32 allocate_memory(void)
-{
-    check_free_memory();
-    P.raw = malloc(sizeof(Uint8) * P.frame_size);
-    P.y_data = malloc(sizeof(Uint8) * P.y_size);
-    P.cb_data = malloc(sizeof(Uint8) * P.cb_size);
-    P.cr_data = malloc(sizeof(Uint8) * P.cr_size);
+/* Memory pool
+ * Frame buffers, scratch buffers, thumbnails, proxies, decoded chunks and
+ * read buffers all come from mem_alloc() and count against one budget,
+ * --mem, half the RAM by default. Blocks of MEM_MAP_MIN and up are mapped
+ * on their own and advised to transparent huge pages, or taken from the
+ * hugetlbfs pool with --huge hugetlb; freed ones are kept as spares for
+ * the next block of about their size, the readers ask for the same
+ * scratch size every frame. A block that would go over the budget first
+ * drops the spares, then makes the caches that can shrink give memory
+ * back, see mem_reclaim(), and fails if that is not enough.
+ */
+#define MEM_MAP_MIN (1 << 20)        /* mapped, smaller ones malloc()ed */
+#define MEM_HUGE_PAGE (2 << 20)
+#define MEM_HDR 64                   /* bytes before a block, its MemHdr */
+#define MEM_SPARES 8                 /* freed mappings kept for reuse */
 
-    if (!P.raw || !P.y_data || !P.cb_data || !P.cr_data) {
-        DIE("Error allocating memory...\n");
-        check_free_memory();
-        return 0;
+enum {
+    MEM_THP = 0,              /* --huge thp, madvise(MADV_HUGEPAGE) */
+    MEM_HUGETLB,              /* --huge hugetlb, MAP_HUGETLB, thp if none */
+    MEM_SMALL,                /* --huge off */
+};
+
+enum {
+    MEM_MALLOC = 0,
+    MEM_MAP,
+    MEM_MAP_HUGETLB,
+};
+
+struct MemHdr {
+    Uint8 *base;              /* malloc()ed or mapped */
+    size_t len;               /* bytes counted, all of a mapping */
+    Uint32 owner;             /* MEM_FRAME .. */
+    Uint32 kind;              /* MEM_MALLOC, MEM_MAP or MEM_MAP_HUGETLB */
+};
+
+struct mem {
+    Uint64 budget;            /* --mem, bytes */
+    Uint32 huge;              /* --huge, MEM_THP, MEM_HUGETLB or MEM_SMALL */
+    Uint64 used;              /* the counters are updated atomically */
+    Uint64 peak;
+    Uint64 owner[MEM_OWNERS];
+    Uint64 hugetlb;           /* bytes mapped from hugetlbfs */
+    Uint32 reclaims;          /* times the budget made caches shrink */
+    Uint64 reclaimed;
+    Uint32 fails;             /* blocks refused, over the budget */
+    MemHdr spare[MEM_SPARES];
+    Uint32 nspare;
+    SDL_mutex *spare_lock;    /* spare[], taken with no other lock held */
+    MemReclaim reclaim[MEM_OWNERS];
+    SDL_mutex *lock;          /* reclaim[], held while reclaiming */
+};
+
+struct mem gMem;
+
+const char *gMemOwner[MEM_OWNERS] = {
+    "frames", "scratch", "thumbnails", "proxies", "chunks", "io", "spare",
+};
+
+void mem_init(void)
+{
+    if (!gMem.budget) {
+        long pages = sysconf(_SC_PHYS_PAGES);
+        long page = sysconf(_SC_PAGE_SIZE);
+        gMem.budget = pages > 0 && page > 0 ? (Uint64)pages * page / 2 : 0;
     }
-    return 1;
+    gMem.lock = SDL_CreateMutex();
+    gMem.spare_lock = SDL_CreateMutex();
 }
 
-void draw_grid422_param(int step, int dot, int color0, int color1) {
-    /* horizontal grid lines */
-    for (Uint32 y = 0; y < P.height; y += step) {
-        for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += dot * 2) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = color0;
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x + 8) = color1;
-        }
-    }
-    /* vertical grid lines */
-    for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += 2 * step) {
-        for (Uint32 y = 0; y < P.height; y += dot) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = color0;
-            *(my_overlay->pixels[0] + (y + 4) * my_overlay->pitches[0] + x) = color1;
-        }
+void mem_count(Uint32 owner, Sint64 len)
+{
+    Uint64 used = __atomic_add_fetch(&gMem.used, len, __ATOMIC_RELAXED);
+    Uint64 peak = __atomic_load_n(&gMem.peak, __ATOMIC_RELAXED);
+
+    __atomic_add_fetch(&gMem.owner[owner], len, __ATOMIC_RELAXED);
+    while (used > peak
+           && !__atomic_compare_exchange_n(&gMem.peak, &peak, used, true,
+                                           __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED)) {
     }
 }
 
-void draw_grid420_param(int step, int dot, int color0, int color1) {
-    /* horizontal grid lines */
-    for (Uint32 y = 0; y < P.height; y += step) {
-        for (Uint32 x = 0; x < P.width; x += dot) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = color0;
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x + 4) = color1;
-        }
+/* owner's reclaim function, NULL when its cache goes away */
+void mem_reclaimer(Uint32 owner, MemReclaim fn)
+{
+    if (gMem.lock) {
+        SDL_mutexP(gMem.lock);
     }
-    /* vertical grid lines */
-    for (Uint32 x = 0; x < P.width; x += step) {
-        for (Uint32 y = 0; y < P.height; y += dot) {
-            *(my_overlay->pixels[0] + y * my_overlay->pitches[0] + x) = color0;
-            *(my_overlay->pixels[0] + (y + 4) * my_overlay->pitches[0] + x) = color1;
-        }
+    gMem.reclaim[owner] = fn;
+    if (gMem.lock) {
+        SDL_mutexV(gMem.lock);
     }
+}
 
+/* a spare goes for good */
+void mem_unmap(MemHdr h)
+{
+    munmap(h.base, h.len);
+    if (h.kind == MEM_MAP_HUGETLB) {
+        __atomic_sub_fetch(&gMem.hugetlb, h.len, __ATOMIC_RELAXED);
+    }
+    mem_count(MEM_SPARE, -(Sint64)h.len);
 }
 
-void draw_grid422(void)
+/* unmap spares, oldest first, until need bytes are gone, bytes freed */
+Uint64 mem_drop_spares(Uint64 need)
 {
-    if (!P.grid) {
-        return;
+    Uint64 got = 0;
+
+    if (!gMem.spare_lock) {
+        return 0;
+    }
+    SDL_mutexP(gMem.spare_lock);
+    while (gMem.nspare && got < need) {
+        MemHdr s = gMem.spare[0];
+        memmove(gMem.spare, gMem.spare + 1, --gMem.nspare * sizeof(MemHdr));
+        mem_unmap(s);
+        got += s.len;
     }
-    draw_grid422_param(16, 8, 0xF0, 0x20);
-    draw_grid422_param(64, 1, 0x90, 0x20);
-    draw_grid422_param(256, 1, 0xE0, 0x20);
-    draw_grid422_param(1024, 1, 0x00, 0x20);
+    SDL_mutexV(gMem.spare_lock);
+    return got;
 }
 
-void draw_grid420(void)
+/* make room for need bytes, the cache of owner excepted */
+void mem_reclaim(Uint64 need, Uint32 owner)
 {
-    if (!P.grid) {
+    Uint64 got = mem_drop_spares(need);
+
+    if (got >= need || !gMem.lock) {
         return;
     }
-    draw_grid420_param(16, 8, 0xF0, 0x20);
-    draw_grid420_param(64, 1, 0x90, 0x20);
-    draw_grid420_param(256, 1, 0xE0, 0x20);
-    draw_grid420_param(1024, 1, 0x00, 0x20);
+    SDL_mutexP(gMem.lock);
+    for (Uint32 k = 0; k < MEM_OWNERS && got < need; k++) {
+        if (k != owner && gMem.reclaim[k]) {
+            got += gMem.reclaim[k](need - got);
+        }
+    }
+    if (got) {
+        gMem.reclaims++;
+        gMem.reclaimed += got;
+    }
+    SDL_mutexV(gMem.lock);
 }
 
-Uint32  bitdepth(Uint32 fmt) {
-    if (fmt == NV1210 || fmt == YV1210) {
-        return 10;
-    } else {
-        return 8;
+/* count len bytes for owner, within the budget if there is one */
+Uint32 mem_reserve(size_t len, Uint32 owner)
+{
+    Uint64 used = __atomic_load_n(&gMem.used, __ATOMIC_RELAXED);
+
+    if (gMem.budget && used + len > gMem.budget) {
+        mem_reclaim(used + len - gMem.budget, owner);
+        used = __atomic_load_n(&gMem.used, __ATOMIC_RELAXED);
+        if (used + len > gMem.budget) {
+            if (__atomic_add_fetch(&gMem.fails, 1, __ATOMIC_RELAXED) == 1) {
+                DIE("memory budget of %.0f MB reached, %.1f MB more for %s"
+                    " refused, key i shows the usage\n", gMem.budget / 1e6,
+                    len / 1e6, gMemOwner[owner]);
+            }
+            return 0;
+        }
     }
+    mem_count(owner, len);
+    return 1;
 }
 
-bool isPlanar(Uint32 fmt) {
-    return fmt == YV12 || fmt == IYUV || fmt == YV1210
-        || fmt == NV12 || fmt == NV21 || fmt == MONO
-        || fmt == YV16 || fmt == YUV444P || fmt == NV1210
-        || fmt == NV12TILED || fmt == NV1210TILED;
+/* a spare of at least len bytes and not much more, base NULL if none */
+MemHdr mem_take_spare(size_t len, Uint32 kind)
+{
+    MemHdr h = {NULL, 0, 0, 0};
+
+    if (!gMem.spare_lock) {
+        return h;
+    }
+    SDL_mutexP(gMem.spare_lock);
+    for (Uint32 i = gMem.nspare; i-- > 0;) {
+        MemHdr *s = &gMem.spare[i];
+        if (s->kind == kind && s->len >= len && s->len <= len + len / 4) {
+            h = *s;
+            memmove(s, s + 1, (--gMem.nspare - i) * sizeof(MemHdr));
+            break;
+        }
+    }
+    SDL_mutexV(gMem.spare_lock);
+    return h;
 }
 
-void luma_only(void)
+/* keep a freed mapping for reuse, the oldest spare goes if full */
+void mem_put_spare(MemHdr h)
 {
-    if (!P.y_only) {
-        return;
-    }
+    MemHdr old = {NULL, 0, 0, 0};
 
-    if (isPlanar(FORMAT)) {
-        /* Set croma part to 0x80 */
-        for (Uint32 i = 0; i < P.cr_size; i++) {
-            my_overlay->pixels[1][i] = 0x80;
-        }
-        for (Uint32 i = 0; i < P.cb_size; i++) {
-            my_overlay->pixels[2][i] = 0x80;
-        }
+    mem_count(h.owner, -(Sint64)h.len);
+    mem_count(MEM_SPARE, h.len);
+    h.owner = MEM_SPARE;
+    if (!gMem.spare_lock) {
+        mem_unmap(h);
         return;
     }
-
-    /* YUY2, UYVY, YVYU */
-    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    SDL_mutexP(gMem.spare_lock);
+    if (gMem.nspare == MEM_SPARES) {
+        old = gMem.spare[0];
+        memmove(gMem.spare, gMem.spare + 1, --gMem.nspare * sizeof(MemHdr));
     }
-    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    gMem.spare[gMem.nspare++] = h;
+    SDL_mutexV(gMem.spare_lock);
+    if (old.base) {
+        mem_unmap(old);
     }
 }
 
-void cb_only(void)
+/* size bytes for owner, 64 byte aligned, URING_ALIGN for MEM_IO */
+void *mem_alloc(size_t size, Uint32 owner)
 {
-    if (!P.cb_only || FORMAT == MONO) {
-        return;
+    size_t hdr = owner == MEM_IO ? URING_ALIGN : MEM_HDR;
+    MemHdr h = {NULL, size + hdr, owner, MEM_MALLOC};
+    MemHdr *p;
+
+    if (h.len >= MEM_MAP_MIN) {
+        /* whole huge pages, the kernel then aligns the mapping to them */
+        size_t page = gMem.huge != MEM_SMALL && h.len >= MEM_HUGE_PAGE
+                      ? MEM_HUGE_PAGE : 4096;
+        h.kind = gMem.huge == MEM_HUGETLB && page == MEM_HUGE_PAGE
+                 ? MEM_MAP_HUGETLB : MEM_MAP;
+        h.len = (h.len + page - 1) & ~(page - 1);
+        MemHdr s = mem_take_spare(h.len, h.kind);
+        if (s.base) {
+            h.base = s.base;
+            h.len = s.len;
+            mem_count(MEM_SPARE, -(Sint64)h.len);
+            mem_count(owner, h.len);
+        }
     }
-
-    if (isPlanar(FORMAT)) {
-        /* Set Luma part and Cr to 0x80 */
-        for (Uint32 i = 0; i < P.y_size; i++) {
-            my_overlay->pixels[0][i] = 0x80;
+    if (!h.base && !mem_reserve(h.len, owner)) {
+        return NULL;
+    }
+#ifdef MAP_HUGETLB
+    if (!h.base && h.kind == MEM_MAP_HUGETLB) {
+        h.base = mmap(NULL, h.len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (h.base == MAP_FAILED) {
+            /* none reserved, vm.nr_hugepages */
+            h.base = NULL;
+            h.kind = MEM_MAP;
+        } else {
+            __atomic_add_fetch(&gMem.hugetlb, h.len, __ATOMIC_RELAXED);
+        }
+    }
+#else
+    if (h.kind == MEM_MAP_HUGETLB) {
+        h.kind = MEM_MAP;
+    }
+#endif
+    if (!h.base && h.kind == MEM_MAP) {
+        h.base = mmap(NULL, h.len, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (h.base == MAP_FAILED) {
+            h.base = NULL;
         }
-        for (Uint32 i = 0; i < P.cr_size; i++) {
-            my_overlay->pixels[1][i] = 0x80;
+#ifdef MADV_HUGEPAGE
+        if (h.base && gMem.huge != MEM_SMALL) {
+            madvise(h.base, h.len, MADV_HUGEPAGE);
         }
-        return;
+#endif
     }
-
-    /* YUY2, UYVY, YVYU */
-    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    if (!h.base && h.kind == MEM_MALLOC
+        && posix_memalign((void **)&h.base, hdr, h.len) != 0) {
+        h.base = NULL;
     }
-    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    if (!h.base) {
+        mem_count(owner, -(Sint64)h.len);
+        return NULL;
     }
+    p = (MemHdr *)(h.base + hdr) - 1;
+    *p = h;
+    return h.base + hdr;
 }
 
-void cr_only(void)
+void mem_free(void *ptr)
 {
-    if (!P.cr_only || FORMAT == MONO) {
+    MemHdr h;
+
+    if (!ptr) {
         return;
     }
+    h = ((MemHdr *)ptr)[-1];
+    if (h.kind == MEM_MALLOC) {
+        free(h.base);
+        mem_count(h.owner, -(Sint64)h.len);
+        return;
+    }
+    mem_put_spare(h);
+}
 
-    if (isPlanar(FORMAT)) {
-        /* Set Luma part and Cb to 0x80 */
-        for (Uint32 i = 0; i < P.y_size; i++) {
-            my_overlay->pixels[0][i] = 0x80;
-        }
-        for (Uint32 i = 0; i < P.cb_size; i++) {
-            my_overlay->pixels[2][i] = 0x80;
+/* bytes a cache that wants size may keep, a quarter of the budget at most */
+Uint64 mem_cap(Uint64 size)
+{
+    return gMem.budget && size > gMem.budget / 4 ? gMem.budget / 4 : size;
+}
+
+/* anonymous memory of the process really in huge pages, -1 if unknown */
+Sint64 mem_thp(void)
+{
+    FILE *fp = fopen("/proc/self/smaps_rollup", "r");
+    char line[128];
+    unsigned long long kb;
+    Sint64 ret = -1;
+
+    while (fp && fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "AnonHugePages: %llu kB", &kb) == 1) {
+            ret = kb << 10;
         }
-        return;
     }
+    if (fp) {
+        fclose(fp);
+    }
+    return ret;
+}
 
-    /* YUY2, UYVY, YVYU */
-    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+/* at exit, after the worker pool */
+void mem_close(void)
+{
+    mem_drop_spares(~0ULL);
+    if (gMem.spare_lock) {
+        SDL_DestroyMutex(gMem.spare_lock);
+        gMem.spare_lock = NULL;
     }
-    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
-        *(my_overlay->pixels[0] + i) = 0x80;
+    if (gMem.lock) {
+        SDL_DestroyMutex(gMem.lock);
+        gMem.lock = NULL;
     }
 }
 
-#define SWAP(a, b, T)      { T t = a; a = b; b = t; }
-void pre_draw(void) {
-    if (P.flip_change_uv) {
-        P.flip_change_uv = false;
-        P.is_change_uv = !P.is_change_uv;
-        // exchange UV planar for this frame
-        SWAP(P.cr_data, P.cb_data, unsigned char *);
-    } else if (P.is_change_uv) {
-        // keep exchange UV for next frames
-        SWAP(P.cr_data, P.cb_data, unsigned char *);
+void mem_stats(void)
+{
+    Sint64 thp = mem_thp();
+
+    printf("mem: %.1f MB used, peak %.1f MB, budget %.0f MB (",
+           gMem.used / 1e6, gMem.peak / 1e6, gMem.budget / 1e6);
+    for (Uint32 k = 0; k < MEM_OWNERS; k++) {
+        printf("%s%s %.1f", k ? ", " : "", gMemOwner[k], gMem.owner[k] / 1e6);
     }
+    printf(")\n     huge pages: %s", gMem.huge == MEM_SMALL ? "off"
+           : gMem.huge == MEM_HUGETLB ? "hugetlb" : "thp");
+    if (gMem.hugetlb) {
+        printf(", %.1f MB hugetlbfs", gMem.hugetlb / 1e6);
+    }
+    if (thp >= 0) {
+        printf(", %.1f MB transparent", thp / 1e6);
+    }
+    printf(", %u reclaims freed %.1f MB, %u refused\n", gMem.reclaims,
+           gMem.reclaimed / 1e6, gMem.fails);
 }
 
-void post_draw(void) {
-    luma_only();
-    cb_only();
-    cr_only();
-    histogram();
+void frame_free(Frame *f)
+{
+    mem_free(f->raw);
+    mem_free(f->y_data);
+    mem_free(f->cb_data);
+    mem_free(f->cr_data);
+    mem_free(f->deep);
+    memset(f, 0, sizeof(*f));
 }
 
-void draw_420sp(void) {
-    pre_draw();
-    memcpy(my_overlay->pixels[0], P.y_data, P.y_size);
-    memcpy(my_overlay->pixels[1], P.cb_data, P.cb_size);
-    memcpy(my_overlay->pixels[2], P.cr_data, P.cr_size);
-    draw_grid420();
-    post_draw();
+/* make buf hold size bytes, contents are not kept */
+Uint32 frame_grow(Uint8 **buf, Uint32 *cap, Uint32 size)
+{
+    if (size <= *cap) {
+        return 1;
+    }
+    mem_free(*buf);
+    /* some headroom, so stepping the size up doesn't allocate every time */
+    *cap = size + size / 4;
+    *buf = mem_alloc(sizeof(Uint8) * *cap, MEM_FRAME);
+    if (!*buf) {
+        *cap = 0;
+        return 0;
+    }
+    return 1;
 }
 
-void draw_yv12(void)
+/* size f for the geometry of d, buffers only ever grow */
+Uint32 frame_alloc(const Dec *d, Frame *f)
 {
-    pre_draw();
-    memcpy(my_overlay->pixels[0], P.y_data, P.y_size);
-    memcpy(my_overlay->pixels[1], P.cr_data, P.cr_size);
-    memcpy(my_overlay->pixels[2], P.cb_data, P.cb_size);
-    draw_grid420();
-    post_draw();
+    if (!frame_grow(&f->raw, &f->raw_cap, d->frame_size)
+        || !frame_grow(&f->y_data, &f->y_cap, d->y_size)
+        || !frame_grow(&f->cb_data, &f->cb_cap, d->cb_size)
+        || !frame_grow(&f->cr_data, &f->cr_cap, d->cr_size)) {
+        DIE("Error allocating memory...\n");
+        frame_free(f);
+        return 0;
+    }
+    if (bitdepth(d->format) > 8 && f->deep_cap < d->frame_size) {
+        /* native samples, mapped to the planes above by deep_map() */
+        mem_free(f->deep);
+        f->deep_cap = d->frame_size;
+        f->deep = mem_alloc(sizeof(Uint16) * f->deep_cap, MEM_FRAME);
+        if (!f->deep) {
+            DIE("Error allocating memory...\n");
+            frame_free(f);
+            return 0;
+        }
+    }
+    return 1;
 }
 
-void draw_422(void)
+/* Kernels
+ * Each kernel has a plain C body, and SSE2, AVX2 or AVX-512 ones where
+ * they pay off. The vector bodies leave the tail to the C one. Callers go
+ * through gKern, filled by kern_init().
+ */
+
+/* memcpy() for the short runs of detile() */
+void copy_u8_c(Uint8 *dst, const Uint8 *src, Uint32 n)
 {
-    pre_draw();
-    memcpy(my_overlay->pixels[0], P.raw, P.frame_size);
-    draw_grid422();
-    post_draw();
+    memcpy(dst, src, n);
 }
 
-void usage(char *name)
+/* n pairs of src to a[] (first of each pair) and b[] */
+void split_u8_c(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n)
 {
-    fprintf(stderr, "Usage:\n");
-    fprintf(stderr, "%s filename [width height format [diff_filename]]\n", name);
-    fprintf(stderr, "\twhen only have filename arg,"
-            " try guess other arg from filename\n");
-    fprintf(stderr, "\tformat=[");
-    char *s;
-    for (Uint32 i = 0; i != COUNT_OF(gFmtMap); i++) {
-        if (i == 0) {
-            s = "%s";
-        } else {
-            s = ", %s";
-        }
-        fprintf(stderr, s, showFmt(i));
+    for (Uint32 i = 0; i < n; i++) {
+        a[i] = src[i * 2];
+        b[i] = src[i * 2 + 1];
     }
-    fprintf(stderr, "]\n");
 }
 
-// show block size cols, rows, stride,
-// add delim width to show YUYV alike case.
-void mb_loop(char *str, Uint8 *start_addr, Uint32 cols, Uint32 rows,
-             Uint32 stride, Uint32 delim)
+/* 16 bit version of split_u8_c() */
+void split_u16_c(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n)
 {
-    printf("%s\n", str);
-    for (Uint32 i = 0; i < rows; i++) {
-        for (Uint32 j = 0; j < cols; j++) {
-            printf("%02X ", start_addr[i * stride + j * (1 + delim)]);
-            if ((j + 1) % 4 == 0) {
-                printf(" ");
-            }
-        }
-        printf("\n");
-        if ((i + 1) % 4 == 0) {
-            printf("\n");
-        }
+    for (Uint32 i = 0; i < n; i++) {
+        a[i] = src[i * 2];
+        b[i] = src[i * 2 + 1];
     }
 }
 
-void show_mb(Uint32 mouse_x, Uint32 mouse_y)
+/* low and high bytes of n samples, to detile them as 8 bit planes */
+void unzip_u16(const Uint16 *src, Uint8 *lo, Uint8 *hi, Uint32 n)
 {
-    if (!P.mb) {
-        return;
+    gKern.split_u8((const Uint8 *)src, lo, hi, n);
+}
+
+/* inverse of unzip_u16() */
+void zip_u16_c(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        dst[i] = lo[i] | hi[i] << 8;
     }
-    if (bitdepth(FORMAT) == 10) {
-        printf("10-bitdepth raw data dither to 8bit\n");
+}
+
+/* dst = lut[src], lut has LUT_SIZE entries and LUT_PAD bytes after */
+void lut_u16_c(Uint8 *dst, const Uint16 *src, const Uint8 *lut, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        dst[i] = lut[src[i]];
+        dst[i + 1] = lut[src[i + 1]];
+        dst[i + 2] = lut[src[i + 2]];
+        dst[i + 3] = lut[src[i + 3]];
     }
-    if (P.width % 16 != 0) {
-        printf("support non-align width=%d have issue\n", P.width);
-        goto unsupport;
+    for (; i < n; i++) {
+        dst[i] = lut[src[i]];
     }
-    Uint32 MB;
-
-    /* which MB are we in? */
-    int mb_x = mouse_x / (16 * P.zoom);
-    int mb_y = mouse_y / (16 * P.zoom);
-    MB = mb_x + (P.width / 16) * mb_y;
+}
 
-    printf("\nMB (%d, %d) #%d\n", mb_x, mb_y, MB);
+/* dst = 0x80 + amp * (b - a), saturated to 0..255 */
+void diff_u8_c(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+               Uint32 amp)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        int d = 0x80 + (int)amp * (b[i] - a[i]);
+        dst[i] = d < 0 ? 0 : d > 255 ? 255 : d;
+    }
+}
 
-    void (*drawer)(void) = gFmtMap[FORMAT].drawer;
-    if (drawer == draw_422) {
-        Uint8 *p = P.raw + 32 * MB;
-        switch (gFmtMap[FORMAT].overlay_fmt) {
-            case SDL_YUY2_OVERLAY:
-                /* Packed mode: Y0+U0+Y1+V0 */
-                mb_loop("= Y =", p, 16, 16, P.width, 1);
-                mb_loop("= Cb =", p + 1, 8, 16, P.width, 3);
-                mb_loop("= Cr =", p + 3, 8, 16, P.width, 3);
-                break;
-            case SDL_UYVY_OVERLAY:
-                mb_loop("= Y =", p + 1, 16, 16, P.width, 1);
-                mb_loop("= Cb =", p, 8, 16, P.width, 3);
-                mb_loop("= Cr =", p + 2, 8, 16, P.width, 3);
-                break;
-            case SDL_YVYU_OVERLAY:
-                mb_loop("= Y =", p, 16, 16, P.width, 1);
-                mb_loop("= Cb =", p + 3, 8, 16, P.width, 3);
-                mb_loop("= Cr =", p + 1, 8, 16, P.width, 3);
-                break;
-            default:
-                goto unsupport;
-        }
-    } else if (drawer == draw_yv12) {
-        mb_loop("= Y =", P.y_data + 16 * MB, 16, 16, P.width, 0);
-        mb_loop("= Cb =", P.cb_data + 8 * MB, 8, 8, P.width / 2, 0);
-        mb_loop("= Cr =", P.cr_data + 8 * MB, 8, 8, P.width / 2, 0);
-    } else {
-        goto unsupport;
+/* sum of squared differences */
+Uint64 sse_u8_c(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint64 sum = 0;
+    for (Uint32 i = 0; i < n; i++) {
+        int d = a[i] - b[i];
+        sum += d * d;
     }
+    return sum;
+}
 
-    fflush(stdout);
-    return;
-unsupport:
-    printf("unsupport show_mb for format=%d[%s]\n",
-           FORMAT, gFmtMap[FORMAT].fmtNameLst);
+/* sum of absolute differences */
+Uint64 sad_u8_c(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint64 sum = 0;
+    for (Uint32 i = 0; i < n; i++) {
+        sum += abs(a[i] - b[i]);
+    }
+    return sum;
 }
 
-void draw_frame(void)
+/* SAD and SSE of nblk horizontally adjacent 8x8 blocks */
+void sad_sse_8x8_c(const Uint8 *a, const Uint8 *b, Uint32 stride,
+                   Uint32 nblk, Uint32 *sad, Uint32 *sse)
 {
-    // lock pixels before modifying them
-    SDL_LockYUVOverlay(my_overlay);
-    precheck_range(FORMAT, gFmtMap);
-    (gFmtMap[FORMAT].drawer)();
-    set_zoom_rect();
-    video_rect.x = 0;
-    video_rect.y = 0;
-    video_rect.w = P.zoom_width;
-    video_rect.h = P.zoom_height;
-    SDL_UnlockYUVOverlay(my_overlay);
-
-    SDL_DisplayYUVOverlay(my_overlay, &video_rect);
+    for (Uint32 k = 0; k < nblk; k++) {
+        sad[k] = sse[k] = 0;
+        for (Uint32 r = 0; r < 8; r++) {
+            for (Uint32 c = 0; c < 8; c++) {
+                int d = a[r * stride + k * 8 + c] - b[r * stride + k * 8 + c];
+                sad[k] += abs(d);
+                sse[k] += d * d;
+            }
+        }
+    }
 }
 
-Uint32 read_frame(void)
+#ifdef __SSE2__
+void copy_u8_sse2(Uint8 *dst, const Uint8 *src, Uint32 n)
 {
-    if (!P.diff) {
-        precheck_range(FORMAT, gFmtMap);
-        return (gFmtMap[FORMAT].reader)();
-    } else {
-        return diff_mode();
+    Uint32 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_loadu_si128((const __m128i *)(src + i)));
     }
+    copy_u8_c(dst + i, src + i, n - i);
 }
 
-Uint32 diff_mode(void)
+void split_u8_sse2(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n)
 {
-    FILE *fd_tmp;
-    Uint8 *y_tmp;
-
-    /* Perhaps a bit ugly but it seams to work...
-     * 1. read frame from fd
-     * 2. store data away
-     * 3. read frame from P.fd2
-     * 4. calculate diff
-     * 5. place result in P.raw or P.y_data depending on FORMAT
-     * 6. diff works on luma data so clear P.cb_data and P.cr_data
-     * Fiddle with the file descriptors so that we read
-     * from correct file.
-     */
-
-    precheck_range(FORMAT, gFmtMap);
-    if (!(gFmtMap[FORMAT].reader)()) {
-        return 0;
-    }
-
-    y_tmp = malloc(sizeof(Uint8) * P.y_size);
-
-    if (!y_tmp) {
-        DIE("Error allocating memory...\n");
-        return 0;
-    }
-
-    for (Uint32 i = 0; i < P.y_size; i++) {
-        y_tmp[i] = P.y_data[i];
-    }
+    Uint32 i = 0;
+    __m128i lo = _mm_set1_epi16(0xff);
+    for (; i + 16 <= n; i += 16) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + i * 2 + 16));
+        _mm_storeu_si128((__m128i *)(a + i),
+                         _mm_packus_epi16(_mm_and_si128(v0, lo),
+                                          _mm_and_si128(v1, lo)));
+        _mm_storeu_si128((__m128i *)(b + i),
+                         _mm_packus_epi16(_mm_srli_epi16(v0, 8),
+                                          _mm_srli_epi16(v1, 8)));
+    }
+    split_u8_c(src + i * 2, a + i, b + i, n - i);
+}
 
-    fd_tmp = fd;
-    fd = P.fd2;
+void split_u16_sse2(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m128i lo = _mm_set1_epi32(0xffff);
+    for (; i + 8 <= n; i += 8) {
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(src + i * 2));
+        __m128i v1 = _mm_loadu_si128((const __m128i *)(src + i * 2 + 8));
+        /* no unsigned 32 to 16 bit pack in SSE2, sign extend and pack */
+        __m128i a0 = _mm_srai_epi32(_mm_slli_epi32(_mm_and_si128(v0, lo), 16), 16);
+        __m128i a1 = _mm_srai_epi32(_mm_slli_epi32(_mm_and_si128(v1, lo), 16), 16);
+        _mm_storeu_si128((__m128i *)(a + i), _mm_packs_epi32(a0, a1));
+        _mm_storeu_si128((__m128i *)(b + i),
+                         _mm_packs_epi32(_mm_srai_epi32(v0, 16),
+                                         _mm_srai_epi32(v1, 16)));
+    }
+    split_u16_c(src + i * 2, a + i, b + i, n - i);
+}
 
-    precheck_range(FORMAT, gFmtMap);
-    if (!(gFmtMap[FORMAT].reader)()) {
-        free(y_tmp);
-        fd = fd_tmp;
-        return 0;
-    }
+void zip_u16_sse2(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i l = _mm_loadu_si128((const __m128i *)(lo + i));
+        __m128i h = _mm_loadu_si128((const __m128i *)(hi + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi8(l, h));
+        _mm_storeu_si128((__m128i *)(dst + i + 8), _mm_unpackhi_epi8(l, h));
+    }
+    zip_u16_c(dst + i, lo + i, hi + i, n - i);
+}
 
-    /* restore file descriptor */
-    fd = fd_tmp;
+void diff_u8_sse2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                  Uint32 amp)
+{
+    Uint32 i = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i gain = _mm_set1_epi16(amp);
+    __m128i bias = _mm_set1_epi16(0x80);
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(vb, zero),
+                                   _mm_unpacklo_epi8(va, zero));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(vb, zero),
+                                   _mm_unpackhi_epi8(va, zero));
+        lo = _mm_add_epi16(_mm_mullo_epi16(lo, gain), bias);
+        hi = _mm_add_epi16(_mm_mullo_epi16(hi, gain), bias);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packus_epi16(lo, hi));
+    }
+    diff_u8_c(dst + i, a + i, b + i, n - i, amp);
+}
 
-    /* now, P.y_data contains luminance data for fd2 and
-     * y_tmp contains luma data for fd.
-     * Calculate diff and place result where it belongs
-     * Clear croma data */
+Uint64 sse_u8_sse2(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc = _mm_setzero_si128();
+    Uint64 lane[2];
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero),
+                                   _mm_unpacklo_epi8(vb, zero));
+        __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero),
+                                   _mm_unpackhi_epi8(vb, zero));
+        /* 4 x 32 bit, each at most 4 * 255 * 255 */
+        __m128i sq = _mm_add_epi32(_mm_madd_epi16(lo, lo),
+                                   _mm_madd_epi16(hi, hi));
+        acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(sq, zero));
+        acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(sq, zero));
+    }
+    _mm_storeu_si128((__m128i *)lane, acc);
+    return lane[0] + lane[1] + sse_u8_c(a + i, b + i, n - i);
+}
 
-    calc_psnr(y_tmp, P.y_data);
+Uint64 sad_u8_sse2(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m128i acc = _mm_setzero_si128();
+    Uint64 lane[2];
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(va, vb));
+    }
+    _mm_storeu_si128((__m128i *)lane, acc);
+    return lane[0] + lane[1] + sad_u8_c(a + i, b + i, n - i);
+}
 
-    if (FORMAT == YV12 || FORMAT == IYUV) {
-        for (Uint32 i = 0; i < P.y_size; i++) {
-            P.y_data[i] = 0x80 - (y_tmp[i] - P.y_data[i]);
-        }
-        for (Uint32 i = 0; i < P.cb_size; i++) {
-            P.cb_data[i] = 0x80;
-        }
-        for (Uint32 i = 0; i < P.cr_size; i++) {
-            P.cr_data[i] = 0x80;
-        }
-    } else {
-        Uint32 j = 0;
-        for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
-            P.raw[i] = 0x80 - (y_tmp[j] - P.y_data[j]);
-            j++;
-        }
-        for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
-            P.raw[i] = 0x80;
-        }
-        for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
-            P.raw[i] = 0x80;
+void sad_sse_8x8_sse2(const Uint8 *a, const Uint8 *b, Uint32 stride,
+                      Uint32 nblk, Uint32 *sad, Uint32 *sse)
+{
+    Uint32 k = 0;
+    __m128i zero = _mm_setzero_si128();
+    /* two blocks per 16 byte row */
+    for (; k + 2 <= nblk; k += 2) {
+        __m128i s = _mm_setzero_si128();
+        __m128i q0 = _mm_setzero_si128();
+        __m128i q1 = _mm_setzero_si128();
+        Uint32 lane[4];
+        for (Uint32 r = 0; r < 8; r++) {
+            __m128i va = _mm_loadu_si128((const __m128i *)(a + r * stride + k * 8));
+            __m128i vb = _mm_loadu_si128((const __m128i *)(b + r * stride + k * 8));
+            __m128i lo = _mm_sub_epi16(_mm_unpacklo_epi8(va, zero),
+                                       _mm_unpacklo_epi8(vb, zero));
+            __m128i hi = _mm_sub_epi16(_mm_unpackhi_epi8(va, zero),
+                                       _mm_unpackhi_epi8(vb, zero));
+            s = _mm_add_epi64(s, _mm_sad_epu8(va, vb));
+            q0 = _mm_add_epi32(q0, _mm_madd_epi16(lo, lo));
+            q1 = _mm_add_epi32(q1, _mm_madd_epi16(hi, hi));
         }
-    }
-
-    free(y_tmp);
-
-    return 1;
+        sad[k] = _mm_cvtsi128_si32(s);
+        sad[k + 1] = _mm_cvtsi128_si32(_mm_srli_si128(s, 8));
+        _mm_storeu_si128((__m128i *)lane, q0);
+        sse[k] = lane[0] + lane[1] + lane[2] + lane[3];
+        _mm_storeu_si128((__m128i *)lane, q1);
+        sse[k + 1] = lane[0] + lane[1] + lane[2] + lane[3];
+    }
+    sad_sse_8x8_c(a + k * 8, b + k * 8, stride, nblk - k, sad + k, sse + k);
 }
+#endif
 
-void calc_psnr(Uint8 *frame0, Uint8 *frame1)
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+void copy_u8_avx2(Uint8 *dst, const Uint8 *src, Uint32 n)
 {
-    double mse = 0.0;
-    double mse_tmp = 0.0;
-    double psnr = 0.0;
-
-    // only compare Y component
-    for (Uint32 i = 0; i < P.y_size; i++) {
-        mse_tmp = abs(frame0[i] - frame1[i]);
-        mse += mse_tmp * mse_tmp;
-    }
-
-    /* division by zero */
-    if (mse == 0) {
-        fprintf(stdout, "PSNR: NaN MSE=0\n");
-        return;
+    Uint32 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        _mm256_storeu_si256((__m256i *)(dst + i),
+                            _mm256_loadu_si256((const __m256i *)(src + i)));
     }
+    copy_u8_c(dst + i, src + i, n - i);
+}
 
-    mse /= P.y_size;
+__attribute__((target("avx2")))
+void split_u8_avx2(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m256i lo = _mm256_set1_epi16(0xff);
+    for (; i + 32 <= n; i += 32) {
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(src + i * 2));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(src + i * 2 + 32));
+        __m256i va = _mm256_packus_epi16(_mm256_and_si256(v0, lo),
+                                         _mm256_and_si256(v1, lo));
+        __m256i vb = _mm256_packus_epi16(_mm256_srli_epi16(v0, 8),
+                                         _mm256_srli_epi16(v1, 8));
+        /* packs work per 128 bit lane, put the quarters back in order */
+        _mm256_storeu_si256((__m256i *)(a + i),
+                            _mm256_permute4x64_epi64(va, 0xd8));
+        _mm256_storeu_si256((__m256i *)(b + i),
+                            _mm256_permute4x64_epi64(vb, 0xd8));
+    }
+    split_u8_c(src + i * 2, a + i, b + i, n - i);
+}
 
-    psnr = 10.0 * log10((256 * 256) / mse);
+__attribute__((target("avx2")))
+void zip_u16_avx2(Uint16 *dst, const Uint8 *lo, const Uint8 *hi, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        /* unpacks work per 128 bit lane, quarters 0 2 1 3 come out in order */
+        __m256i l = _mm256_permute4x64_epi64(
+            _mm256_loadu_si256((const __m256i *)(lo + i)), 0xd8);
+        __m256i h = _mm256_permute4x64_epi64(
+            _mm256_loadu_si256((const __m256i *)(hi + i)), 0xd8);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_unpacklo_epi8(l, h));
+        _mm256_storeu_si256((__m256i *)(dst + i + 16),
+                            _mm256_unpackhi_epi8(l, h));
+    }
+    zip_u16_c(dst + i, lo + i, hi + i, n - i);
+}
 
-    fprintf(stdout, "PSNR: %f\n", psnr);
+/* 16 samples at a time, 4 byte gathers at lut + sample, low byte kept */
+__attribute__((target("avx2")))
+void lut_u16_avx2(Uint8 *dst, const Uint16 *src, const Uint8 *lut, Uint32 n)
+{
+    Uint32 i = 0;
+    __m256i low = _mm256_set1_epi32(0xff);
+    for (; i + 16 <= n; i += 16) {
+        __m128i s0 = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i s1 = _mm_loadu_si128((const __m128i *)(src + i + 8));
+        __m256i a = _mm256_i32gather_epi32((const int *)lut,
+                                           _mm256_cvtepu16_epi32(s0), 1);
+        __m256i b = _mm256_i32gather_epi32((const int *)lut,
+                                           _mm256_cvtepu16_epi32(s1), 1);
+        /* packs work per 128 bit lane, put a and b back in order */
+        __m256i w = _mm256_packus_epi32(_mm256_and_si256(a, low),
+                                        _mm256_and_si256(b, low));
+        w = _mm256_permute4x64_epi64(w, 0xd8);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_packus_epi16(_mm256_castsi256_si128(w),
+                                          _mm256_extracti128_si256(w, 1)));
+    }
+    lut_u16_c(dst + i, src + i, lut, n - i);
 }
 
-void histogram(void)
+__attribute__((target("avx2")))
+void diff_u8_avx2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                  Uint32 amp)
 {
-    if (!P.hist) {
-        return;
-    }
+    Uint32 i = 0;
+    __m256i gain = _mm256_set1_epi16(amp);
+    __m256i bias = _mm256_set1_epi16(0x80);
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128((const __m128i *)(a + i)));
+        __m256i vb = _mm256_cvtepu8_epi16(
+            _mm_loadu_si128((const __m128i *)(b + i)));
+        __m256i w = _mm256_add_epi16(
+            _mm256_mullo_epi16(_mm256_sub_epi16(vb, va), gain), bias);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_packus_epi16(_mm256_castsi256_si128(w),
+                                          _mm256_extracti128_si256(w, 1)));
+    }
+    diff_u8_c(dst + i, a + i, b + i, n - i, amp);
+}
 
-    Uint8 y[256] = {0};
-    Uint8 b[256] = {0};
-    Uint8 r[256] = {0};
+__attribute__((target("avx2")))
+Uint64 sse_u8_avx2(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i acc = _mm256_setzero_si256();
+    Uint64 lane[4];
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(va, zero),
+                                      _mm256_unpacklo_epi8(vb, zero));
+        __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(va, zero),
+                                      _mm256_unpackhi_epi8(vb, zero));
+        __m256i sq = _mm256_add_epi32(_mm256_madd_epi16(lo, lo),
+                                      _mm256_madd_epi16(hi, hi));
+        acc = _mm256_add_epi64(acc, _mm256_unpacklo_epi32(sq, zero));
+        acc = _mm256_add_epi64(acc, _mm256_unpackhi_epi32(sq, zero));
+    }
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    return lane[0] + lane[1] + lane[2] + lane[3]
+           + sse_u8_c(a + i, b + i, n - i);
+}
 
-    for (Uint32 i = 0; i < P.y_size; i++) {
-        y[P.y_data[i]]++;
-    }
-    for (Uint32 i = 0; i < P.cb_size; i++) {
-        b[P.cb_data[i]]++;
-    }
-    for (Uint32 i = 0; i < P.cr_size; i++) {
-        r[P.cr_data[i]]++;
-    }
+__attribute__((target("avx2")))
+Uint64 sad_u8_avx2(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m256i acc = _mm256_setzero_si256();
+    Uint64 lane[4];
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(va, vb));
+    }
+    _mm256_storeu_si256((__m256i *)lane, acc);
+    return lane[0] + lane[1] + lane[2] + lane[3]
+           + sad_u8_c(a + i, b + i, n - i);
+}
+#endif
 
-    fprintf(stdout, "\nY,");
-    for (Uint32 i = 0; i < 256; i++) {
-        fprintf(stdout, "%u,", y[i]);
-    }
-    fprintf(stdout, "\nCb,");
-    for (Uint32 i = 0; i < 256; i++) {
-        fprintf(stdout, "%u,", b[i]);
-    }
-    fprintf(stdout, "\nCr,");
-    for (Uint32 i = 0; i < 256; i++) {
-        fprintf(stdout, "%u,", r[i]);
-    }
-    fprintf(stdout, "\n");
-    fflush(stdout);
+#ifdef HAVE_AVX512
+__attribute__((target("avx512f,avx512bw")))
+void split_u8_avx512(const Uint8 *src, Uint8 *a, Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + i * 2));
+        /* the narrowing moves keep the order, no lanes to fix up */
+        _mm256_storeu_si256((__m256i *)(a + i), _mm512_cvtepi16_epi8(v));
+        _mm256_storeu_si256((__m256i *)(b + i),
+                            _mm512_cvtepi16_epi8(_mm512_srli_epi16(v, 8)));
+    }
+    split_u8_c(src + i * 2, a + i, b + i, n - i);
 }
 
-void setup_param(void)
+__attribute__((target("avx512f,avx512bw")))
+void split_u16_avx512(const Uint16 *src, Uint16 *a, Uint16 *b, Uint32 n)
 {
-    P.zoom = 1;
-    P.wh = P.width * P.height;
+    Uint32 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + i * 2));
+        _mm256_storeu_si256((__m256i *)(a + i), _mm512_cvtepi32_epi16(v));
+        _mm256_storeu_si256((__m256i *)(b + i),
+                            _mm512_cvtepi32_epi16(_mm512_srli_epi32(v, 16)));
+    }
+    split_u16_c(src + i * 2, a + i, b + i, n - i);
+}
 
-    switch (FORMAT) {
-        case YV12:
-        case IYUV:
-        case YV1210:
-        case NV12:
-        case NV1210:
-        case NV21:
-        case NV12TILED:
-        case NV1210TILED:
-        case MONO:
-            P.y_size = P.wh;
-            P.cb_size = P.cr_size = P.wh / 4;
-            break;
-        case YUY2:
-        case UYVY:
-        case YVYU:
-        case Y42210:
-        case YV16:
-            P.y_size = P.wh;
-            P.cb_size = P.cr_size = P.wh / 2;
-            P.grid_start_pos = 0;
-            break;
-        case YUV444P:
-            P.y_size = P.cb_size = P.cr_size = P.wh;
-            break;
-        default:
-            DIE("unhandled format=%d(%s)\n", FORMAT, showFmt(FORMAT));
-            break;
-    }
-    P.frame_size = P.y_size + P.cb_size + P.cr_size;
-    P.raw_frame_size = P.frame_size * bitdepth(FORMAT) / 8;
+__attribute__((target("avx512f,avx512bw")))
+void lut_u16_avx512(Uint8 *dst, const Uint16 *src, const Uint8 *lut, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m512i idx = _mm512_cvtepu16_epi32(
+            _mm256_loadu_si256((const __m256i *)(src + i)));
+        __m512i v = _mm512_i32gather_epi32(idx, (const void *)lut, 1);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm512_cvtepi32_epi8(v));
+    }
+    lut_u16_c(dst + i, src + i, lut, n - i);
+}
 
-    if (FORMAT == YUY2) {
-        /* Y U Y V
-         * 0 1 2 3 */
-        P.y_start_pos = 0;
-        P.cb_start_pos = 1;
-        P.cr_start_pos = 3;
-    } else if (FORMAT == UYVY) {
-        /* U Y V Y
-         * 0 1 2 3 */
-        P.y_start_pos = 1;
-        P.grid_start_pos = 1;
-        P.cb_start_pos = 0;
-        P.cr_start_pos = 2;
-    } else if (FORMAT == YVYU || FORMAT == Y42210) {
-        /* Y V Y U
-         * 0 1 2 3 */
-        P.y_start_pos = 0;
-        P.cb_start_pos = 3;
-        P.cr_start_pos = 1;
-    }
-    printf("format=%d size=%dx%d frame_size=%d y_size=%d cb_size=%d cr_size=%d\n",
-           FORMAT, P.width, P.height, P.frame_size, P.y_size, P.cb_size, P.cr_size);
+__attribute__((target("avx512f,avx512bw")))
+void diff_u8_avx512(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n,
+                    Uint32 amp)
+{
+    Uint32 i = 0;
+    __m512i gain = _mm512_set1_epi16(amp);
+    __m512i bias = _mm512_set1_epi16(0x80);
+    __m512i zero = _mm512_setzero_si512();
+    __m512i max = _mm512_set1_epi16(255);
+    for (; i + 32 <= n; i += 32) {
+        __m512i va = _mm512_cvtepu8_epi16(
+            _mm256_loadu_si256((const __m256i *)(a + i)));
+        __m512i vb = _mm512_cvtepu8_epi16(
+            _mm256_loadu_si256((const __m256i *)(b + i)));
+        __m512i w = _mm512_add_epi16(
+            _mm512_mullo_epi16(_mm512_sub_epi16(vb, va), gain), bias);
+        /* saturate as packus does, then narrow */
+        w = _mm512_min_epi16(_mm512_max_epi16(w, zero), max);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm512_cvtepi16_epi8(w));
+    }
+    diff_u8_c(dst + i, a + i, b + i, n - i, amp);
 }
 
-void check_input(void)
+__attribute__((target("avx512f,avx512bw")))
+Uint64 sse_u8_avx512(const Uint8 *a, const Uint8 *b, Uint32 n)
 {
-    Uint32 file_size;
+    Uint32 i = 0;
+    __m512i zero = _mm512_setzero_si512();
+    __m512i acc = _mm512_setzero_si512();
+    for (; i + 64 <= n; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void *)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(b + i));
+        __m512i lo = _mm512_sub_epi16(_mm512_unpacklo_epi8(va, zero),
+                                      _mm512_unpacklo_epi8(vb, zero));
+        __m512i hi = _mm512_sub_epi16(_mm512_unpackhi_epi8(va, zero),
+                                      _mm512_unpackhi_epi8(vb, zero));
+        __m512i sq = _mm512_add_epi32(_mm512_madd_epi16(lo, lo),
+                                      _mm512_madd_epi16(hi, hi));
+        acc = _mm512_add_epi64(acc, _mm512_unpacklo_epi32(sq, zero));
+        acc = _mm512_add_epi64(acc, _mm512_unpackhi_epi32(sq, zero));
+    }
+    return _mm512_reduce_add_epi64(acc) + sse_u8_c(a + i, b + i, n - i);
+}
 
-    /* Frame Size is an even multipe of 16x16? */
-    if (P.width % 16 != 0) {
-        DIE("WIDTH not multiple of 16, check input...\n");
-    }
-    if (P.height % 16 != 0) {
-        DIE("HEIGHT not multiple of 16, check input...\n");
-    }
+__attribute__((target("avx512f,avx512bw")))
+Uint64 sad_u8_avx512(const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    __m512i acc = _mm512_setzero_si512();
+    for (; i + 64 <= n; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void *)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(b + i));
+        acc = _mm512_add_epi64(acc, _mm512_sad_epu8(va, vb));
+    }
+    return _mm512_reduce_add_epi64(acc) + sad_u8_c(a + i, b + i, n - i);
+}
+#endif
 
-    /* Even number of frames? */
-    fseek(fd, 0L, SEEK_END);
-    file_size = ftell(fd);
-    fseek(fd, 0L, SEEK_SET);
+/* Kernel registry
+ * One row of gKernTab per level, NULL where a kernel has no body for it.
+ * kern_init() starts from the C row and takes the entries of every level
+ * up to the highest one the CPU runs, so a kernel without an AVX-512 body
+ * still gets its AVX2 or SSE2 one. YV_KERNELS or --kernels lower the
+ * level, to compare speed or rule a vector body out of a bug.
+ */
+const char *gKernName[KERN_LEVELS] = {"scalar", "sse2", "avx2", "avx512"};
+
+const struct kernels gKernTab[KERN_LEVELS] = {
+    [KERN_SCALAR] = {
+        .unpack10 = unpack10_c,
+        .unpack16 = unpack16_c,
+        .copy_u8 = copy_u8_c,
+        .split_u8 = split_u8_c,
+        .split_u16 = split_u16_c,
+        .zip_u16 = zip_u16_c,
+        .lut_u16 = lut_u16_c,
+        .diff_u8 = diff_u8_c,
+        .sse_u8 = sse_u8_c,
+        .sad_u8 = sad_u8_c,
+        .sad_sse_8x8 = sad_sse_8x8_c,
+        .blend_u8 = blend_u8_c,
+        .merge_u8 = merge_u8_c,
+        .dirty_row = dirty_row_c,
+        .sub_u8 = sub_u8_c,
+        .add_u8 = add_u8_c,
+    },
+#ifdef __SSE2__
+    [KERN_SSE2] = {
+        .unpack10 = unpack10_sse2,
+        .unpack16 = unpack16_sse2,
+        .copy_u8 = copy_u8_sse2,
+        .split_u8 = split_u8_sse2,
+        .split_u16 = split_u16_sse2,
+        .zip_u16 = zip_u16_sse2,
+        .diff_u8 = diff_u8_sse2,
+        .sse_u8 = sse_u8_sse2,
+        .sad_u8 = sad_u8_sse2,
+        .sad_sse_8x8 = sad_sse_8x8_sse2,
+        .blend_u8 = blend_u8_sse2,
+        .merge_u8 = merge_u8_sse2,
+        .dirty_row = dirty_row_sse2,
+        .sub_u8 = sub_u8_sse2,
+        .add_u8 = add_u8_sse2,
+    },
+#endif
+#ifdef HAVE_AVX2
+    [KERN_AVX2] = {
+        .unpack10 = unpack10_avx2,
+        .copy_u8 = copy_u8_avx2,
+        .split_u8 = split_u8_avx2,
+        .zip_u16 = zip_u16_avx2,
+        .lut_u16 = lut_u16_avx2,
+        .diff_u8 = diff_u8_avx2,
+        .sse_u8 = sse_u8_avx2,
+        .sad_u8 = sad_u8_avx2,
+        .sub_u8 = sub_u8_avx2,
+        .add_u8 = add_u8_avx2,
+    },
+#endif
+#ifdef HAVE_AVX512
+    [KERN_AVX512] = {
+        .split_u8 = split_u8_avx512,
+        .split_u16 = split_u16_avx512,
+        .lut_u16 = lut_u16_avx512,
+        .diff_u8 = diff_u8_avx512,
+        .sse_u8 = sse_u8_avx512,
+        .sad_u8 = sad_u8_avx512,
+        .sub_u8 = sub_u8_avx512,
+        .add_u8 = add_u8_avx512,
+    },
+#endif
+};
 
-    if (file_size % P.frame_size != 0) {
-        DIE("#FRAMES not an integer, check input...\n");
+/* the highest level the CPU and the build run */
+Uint32 kern_top(void)
+{
+    Uint32 top = KERN_SCALAR;
+#ifdef __SSE2__
+    top = KERN_SSE2;
+#endif
+#ifdef HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+        top = KERN_AVX2;
+    }
+#endif
+#ifdef HAVE_AVX512
+    if (__builtin_cpu_supports("avx512f")
+        && __builtin_cpu_supports("avx512bw")) {
+        top = KERN_AVX512;
     }
+#endif
+    return top;
 }
 
-Uint32 create_message_queue(void)
+/* fills gKern for the named level, NULL or "" for the highest one, 0 when
+ * there is no such level */
+Uint32 kern_init(const char *name)
 {
-    /* Should probably use argv[0] or similar as pathname
-     * when creating the key;
-     * but let's keep it simple for now. Y for YCbCr
-     */
-    if ((P.key = ftok("/tmp", 'Y')) == -1) {
-        perror("ftok");
-        return 0;
-    }
+    Uint32 top = kern_top();
+    Uint32 level = top;
 
-    if ((P.msqid = msgget(P.key, 0644 | IPC_CREAT)) == -1) {
-        perror("msgget");
-        return 0;
+    if (name && *name) {
+        for (level = 0; level < KERN_LEVELS && strcmp(name, gKernName[level]);
+             level++) {
+        }
+        if (level == KERN_LEVELS) {
+            return 0;
+        }
+        if (level > top) {
+            fprintf(stderr, "no %s on this CPU, using %s kernels\n", name,
+                    gKernName[top]);
+            level = top;
+        }
     }
 
-    /* we don't really care in this case */
-    P.buf.mtype = 1;
+#define KERN_TAKE(fn) if (k->fn) { gKern.fn = k->fn; }
+    gKern = gKernTab[KERN_SCALAR];
+    for (Uint32 l = KERN_SCALAR + 1; l <= level; l++) {
+        const struct kernels *k = &gKernTab[l];
+        KERN_TAKE(unpack10);
+        KERN_TAKE(unpack16);
+        KERN_TAKE(copy_u8);
+        KERN_TAKE(split_u8);
+        KERN_TAKE(split_u16);
+        KERN_TAKE(zip_u16);
+        KERN_TAKE(lut_u16);
+        KERN_TAKE(diff_u8);
+        KERN_TAKE(sse_u8);
+        KERN_TAKE(sad_u8);
+        KERN_TAKE(sad_sse_8x8);
+        KERN_TAKE(blend_u8);
+        KERN_TAKE(merge_u8);
+        KERN_TAKE(dirty_row);
+        KERN_TAKE(sub_u8);
+        KERN_TAKE(add_u8);
+    }
+#undef KERN_TAKE
+    gKernLevel = level;
     return 1;
 }
 
-Uint32 connect_message_queue(void)
+void kern_stats(void)
 {
-    if ((P.key = ftok("/tmp", 'Y')) == -1) {
-        perror("ftok");
-        return 0;
-    }
-
-    /* connect to the queue */
-    if ((P.msqid = msgget(P.key, 0644)) == -1) {
-        perror("msgget");
-        return 0;
-    }
+    printf("kernels: %s, CPU runs up to %s\n", gKernName[gKernLevel],
+           gKernName[kern_top()]);
+}
 
-    printf("Ready to receive messages, captain.\n");
+Uint32 check_free_memory(void) {
+    heat_free();
+    temp_free();
+    frame_free(&P.frame);
+    frame_free(&P.diff_src[0]);
+    frame_free(&P.diff_src[1]);
     return 1;
 }
 
-Uint32 send_message(char cmd)
+Uint32 allocate_memory(void)
 {
-    if (P.mode != MASTER) {
+    if (gCmp.on) {
+        /* inputs decode into gCmp.src */
         return 1;
     }
-
-    P.buf.mtext[0] = cmd;
-    P.buf.mtext[1] = '\0';
-
-    if (msgsnd(P.msqid, &P.buf, 2, 0) == -1) {
-        perror("msgsnd");
+    if (!frame_alloc(&P.dec, &P.frame)) {
         return 0;
     }
-
+    if (P.diff) {
+        /* both decoded inputs are kept for re-diffing */
+        if (!frame_alloc(&P.dec, &P.diff_src[0]) || !frame_alloc(&P.dec, &P.diff_src[1])) {
+            check_free_memory();
+            return 0;
+        }
+    }
     return 1;
 }
 
-Uint32 read_message(void)
-{
-    if (msgrcv(P.msqid, &P.buf, sizeof(P.buf.mtext), 0, 0) == -1) {
-        perror("msgrcv");
-        P.mode = NONE;
-        return 0;
-    }
+/* Overlay layers
+ * Grid, plane masks, the selected MB and the heatmap are rendered into
+ * masks in overlay layout, a value and an op per overlay byte, only when
+ * what they show changes. The layers are merged into one composite that
+ * is blended onto the overlay in one pass after the frame is copied in.
+ * Merge and blend only cover the bytes a layer touches.
+ */
+enum {
+    LAYER_KEEP = 0x00,        /* overlay byte stays */
+    LAYER_HALF = 0x80,        /* average of overlay byte and value */
+    LAYER_SET = 0xFF,         /* value replaces overlay byte */
+};
 
-    return 1;
-}
+enum {
+    LAYER_GRID = 0,
+    LAYER_PLANES,
+    LAYER_MB,
+    LAYER_HEAT,
+    LAYERS,                   /* merge order, later ones on top */
+};
+
+struct Layer {
+    Uint8 *val;               /* all overlay planes back to back */
+    Uint8 *op;                /* LAYER_KEEP, LAYER_HALF or LAYER_SET */
+    Uint32 lo;                /* ops other than LAYER_KEEP in lo..hi-1 */
+    Uint32 hi;
+    Uint64 key;               /* what was rendered, 0 for nothing */
+};
+
+struct layers {
+    Layer layer[LAYERS];
+    Layer comp;               /* merged layers */
+    Uint64 comp_key[LAYERS];  /* layer keys merged into comp */
+    Uint32 size;              /* bytes of all overlay planes, 0 until known */
+    Uint32 off[3];            /* plane offsets in val and op */
+    Uint32 psize[3];
+    Uint32 pitch[3];
+    Uint32 mb;                /* selected MB + 1, 0 for none */
+};
+
+struct layers gLayers;
 
-void destroy_message_queue(void)
+/* Dirty blocks
+ * The overlay keeps what it showed last. Drawers hand every plane to
+ * dirty_plane(), which compares it with the copy the overlay was drawn
+ * from, a row of blocks at a time, and marks the blocks that
+ * changed. dirty_flush() copies and blends only those, plus the ones a
+ * changed layer or the timeline bar covers, and draw_frame() does not
+ * display a frame again when no block changed. Blocks are MBs, 8x8 in
+ * the chroma of 4:2:0, one map for all planes.
+ */
+#define DIRTY_MB 16                  /* block - in luma pels and rows */
+#define DIRTY_LAYER 8                /* map bit, a layer changed over it */
+
+struct dirty {
+    Uint8 *shadow;            /* planes the overlay was drawn from */
+    Uint8 *map;               /* per block, 1 << plane that changed */
+    Uint32 cols;              /* blocks per row */
+    Uint32 mbrows;            /* rows of blocks */
+    Uint32 planes;
+    Uint32 off[3];            /* plane offsets in shadow */
+    Uint32 row[3];            /* bytes per plane row */
+    Uint32 rows[3];
+    Uint32 bw[3];             /* block of plane - in bytes */
+    Uint32 bh[3];             /* block of plane - in rows */
+    bool valid;               /* overlay is shadow with the composite */
+    bool bar;                 /* timeline bar drawn at the last flush */
+    Uint32 n;                 /* blocks the last flush redrew */
+    SDL_Overlay *shown;       /* on screen, see display_overlay() */
+    SDL_Rect rect;
+    Uint64 frames;            /* draws */
+    Uint64 blocks;            /* blocks redrawn by them */
+    Uint64 skipped;           /* draws not displayed */
+};
+
+struct dirty gDirty;
+
+/* one overlay byte of plane p */
+void layer_put(Layer *l, Uint32 p, Uint32 off, Uint8 v, Uint8 op)
 {
-    if (P.mode == MASTER) {
-        if (msgctl(P.msqid, IPC_RMID, NULL) == -1) {
-            perror("msgctl");
-        }
-        printf("queue destroyed\n");
+    if (off >= gLayers.psize[p]) {
+        return;
+    }
+    off += gLayers.off[p];
+    l->val[off] = v;
+    l->op[off] = op;
+    if (off < l->lo) {
+        l->lo = off;
+    }
+    if (off >= l->hi) {
+        l->hi = off + 1;
     }
 }
 
-Uint32 event_dispatcher(void)
+/* n overlay bytes of plane p from off on, set to v */
+void layer_fill(Layer *l, Uint32 p, Uint32 off, Uint32 n, Uint8 v)
 {
-    if (read_message()) {
+    if (off >= gLayers.psize[p]) {
+        return;
+    }
+    if (n > gLayers.psize[p] - off) {
+        n = gLayers.psize[p] - off;
+    }
+    off += gLayers.off[p];
+    memset(l->val + off, v, n);
+    memset(l->op + off, LAYER_SET, n);
+    if (off < l->lo) {
+        l->lo = off;
+    }
+    if (off + n > l->hi) {
+        l->hi = off + n;
+    }
+}
 
-        switch (P.buf.mtext[0]) {
-            case NEXT:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_RIGHT;
-                SDL_PushEvent(&event);
-                break;
+void draw_grid422_param(Layer *l, int step, int dot, int color0, int color1) {
+    Uint32 pitch = gLayers.pitch[0];
 
-            case PREV:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_LEFT;
-                SDL_PushEvent(&event);
-                break;
+    /* horizontal grid lines */
+    for (Uint32 y = 0; y < P.height; y += step) {
+        for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += dot * 2) {
+            layer_put(l, 0, y * pitch + x, color0, LAYER_SET);
+            layer_put(l, 0, y * pitch + x + 8, color1, LAYER_SET);
+        }
+    }
+    /* vertical grid lines */
+    for (Uint32 x = P.grid_start_pos; x < P.width * 2; x += 2 * step) {
+        for (Uint32 y = 0; y < P.height; y += dot) {
+            layer_put(l, 0, y * pitch + x, color0, LAYER_SET);
+            layer_put(l, 0, (y + 4) * pitch + x, color1, LAYER_SET);
+        }
+    }
+}
 
-            case REW:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_r;
-                SDL_PushEvent(&event);
-                break;
+void draw_grid420_param(Layer *l, int step, int dot, int color0, int color1) {
+    Uint32 pitch = gLayers.pitch[0];
 
-            case ZOOM_IN:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_UP;
-                SDL_PushEvent(&event);
-                break;
+    /* horizontal grid lines */
+    for (Uint32 y = 0; y < P.height; y += step) {
+        for (Uint32 x = 0; x < P.width; x += dot) {
+            layer_put(l, 0, y * pitch + x, color0, LAYER_SET);
+            layer_put(l, 0, y * pitch + x + 4, color1, LAYER_SET);
+        }
+    }
+    /* vertical grid lines */
+    for (Uint32 x = 0; x < P.width; x += step) {
+        for (Uint32 y = 0; y < P.height; y += dot) {
+            layer_put(l, 0, y * pitch + x, color0, LAYER_SET);
+            layer_put(l, 0, (y + 4) * pitch + x, color1, LAYER_SET);
+        }
+    }
 
-            case ZOOM_OUT:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_DOWN;
-                SDL_PushEvent(&event);
-                break;
+}
 
-            case QUIT:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_q;
-                SDL_PushEvent(&event);
-                break;
+void draw_grid422(Layer *l)
+{
+    draw_grid422_param(l, 16, 8, 0xF0, 0x20);
+    draw_grid422_param(l, 64, 1, 0x90, 0x20);
+    draw_grid422_param(l, 256, 1, 0xE0, 0x20);
+    draw_grid422_param(l, 1024, 1, 0x00, 0x20);
+}
 
-            case Y_ONLY:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F5;
-                SDL_PushEvent(&event);
-                break;
+void draw_grid420(Layer *l)
+{
+    draw_grid420_param(l, 16, 8, 0xF0, 0x20);
+    draw_grid420_param(l, 64, 1, 0x90, 0x20);
+    draw_grid420_param(l, 256, 1, 0xE0, 0x20);
+    draw_grid420_param(l, 1024, 1, 0x00, 0x20);
+}
 
-            case CB_ONLY:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F6;
-                SDL_PushEvent(&event);
-                break;
+Uint32  bitdepth(Uint32 fmt) {
+    if (fmt == NV1210 || fmt == YV1210
+        || fmt == NV1210TILED || fmt == Y42210) {
+        return 10;
+    } else {
+        return 8;
+    }
+}
 
-            case CR_ONLY:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F7;
-                SDL_PushEvent(&event);
-                break;
+bool isPlanar(Uint32 fmt) {
+    return fmt == YV12 || fmt == IYUV || fmt == YV1210
+        || fmt == NV12 || fmt == NV21 || fmt == MONO
+        || fmt == YV16 || fmt == YUV444P || fmt == NV1210
+        || (fmt < FORMAT_MAX && gTileMap[fmt].tw);
+}
 
-            case ALL_PLANES:
-                event.type = SDL_KEYDOWN;
-                event.key.keysym.sym = SDLK_F8;
-                SDL_PushEvent(&event);
-                break;
+void luma_only(Layer *l)
+{
+    if (!P.y_only) {
+        return;
+    }
 
-            default:
-                DIE("~TILT\n");
-                return 0;
+    if (isPlanar(FORMAT)) {
+        /* Set croma part to 0x80 */
+        layer_fill(l, 1, 0, P.cr_size, 0x80);
+        layer_fill(l, 2, 0, P.cb_size, 0x80);
+        return;
+    }
+
+    /* YUY2, UYVY, YVYU */
+    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
+        layer_put(l, 0, i, 0x80, LAYER_SET);
+    }
+    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
+        layer_put(l, 0, i, 0x80, LAYER_SET);
+    }
+}
+
+void cb_only(Layer *l)
+{
+    if (!P.cb_only || FORMAT == MONO) {
+        return;
+    }
+
+    if (isPlanar(FORMAT)) {
+        /* Set Luma part and Cr to 0x80 */
+        layer_fill(l, 0, 0, P.y_size, 0x80);
+        layer_fill(l, 1, 0, P.cr_size, 0x80);
+        return;
+    }
+
+    /* YUY2, UYVY, YVYU */
+    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
+        layer_put(l, 0, i, 0x80, LAYER_SET);
+    }
+    for (Uint32 i = P.cr_start_pos; i < P.frame_size; i += 4) {
+        layer_put(l, 0, i, 0x80, LAYER_SET);
+    }
+}
+
+void cr_only(Layer *l)
+{
+    if (!P.cr_only || FORMAT == MONO) {
+        return;
+    }
+
+    if (isPlanar(FORMAT)) {
+        /* Set Luma part and Cb to 0x80 */
+        layer_fill(l, 0, 0, P.y_size, 0x80);
+        layer_fill(l, 2, 0, P.cb_size, 0x80);
+        return;
+    }
+
+    /* YUY2, UYVY, YVYU */
+    for (Uint32 i = P.y_start_pos; i < P.frame_size; i += 2) {
+        layer_put(l, 0, i, 0x80, LAYER_SET);
+    }
+    for (Uint32 i = P.cb_start_pos; i < P.frame_size; i += 4) {
+        layer_put(l, 0, i, 0x80, LAYER_SET);
+    }
+}
+
+/* outline of the MB picked with the mouse */
+void mb_box(Layer *l)
+{
+    Uint32 mb = gLayers.mb - 1;
+    Uint32 x0 = mb % (P.width / 16) * 16, y0 = mb / (P.width / 16) * 16;
+    Uint32 pitch = gLayers.pitch[0];
+    Uint32 step = 1, y_pos = 0;
+
+    if (!isPlanar(FORMAT)) {
+        /* packed, luma every other byte */
+        step = 2;
+        y_pos = my_overlay->format == SDL_UYVY_OVERLAY ? 1 : 0;
+    }
+    for (Uint32 i = 0; i < 16; i++) {
+        Uint32 x = (x0 + i) * step + y_pos;
+        Uint32 y = y0 + i;
+        layer_put(l, 0, y0 * pitch + x, 0xEB, LAYER_SET);
+        layer_put(l, 0, (y0 + 15) * pitch + x, 0xEB, LAYER_SET);
+        layer_put(l, 0, y * pitch + x0 * step + y_pos, 0xEB, LAYER_SET);
+        layer_put(l, 0, y * pitch + (x0 + 15) * step + y_pos, 0xEB, LAYER_SET);
+    }
+}
+
+/* dst = val where op is LAYER_SET, (dst + val) / 2 where LAYER_HALF */
+void blend_u8_c(Uint8 *dst, const Uint8 *val, const Uint8 *op, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        if (op[i] == LAYER_SET) {
+            dst[i] = val[i];
+        } else if (op[i] == LAYER_HALF) {
+            dst[i] = (dst[i] + val[i]) / 2;
         }
     }
-    return 1;
 }
 
-void set_caption(char *array, Uint32 frame, Uint32 bytes)
+#ifdef __SSE2__
+void blend_u8_sse2(Uint8 *dst, const Uint8 *val, const Uint8 *op, Uint32 n)
 {
-    snprintf(array, bytes, "%s - %s%s%s%s%s%s%s%s frame %d, size %dx%d",
-             P.filename,
-             (P.mode == MASTER) ? "[MASTER]" :
-             (P.mode == SLAVE) ? "[SLAVE]" : "",
-             P.grid ? "G" : "",
-             P.mb ? "M" : "",
-             P.diff ? "D" : "",
-             P.hist ? "H" : "",
-             P.y_only ? "Y" : "",
-             P.cb_only ? "Cb" : "",
-             P.cr_only ? "Cr" : "",
-             frame,
-             P.zoom_width,
-             P.zoom_height);
+    Uint32 i = 0;
+    __m128i one = _mm_set1_epi8(1);
+    __m128i set = _mm_set1_epi8((char)LAYER_SET);
+    __m128i half = _mm_set1_epi8((char)LAYER_HALF);
+    for (; i + 16 <= n; i += 16) {
+        __m128i o = _mm_loadu_si128((const __m128i *)(op + i));
+        __m128i d, v, s, h, avg;
+        if (!_mm_movemask_epi8(o)) {
+            /* all LAYER_KEEP */
+            continue;
+        }
+        d = _mm_loadu_si128((const __m128i *)(dst + i));
+        v = _mm_loadu_si128((const __m128i *)(val + i));
+        s = _mm_cmpeq_epi8(o, set);
+        h = _mm_cmpeq_epi8(o, half);
+        /* pavgb rounds up, take the carry back off */
+        avg = _mm_sub_epi8(_mm_avg_epu8(d, v),
+                           _mm_and_si128(_mm_xor_si128(d, v), one));
+        d = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(s, h), d),
+                         _mm_or_si128(_mm_and_si128(s, v),
+                                      _mm_and_si128(h, avg)));
+        _mm_storeu_si128((__m128i *)(dst + i), d);
+    }
+    blend_u8_c(dst + i, val + i, op + i, n - i);
 }
+#endif
 
-void set_zoom_rect(void)
+/* one layer on top of the composite cval, cop
+ * LAYER_HALF over LAYER_SET becomes LAYER_SET of the average, over
+ * LAYER_HALF the top one wins.
+ */
+void merge_u8_c(Uint8 *cval, Uint8 *cop, const Uint8 *val, const Uint8 *op,
+                Uint32 n)
 {
-    if (P.zoom > 0) {
-        P.zoom_width = P.width * P.zoom;
-        P.zoom_height = P.height * P.zoom;
-    } else if (P.zoom <= 0) {
-        P.zoom_width = P.width / (abs(P.zoom) + 2);
-        P.zoom_height = P.height / (abs(P.zoom) + 2);
-    } else {
-        DIE("ERROR in zoom:\n");
+    for (Uint32 i = 0; i < n; i++) {
+        if (op[i] == LAYER_SET) {
+            cval[i] = val[i];
+            cop[i] = LAYER_SET;
+        } else if (op[i] == LAYER_HALF && cop[i] == LAYER_SET) {
+            cval[i] = (cval[i] + val[i]) / 2;
+        } else if (op[i] == LAYER_HALF) {
+            cval[i] = val[i];
+            cop[i] = LAYER_HALF;
+        }
     }
-    // printf("zoom to %dx%d\n", P.zoom_width, P.zoom_height);
 }
 
-Uint32 redraw(void)
+#ifdef __SSE2__
+void merge_u8_sse2(Uint8 *cval, Uint8 *cop, const Uint8 *val,
+                   const Uint8 *op, Uint32 n)
 {
-    fseek(fd, 0, SEEK_SET);
-    if (P.diff) {
-        fseek(P.fd2, 0, SEEK_SET);
+    Uint32 i = 0;
+    __m128i one = _mm_set1_epi8(1);
+    __m128i set = _mm_set1_epi8((char)LAYER_SET);
+    __m128i half = _mm_set1_epi8((char)LAYER_HALF);
+    for (; i + 16 <= n; i += 16) {
+        __m128i o = _mm_loadu_si128((const __m128i *)(op + i));
+        __m128i v, cv, co, s, h, hs, hn, avg;
+        if (!_mm_movemask_epi8(o)) {
+            continue;
+        }
+        v = _mm_loadu_si128((const __m128i *)(val + i));
+        cv = _mm_loadu_si128((const __m128i *)(cval + i));
+        co = _mm_loadu_si128((const __m128i *)(cop + i));
+        s = _mm_cmpeq_epi8(o, set);
+        h = _mm_cmpeq_epi8(o, half);
+        hs = _mm_and_si128(h, _mm_cmpeq_epi8(co, set));
+        hn = _mm_andnot_si128(hs, h);
+        avg = _mm_sub_epi8(_mm_avg_epu8(cv, v),
+                           _mm_and_si128(_mm_xor_si128(cv, v), one));
+        cv = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(s, h), cv),
+                          _mm_or_si128(_mm_and_si128(_mm_or_si128(s, hn), v),
+                                       _mm_and_si128(hs, avg)));
+        co = _mm_or_si128(_mm_andnot_si128(_mm_or_si128(s, hn), co),
+                          _mm_or_si128(s, _mm_and_si128(hn, half)));
+        _mm_storeu_si128((__m128i *)(cval + i), cv);
+        _mm_storeu_si128((__m128i *)(cop + i), co);
+    }
+    merge_u8_c(cval + i, cop + i, val + i, op + i, n - i);
+}
+#endif
+
+void layer_clear(Layer *l)
+{
+    if (l->op && l->lo < l->hi) {
+        memset(l->op + l->lo, LAYER_KEEP, l->hi - l->lo);
+    }
+    l->lo = gLayers.size;
+    l->hi = 0;
+    l->key = 0;
+}
+
+void layers_free(void)
+{
+    for (Uint32 i = 0; i <= LAYERS; i++) {
+        Layer *l = i < LAYERS ? &gLayers.layer[i] : &gLayers.comp;
+        free(l->val);
+        free(l->op);
+    }
+    /* the picked MB stays */
+    Uint32 mb = gLayers.mb;
+    memset(&gLayers, 0, sizeof(gLayers));
+    gLayers.mb = mb;
+}
+
+/* buffers for the geometry of my_overlay */
+Uint32 layers_alloc(void)
+{
+    SDL_Overlay *o = my_overlay;
+
+    layers_free();
+    for (Uint32 p = 0; p < (Uint32)o->planes; p++) {
+        Uint32 rows = p ? o->h / 2 : o->h;
+        gLayers.pitch[p] = o->pitches[p];
+        gLayers.psize[p] = o->pitches[p] * rows;
+        gLayers.off[p] = gLayers.size;
+        gLayers.size += gLayers.psize[p];
+    }
+    for (Uint32 i = 0; i <= LAYERS; i++) {
+        Layer *l = i < LAYERS ? &gLayers.layer[i] : &gLayers.comp;
+        l->val = malloc(gLayers.size);
+        l->op = calloc(gLayers.size, 1);
+        if (!l->val || !l->op) {
+            DIE("Error allocating memory...\n");
+            layers_free();
+            return 0;
+        }
+        l->lo = gLayers.size;
+        l->hi = 0;
     }
-    read_frame();
-    draw_frame();
-    send_message(REW);
     return 1;
 }
 
-Uint32 reinit(void)
+/* render layer i for key, nothing for key 0 */
+void layer_render(Uint32 i, Uint64 key)
 {
-    /* Initialize parameters corresponding to YUV-format */
-    setup_param();
-    if (!sdl_init()) {
-        return 0;
+    Layer *l = &gLayers.layer[i];
+
+    layer_clear(l);
+    l->key = key;
+    if (!key) {
+        return;
     }
-    if (!allocate_memory()) {
+    switch (i) {
+        case LAYER_GRID:
+            if (isPlanar(FORMAT)) {
+                draw_grid420(l);
+            } else {
+                draw_grid422(l);
+            }
+            break;
+        case LAYER_PLANES:
+            luma_only(l);
+            cb_only(l);
+            cr_only(l);
+            break;
+        case LAYER_MB:
+            mb_box(l);
+            break;
+        case LAYER_HEAT:
+            heat_draw(l);
+            break;
+    }
+}
+
+/* bring the layers up to date, dirty_flush() blends them onto my_overlay */
+void layers_draw(void)
+{
+    Uint64 key[LAYERS];
+    Layer *c = &gLayers.comp;
+    bool dirty = false;
+
+    if (!gLayers.size && !layers_alloc()) {
+        return;
+    }
+    key[LAYER_GRID] = P.grid ? 1 : 0;
+    key[LAYER_PLANES] = (P.y_only ? 1 : 0) | (P.cb_only ? 2 : 0)
+                        | (P.cr_only ? 4 : 0);
+    key[LAYER_MB] = P.mb ? gLayers.mb : 0;
+    key[LAYER_HEAT] = heat_key();
+    for (Uint32 i = 0; i < LAYERS; i++) {
+        if (key[i] != gLayers.layer[i].key) {
+            layer_render(i, key[i]);
+        }
+        dirty |= key[i] != gLayers.comp_key[i];
+    }
+
+    if (dirty) {
+        /* blocks under the old and the new composite are redrawn */
+        dirty_layers(c->lo, c->hi);
+        layer_clear(c);
+        for (Uint32 i = 0; i < LAYERS; i++) {
+            Layer *l = &gLayers.layer[i];
+            gLayers.comp_key[i] = key[i];
+            if (l->lo >= l->hi) {
+                continue;
+            }
+            gKern.merge_u8(c->val + l->lo, c->op + l->lo, l->val + l->lo,
+                           l->op + l->lo, l->hi - l->lo);
+            c->lo = l->lo < c->lo ? l->lo : c->lo;
+            c->hi = l->hi > c->hi ? l->hi : c->hi;
+        }
+        dirty_layers(c->lo, c->hi);
+    }
+}
+
+/* shadow and map for the geometry of my_overlay */
+Uint32 dirty_alloc(void)
+{
+    SDL_Overlay *o = my_overlay;
+    Uint32 size = 0;
+
+    dirty_free();
+    gDirty.planes = o->planes;
+    gDirty.cols = (o->w + DIRTY_MB - 1) / DIRTY_MB;
+    gDirty.mbrows = (o->h + DIRTY_MB - 1) / DIRTY_MB;
+    for (Uint32 p = 0; p < gDirty.planes; p++) {
+        /* packed 4:2:2 is one plane of two bytes per pel */
+        Uint32 sub = p ? 2 : 1, bpp = gDirty.planes == 1 ? 2 : 1;
+        gDirty.row[p] = o->w / sub * bpp;
+        gDirty.rows[p] = o->h / sub;
+        gDirty.bw[p] = DIRTY_MB / sub * bpp;
+        gDirty.bh[p] = DIRTY_MB / sub;
+        gDirty.off[p] = size;
+        size += gDirty.row[p] * gDirty.rows[p];
+    }
+    gDirty.shadow = mem_alloc(size, MEM_FRAME);
+    gDirty.map = calloc(gDirty.cols * gDirty.mbrows, 1);
+    if (!gDirty.shadow || !gDirty.map) {
+        DIE("Error allocating memory...\n");
+        dirty_free();
         return 0;
     }
     return 1;
 }
 
-/* loop inspired by yay
- * http://freecode.com/projects/yay
- */
-Uint32 event_loop(void)
+void dirty_free(void)
 {
-    char caption[256];
-    Uint16 quit = 0;
-    Uint32 frame = 0;
-    int play_yuv = 0;
-    unsigned int start_ticks = 0;
+    mem_free(gDirty.shadow);
+    free(gDirty.map);
+    gDirty.shadow = NULL;
+    gDirty.map = NULL;
+    gDirty.valid = false;
+}
 
-    while (!quit) {
+/* marks the blocks of m where the n bytes of a and b differ */
+void dirty_row_c(const Uint8 *a, const Uint8 *b, Uint32 n, Uint32 bw,
+                 Uint8 *m, Uint8 bit)
+{
+    for (Uint32 x = 0; x < n; x++) {
+        if (a[x] != b[x]) {
+            m[x / bw] |= bit;
+        }
+    }
+}
 
-        set_caption(caption, frame, 256);
-        SDL_WM_SetCaption(caption, NULL);
+#ifdef __SSE2__
+void dirty_row_sse2(const Uint8 *a, const Uint8 *b, Uint32 n, Uint32 bw,
+                    Uint8 *m, Uint8 bit)
+{
+    Uint32 x = 0;
+    /* blocks are 8, 16 or 32 bytes wide */
+    for (; x + 16 <= n; x += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + x));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + x));
+        Uint32 diff = _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xFFFF;
+        if (!diff) {
+            continue;
+        }
+        if (bw >= 16) {
+            m[x / bw] |= bit;
+            continue;
+        }
+        if (diff & 0x00FF) {
+            m[x / bw] |= bit;
+        }
+        if (diff & 0xFF00) {
+            m[x / bw + 1] |= bit;
+        }
+    }
+    /* x may be inside a 32 byte block, the tail keeps counting from it */
+    for (; x < n; x++) {
+        if (a[x] != b[x]) {
+            m[x / bw] |= bit;
+        }
+    }
+}
+#endif
 
-        /* wait for SDL event */
-        if (P.mode == NONE || P.mode == MASTER) {
-            SDL_WaitEvent(&event);
-        } else if (P.mode == SLAVE) {
-            if (!event_dispatcher()) {
-                SDL_WaitEvent(&event);
+/* plane p of the frame to draw, changed blocks marked and kept */
+void dirty_plane(Uint32 p, const Uint8 *src)
+{
+    Uint32 row, rows, bw, bh;
+    Uint8 *shadow;
+
+    if (!gDirty.shadow && !dirty_alloc()) {
+        /* no shadow, straight into the overlay */
+        SDL_Overlay *o = my_overlay;
+        Uint32 sub = p ? 2 : 1, bpp = o->planes == 1 ? 2 : 1;
+        for (Uint32 y = 0; y < (Uint32)o->h / sub; y++) {
+            memcpy(o->pixels[p] + y * o->pitches[p],
+                   src + y * (o->w / sub * bpp), o->w / sub * bpp);
+        }
+        return;
+    }
+    row = gDirty.row[p];
+    rows = gDirty.rows[p];
+    bw = gDirty.bw[p];
+    bh = gDirty.bh[p];
+    shadow = gDirty.shadow + gDirty.off[p];
+    if (!gDirty.valid) {
+        /* dirty_flush() redraws everything */
+        memcpy(shadow, src, (size_t)row * rows);
+        return;
+    }
+    for (Uint32 by = 0; by < gDirty.mbrows; by++) {
+        Uint8 *m = gDirty.map + by * gDirty.cols;
+        Uint32 y0 = by * bh, y1 = MIN(y0 + bh, rows);
+        for (Uint32 y = y0; y < y1; y++) {
+            gKern.dirty_row(src + (size_t)y * row, shadow + (size_t)y * row,
+                            row, bw, m, 1 << p);
+        }
+        for (Uint32 b = 0; b < gDirty.cols;) {
+            Uint32 e = b, x0, x1;
+            if (!(m[b] & 1 << p)) {
+                b++;
+                continue;
+            }
+            while (e < gDirty.cols && (m[e] & 1 << p)) {
+                e++;
             }
+            x0 = b * bw;
+            x1 = MIN(e * bw, row);
+            for (Uint32 y = y0; y < y1; y++) {
+                memcpy(shadow + (size_t)y * row + x0,
+                       src + (size_t)y * row + x0, x1 - x0);
+            }
+            b = e;
         }
+    }
+}
 
-        switch (event.type) {
-            case SDL_KEYDOWN:
-                switch (event.key.keysym.sym) {
-                    case SDLK_SPACE:
-                        play_yuv = 1; /* play it, sam! */
-                        while (play_yuv) {
-                            start_ticks = SDL_GetTicks();
-                            set_caption(caption, frame, 256);
-                            SDL_WM_SetCaption(caption, NULL);
+/* blocks under bytes lo..hi-1 of the layers */
+void dirty_layers(Uint32 lo, Uint32 hi)
+{
+    if (!gDirty.shadow || !gLayers.size) {
+        return;
+    }
+    for (Uint32 p = 0; p < gDirty.planes; p++) {
+        Uint32 a = MAX(lo, gLayers.off[p]);
+        Uint32 b = MIN(hi, gLayers.off[p] + gLayers.psize[p]);
+        Uint32 r0, r1;
+        if (a >= b) {
+            continue;
+        }
+        r0 = (a - gLayers.off[p]) / gLayers.pitch[p] / gDirty.bh[p];
+        r1 = (b - 1 - gLayers.off[p]) / gLayers.pitch[p] / gDirty.bh[p];
+        r1 = MIN(r1, gDirty.mbrows - 1);
+        for (Uint32 by = r0; by <= r1; by++) {
+            Uint8 *m = gDirty.map + by * gDirty.cols;
+            for (Uint32 x = 0; x < gDirty.cols; x++) {
+                m[x] |= DIRTY_LAYER;
+            }
+        }
+    }
+}
 
-                            /* check for next frame existing */
-                            if (read_frame()) {
-                                draw_frame();
-                                /* insert delay for real time viewing */
-                                if (SDL_GetTicks() - start_ticks < 40) {
-                                    SDL_Delay(40 - (SDL_GetTicks() - start_ticks));
-                                }
-                                frame++;
-                                send_message(NEXT);
-                            } else {
-                                play_yuv = 0;
-                            }
-                            /* check for any key event */
-                            if (SDL_PollEvent(&event)) {
-                                if (event.type == SDL_KEYDOWN) {
-                                    /* stop playing */
-                                    play_yuv = 0;
-                                }
-                            }
-                        }
-                        break;
-                    case SDLK_RIGHT: /* next frame */
-                        /* check for next frame existing */
-                        if (read_frame()) {
-                            draw_frame();
-                            frame++;
-                            send_message(NEXT);
-                        }
-                        break;
-                    case SDLK_LEFT: /* previous frame */
-                        if (frame > 1) {
-                            frame--;
-                            fseek(fd, ((frame - 1) * P.raw_frame_size), SEEK_SET);
-                            if (P.diff) {
-                                fseek(P.fd2, ((frame - 1) * P.raw_frame_size), SEEK_SET);
-                            }
-                            read_frame();
-                            draw_frame();
-                            send_message(PREV);
-                        }
-                        break;
-                    case SDLK_UP: /* zoom in */
-                        P.zoom++;
-                        set_zoom_rect();
-                        screen = SDL_SetVideoMode(P.zoom_width,
-                                                  P.zoom_height,
-                                                  P.bpp, P.vflags);
-                        video_rect.w = P.zoom_width;
-                        video_rect.h = P.zoom_height;
-                        SDL_DisplayYUVOverlay(my_overlay, &video_rect);
-                        send_message(ZOOM_IN);
-                        break;
-                    case SDLK_DOWN: /* zoom out */
-                        P.zoom--;
-                        set_zoom_rect();
-                        screen = SDL_SetVideoMode(P.zoom_width,
-                                                  P.zoom_height,
-                                                  P.bpp, P.vflags);
-                        video_rect.w = P.zoom_width;
-                        video_rect.h = P.zoom_height;
-                        SDL_DisplayYUVOverlay(my_overlay, &video_rect);
-                        send_message(ZOOM_OUT);
-                        break;
-                    case SDLK_r: /* rewind */
-                        if (frame > 1) {
-                            frame = 1;
-                            redraw();
-                        }
-                        break;
-                    case SDLK_l:
-                        P.width += 16;
-                        frame = 1; reinit(); redraw(); break;
-                    case SDLK_h:
-                        P.width -= 16;
-                        frame = 1; reinit(); redraw(); break;
-                    case SDLK_j:
-                        P.height += 16;
-                        frame = 1; reinit(); redraw(); break;
-                    case SDLK_k:
-                        P.height -= 16;
-                        frame = 1; reinit(); redraw(); break;
-                    case SDLK_g: /* display grid */
-                        P.grid = ~P.grid;
-                        if (P.zoom < 1) {
-                            P.grid = 0;
-                        }
-                        draw_frame();
-                        break;
-                    case SDLK_x:
-                        P.flip_change_uv = true;
-                        draw_frame();
-                        break;
-                    case SDLK_m: /* show mb-data on stdout */
-                        P.mb = ~P.mb;
-                        if (P.zoom < 1) {
-                            P.mb = 0;
-                        }
-                        draw_frame();
-                        break;
-                    case SDLK_F5: /* Luma data only */
-                    case SDLK_y:
-                        P.y_only = ~P.y_only;
-                        P.cb_only = 0;
-                        P.cr_only = 0;
-                        draw_frame();
-                        send_message(Y_ONLY);
-                        break;
-                    case SDLK_F6: /* Cb data only */
-                    case SDLK_u:
-                        P.cb_only = ~P.cb_only;
-                        P.y_only = 0;
-                        P.cr_only = 0;
-                        draw_frame();
-                        send_message(CB_ONLY);
-                        break;
-                    case SDLK_F7: /* Cr data only */
-                    case SDLK_v:
-                        P.cr_only = ~P.cr_only;
-                        P.y_only = 0;
-                        P.cb_only = 0;
-                        send_message(CR_ONLY);
-                        draw_frame();
-                        break;
-                    case SDLK_F8: /* display all color planes */
-                    case SDLK_a:
-                        P.y_only = 0;
-                        P.cb_only = 0;
-                        P.cr_only = 0;
-                        draw_frame();
-                        send_message(ALL_PLANES);
-                        break;
-                    case SDLK_s: /* histogram */
-                        P.hist = ~P.hist;
-                        draw_frame();
-                        break;
-                    case SDLK_F1: /* MASTER-mode */
-                        if (create_message_queue()) {
-                            P.mode = MASTER;
-                        }
-                        break;
-                    case SDLK_F2: /* SLAVE-mode */
-                        if (P.mode == MASTER) {
-                            destroy_message_queue();
-                        }
-                        if (connect_message_queue()) {
-                            P.mode = SLAVE;
-                        }
-                        break;
-                    case SDLK_F3: /* NONE-mode */
-                        destroy_message_queue();
-                        P.mode = NONE;
-                        break;
-                    case SDLK_q: /* quit */
-                        quit = 1;
-                        send_message(QUIT);
-                        break;
-                    default:
-                        break;
-                } /* switch key */
-                break;
-            case SDL_QUIT:
-                quit = 1;
-                break;
-            case SDL_VIDEOEXPOSE:
-                SDL_DisplayYUVOverlay(my_overlay, &video_rect);
-                break;
-            case SDL_MOUSEBUTTONDOWN:
-                /* If the left mouse button was pressed */
-                if (event.button.button == SDL_BUTTON_LEFT ) {
-                    show_mb(event.button.x, event.button.y);
+/* n bytes at x, y of plane p from the shadow, composite blended on */
+void dirty_copy(Uint32 p, Uint32 x, Uint32 y, Uint32 n)
+{
+    Layer *c = &gLayers.comp;
+    Uint8 *dst = my_overlay->pixels[p] + y * my_overlay->pitches[p] + x;
+    Uint32 lo = gLayers.off[p] + y * gLayers.pitch[p] + x;
+    Uint32 a = MAX(lo, c->lo), b = MIN(lo + n, c->hi);
+
+    memcpy(dst, gDirty.shadow + gDirty.off[p] + y * gDirty.row[p] + x, n);
+    if (gLayers.size && a < b) {
+        gKern.blend_u8(dst + a - lo, c->val + a, c->op + a, b - a);
+    }
+}
+
+/* the marked blocks onto the locked overlay */
+void dirty_flush(void)
+{
+    SDL_Overlay *o = my_overlay;
+    Uint32 n = 0;
+
+    gDirty.frames++;
+    if (!gDirty.shadow) {
+        /* dirty_plane() copied the frame, blend everything */
+        Layer *c = &gLayers.comp;
+        for (Uint32 p = 0; gLayers.size && p < (Uint32)o->planes; p++) {
+            Uint32 lo = MAX(c->lo, gLayers.off[p]);
+            Uint32 hi = MIN(c->hi, gLayers.off[p] + gLayers.psize[p]);
+            if (lo < hi) {
+                gKern.blend_u8(o->pixels[p] + lo - gLayers.off[p],
+                               c->val + lo, c->op + lo, hi - lo);
+            }
+        }
+        gDirty.n = gDirty.cols * gDirty.mbrows + 1;
+        return;
+    }
+    if (!gDirty.valid) {
+        memset(gDirty.map, DIRTY_LAYER, gDirty.cols * gDirty.mbrows);
+    }
+    if (gLine.on || gDirty.bar) {
+        /* line_bar() draws over the last rows, or did */
+        Uint32 h = MIN((Uint32)o->h, LINE_BAR);
+        memset(gDirty.map + (o->h - h) / DIRTY_MB * gDirty.cols, DIRTY_LAYER,
+               (gDirty.mbrows - (o->h - h) / DIRTY_MB) * gDirty.cols);
+    }
+    gDirty.bar = gLine.on;
+    for (Uint32 by = 0; by < gDirty.mbrows; by++) {
+        Uint8 *m = gDirty.map + by * gDirty.cols;
+        for (Uint32 b = 0; b < gDirty.cols;) {
+            Uint32 e = b;
+            if (!m[b]) {
+                b++;
+                continue;
+            }
+            while (e < gDirty.cols && m[e]) {
+                m[e++] = 0;
+            }
+            n += e - b;
+            for (Uint32 p = 0; p < gDirty.planes; p++) {
+                Uint32 x0 = b * gDirty.bw[p];
+                Uint32 x1 = MIN(e * gDirty.bw[p], gDirty.row[p]);
+                Uint32 y0 = by * gDirty.bh[p];
+                Uint32 y1 = MIN(y0 + gDirty.bh[p], gDirty.rows[p]);
+                for (Uint32 y = y0; y < y1; y++) {
+                    dirty_copy(p, x0, y, x1 - x0);
                 }
-                break;
+            }
+            b = e;
+        }
+    }
+    gDirty.valid = true;
+    gDirty.n = n;
+    gDirty.blocks += n;
+}
 
-            default:
-                break;
+/* overlay no longer what the shadow says, redraw all of it */
+void dirty_reset(void)
+{
+    gDirty.valid = false;
+}
 
-        } /* switch event type */
+/* SDL_DisplayYUVOverlay() at video_rect, draw_frame() skips unchanged */
+void display_overlay(SDL_Overlay *o)
+{
+    gDirty.shown = o;
+    gDirty.rect = video_rect;
+    SDL_DisplayYUVOverlay(o, &video_rect);
+}
 
-    } /* while */
+/* my_overlay on screen already shows the frame just drawn */
+bool dirty_same(void)
+{
+    return gDirty.valid && !gDirty.n && gDirty.shown == my_overlay
+           && !memcmp(&gDirty.rect, &video_rect, sizeof(video_rect));
+}
 
-    return quit;
+void dirty_stats(void)
+{
+    Uint64 all = gDirty.frames * gDirty.cols * gDirty.mbrows;
+
+    printf("draw: %llu frames, %.1f%% of blocks redrawn, %llu not"
+           " displayed again\n", (unsigned long long)gDirty.frames,
+           all ? gDirty.blocks * 100.0 / all : 0.0,
+           (unsigned long long)gDirty.skipped);
 }
 
-int strfmtcmp(const void *p0, const void *p1) {
-    char *s0 = ((StrFmt *)p0)->str;
-    char *s1 = ((StrFmt *)p1)->str;
-    int l0 = strlen(s0);
-    int l1 = strlen(s1);
-    if (l0 != l1) {
-        return l0 - l1;
+#define SWAP(a, b, T)      { T t = a; a = b; b = t; }
+void pre_draw(void) {
+    if (P.flip_change_uv) {
+        P.flip_change_uv = false;
+        P.is_change_uv = !P.is_change_uv;
+        // exchange UV planar for this frame
+        SWAP(P.frame.cr_data, P.frame.cb_data, unsigned char *);
+    } else if (P.is_change_uv) {
+        // keep exchange UV for next frames
+        SWAP(P.frame.cr_data, P.frame.cb_data, unsigned char *);
     }
-    return strcmp(s0, s1);
 }
 
-int strfmtcmp_r(const void *p0, const void *p1) {
-    return -1 * strfmtcmp(p0, p1);
+void post_draw(void) {
+    layers_draw();
+    dirty_flush();
+    histogram();
 }
 
-static char **gNameLst;
-StrFmt *buildStrFmtLst(Uint32 *pLen) {
-    // fmtnameLst is a list with whitespace delimiter
-    // so split it to list.
-    // and build one dict which map from format name to format
-    Uint32 ft = 0, len = COUNT_OF(gFmtMap);
-    gNameLst = malloc(sizeof(char *) * len);
-    for (ft = 0; ft != len; ft++) {
-        // dup it for writeable string
-        gNameLst[ft] = strdup(showFmt(ft));
+void draw_420sp(void) {
+    pre_draw();
+    dirty_plane(0, P.frame.y_data);
+    dirty_plane(1, P.frame.cb_data);
+    dirty_plane(2, P.frame.cr_data);
+    post_draw();
+}
+
+void draw_yv12(void)
+{
+    pre_draw();
+    dirty_plane(0, P.frame.y_data);
+    dirty_plane(1, P.frame.cr_data);
+    dirty_plane(2, P.frame.cb_data);
+    post_draw();
+}
+
+void draw_422(void)
+{
+    pre_draw();
+    dirty_plane(0, P.frame.raw);
+    post_draw();
+}
+
+void usage(char *name)
+{
+    fprintf(stderr, "Usage:\n");
+    fprintf(stderr, "%s filename [width height format [diff_filename]]\n", name);
+    fprintf(stderr, "%s -c filename [width height format] filename2 ..\n", name);
+    fprintf(stderr, "%s -a filename [format]\n", name);
+    fprintf(stderr, "%s yv://HOST:PORT [--scale N] [--roi WxH[+X+Y]]\n",
+            name);
+    fprintf(stderr, "options: --stride N --uv-stride N"
+            " --plane-offset N[,N]\n");
+    fprintf(stderr, "         --out FILE[.y4m|.png] [--to format]"
+            " [--range FIRST[:LAST]]\n");
+    fprintf(stderr, "         --io uring[:N]|stdio --qc REPORT|-\n");
+    fprintf(stderr, "         --hash [crc32c|xxh3:]FILE|-"
+            " --verify|--verify-view MANIFEST\n");
+    fprintf(stderr, "         --mem N[K|M|G] --huge thp|hugetlb|off"
+            " --serve [HOST:]PORT\n");
+    fprintf(stderr, "         --window LO:HI --gamma G"
+            " --kernels scalar|sse2|avx2|avx512\n");
+    fprintf(stderr, "\twhen only have filename arg,"
+            " try guess other arg from filename\n");
+    fprintf(stderr, "\t-c compares up to %d files side by side\n", CMP_MAX);
+    fprintf(stderr, "\t-a ranks sizes and formats that fit the data,"
+            " also done when the name has no size\n");
+    fprintf(stderr, "\t--stride/--uv-stride give padded bytes per row,"
+            " --plane-offset where the chroma planes start in a frame\n");
+    fprintf(stderr, "\t--out converts frames to raw (format of --to, default"
+            " the input's), Y4M or one PNG per frame, no window\n");
+    fprintf(stderr, "\t--io uring reads N frames ahead (default %d) with"
+            " io_uring and O_DIRECT, key i shows the throughput\n",
+            URING_DEPTH);
+    fprintf(stderr, "\t--qc writes mean, variance, min, max and difference"
+            " of every frame as CSV and flags black, frozen, repeated and"
+            " corrupt ones, no window\n");
+    fprintf(stderr, "\t--hash writes a hash of every plane of every frame,"
+            " --verify checks the input against such a manifest and names"
+            " the first frame and plane that differ, --verify-view shows"
+            " it\n");
+    fprintf(stderr, "\t--mem limits frame buffers and caches (default half"
+            " the RAM, N in MB), --huge backs big buffers with transparent"
+            " (default) or hugetlbfs huge pages, key i shows the usage\n");
+    fprintf(stderr, "\t--serve streams frames to viewers opened on"
+            " yv://HOST:PORT, which ask for a crop (--roi) and a downscale"
+            " (--scale), no window\n");
+    fprintf(stderr, "\t--window and --gamma map samples of formats over 8"
+            " bit to the display, LO and below black, HI and up white\n");
+    fprintf(stderr, "\t--kernels (or YV_KERNELS) caps the SIMD level of the"
+            " hot loops, default the best this CPU runs, key i shows it\n");
+    fprintf(stderr, "\tformat=[");
+    char *s;
+    for (Uint32 i = 0; i != COUNT_OF(gFmtMap); i++) {
+        if (i == 0) {
+            s = "%s";
+        } else {
+            s = ", %s";
+        }
+        fprintf(stderr, s, showFmt(i));
     }
+    fprintf(stderr, "]\n");
+}
 
-    int toklen = 2 * len, tokidx;
-    char delim[] = " ";
-    char *s, *token;
-    StrFmt *toklst = malloc(sizeof(StrFmt) * toklen);
-    memset(toklst, 0, sizeof(StrFmt) * toklen);
-    for (ft = tokidx = 0; ft != len; ft++) {
-        s = gNameLst[ft];
-        while ((token = strtok(s, delim)) != NULL) {
-            s = NULL;
-            toklst[tokidx].str = token;
-            toklst[tokidx].fmt = ft;
-            tokidx++;
-            if (tokidx > toklen) {
-                DIE("not enough toklst, toklen=%d\n", toklen);
-                goto cleanup;
+// show block size cols, rows, stride,
+// add delim width to show YUYV alike case.
+void mb_loop(char *str, Uint8 *start_addr, Uint32 cols, Uint32 rows,
+             Uint32 stride, Uint32 delim)
+{
+    printf("%s\n", str);
+    for (Uint32 i = 0; i < rows; i++) {
+        for (Uint32 j = 0; j < cols; j++) {
+            printf("%02X ", start_addr[i * stride + j * (1 + delim)]);
+            if ((j + 1) % 4 == 0) {
+                printf(" ");
+            }
+        }
+        printf("\n");
+        if ((i + 1) % 4 == 0) {
+            printf("\n");
+        }
+    }
+}
+
+void show_mb(Uint32 mouse_x, Uint32 mouse_y)
+{
+    if (!P.mb) {
+        return;
+    }
+    if (bitdepth(FORMAT) == 10) {
+        printf("10-bitdepth raw data dither to 8bit\n");
+    }
+    if (P.width % 16 != 0) {
+        printf("support non-align width=%d have issue\n", P.width);
+        goto unsupport;
+    }
+    Uint32 MB;
+
+    /* which MB are we in? */
+    int mb_x = mouse_x / (16 * P.zoom);
+    int mb_y = mouse_y / (16 * P.zoom);
+    MB = mb_x + (P.width / 16) * mb_y;
+    gLayers.mb = MB + 1;
+
+    printf("\nMB (%d, %d) #%d\n", mb_x, mb_y, MB);
+
+    void (*drawer)(void) = gFmtMap[FORMAT].drawer;
+    if (drawer == draw_422) {
+        Uint8 *p = P.frame.raw + 32 * MB;
+        switch (gFmtMap[FORMAT].overlay_fmt) {
+            case SDL_YUY2_OVERLAY:
+                /* Packed mode: Y0+U0+Y1+V0 */
+                mb_loop("= Y =", p, 16, 16, P.width, 1);
+                mb_loop("= Cb =", p + 1, 8, 16, P.width, 3);
+                mb_loop("= Cr =", p + 3, 8, 16, P.width, 3);
+                break;
+            case SDL_UYVY_OVERLAY:
+                mb_loop("= Y =", p + 1, 16, 16, P.width, 1);
+                mb_loop("= Cb =", p, 8, 16, P.width, 3);
+                mb_loop("= Cr =", p + 2, 8, 16, P.width, 3);
+                break;
+            case SDL_YVYU_OVERLAY:
+                mb_loop("= Y =", p, 16, 16, P.width, 1);
+                mb_loop("= Cb =", p + 3, 8, 16, P.width, 3);
+                mb_loop("= Cr =", p + 1, 8, 16, P.width, 3);
+                break;
+            default:
+                goto unsupport;
+        }
+    } else if (drawer == draw_yv12) {
+        mb_loop("= Y =", P.frame.y_data + 16 * MB, 16, 16, P.width, 0);
+        mb_loop("= Cb =", P.frame.cb_data + 8 * MB, 8, 8, P.width / 2, 0);
+        mb_loop("= Cr =", P.frame.cr_data + 8 * MB, 8, 8, P.width / 2, 0);
+    } else {
+        goto unsupport;
+    }
+
+    fflush(stdout);
+    return;
+unsupport:
+    printf("unsupport show_mb for format=%d[%s]\n",
+           FORMAT, gFmtMap[FORMAT].fmtNameLst);
+}
+
+void draw_frame(void)
+{
+    if (gCmp.on) {
+        cmp_draw();
+        return;
+    }
+    if (!diff_view() && P.next
+        && (view_planes() & ~(P.frame.need ? P.frame.need : PLANE_ALL))) {
+        /* a toggle shows planes the last read skipped */
+        seek_frame(P.next - 1);
+        read_frame();
+    }
+    // lock pixels before modifying them
+    SDL_LockYUVOverlay(my_overlay);
+    precheck_range(FORMAT, gFmtMap);
+    (gFmtMap[FORMAT].drawer)();
+    if (gLine.on) {
+        line_bar(my_overlay, P.next ? P.next - 1 : 0);
+    }
+    set_zoom_rect();
+    video_rect.x = 0;
+    video_rect.y = 0;
+    video_rect.w = P.zoom_width;
+    video_rect.h = P.zoom_height;
+    SDL_UnlockYUVOverlay(my_overlay);
+
+    if (dirty_same()) {
+        /* no block changed, the screen still shows it */
+        gDirty.skipped++;
+        return;
+    }
+    display_overlay(my_overlay);
+}
+
+/* planes of P.frame the view shows or measures */
+Uint32 view_planes(void)
+{
+    if (P.hist || P.mb || diff_view() || gCmp.on) {
+        return PLANE_ALL;
+    }
+    if (P.y_only) {
+        return PLANE_Y;
+    }
+    if ((P.cb_only || P.cr_only) && (P.is_change_uv || P.flip_change_uv)) {
+        /* pre_draw() swaps the chroma planes */
+        return PLANE_CB | PLANE_CR;
+    }
+    if (P.cb_only) {
+        return PLANE_CB;
+    }
+    if (P.cr_only) {
+        return PLANE_CR;
+    }
+    return PLANE_ALL;
+}
+
+Uint32 read_frame(void)
+{
+    Uint32 ok;
+
+    if (gCmp.on) {
+        ok = cmp_read();
+    } else if (gTemp.on) {
+        ok = temporal_read();
+    } else if (!P.diff) {
+        P.frame.need = view_planes();
+        if (gUring.on) {
+            ok = uring_read(&P.dec, &P.frame);
+        } else {
+            ok = dec_read(&P.dec, fd, &P.frame);
+        }
+    } else {
+        ok = diff_mode();
+    }
+    if (ok) {
+        P.next++;
+    }
+    if (ok && gLut.custom) {
+        lut_apply();
+    }
+    return ok;
+}
+
+/* Block error heatmap
+ * SAD and SSE of the two diff inputs' luma per 8x8 block, computed once
+ * per frame. 16x16 and 64x64 values are sums of the 8x8 ones, so block
+ * size, metric and colour scale only change how the cache is rendered.
+ */
+enum {
+    HEAT_OFF = 0,
+    HEAT_SAD,
+    HEAT_MSE,
+};
+
+#define HEAT_LEVELS 3
+
+struct heat {
+    Uint32 mode;              /* HEAT_OFF, HEAT_SAD or HEAT_MSE */
+    Uint32 level;             /* index in heat_block[] */
+    Uint32 scale;             /* full scale mean abs diff, 0 for auto */
+    bool valid;               /* cache matches the frames in P.diff_src */
+    Uint32 gen;               /* bumped whenever the cache is computed */
+    Uint32 bw[HEAT_LEVELS];   /* blocks per row */
+    Uint32 bh[HEAT_LEVELS];   /* blocks per column */
+    Uint32 *sad[HEAT_LEVELS];
+    Uint32 *sse[HEAT_LEVELS];
+    Uint32 *cnt[HEAT_LEVELS]; /* pels per block, less at right/bottom edge */
+};
+
+const Uint32 heat_block[HEAT_LEVELS] = {8, 16, 64};
+struct heat gHeat;
+
+void heat_free(void)
+{
+    for (Uint32 l = 0; l < HEAT_LEVELS; l++) {
+        free(gHeat.sad[l]);
+        free(gHeat.sse[l]);
+        free(gHeat.cnt[l]);
+        gHeat.sad[l] = gHeat.sse[l] = gHeat.cnt[l] = NULL;
+    }
+    gHeat.valid = false;
+}
+
+Uint32 heat_alloc(void)
+{
+    heat_free();
+    for (Uint32 l = 0; l < HEAT_LEVELS; l++) {
+        Uint32 n;
+        gHeat.bw[l] = (P.width + heat_block[l] - 1) / heat_block[l];
+        gHeat.bh[l] = (P.height + heat_block[l] - 1) / heat_block[l];
+        n = gHeat.bw[l] * gHeat.bh[l];
+        gHeat.sad[l] = malloc(sizeof(Uint32) * n);
+        gHeat.sse[l] = malloc(sizeof(Uint32) * n);
+        gHeat.cnt[l] = malloc(sizeof(Uint32) * n);
+        if (!gHeat.sad[l] || !gHeat.sse[l] || !gHeat.cnt[l]) {
+            DIE("Error allocating memory...\n");
+            heat_free();
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void heat_calc(void)
+{
+    Frame *fa, *fb;
+    const Uint8 *a, *b;
+    Uint32 full = P.width / 8;
+
+    diff_pair(&fa, &fb);
+    a = fa->y_data;
+    b = fb->y_data;
+
+    if (!gHeat.sad[0] && !heat_alloc()) {
+        return;
+    }
+
+    /* 8x8, SIMD over whole blocks, the ragged edge in plain C */
+    for (Uint32 by = 0; by < gHeat.bh[0]; by++) {
+        Uint32 rows = P.height - by * 8 < 8 ? P.height - by * 8 : 8;
+        Uint32 *sad = gHeat.sad[0] + by * gHeat.bw[0];
+        Uint32 *sse = gHeat.sse[0] + by * gHeat.bw[0];
+        Uint32 *cnt = gHeat.cnt[0] + by * gHeat.bw[0];
+        Uint32 o = by * 8 * P.width;
+        Uint32 bx = 0;
+        if (rows == 8) {
+            gKern.sad_sse_8x8(a + o, b + o, P.width, full, sad, sse);
+            for (; bx < full; bx++) {
+                cnt[bx] = 64;
+            }
+        }
+        for (; bx < gHeat.bw[0]; bx++) {
+            Uint32 cols = P.width - bx * 8 < 8 ? P.width - bx * 8 : 8;
+            sad[bx] = sse[bx] = 0;
+            for (Uint32 r = 0; r < rows; r++) {
+                for (Uint32 c = 0; c < cols; c++) {
+                    int d = a[o + r * P.width + bx * 8 + c]
+                            - b[o + r * P.width + bx * 8 + c];
+                    sad[bx] += abs(d);
+                    sse[bx] += d * d;
+                }
+            }
+            cnt[bx] = rows * cols;
+        }
+    }
+
+    /* bigger blocks from the 8x8 ones */
+    for (Uint32 l = 1; l < HEAT_LEVELS; l++) {
+        Uint32 f = heat_block[l] / 8;
+        memset(gHeat.sad[l], 0, sizeof(Uint32) * gHeat.bw[l] * gHeat.bh[l]);
+        memset(gHeat.sse[l], 0, sizeof(Uint32) * gHeat.bw[l] * gHeat.bh[l]);
+        memset(gHeat.cnt[l], 0, sizeof(Uint32) * gHeat.bw[l] * gHeat.bh[l]);
+        for (Uint32 y = 0; y < gHeat.bh[0]; y++) {
+            for (Uint32 x = 0; x < gHeat.bw[0]; x++) {
+                Uint32 i = y * gHeat.bw[0] + x;
+                Uint32 j = y / f * gHeat.bw[l] + x / f;
+                gHeat.sad[l][j] += gHeat.sad[0][i];
+                gHeat.sse[l][j] += gHeat.sse[0][i];
+                gHeat.cnt[l][j] += gHeat.cnt[0][i];
+            }
+        }
+    }
+    gHeat.valid = true;
+    gHeat.gen++;
+}
+
+/* per pel error of one block in the current metric */
+double heat_value(Uint32 index)
+{
+    Uint32 l = gHeat.level;
+
+    if (gHeat.mode == HEAT_SAD) {
+        return (double)gHeat.sad[l][index] / gHeat.cnt[l][index];
+    }
+    return (double)gHeat.sse[l][index] / gHeat.cnt[l][index];
+}
+
+/* blue - green - yellow - red ramp, t in 0..1 */
+void heat_color(double t, Uint8 *y, Uint8 *u, Uint8 *v)
+{
+    static const Uint8 stop[4][3] = {
+        {41, 240, 110},       /* blue */
+        {145, 54, 34},        /* green */
+        {210, 16, 146},       /* yellow */
+        {81, 90, 240},        /* red */
+    };
+    Uint32 i = t >= 1.0 ? 2 : t * 3;
+    double f = t * 3 - i;
+
+    *y = stop[i][0] + f * (stop[i + 1][0] - stop[i][0]);
+    *u = stop[i][1] + f * (stop[i + 1][1] - stop[i][1]);
+    *v = stop[i][2] + f * (stop[i + 1][2] - stop[i][2]);
+}
+
+/* heatmap layer key, 0 when off, computes the cache if needed
+ * gen in the top 32 bits, scale (at most 32, see key c) in the 24 below,
+ * then level and mode in 4 bits each, no field reaches into the next.
+ */
+Uint64 heat_key(void)
+{
+    if (!diff_view() || gHeat.mode == HEAT_OFF) {
+        return 0;
+    }
+    if (!gHeat.valid) {
+        heat_calc();
+        if (!gHeat.valid) {
+            return 0;
+        }
+    }
+    return (Uint64)gHeat.gen << 32 | (Uint64)(gHeat.scale & 0xFFFFFF) << 8
+           | gHeat.level << 4 | gHeat.mode;
+}
+
+void heat_draw(Layer *layer)
+{
+    Uint32 l = gHeat.level, bs = heat_block[l];
+    Uint32 pitch = gLayers.pitch[0];
+    double full = 0.0;
+    bool packed = !isPlanar(FORMAT);
+
+    if (gHeat.scale) {
+        full = gHeat.scale;
+        if (gHeat.mode == HEAT_MSE) {
+            full *= gHeat.scale;
+        }
+    } else {
+        for (Uint32 i = 0; i < gHeat.bw[l] * gHeat.bh[l]; i++) {
+            if (heat_value(i) > full) {
+                full = heat_value(i);
+            }
+        }
+    }
+    if (full == 0.0) {
+        return;
+    }
+
+    for (Uint32 by = 0; by < gHeat.bh[l]; by++) {
+        for (Uint32 bx = 0; bx < gHeat.bw[l]; bx++) {
+            double t = heat_value(by * gHeat.bw[l] + bx) / full;
+            Uint32 x1 = (bx + 1) * bs < P.width ? (bx + 1) * bs : P.width;
+            Uint32 y1 = (by + 1) * bs < P.height ? (by + 1) * bs : P.height;
+            Uint8 cy, cu, cv;
+            if (t <= 0.0) {
+                /* no error, leave it alone */
+                continue;
+            }
+            heat_color(t > 1.0 ? 1.0 : t, &cy, &cu, &cv);
+            for (Uint32 y = by * bs; y < y1; y++) {
+                Uint32 row = y * pitch;
+                for (Uint32 x = bx * bs; x < x1; x++) {
+                    if (packed) {
+                        layer_put(layer, 0, row + x * 2 + P.y_start_pos,
+                                  cy, LAYER_HALF);
+                        layer_put(layer, 0, row + x / 2 * 4 + P.cb_start_pos,
+                                  cu, LAYER_SET);
+                        layer_put(layer, 0, row + x / 2 * 4 + P.cr_start_pos,
+                                  cv, LAYER_SET);
+                    } else {
+                        layer_put(layer, 0, row + x, cy, LAYER_HALF);
+                    }
+                }
+                if (!packed && y % 2 == 0) {
+                    /* YV12 overlay: Y + V + U */
+                    Uint32 n = (x1 - bx * bs) / 2;
+                    for (Uint32 x = bx * bs / 2; x < bx * bs / 2 + n; x++) {
+                        layer_put(layer, 1, y / 2 * gLayers.pitch[1] + x,
+                                  cv, LAYER_SET);
+                        layer_put(layer, 2, y / 2 * gLayers.pitch[2] + x,
+                                  cu, LAYER_SET);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void heat_show(Uint32 mouse_x, Uint32 mouse_y)
+{
+    Uint32 l = gHeat.level, bs = heat_block[l];
+    Uint32 bx, by, index, f = bs / 8;
+    double mse;
+
+    if (!diff_view() || gHeat.mode == HEAT_OFF || !gHeat.valid) {
+        return;
+    }
+    bx = mouse_x * P.width / P.zoom_width / bs;
+    by = mouse_y * P.height / P.zoom_height / bs;
+    if (bx >= gHeat.bw[l] || by >= gHeat.bh[l]) {
+        return;
+    }
+    index = by * gHeat.bw[l] + bx;
+    mse = (double)gHeat.sse[l][index] / gHeat.cnt[l][index];
+
+    printf("\nBlock %dx%d (%d, %d) #%d\n", bs, bs, bx, by, index);
+    if (mse == 0) {
+        printf("SAD=0 MSE=0 PSNR=NaN\n");
+    } else {
+        printf("SAD=%u MSE=%f PSNR=%f\n", gHeat.sad[l][index], mse,
+               10.0 * log10((256 * 256) / mse));
+    }
+    printf("= 8x8 SAD =\n");
+    for (Uint32 y = by * f; y < (by + 1) * f && y < gHeat.bh[0]; y++) {
+        for (Uint32 x = bx * f; x < (bx + 1) * f && x < gHeat.bw[0]; x++) {
+            printf("%6u ", gHeat.sad[0][y * gHeat.bw[0] + x]);
+        }
+        printf("\n");
+    }
+    if (bs <= 16 && bx * bs + bs <= P.width && by * bs + bs <= P.height) {
+        Uint32 o = by * bs * P.width + bx * bs;
+        Frame *a, *b;
+        diff_pair(&a, &b);
+        mb_loop("= Y =", a->y_data + o, bs, bs, P.width, 0);
+        mb_loop("= Y diff =", b->y_data + o, bs, bs, P.width, 0);
+    }
+    fflush(stdout);
+}
+
+Uint32 diff_mode(void)
+{
+    ReadJob job[2] = {
+        {&P.dec, fd, &P.diff_src[0], 0},
+        {&P.dec, P.fd2, &P.diff_src[1], 0},
+    };
+    void *arg[2] = {&job[0], &job[1]};
+
+    /* decode both files at the same time into their own buffers,
+     * then place amplified difference of all planes in P.frame */
+    pool_run(pool_get(), read_job, arg, 2);
+    if (!job[0].ret || !job[1].ret) {
+        return 0;
+    }
+
+    calc_psnr(&P.dec, P.diff_src[0].y_data, P.diff_src[1].y_data);
+    diff_frames(&P.dec, &P.frame, &P.diff_src[0], &P.diff_src[1], P.diff_amp);
+    gHeat.valid = false;
+    return 1;
+}
+
+/* dst = 0x80 + amp * (b - a), per sample, saturated */
+void diff_frames(const Dec *d, Frame *dst, const Frame *a, const Frame *b,
+                 Uint32 amp)
+{
+    if (gFmtMap[d->format].drawer == draw_422) {
+        /* packed frame is what gets displayed */
+        gKern.diff_u8(dst->raw, a->raw, b->raw, d->frame_size, amp);
+    }
+    gKern.diff_u8(dst->y_data, a->y_data, b->y_data, d->y_size, amp);
+    gKern.diff_u8(dst->cb_data, a->cb_data, b->cb_data, d->cb_size, amp);
+    gKern.diff_u8(dst->cr_data, a->cr_data, b->cr_data, d->cr_size, amp);
+}
+
+void calc_psnr(const Dec *d, Uint8 *frame0, Uint8 *frame1)
+{
+    double mse = 0.0;
+    double psnr = 0.0;
+
+    // only compare Y component
+    mse = gKern.sse_u8(frame0, frame1, d->y_size);
+
+    /* division by zero */
+    if (mse == 0) {
+        fprintf(stdout, "PSNR: NaN MSE=0\n");
+        return;
+    }
+
+    mse /= d->y_size;
+
+    psnr = 10.0 * log10((256 * 256) / mse);
+
+    fprintf(stdout, "PSNR: %f\n", psnr);
+}
+
+/* P.frame holds a difference, of two inputs or of two frames */
+bool diff_view(void)
+{
+    return P.diff || gTemp.on;
+}
+
+/* the frames P.frame is the difference of, b - a */
+void diff_pair(Frame **a, Frame **b)
+{
+    if (gTemp.on) {
+        *a = gTemp.prev;
+        *b = gTemp.cur;
+    } else {
+        *a = &P.diff_src[0];
+        *b = &P.diff_src[1];
+    }
+}
+
+/* Temporal difference
+ * Frame N against frame N - 1 of the one input. The last TEMP_RING decoded
+ * frames are kept by index, so playing or stepping forward decodes only the
+ * new frame, the previous one comes from the ring. The input is seeked only
+ * when a frame has to be decoded out of order.
+ */
+void temp_reset(void)
+{
+    for (Uint32 i = 0; i < TEMP_RING; i++) {
+        gTemp.slot[i].index = -1;
+        gTemp.slot[i].used = 0;
+    }
+    gTemp.pos = -1;
+    gTemp.prev = gTemp.cur = NULL;
+}
+
+void temp_free(void)
+{
+    for (Uint32 i = 0; i < TEMP_RING; i++) {
+        frame_free(&gTemp.slot[i].f);
+    }
+    temp_reset();
+}
+
+/* slot holding frame #index, decoded unless the ring has it, keep stays */
+TempSlot *temp_get(Uint32 index, const TempSlot *keep)
+{
+    TempSlot *s = NULL;
+
+    for (Uint32 i = 0; i < TEMP_RING; i++) {
+        if (gTemp.slot[i].index == (Sint32)index) {
+            gTemp.slot[i].used = ++gTemp.stamp;
+            gTemp.reused++;
+            return &gTemp.slot[i];
+        }
+    }
+    for (Uint32 i = 0; i < TEMP_RING; i++) {
+        if (&gTemp.slot[i] != keep && (!s || gTemp.slot[i].used < s->used)) {
+            s = &gTemp.slot[i];
+        }
+    }
+    s->index = -1;
+    if (!frame_alloc(&P.dec, &s->f)) {
+        return NULL;
+    }
+    if (gTemp.pos != (Sint32)index
+        && fseeko(fd, frame_offset(index), SEEK_SET) != 0) {
+        gTemp.pos = -1;
+        return NULL;
+    }
+    s->f.need = PLANE_ALL;
+    if (!dec_read(&P.dec, fd, &s->f)) {
+        gTemp.pos = -1;
+        return NULL;
+    }
+    gTemp.pos = index + 1;
+    s->index = index;
+    s->used = ++gTemp.stamp;
+    gTemp.decoded++;
+    return s;
+}
+
+/* P.frame = amplified frame #P.next - frame #P.next - 1, 0 against itself */
+Uint32 temporal_read(void)
+{
+    Uint32 index = P.next;
+    TempSlot *a, *b;
+    double mse;
+
+    /* the previous frame first, in file order if both are decoded */
+    a = temp_get(index > 0 ? index - 1 : 0, NULL);
+    b = a && index > 0 ? temp_get(index, a) : a;
+    if (!b) {
+        return 0;
+    }
+    gTemp.prev = &a->f;
+    gTemp.cur = &b->f;
+
+    mse = (double)gKern.sse_u8(a->f.y_data, b->f.y_data, P.dec.y_size)
+          / P.dec.y_size;
+    fprintf(stdout, "frame %d temporal MSE: %f\n", index, mse);
+
+    P.frame.need = PLANE_ALL;
+    diff_frames(&P.dec, &P.frame, gTemp.prev, gTemp.cur, P.diff_amp);
+    gHeat.valid = false;
+    return 1;
+}
+
+/* key p, the current frame is read again in the new mode */
+void temporal_toggle(void)
+{
+    Uint32 index = P.next > 0 ? P.next - 1 : 0;
+
+    if (gCmp.on || P.diff) {
+        printf("temporal difference views a single input\n");
+        return;
+    }
+    gTemp.on = !gTemp.on;
+    if (gTemp.on) {
+        temp_reset();
+        if (!P.diff_amp) {
+            P.diff_amp = 1;
+        }
+    } else {
+        temp_free();
+    }
+    printf("temporal difference %s\n", gTemp.on ? "on" : "off");
+    if (P.next > 0) {
+        seek_frame(index);
+        read_frame();
+        draw_frame();
+    } else {
+        seek_frame(0);
+    }
+}
+
+void temporal_stats(void)
+{
+    if (!gTemp.on) {
+        return;
+    }
+    printf("temporal: %llu frames decoded, %llu from the ring\n",
+           (unsigned long long)gTemp.decoded,
+           (unsigned long long)gTemp.reused);
+}
+
+/* Display mapping
+ * Formats over 8 bit keep their samples in Frame.deep. Readers map them to
+ * the 8 bit planes through gLut.base, rounded as before; the view maps
+ * P.frame again through gLut.view, built from a window lo..hi and a gamma,
+ * or showing one bit plane alone. Changing the mapping only runs the table
+ * over the samples of P.frame again, nothing is read.
+ */
+const double lut_gammas[] = {1.0, 2.2, 0.45};
+
+/* base table for bits per sample, the window clamped to its range */
+void lut_setup(Uint32 bits)
+{
+    Uint32 max = (1 << bits) - 1;
+
+    if (bits != gLut.bits) {
+        Uint32 shift = bits > 8 ? bits - 8 : 0;
+        Uint32 half = shift ? 1 << (shift - 1) : 0;
+        for (Uint32 x = 0; x < LUT_SIZE; x++) {
+            Uint32 v = (x + half) >> shift;
+            gLut.base[x] = v > 255 ? 255 : v;
+        }
+        gLut.bits = bits;
+    }
+    if (!gLut.hi || gLut.hi > max) {
+        gLut.hi = max;
+    }
+    if (gLut.lo >= gLut.hi) {
+        gLut.lo = 0;
+    }
+    if (gLut.bit >= (Sint32)bits) {
+        gLut.bit = -1;
+    }
+    lut_build();
+}
+
+void lut_build(void)
+{
+    Uint32 max = (1 << gLut.bits) - 1;
+
+    gLut.custom = gLut.bits > 8 && (gLut.lo > 0 || gLut.hi < max
+                                    || gLut.gamma != 1.0 || gLut.bit >= 0);
+    if (!gLut.custom) {
+        return;
+    }
+    for (Uint32 x = 0; x < LUT_SIZE; x++) {
+        Uint8 v;
+        if (gLut.bit >= 0) {
+            v = x >> gLut.bit & 1 ? 255 : 0;
+        } else if (x <= gLut.lo) {
+            v = 0;
+        } else if (x >= gLut.hi) {
+            v = 255;
+        } else {
+            double t = (double)(x - gLut.lo) / (gLut.hi - gLut.lo);
+            v = 255.0 * pow(t, 1.0 / gLut.gamma) + 0.5;
+        }
+        gLut.view[x] = v;
+    }
+}
+
+/* P.frame from its samples through the current mapping */
+void lut_apply(void)
+{
+    if (!P.frame.deep || !P.next || diff_view() || gCmp.on) {
+        return;
+    }
+    deep_map(&P.dec, &P.frame, gLut.custom ? gLut.view : gLut.base);
+}
+
+/* [ ] narrower or wider window, - = lower or higher level, o cycles the
+ * bit plane shown alone, F4 the gamma */
+Uint32 lut_key(SDLKey key)
+{
+    Uint32 max = (1 << gLut.bits) - 1;
+    Uint32 w = gLut.hi - gLut.lo;
+    Uint32 mid = gLut.lo + w / 2;
+    Uint32 step = w / 4 ? w / 4 : 1;
+    Uint32 g = 0;
+
+    if (key != SDLK_LEFTBRACKET && key != SDLK_RIGHTBRACKET
+        && key != SDLK_MINUS && key != SDLK_EQUALS && key != SDLK_o
+        && key != SDLK_F4) {
+        return 0;
+    }
+    if (gLut.bits <= 8) {
+        printf("display mapping is for formats over 8 bit\n");
+        return 1;
+    }
+    if (diff_view() || gCmp.on) {
+        printf("display mapping shows a single input\n");
+        return 1;
+    }
+    if (key != SDLK_o) {
+        /* back to the window */
+        gLut.bit = -1;
+    }
+    switch (key) {
+        case SDLK_LEFTBRACKET:
+            w = w / 2 ? w / 2 : 1;
+            break;
+        case SDLK_RIGHTBRACKET:
+            w = w * 2 + 1 < max ? w * 2 + 1 : max;
+            break;
+        case SDLK_MINUS:
+            mid = mid > step ? mid - step : 0;
+            break;
+        case SDLK_EQUALS:
+            mid += step;
+            break;
+        case SDLK_o:
+            gLut.bit = gLut.bit < 0 ? (Sint32)gLut.bits - 1 : gLut.bit - 1;
+            break;
+        default:
+            while (g < COUNT_OF(lut_gammas) && lut_gammas[g] != gLut.gamma) {
+                g++;
+            }
+            gLut.gamma = lut_gammas[(g + 1) % COUNT_OF(lut_gammas)];
+            break;
+    }
+    /* the window keeps its width inside 0..max */
+    gLut.lo = mid > w / 2 ? mid - w / 2 : 0;
+    gLut.hi = gLut.lo + w;
+    if (gLut.hi > max) {
+        gLut.hi = max;
+        gLut.lo = max - w;
+    }
+    if (gLut.bit >= 0) {
+        printf("display bit %d of %d\n", gLut.bit, gLut.bits);
+    } else {
+        printf("display window %d..%d gamma %.2f\n", gLut.lo, gLut.hi,
+               gLut.gamma);
+    }
+    lut_build();
+    lut_apply();
+    draw_frame();
+    return 1;
+}
+
+void histogram(void)
+{
+    if (!P.hist) {
+        return;
+    }
+
+    Uint8 y[256] = {0};
+    Uint8 b[256] = {0};
+    Uint8 r[256] = {0};
+
+    for (Uint32 i = 0; i < P.y_size; i++) {
+        y[P.frame.y_data[i]]++;
+    }
+    for (Uint32 i = 0; i < P.cb_size; i++) {
+        b[P.frame.cb_data[i]]++;
+    }
+    for (Uint32 i = 0; i < P.cr_size; i++) {
+        r[P.frame.cr_data[i]]++;
+    }
+
+    fprintf(stdout, "\nY,");
+    for (Uint32 i = 0; i < 256; i++) {
+        fprintf(stdout, "%u,", y[i]);
+    }
+    fprintf(stdout, "\nCb,");
+    for (Uint32 i = 0; i < 256; i++) {
+        fprintf(stdout, "%u,", b[i]);
+    }
+    fprintf(stdout, "\nCr,");
+    for (Uint32 i = 0; i < 256; i++) {
+        fprintf(stdout, "%u,", r[i]);
+    }
+    fprintf(stdout, "\n");
+    fflush(stdout);
+}
+
+/* Worker pool
+ * A fixed set of SDL threads pulling jobs from one queue. Every job is
+ * told which worker runs it, so callers can keep per-worker state
+ * (input handle, decode buffers) without any locking of their own.
+ */
+#define POOL_MAX_WORKER 64
+
+typedef struct Job {
+    JobFn fn;
+    void *arg;
+} Job;
+
+typedef struct PoolWorker {
+    Pool *pool;
+    Uint32 id;
+    SDL_Thread *thread;
+} PoolWorker;
+
+struct Pool {
+    PoolWorker *worker;
+    Uint32 nworker;
+    SDL_mutex *lock;
+    SDL_cond *wake;           /* new job queued, or quit */
+    SDL_cond *idle;           /* queue drained and nothing running */
+    SDL_cond *batch;          /* one item of a pool_run() batch finished */
+    Job *queue;               /* ring buffer of pending jobs */
+    Uint32 qcap;
+    Uint32 qhead;
+    Uint32 qlen;
+    Uint32 busy;              /* jobs being executed right now */
+    bool quit;
+};
+
+/* shared by every feature that decodes in the background */
+Pool *gPool;
+
+Uint32 cpu_count(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (n < 1) {
+        return 1;
+    }
+    if (n > POOL_MAX_WORKER) {
+        return POOL_MAX_WORKER;
+    }
+    return n;
+}
+
+int pool_worker(void *arg)
+{
+    PoolWorker *w = arg;
+    Pool *pool = w->pool;
+    Job job;
+
+    SDL_LockMutex(pool->lock);
+    while (1) {
+        while (!pool->qlen && !pool->quit) {
+            SDL_CondWait(pool->wake, pool->lock);
+        }
+        if (pool->quit) {
+            break;
+        }
+        job = pool->queue[pool->qhead];
+        pool->qhead = (pool->qhead + 1) % pool->qcap;
+        pool->qlen--;
+        pool->busy++;
+        SDL_UnlockMutex(pool->lock);
+
+        job.fn(job.arg, w->id);
+
+        SDL_LockMutex(pool->lock);
+        pool->busy--;
+        if (!pool->qlen && !pool->busy) {
+            SDL_CondBroadcast(pool->idle);
+        }
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+Pool *pool_create(Uint32 nworker)
+{
+    Pool *pool = calloc(1, sizeof(Pool));
+
+    if (!pool) {
+        DIE("Error allocating memory...\n");
+        return NULL;
+    }
+    pool->qcap = 64;
+    pool->queue = malloc(sizeof(Job) * pool->qcap);
+    pool->worker = calloc(nworker, sizeof(PoolWorker));
+    pool->lock = SDL_CreateMutex();
+    pool->wake = SDL_CreateCond();
+    pool->idle = SDL_CreateCond();
+    pool->batch = SDL_CreateCond();
+    if (!pool->queue || !pool->worker || !pool->lock
+        || !pool->wake || !pool->idle || !pool->batch) {
+        DIE("Error creating worker pool\n");
+        pool_destroy(pool);
+        return NULL;
+    }
+
+    for (Uint32 i = 0; i < nworker; i++) {
+        PoolWorker *w = &pool->worker[i];
+        w->pool = pool;
+        w->id = i;
+        w->thread = SDL_CreateThread(pool_worker, w);
+        if (!w->thread) {
+            DIE("Error creating worker thread: %s\n", SDL_GetError());
+            break;
+        }
+        pool->nworker++;
+    }
+    if (!pool->nworker) {
+        pool_destroy(pool);
+        return NULL;
+    }
+    LOG("worker pool with %d threads\n", pool->nworker);
+    return pool;
+}
+
+void pool_destroy(Pool *pool)
+{
+    if (!pool) {
+        return;
+    }
+    if (pool->lock) {
+        SDL_LockMutex(pool->lock);
+        pool->qlen = 0;
+        pool->quit = true;
+        SDL_CondBroadcast(pool->wake);
+        SDL_UnlockMutex(pool->lock);
+    }
+    for (Uint32 i = 0; i < pool->nworker; i++) {
+        SDL_WaitThread(pool->worker[i].thread, NULL);
+    }
+    if (pool->batch) {
+        SDL_DestroyCond(pool->batch);
+    }
+    if (pool->idle) {
+        SDL_DestroyCond(pool->idle);
+    }
+    if (pool->wake) {
+        SDL_DestroyCond(pool->wake);
+    }
+    if (pool->lock) {
+        SDL_DestroyMutex(pool->lock);
+    }
+    free(pool->worker);
+    free(pool->queue);
+    free(pool);
+}
+
+Uint32 pool_submit(Pool *pool, JobFn fn, void *arg)
+{
+    SDL_LockMutex(pool->lock);
+    if (pool->qlen == pool->qcap) {
+        /* grow and unwrap the ring */
+        Job *q = malloc(sizeof(Job) * pool->qcap * 2);
+        if (!q) {
+            SDL_UnlockMutex(pool->lock);
+            DIE("Error allocating memory...\n");
+            return 0;
+        }
+        for (Uint32 i = 0; i < pool->qlen; i++) {
+            q[i] = pool->queue[(pool->qhead + i) % pool->qcap];
+        }
+        free(pool->queue);
+        pool->queue = q;
+        pool->qhead = 0;
+        pool->qcap *= 2;
+    }
+    pool->queue[(pool->qhead + pool->qlen) % pool->qcap].fn = fn;
+    pool->queue[(pool->qhead + pool->qlen) % pool->qcap].arg = arg;
+    pool->qlen++;
+    SDL_CondSignal(pool->wake);
+    SDL_UnlockMutex(pool->lock);
+    return 1;
+}
+
+/* drop queued, not yet started jobs of one kind */
+void pool_cancel(Pool *pool, JobFn fn)
+{
+    Uint32 n = 0;
+
+    SDL_LockMutex(pool->lock);
+    for (Uint32 i = 0; i < pool->qlen; i++) {
+        Job *job = &pool->queue[(pool->qhead + i) % pool->qcap];
+        if (job->fn != fn) {
+            pool->queue[(pool->qhead + n) % pool->qcap] = *job;
+            n++;
+        }
+    }
+    pool->qlen = n;
+    if (!pool->qlen && !pool->busy) {
+        SDL_CondBroadcast(pool->idle);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+void pool_wait(Pool *pool)
+{
+    SDL_LockMutex(pool->lock);
+    while (pool->qlen || pool->busy) {
+        SDL_CondWait(pool->idle, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+typedef struct Batch {
+    Pool *pool;
+    Uint32 pending;           /* items not finished yet */
+} Batch;
+
+typedef struct BatchItem {
+    Batch *batch;
+    JobFn fn;
+    void *arg;
+} BatchItem;
+
+void pool_batch_job(void *arg, Uint32 worker)
+{
+    BatchItem *item = arg;
+    Pool *pool = item->batch->pool;
+
+    item->fn(item->arg, worker);
+
+    SDL_LockMutex(pool->lock);
+    item->batch->pending--;
+    SDL_CondBroadcast(pool->batch);
+    SDL_UnlockMutex(pool->lock);
+}
+
+/* take back one item of batch that no worker has started yet */
+BatchItem *pool_steal(Pool *pool, Batch *batch);
+BatchItem *pool_steal(Pool *pool, Batch *batch)
+{
+    BatchItem *item = NULL;
+
+    SDL_LockMutex(pool->lock);
+    for (Uint32 i = 0; i < pool->qlen; i++) {
+        Job *job = &pool->queue[(pool->qhead + i) % pool->qcap];
+        if (job->fn == pool_batch_job
+            && ((BatchItem *)job->arg)->batch == batch) {
+            item = job->arg;
+            for (; i + 1 < pool->qlen; i++) {
+                pool->queue[(pool->qhead + i) % pool->qcap] =
+                    pool->queue[(pool->qhead + i + 1) % pool->qcap];
+            }
+            pool->qlen--;
+            break;
+        }
+    }
+    SDL_UnlockMutex(pool->lock);
+    return item;
+}
+
+/* run fn on every arg in parallel and return once all are done.
+ * The calling thread takes part as worker #nworker, so per-worker state
+ * used from here needs nworker + 1 slots. */
+void pool_run(Pool *pool, JobFn fn, void **arg, Uint32 n)
+{
+    Batch batch;
+    BatchItem item[n ? n : 1];
+    BatchItem *it;
+
+    if (!pool || n < 2) {
+        for (Uint32 i = 0; i < n; i++) {
+            fn(arg[i], pool ? pool->nworker : 0);
+        }
+        return;
+    }
+
+    batch.pool = pool;
+    batch.pending = n - 1;
+    for (Uint32 i = 1; i < n; i++) {
+        item[i].batch = &batch;
+        item[i].fn = fn;
+        item[i].arg = arg[i];
+        if (!pool_submit(pool, pool_batch_job, &item[i])) {
+            pool_batch_job(&item[i], pool->nworker);
+        }
+    }
+    fn(arg[0], pool->nworker);
+
+    /* rather than wait behind other queued work, help out */
+    while ((it = pool_steal(pool, &batch)) != NULL) {
+        pool_batch_job(it, pool->nworker);
+    }
+
+    SDL_LockMutex(pool->lock);
+    while (batch.pending) {
+        SDL_CondWait(pool->batch, pool->lock);
+    }
+    SDL_UnlockMutex(pool->lock);
+}
+
+Pool *pool_get(void)
+{
+    if (!gPool) {
+        gPool = pool_create(cpu_count());
+    }
+    return gPool;
+}
+
+/* decode one frame of one input, see pool_run() */
+void read_job(void *arg, Uint32 worker)
+{
+    ReadJob *job = arg;
+
+    (void)worker;
+    job->ret = dec_read(job->d, job->fp, job->f);
+}
+
+/* io_uring frame reader
+ * With --io uring the main input is also opened with O_DIRECT and the
+ * frames ahead of the playhead are read into aligned slot buffers, up to
+ * depth reads in flight. Frame offsets are rarely block aligned, so each
+ * read covers the aligned span around the frame. The reader of the format
+ * then decodes from the slot through a memory stream. Without io_uring,
+ * or where O_DIRECT is refused, it falls back to buffered reads.
+ */
+Uint64 now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#ifdef HAVE_URING
+Uint32 uring_setup(void)
+{
+    struct io_uring_params p;
+    size_t off;
+
+    memset(&p, 0, sizeof(p));
+    gUring.ring = syscall(__NR_io_uring_setup, gUring.depth, &p);
+    if (gUring.ring < 0) {
+        return 0;
+    }
+    gUring.sq_size = p.sq_off.array + p.sq_entries * sizeof(Uint32);
+    gUring.cq_size = p.cq_off.cqes
+                     + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (gUring.cq_size > gUring.sq_size) {
+            gUring.sq_size = gUring.cq_size;
+        }
+        gUring.cq_size = 0;
+    }
+    gUring.sq_map = mmap(NULL, gUring.sq_size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, gUring.ring,
+                         IORING_OFF_SQ_RING);
+    if (gUring.sq_map == MAP_FAILED) {
+        gUring.sq_map = NULL;
+        return 0;
+    }
+    gUring.cq_map = gUring.sq_map;
+    if (gUring.cq_size) {
+        gUring.cq_map = mmap(NULL, gUring.cq_size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, gUring.ring,
+                             IORING_OFF_CQ_RING);
+        if (gUring.cq_map == MAP_FAILED) {
+            gUring.cq_map = NULL;
+            return 0;
+        }
+    }
+    gUring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    gUring.sqes = mmap(NULL, gUring.sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, gUring.ring,
+                       IORING_OFF_SQES);
+    if (gUring.sqes == MAP_FAILED) {
+        gUring.sqes = NULL;
+        return 0;
+    }
+    off = (size_t)gUring.sq_map;
+    gUring.sq_tail = (Uint32 *)(off + p.sq_off.tail);
+    gUring.sq_mask = (Uint32 *)(off + p.sq_off.ring_mask);
+    gUring.sq_array = (Uint32 *)(off + p.sq_off.array);
+    off = (size_t)gUring.cq_map;
+    gUring.cq_head = (Uint32 *)(off + p.cq_off.head);
+    gUring.cq_tail = (Uint32 *)(off + p.cq_off.tail);
+    gUring.cq_mask = (Uint32 *)(off + p.cq_off.ring_mask);
+    gUring.cqes = (void *)(off + p.cq_off.cqes);
+    return 1;
+}
+
+/* queue the rest of slot s, one READV */
+Uint32 uring_submit(UringSlot *s)
+{
+    Uint32 tail = *gUring.sq_tail;
+    Uint32 i = tail & *gUring.sq_mask;
+    struct io_uring_sqe *sqe = (struct io_uring_sqe *)gUring.sqes + i;
+
+    s->iov.iov_base = s->buf + s->done;
+    s->iov.iov_len = s->len - s->done;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = gUring.fd;
+    sqe->off = s->off + s->done;
+    sqe->addr = (size_t)&s->iov;
+    sqe->len = 1;
+    sqe->user_data = s - gUring.slot;
+    gUring.sq_array[i] = i;
+    __atomic_store_n(gUring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    if (syscall(__NR_io_uring_enter, gUring.ring, 1, 0, 0, NULL, 0) != 1) {
+        /* not queued, the tail goes back */
+        __atomic_store_n(gUring.sq_tail, tail, __ATOMIC_RELEASE);
+        s->state = IO_ERROR;
+        return 0;
+    }
+    if (!gUring.inflight++) {
+        gUring.busy_start = now_ns();
+    }
+    gUring.depth_sum += gUring.inflight;
+    gUring.submits++;
+    if (gUring.inflight > gUring.depth_max) {
+        gUring.depth_max = gUring.inflight;
+    }
+    s->state = IO_BUSY;
+    return 1;
+}
+
+/* handle completions, waiting for at least one if wait */
+void uring_reap(bool wait)
+{
+    Uint32 head, tail;
+
+    if (wait) {
+        syscall(__NR_io_uring_enter, gUring.ring, 0, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+    head = *gUring.cq_head;
+    tail = __atomic_load_n(gUring.cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++) {
+        struct io_uring_cqe *cqe = (struct io_uring_cqe *)gUring.cqes
+                                   + (head & *gUring.cq_mask);
+        UringSlot *s = &gUring.slot[cqe->user_data];
+        Sint32 res = cqe->res;
+
+        if (!--gUring.inflight) {
+            gUring.busy_ns += now_ns() - gUring.busy_start;
+        }
+        if (res < 0) {
+            s->state = IO_ERROR;
+            continue;
+        }
+        s->done += res;
+        gUring.bytes += res;
+        if (res == 0 || s->done >= s->len) {
+            /* short at the end of the file is fine */
+            s->state = s->done >= s->skip + P.raw_frame_size
+                       ? IO_READY : IO_ERROR;
+        } else if (!uring_submit(s)) {
+            s->state = IO_ERROR;
+        }
+    }
+    __atomic_store_n(gUring.cq_head, head, __ATOMIC_RELEASE);
+}
+#else
+Uint32 uring_setup(void)
+{
+    return 0;
+}
+
+Uint32 uring_submit(UringSlot *s)
+{
+    s->state = IO_ERROR;
+    return 0;
+}
+
+void uring_reap(bool wait)
+{
+    (void)wait;
+}
+#endif
+
+void uring_open(void)
+{
+    if (!gUring.depth || gCmp.on || P.diff) {
+        return;
+    }
+    if (fileno(fd) < 0) {
+        DIE("io_uring reads uncompressed files only, reading with stdio\n");
+        return;
+    }
+    gUring.direct = true;
+    gUring.fd = open(P.filename, O_RDONLY | O_DIRECT);
+    if (gUring.fd < 0) {
+        gUring.direct = false;
+        gUring.fd = open(P.filename, O_RDONLY);
+    }
+    if (gUring.fd < 0 || !uring_setup()) {
+        DIE("io_uring not available, reading with stdio\n");
+        uring_close();
+        return;
+    }
+    for (Uint32 i = 0; i < URING_MAX; i++) {
+        gUring.slot[i].index = -1;
+    }
+    gUring.on = true;
+    printf("io_uring: %d frames in flight%s\n", gUring.depth,
+           gUring.direct ? ", O_DIRECT" : "");
+}
+
+void uring_close(void)
+{
+    if (!gUring.depth) {
+        return;
+    }
+    if (gUring.on) {
+        /* drain before the buffers go */
+        while (gUring.inflight) {
+            uring_reap(true);
+        }
+        uring_stats();
+    }
+    if (gUring.sqes) {
+        munmap(gUring.sqes, gUring.sqes_size);
+    }
+    if (gUring.cq_map && gUring.cq_map != gUring.sq_map) {
+        munmap(gUring.cq_map, gUring.cq_size);
+    }
+    if (gUring.sq_map) {
+        munmap(gUring.sq_map, gUring.sq_size);
+    }
+    if (gUring.ring >= 0) {
+        close(gUring.ring);
+    }
+    if (gUring.fd >= 0) {
+        close(gUring.fd);
+    }
+    for (Uint32 i = 0; i < URING_MAX; i++) {
+        mem_free(gUring.slot[i].buf);
+    }
+    memset(&gUring, 0, sizeof(gUring));
+}
+
+void uring_stats(void)
+{
+    Uint64 busy = gUring.busy_ns;
+
+    if (!gUring.on) {
+        printf("io: stdio\n");
+        return;
+    }
+    if (gUring.inflight) {
+        busy += now_ns() - gUring.busy_start;
+    }
+    printf("io: io_uring%s, %llu frames, %.1f MB read, %.1f MB/s,"
+           " queue depth avg %.1f max %d of %d\n",
+           gUring.direct ? " O_DIRECT" : "",
+           (unsigned long long)gUring.frames, gUring.bytes / 1e6,
+           busy ? gUring.bytes * 1e3 / busy : 0.0,
+           gUring.submits ? (double)gUring.depth_sum / gUring.submits : 0.0,
+           gUring.depth_max, gUring.depth);
+}
+
+UringSlot *uring_find(Uint32 index)
+{
+    for (Uint32 i = 0; i < gUring.depth; i++) {
+        UringSlot *s = &gUring.slot[i];
+        if (s->index == index && s->gen == gUring.gen) {
+            return s;
+        }
+    }
+    return NULL;
+}
+
+/* keep reads going for the frames next .. next + depth - 1 */
+void uring_fill(void)
+{
+    Uint32 nframes = frame_count(fd);
+
+    for (Uint32 k = 0; k < gUring.depth; k++) {
+        Uint32 index = gUring.next + k;
+        UringSlot *s = NULL;
+        off_t pos, end;
+
+        if (index >= nframes) {
+            break;
+        }
+        if (uring_find(index)) {
+            continue;
+        }
+        for (Uint32 i = 0; i < gUring.depth && !s; i++) {
+            UringSlot *t = &gUring.slot[i];
+            if (t->state != IO_BUSY
+                && (t->index < 0 || t->gen != gUring.gen
+                    || t->index < gUring.next
+                    || t->index >= (Sint64)gUring.next + gUring.depth)) {
+                s = t;
+            }
+        }
+        if (!s) {
+            /* all busy with frames off the window */
+            break;
+        }
+        pos = frame_offset(index);
+        end = pos + P.raw_frame_size;
+        s->off = pos & ~(off_t)(URING_ALIGN - 1);
+        s->skip = pos - s->off;
+        s->len = ((end + URING_ALIGN - 1) & ~(off_t)(URING_ALIGN - 1)) - s->off;
+        if (s->cap < s->len) {
+            mem_free(s->buf);
+            s->cap = 0;
+            s->buf = mem_alloc(s->len, MEM_IO);
+            if (!s->buf) {
+                break;
+            }
+            s->cap = s->len;
+        }
+        s->index = index;
+        s->gen = gUring.gen;
+        s->done = 0;
+        if (!uring_submit(s)) {
+            break;
+        }
+    }
+}
+
+/* frame #gUring.next into f */
+Uint32 uring_read(const Dec *d, Frame *f)
+{
+    UringSlot *s;
+    FILE *mem = NULL;
+    Uint32 ret = 0;
+
+    for (;;) {
+        uring_fill();
+        s = uring_find(gUring.next);
+        if (s && s->state != IO_BUSY) {
+            break;
+        }
+        if (!gUring.inflight) {
+            s = NULL;
+            break;
+        }
+        uring_reap(true);
+    }
+    if (s && s->state == IO_READY) {
+        mem = fmemopen(s->buf + s->skip, d->raw_frame_size, "rb");
+        if (mem) {
+            ret = dec_read(d, mem, f);
+            fclose(mem);
+        }
+    }
+    if (!s || s->state != IO_READY || !mem) {
+        /* past the end or the read failed, the buffered way */
+        if (fseeko(fd, frame_offset(gUring.next), SEEK_SET) == 0) {
+            ret = dec_read(d, fd, f);
+        }
+    }
+    if (ret) {
+        gUring.next++;
+        gUring.frames++;
+        uring_fill();
+    }
+    return ret;
+}
+
+/* Compressed input
+ * zfopen() hands out a FILE that decompresses .gz, .xz and .zst inputs on
+ * the fly (fopencookie), so every reader, seek and frame count works on
+ * them unchanged. Inputs with an index, seekable zstd (seek table frame at
+ * the end) and xz with several blocks, are cut into independent chunks:
+ * a seek decodes only the chunk needed and worker jobs decode the chunks
+ * ahead of the last read. Other streams are decoded in ZIN_BLOCK chunks in
+ * order, a seek back past the cache restarts them from the beginning.
+ */
+Uint32 zin_magic(const Uint8 *b, size_t n)
+{
+    static const Uint8 gz[] = {0x1F, 0x8B};
+    static const Uint8 xz[] = {0xFD, '7', 'z', 'X', 'Z', 0x00};
+    static const Uint8 zst[] = {0x28, 0xB5, 0x2F, 0xFD};
+
+    if (n >= sizeof(gz) && !memcmp(b, gz, sizeof(gz))) {
+        return ZIN_GZIP;
+    }
+    if (n >= sizeof(xz) && !memcmp(b, xz, sizeof(xz))) {
+        return ZIN_XZ;
+    }
+    if (n >= sizeof(zst) && !memcmp(b, zst, sizeof(zst))) {
+        return ZIN_ZSTD;
+    }
+    return 0;
+}
+
+Uint32 get_le32(const Uint8 *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (Uint32)p[3] << 24;
+}
+
+/* seek table of the zstd seekable format, at the end of the file */
+Uint32 zin_index_zstd(Zin *z, Uint64 fsize)
+{
+    Uint8 foot[9];
+    Uint8 *tab;
+    Uint32 n, esize;
+    Uint64 tsize, coff = 0, doff = 0;
+
+    if (fsize < 17 || pread(z->fd, foot, 9, fsize - 9) != 9
+        || get_le32(foot + 5) != ZSTD_SEEKABLE_MAGIC || foot[4] & 0x7C) {
+        return 0;
+    }
+    n = get_le32(foot);
+    esize = foot[4] & 0x80 ? 12 : 8;
+    tsize = (Uint64)n * esize;
+    if (!n || tsize + 17 > fsize) {
+        return 0;
+    }
+    tab = malloc(tsize);
+    z->chunk = calloc(n, sizeof(ZChunk));
+    if (!tab || !z->chunk
+        || pread(z->fd, tab, tsize, fsize - 9 - tsize) != (ssize_t)tsize) {
+        free(tab);
+        return 0;
+    }
+    for (Uint32 i = 0; i < n; i++) {
+        ZChunk *c = &z->chunk[i];
+        c->coff = coff;
+        c->csize = get_le32(tab + i * esize);
+        c->doff = doff;
+        c->dsize = get_le32(tab + i * esize + 4);
+        coff += c->csize;
+        doff += c->dsize;
+    }
+    free(tab);
+    z->nchunk = n;
+    z->size = doff;
+    return 1;
+}
+
+/* block list of the xz index, one stream only */
+Uint32 zin_index_xz(Zin *z, Uint64 fsize)
+{
+#ifdef HAVE_LZMA
+    Uint8 foot[LZMA_STREAM_HEADER_SIZE];
+    lzma_stream_flags flags;
+    lzma_index *idx = NULL;
+    lzma_index_iter it;
+    uint64_t memlimit = UINT64_MAX;
+    size_t pos = 0;
+    Uint8 *buf;
+    Uint32 ret = 0;
+
+    if (fsize < 2 * LZMA_STREAM_HEADER_SIZE
+        || pread(z->fd, foot, sizeof(foot), fsize - sizeof(foot))
+           != sizeof(foot)
+        || lzma_stream_footer_decode(&flags, foot) != LZMA_OK
+        || flags.backward_size > fsize - 2 * sizeof(foot)) {
+        return 0;
+    }
+    buf = malloc(flags.backward_size);
+    if (!buf || pread(z->fd, buf, flags.backward_size,
+                      fsize - sizeof(foot) - flags.backward_size)
+                != (ssize_t)flags.backward_size
+        || lzma_index_buffer_decode(&idx, &memlimit, NULL, buf, &pos,
+                                    flags.backward_size) != LZMA_OK) {
+        free(buf);
+        return 0;
+    }
+    free(buf);
+    /* concatenated streams or padding: decode as a stream */
+    if (lzma_index_file_size(idx) == fsize) {
+        z->nchunk = lzma_index_block_count(idx);
+        z->chunk = calloc(z->nchunk, sizeof(ZChunk));
+        lzma_index_iter_init(&it, idx);
+        for (Uint32 i = 0; z->chunk && i < z->nchunk
+             && !lzma_index_iter_next(&it, LZMA_INDEX_ITER_BLOCK); i++) {
+            ZChunk *c = &z->chunk[i];
+            c->coff = it.block.compressed_file_offset;
+            c->csize = it.block.total_size;
+            c->doff = it.block.uncompressed_file_offset;
+            c->dsize = it.block.uncompressed_size;
+        }
+        z->size = lzma_index_uncompressed_size(idx);
+        z->xz_check = flags.check;
+        ret = z->chunk != NULL;
+    }
+    lzma_index_end(idx, NULL);
+    return ret;
+#else
+    (void)z;
+    (void)fsize;
+    return 0;
+#endif
+}
+
+Uint32 zin_stream_init(Zin *z)
+{
+    switch (z->kind) {
+#ifdef HAVE_ZLIB
+        case ZIN_GZIP:
+            z->stream = calloc(1, sizeof(z_stream));
+            /* 32: gzip or zlib header */
+            return z->stream && inflateInit2((z_stream *)z->stream, 15 + 32)
+                   == Z_OK;
+#endif
+#ifdef HAVE_LZMA
+        case ZIN_XZ: {
+            lzma_stream init = LZMA_STREAM_INIT;
+            z->stream = malloc(sizeof(lzma_stream));
+            if (!z->stream) {
+                return 0;
+            }
+            *(lzma_stream *)z->stream = init;
+            return lzma_stream_decoder(z->stream, UINT64_MAX,
+                                       LZMA_CONCATENATED) == LZMA_OK;
+        }
+#endif
+#ifdef HAVE_ZSTD
+        case ZIN_ZSTD:
+            z->stream = ZSTD_createDCtx();
+            return z->stream != NULL;
+#endif
+        default:
+            return 0;
+    }
+}
+
+void zin_stream_end(Zin *z)
+{
+    if (!z->stream) {
+        return;
+    }
+    switch (z->kind) {
+#ifdef HAVE_ZLIB
+        case ZIN_GZIP:
+            inflateEnd(z->stream);
+            free(z->stream);
+            break;
+#endif
+#ifdef HAVE_LZMA
+        case ZIN_XZ:
+            lzma_end(z->stream);
+            free(z->stream);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case ZIN_ZSTD:
+            ZSTD_freeDCtx(z->stream);
+            break;
+#endif
+        default:
+            break;
+    }
+    z->stream = NULL;
+}
+
+/* back to the first byte of a stream */
+Uint32 zin_restart(Zin *z)
+{
+    zin_stream_end(z);
+    z->cin = 0;
+    z->inlen = z->inpos = 0;
+    z->sdone = 0;
+    z->eof = false;
+    return zin_stream_init(z);
+}
+
+/* compressed input for zin_stream(), 0 at the end of the file */
+Uint32 zin_fill(Zin *z)
+{
+    ssize_t n;
+
+    if (z->inpos < z->inlen) {
+        return 1;
+    }
+    n = pread(z->fd, z->inbuf, ZIN_IN, z->cin);
+    if (n <= 0) {
+        return 0;
+    }
+    z->cin += n;
+    z->inlen = n;
+    z->inpos = 0;
+    return 1;
+}
+
+/* next n bytes of a stream into out, NULL skips them;
+ * returns the bytes produced, fewer at the end */
+Uint32 zin_stream(Zin *z, Uint8 *out, Uint32 n)
+{
+    Uint32 got = 0;
+
+    while (got < n && !z->eof) {
+        Uint8 *dst = out ? out + got : z->sink;
+        Uint32 want = n - got;
+        Uint32 more = zin_fill(z);
+        size_t left = z->inlen - z->inpos;
+        size_t made = 0;
+        bool end = false, err = false;
+
+        if (!out && want > ZIN_IN) {
+            want = ZIN_IN;
+        }
+        switch (z->kind) {
+#ifdef HAVE_ZLIB
+            case ZIN_GZIP: {
+                z_stream *s = z->stream;
+                int r;
+                s->next_in = z->inbuf + z->inpos;
+                s->avail_in = left;
+                s->next_out = dst;
+                s->avail_out = want;
+                r = inflate(s, Z_NO_FLUSH);
+                made = want - s->avail_out;
+                z->inpos = z->inlen - s->avail_in;
+                if (r == Z_STREAM_END) {
+                    /* concatenated members */
+                    end = !zin_fill(z) || inflateReset(s) != Z_OK;
+                } else {
+                    err = r != Z_OK && r != Z_BUF_ERROR;
+                }
+                break;
+            }
+#endif
+#ifdef HAVE_LZMA
+            case ZIN_XZ: {
+                lzma_stream *s = z->stream;
+                lzma_ret r;
+                s->next_in = z->inbuf + z->inpos;
+                s->avail_in = left;
+                s->next_out = dst;
+                s->avail_out = want;
+                r = lzma_code(s, more ? LZMA_RUN : LZMA_FINISH);
+                made = want - s->avail_out;
+                z->inpos = z->inlen - s->avail_in;
+                end = r == LZMA_STREAM_END;
+                err = r != LZMA_OK && r != LZMA_STREAM_END
+                      && r != LZMA_BUF_ERROR;
+                break;
+            }
+#endif
+#ifdef HAVE_ZSTD
+            case ZIN_ZSTD: {
+                ZSTD_inBuffer in = {z->inbuf + z->inpos, left, 0};
+                ZSTD_outBuffer o = {dst, want, 0};
+                size_t r = ZSTD_decompressStream(z->stream, &o, &in);
+                made = o.pos;
+                z->inpos += in.pos;
+                err = ZSTD_isError(r);
+                break;
+            }
+#endif
+            default:
+                /* built without the decoder */
+                (void)dst;
+                (void)left;
+                err = true;
+                break;
+        }
+        if (err) {
+            DIE("corrupt compressed data at %llu\n",
+                (unsigned long long)z->cin);
+        }
+        got += made;
+        z->sdone += made;
+        /* truncated input makes no progress */
+        z->eof = end || err || (!more && !made);
+    }
+    return got;
+}
+
+Uint64 zin_doff(Zin *z, Uint32 k)
+{
+    return z->chunk ? z->chunk[k].doff : (Uint64)k * ZIN_BLOCK;
+}
+
+Uint32 zin_dsize(Zin *z, Uint32 k)
+{
+    Uint64 left = z->size - zin_doff(z, k);
+    return z->chunk ? z->chunk[k].dsize : left < ZIN_BLOCK ? left : ZIN_BLOCK;
+}
+
+Uint32 zin_nchunk(Zin *z)
+{
+    return z->chunk ? z->nchunk : (z->size + ZIN_BLOCK - 1) / ZIN_BLOCK;
+}
+
+/* chunk holding decompressed byte pos */
+Uint32 zin_find(Zin *z, Uint64 pos)
+{
+    Uint32 lo = 0, hi;
+
+    if (!z->chunk) {
+        return pos / ZIN_BLOCK;
+    }
+    hi = z->nchunk;
+    while (hi - lo > 1) {
+        Uint32 mid = (lo + hi) / 2;
+        if (z->chunk[mid].doff <= pos) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/* fill e with its chunk, any thread */
+void zin_decode(ZEntry *e)
+{
+    Zin *z = e->z;
+    Uint32 k = e->chunk;
+    Uint32 size = zin_dsize(z, k);
+    Uint8 *in = NULL;
+    Uint32 ok = 0;
+
+    if (e->cap < size) {
+        mem_free(e->data);
+        e->data = mem_alloc(size, MEM_CHUNK);
+        e->cap = e->data ? size : 0;
+    }
+    if (!e->data) {
+        goto done;
+    }
+    if (!z->chunk) {
+        Uint64 skip;
+        SDL_mutexP(z->slock);
+        if (z->sdone > zin_doff(z, k) && !zin_restart(z)) {
+            SDL_mutexV(z->slock);
+            goto done;
+        }
+        for (skip = zin_doff(z, k) - z->sdone; skip && !z->eof;) {
+            Uint32 n = skip < (1 << 30) ? skip : (1 << 30);
+            skip -= zin_stream(z, NULL, n);
+        }
+        ok = zin_stream(z, e->data, size) == size;
+        SDL_mutexV(z->slock);
+        goto done;
+    }
+
+    in = mem_alloc(z->chunk[k].csize, MEM_SCRATCH);
+    if (!in || pread(z->fd, in, z->chunk[k].csize, z->chunk[k].coff)
+               != (ssize_t)z->chunk[k].csize) {
+        goto done;
+    }
+    if (z->kind == ZIN_ZSTD) {
+#ifdef HAVE_ZSTD
+        size_t r = ZSTD_decompress(e->data, size, in, z->chunk[k].csize);
+        ok = !ZSTD_isError(r) && r == size;
+#endif
+    } else {
+#ifdef HAVE_LZMA
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block block;
+        size_t in_pos, out_pos = 0;
+
+        memset(&block, 0, sizeof(block));
+        block.check = z->xz_check;
+        block.filters = filters;
+        block.header_size = lzma_block_header_size_decode(in[0]);
+        if (lzma_block_header_decode(&block, NULL, in) == LZMA_OK) {
+            in_pos = block.header_size;
+            ok = lzma_block_buffer_decode(&block, NULL, in, &in_pos,
+                                          z->chunk[k].csize, e->data,
+                                          &out_pos, size) == LZMA_OK
+                 && out_pos == size;
+            for (Uint32 i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++) {
+                free(filters[i].options);
+            }
+        }
+#endif
+    }
+done:
+    mem_free(in);
+    if (!ok) {
+        DIE("Error decompressing chunk %d\n", k);
+    }
+    SDL_mutexP(z->lock);
+    e->size = ok ? size : 0;
+    e->state = ok ? ZIN_READY : ZIN_ERROR;
+    SDL_CondBroadcast(z->done);
+    SDL_mutexV(z->lock);
+}
+
+void zin_job(void *arg, Uint32 worker)
+{
+    ZEntry *e = arg;
+    Zin *z = e->z;
+
+    (void)worker;
+    zin_decode(e);
+    SDL_mutexP(z->lock);
+    z->jobs--;
+    SDL_CondBroadcast(z->done);
+    SDL_mutexV(z->lock);
+}
+
+/* least recently used entry outside chunks lo..hi, z->lock held */
+ZEntry *zin_victim(Zin *z, Uint32 lo, Uint32 hi)
+{
+    ZEntry *v = NULL;
+
+    for (Uint32 i = 0; i < ZIN_CACHE; i++) {
+        ZEntry *e = &z->cache[i];
+        if (e->state == ZIN_LOADING
+            || (e->chunk >= lo && e->chunk <= hi && e->state == ZIN_READY)) {
+            continue;
+        }
+        if (!v || e->used < v->used) {
+            v = e;
+        }
+    }
+    return v;
+}
+
+/* entry holding chunk k, decoded here unless a job is on it */
+ZEntry *zin_get(Zin *z, Uint32 k)
+{
+    ZEntry *e = NULL;
+
+    SDL_mutexP(z->lock);
+    for (;;) {
+        for (Uint32 i = 0; i < ZIN_CACHE && !e; i++) {
+            if (z->cache[i].chunk == k && z->cache[i].state != ZIN_EMPTY) {
+                e = &z->cache[i];
+            }
+        }
+        if (!e || e->state != ZIN_LOADING) {
+            break;
+        }
+        SDL_CondWait(z->done, z->lock);
+        e = NULL;
+    }
+    if (e && e->state == ZIN_ERROR) {
+        /* try again */
+        e->state = ZIN_EMPTY;
+        e = NULL;
+    }
+    if (!e) {
+        e = zin_victim(z, k, k);
+        if (!e) {
+            SDL_mutexV(z->lock);
+            return NULL;
+        }
+        e->chunk = k;
+        e->state = ZIN_LOADING;
+        SDL_mutexV(z->lock);
+        zin_decode(e);
+        SDL_mutexP(z->lock);
+    }
+    e->used = ++z->tick;
+    if (e->state != ZIN_READY) {
+        e = NULL;
+    }
+    SDL_mutexV(z->lock);
+    return e;
+}
+
+/* queue the chunks of the next ZIN_AHEAD frames */
+void zin_ahead(Zin *z)
+{
+    Uint64 end = z->pos + (Uint64)ZIN_AHEAD * P.raw_frame_size;
+    Uint32 lo = zin_find(z, z->pos);
+    Uint32 n = zin_nchunk(z);
+
+    SDL_mutexP(z->lock);
+    for (Uint32 k = lo; k < n && zin_doff(z, k) < end; k++) {
+        ZEntry *e = NULL;
+        for (Uint32 i = 0; i < ZIN_CACHE && !e; i++) {
+            if (z->cache[i].chunk == k
+                && (z->cache[i].state == ZIN_READY
+                    || z->cache[i].state == ZIN_LOADING)) {
+                e = &z->cache[i];
+            }
+        }
+        if (e) {
+            continue;
+        }
+        if (!z->chunk && z->jobs) {
+            /* a stream decodes one chunk after the other */
+            break;
+        }
+        e = zin_victim(z, lo, zin_find(z, end));
+        if (!e) {
+            break;
+        }
+        e->chunk = k;
+        e->state = ZIN_LOADING;
+        e->used = ++z->tick;
+        z->jobs++;
+        if (!pool_submit(pool_get(), zin_job, e)) {
+            e->state = ZIN_EMPTY;
+            z->jobs--;
+            break;
+        }
+        if (!z->chunk) {
+            break;
+        }
+    }
+    SDL_mutexV(z->lock);
+}
+
+ssize_t zin_read(void *cookie, char *buf, size_t size)
+{
+    Zin *z = cookie;
+    size_t got = 0;
+
+    while (got < size && z->pos < z->size) {
+        Uint32 k = zin_find(z, z->pos);
+        ZEntry *e = zin_get(z, k);
+        Uint64 at, n;
+        if (!e) {
+            return got ? (ssize_t)got : -1;
+        }
+        at = z->pos - zin_doff(z, k);
+        n = e->size - at;
+        if (n > size - got) {
+            n = size - got;
+        }
+        memcpy(buf + got, e->data + at, n);
+        got += n;
+        z->pos += n;
+    }
+    if (z->ahead && got) {
+        zin_ahead(z);
+    }
+    return got;
+}
+
+int zin_seek(void *cookie, off64_t *pos, int whence)
+{
+    Zin *z = cookie;
+    off64_t base = whence == SEEK_SET ? 0
+                   : whence == SEEK_CUR ? (off64_t)z->pos : (off64_t)z->size;
+
+    if (base + *pos < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+    z->pos = base + *pos;
+    *pos = z->pos;
+    return 0;
+}
+
+int zin_close(void *cookie)
+{
+    Zin *z = cookie;
+
+    if (z->lock) {
+        SDL_mutexP(z->lock);
+        while (z->jobs) {
+            SDL_CondWait(z->done, z->lock);
+        }
+        SDL_mutexV(z->lock);
+    }
+    for (Uint32 i = 0; i < ZIN_CACHE; i++) {
+        mem_free(z->cache[i].data);
+    }
+    zin_stream_end(z);
+    SDL_DestroyCond(z->done);
+    SDL_DestroyMutex(z->lock);
+    SDL_DestroyMutex(z->slock);
+    free(z->chunk);
+    mem_free(z->inbuf);
+    mem_free(z->sink);
+    close(z->fd);
+    free(z);
+    return 0;
+}
+
+/* index or size of the input, then the FILE */
+FILE *zin_open(Zin *z, const char *name)
+{
+    static const char *kinds[] = {"", "gzip", "xz", "zstd"};
+    cookie_io_functions_t io = {zin_read, NULL, zin_seek, zin_close};
+    struct stat st;
+    FILE *fp;
+    Uint32 big = 0;
+
+    for (Uint32 i = 0; i < ZIN_CACHE; i++) {
+        z->cache[i].z = z;
+        z->cache[i].chunk = (Uint32)-1;
+    }
+    z->lock = SDL_CreateMutex();
+    z->slock = SDL_CreateMutex();
+    z->done = SDL_CreateCond();
+    z->inbuf = mem_alloc(ZIN_IN, MEM_CHUNK);
+    z->sink = mem_alloc(ZIN_IN, MEM_CHUNK);
+    if (fstat(z->fd, &st) != 0 || !z->lock || !z->slock || !z->done
+        || !z->inbuf || !z->sink || !zin_stream_init(z)) {
+        DIE("%s: %s input not supported by this build\n", name,
+            kinds[z->kind]);
+        zin_close(z);
+        return NULL;
+    }
+    if ((z->kind == ZIN_ZSTD && zin_index_zstd(z, st.st_size))
+        || (z->kind == ZIN_XZ && zin_index_xz(z, st.st_size))) {
+        for (Uint32 k = 0; k < z->nchunk; k++) {
+            big |= z->chunk[k].dsize > ZIN_MAX_CHUNK;
+        }
+    }
+    if (z->chunk && (big || z->nchunk < 2)) {
+        /* one huge chunk, decode it as a stream */
+        free(z->chunk);
+        z->chunk = NULL;
+    }
+#ifdef HAVE_ZSTD
+    if (!z->size && z->kind == ZIN_ZSTD) {
+        void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, z->fd, 0);
+        if (map != MAP_FAILED) {
+            Uint64 n = ZSTD_findDecompressedSize(map, st.st_size);
+            if (n != ZSTD_CONTENTSIZE_UNKNOWN && n != ZSTD_CONTENTSIZE_ERROR) {
+                z->size = n;
+            }
+            munmap(map, st.st_size);
+        }
+    }
+#endif
+    if (!z->size) {
+        /* gzip too: its ISIZE is modulo 4 GiB and of the last member only */
+        printf("%s: no size stored, decompressing it once\n", name);
+        while (!z->eof) {
+            zin_stream(z, NULL, ZIN_IN);
+        }
+        z->size = z->sdone;
+        zin_restart(z);
+    }
+    printf("%s: %s, %llu bytes, %s\n", name, kinds[z->kind],
+           (unsigned long long)z->size,
+           z->chunk ? "random access" : "sequential");
+
+    fp = fopencookie(z, "rb", io);
+    if (!fp) {
+        zin_close(z);
+    }
+    return fp;
+}
+
+/* fopen(name, "rb"), decompressing when the data is compressed;
+ * ahead: decode upcoming frames on the workers */
+FILE *zfopen(const char *name, bool ahead)
+{
+    Uint8 magic[8];
+    Zin *z;
+    int fdn;
+    ssize_t n;
+
+    if (!strncmp(name, NET_SCHEME, strlen(NET_SCHEME))) {
+        return net_open(name);
+    }
+    fdn = open(name, O_RDONLY);
+    if (fdn < 0) {
+        return NULL;
+    }
+    n = read(fdn, magic, sizeof(magic));
+    if (n <= 0 || !zin_magic(magic, n)) {
+        close(fdn);
+        return fopen(name, "rb");
+    }
+    z = calloc(1, sizeof(Zin));
+    if (!z) {
+        close(fdn);
+        return NULL;
+    }
+    z->fd = fdn;
+    z->kind = zin_magic(magic, n);
+    z->ahead = ahead;
+    return zin_open(z, name);
+}
+
+Uint32 frame_count(FILE *fp)
+{
+    struct stat st;
+
+    if (fileno(fp) < 0) {
+        /* decompressing, see zfopen() */
+        off_t pos = ftello(fp);
+        fseeko(fp, 0, SEEK_END);
+        st.st_size = ftello(fp);
+        fseeko(fp, pos, SEEK_SET);
+    } else if (fstat(fileno(fp), &st) != 0) {
+        perror("fstat");
+        return 0;
+    }
+    if (st.st_size < P.origin) {
+        return 0;
+    }
+    return (st.st_size - P.origin) / P.raw_frame_size;
+}
+
+off_t frame_offset(Uint32 index)
+{
+    return P.origin + (off_t)index * P.raw_frame_size;
+}
+
+/* position input(s) so that the next read_frame() returns frame #index */
+Uint32 seek_frame(Uint32 index)
+{
+    off_t pos = frame_offset(index);
+
+    P.next = index;
+    if (gCmp.on) {
+        /* every input is positioned when decoded */
+        gCmp.index = index;
+        return 1;
+    }
+    gUring.next = index;
+    if (gTemp.on) {
+        /* positioned when a frame is decoded, the ring may have it */
+        return 1;
+    }
+    if (fseeko(fd, pos, SEEK_SET) != 0) {
+        return 0;
+    }
+    if (P.diff && fseeko(P.fd2, pos, SEEK_SET) != 0) {
+        return 0;
+    }
+    return 1;
+}
+
+/* Contact sheet
+ * cols x rows thumbnails of frames first, first + step, ... tiled into one
+ * YV12 overlay of the window size. Thumbnails are decoded by the worker
+ * pool through the regular gFmtMap readers and cached per frame index, so
+ * paging back and forth or changing the step only decodes new frames.
+ */
+#define SHEET_MAX_DIM 8
+#define SHEET_CACHE_SIZE (256 << 20) /* bytes of thumbnails kept around */
+#define EVENT_SHEET_READY 1          /* SDL_USEREVENT code */
+
+enum {
+    THUMB_EMPTY = 0,
+    THUMB_PENDING,
+    THUMB_READY,
+};
+
+typedef struct Thumb {
+    Uint8 *data;              /* tw x th luma, then tw/2 x th/2 Cb and Cr */
+    Uint32 state;             /* THUMB_EMPTY, THUMB_PENDING or THUMB_READY */
+} Thumb;
+
+struct sheet {
+    bool on;
+    Uint32 cols;              /* tiles per row */
+    Uint32 rows;              /* tiles per column */
+    Uint32 step;              /* frames between two neighbour tiles */
+    Uint32 first;             /* frame index shown in top-left tile */
+    Uint32 tw;                /* tile width - in pixels */
+    Uint32 th;                /* tile height - in pixels */
+    Uint32 nframes;           /* frames in file */
+    Uint32 cached;            /* thumbnails kept right now */
+    Uint32 max_cached;
+    Thumb *thumb;             /* one per frame in file */
+    FILE **fd;                /* one input per pool worker */
+    Frame *frame;             /* one decode buffer per pool worker */
+    Uint32 nworker;
+    SDL_mutex *lock;          /* protects thumb[], cached and paging */
+    bool redraw_pending;      /* EVENT_SHEET_READY already queued */
+    SDL_Overlay *overlay;
+};
+
+struct sheet gSheet;
+
+void sheet_layout(void)
+{
+    gSheet.tw = (P.width / gSheet.cols) & ~1;
+    gSheet.th = (P.height / gSheet.rows) & ~1;
+    gSheet.max_cached = mem_cap(SHEET_CACHE_SIZE)
+                        / (gSheet.tw * gSheet.th * 3 / 2);
+    /* never evict the page on screen */
+    if (gSheet.max_cached < 3 * gSheet.cols * gSheet.rows) {
+        gSheet.max_cached = 3 * gSheet.cols * gSheet.rows;
+    }
+}
+
+/* nearest-neighbour downscale of one decoded frame into a thumbnail */
+void sheet_scale(Frame *f, Uint8 *dst)
+{
+    Uint32 tw = gSheet.tw, th = gSheet.th;
+    Uint8 *y = dst;
+    Uint8 *cb = y + tw * th;
+    Uint8 *cr = cb + tw * th / 4;
+    Uint8 *row;
+
+    if (gFmtMap[FORMAT].drawer == draw_422) {
+        /* packed, 4 bytes for 2 pels */
+        for (Uint32 i = 0; i < th; i++) {
+            row = f->raw + (i * P.height / th) * P.width * 2;
+            for (Uint32 j = 0; j < tw; j++) {
+                *y++ = row[(j * P.width / tw) * 2 + P.y_start_pos];
+            }
+        }
+        for (Uint32 i = 0; i < th / 2; i++) {
+            row = f->raw + (i * 2 * P.height / th) * P.width * 2;
+            for (Uint32 j = 0; j < tw / 2; j++) {
+                Uint32 o = (j * 2 * P.width / tw) / 2 * 4;
+                *cb++ = row[o + P.cb_start_pos];
+                *cr++ = row[o + P.cr_start_pos];
+            }
+        }
+        return;
+    }
+
+    for (Uint32 i = 0; i < th; i++) {
+        row = f->y_data + (i * P.height / th) * P.width;
+        for (Uint32 j = 0; j < tw; j++) {
+            *y++ = row[j * P.width / tw];
+        }
+    }
+    for (Uint32 i = 0; i < th / 2; i++) {
+        Uint32 o = (i * P.height / th) * (P.width / 2);
+        for (Uint32 j = 0; j < tw / 2; j++) {
+            *cb++ = f->cb_data[o + j * P.width / tw];
+            *cr++ = f->cr_data[o + j * P.width / tw];
+        }
+    }
+}
+
+/* called with gSheet.lock held, drop the thumbnail furthest off the
+ * page on screen, bytes freed, 0 if only the page is left */
+Uint32 sheet_evict_one(void)
+{
+    Uint32 span = gSheet.cols * gSheet.rows * gSheet.step;
+    Uint32 victim = 0, far = 0, dist;
+
+    for (Uint32 i = 0; i < gSheet.nframes; i++) {
+        if (!gSheet.thumb[i].data) {
+            continue;
+        }
+        if (i < gSheet.first) {
+            dist = gSheet.first - i;
+        } else if (i >= gSheet.first + span) {
+            dist = i - gSheet.first - span + 1;
+        } else {
+            continue;
+        }
+        if (dist > far) {
+            far = dist;
+            victim = i;
+        }
+    }
+    if (!far) {
+        return 0;
+    }
+    mem_free(gSheet.thumb[victim].data);
+    gSheet.thumb[victim].data = NULL;
+    gSheet.thumb[victim].state = THUMB_EMPTY;
+    gSheet.cached--;
+    return gSheet.tw * gSheet.th * 3 / 2;
+}
+
+/* called with gSheet.lock held, make room for one more thumbnail */
+void sheet_evict(void)
+{
+    while (gSheet.cached >= gSheet.max_cached && sheet_evict_one()) {
+    }
+}
+
+/* MemReclaim, any thread but one holding gSheet.lock */
+Uint64 sheet_reclaim(Uint64 need)
+{
+    Uint64 got = 0;
+    Uint32 n = 1;
+
+    SDL_LockMutex(gSheet.lock);
+    while (got < need && n) {
+        n = sheet_evict_one();
+        got += n;
+    }
+    SDL_UnlockMutex(gSheet.lock);
+    return got;
+}
+
+void sheet_job(void *arg, Uint32 worker)
+{
+    Uint32 index = (uintptr_t)arg;
+    Uint32 span, size, evicted;
+    Uint8 *data = NULL;
+    FILE *fp = gSheet.fd[worker];
+    Frame *f = &gSheet.frame[worker];
+    SDL_Event ev;
+
+    SDL_LockMutex(gSheet.lock);
+    span = gSheet.cols * gSheet.rows * gSheet.step;
+    if (index + span < gSheet.first || index >= gSheet.first + 2 * span) {
+        /* paged away meanwhile, a later request picks it up again */
+        gSheet.thumb[index].state = THUMB_EMPTY;
+        SDL_UnlockMutex(gSheet.lock);
+        return;
+    }
+    SDL_UnlockMutex(gSheet.lock);
+
+    size = gSheet.tw * gSheet.th * 3 / 2;
+    data = mem_alloc(size, MEM_THUMB);
+    if (!data) {
+        /* over the memory budget, make room in the cache */
+        SDL_LockMutex(gSheet.lock);
+        evicted = sheet_evict_one();
+        SDL_UnlockMutex(gSheet.lock);
+        data = evicted ? mem_alloc(size, MEM_THUMB) : NULL;
+    }
+    if (data && fseeko(fp, frame_offset(index), SEEK_SET) == 0
+        && dec_read(&P.dec, fp, f)) {
+        sheet_scale(f, data);
+    } else {
+        mem_free(data);
+        data = NULL;
+    }
+
+    SDL_LockMutex(gSheet.lock);
+    if (data) {
+        sheet_evict();
+        gSheet.thumb[index].data = data;
+        gSheet.cached++;
+    }
+    /* a failed decode stays READY without data, drawn as blank tile */
+    gSheet.thumb[index].state = THUMB_READY;
+    if (!gSheet.redraw_pending) {
+        gSheet.redraw_pending = true;
+        ev.type = SDL_USEREVENT;
+        ev.user.code = EVENT_SHEET_READY;
+        ev.user.data1 = NULL;
+        ev.user.data2 = NULL;
+        SDL_PushEvent(&ev);
+    }
+    SDL_UnlockMutex(gSheet.lock);
+}
+
+/* queue current page first, then the pages after and before it */
+void sheet_request(void)
+{
+    Uint32 n = gSheet.cols * gSheet.rows;
+    Uint32 span = n * gSheet.step;
+    Sint64 page[3] = {gSheet.first,
+                      (Sint64)gSheet.first + span,
+                      (Sint64)gSheet.first - span};
+
+    SDL_LockMutex(gSheet.lock);
+    for (Uint32 p = 0; p < COUNT_OF(page); p++) {
+        for (Uint32 t = 0; t < n; t++) {
+            Sint64 index = page[p] + (Sint64)t * gSheet.step;
+            if (index < 0 || index >= gSheet.nframes) {
+                continue;
+            }
+            if (gSheet.thumb[index].state == THUMB_EMPTY) {
+                gSheet.thumb[index].state = THUMB_PENDING;
+                pool_submit(gPool, sheet_job, (void *)(uintptr_t)index);
+            }
+        }
+    }
+    SDL_UnlockMutex(gSheet.lock);
+}
+
+/* stop background work and forget every thumbnail */
+void sheet_flush(void)
+{
+    pool_cancel(gPool, sheet_job);
+    pool_wait(gPool);
+    SDL_LockMutex(gSheet.lock);
+    for (Uint32 i = 0; i < gSheet.nframes; i++) {
+        mem_free(gSheet.thumb[i].data);
+        gSheet.thumb[i].data = NULL;
+        gSheet.thumb[i].state = THUMB_EMPTY;
+    }
+    gSheet.cached = 0;
+    SDL_UnlockMutex(gSheet.lock);
+}
+
+void sheet_draw(void)
+{
+    SDL_Overlay *o = gSheet.overlay;
+    Uint32 tw = gSheet.tw, th = gSheet.th;
+    /* YV12 overlay: Y + V + U, same as draw_yv12() */
+    Uint8 *dst_cb = o->pixels[2], *dst_cr = o->pixels[1];
+
+    if (P.is_change_uv) {
+        SWAP(dst_cb, dst_cr, Uint8 *);
+    }
+
+    SDL_LockYUVOverlay(o);
+    memset(o->pixels[0], 0x10, o->pitches[0] * P.height);
+    memset(o->pixels[1], 0x80, o->pitches[1] * P.height / 2);
+    memset(o->pixels[2], 0x80, o->pitches[2] * P.height / 2);
+
+    SDL_LockMutex(gSheet.lock);
+    gSheet.redraw_pending = false;
+    for (Uint32 r = 0; r < gSheet.rows; r++) {
+        for (Uint32 c = 0; c < gSheet.cols; c++) {
+            Uint32 index = gSheet.first + (r * gSheet.cols + c) * gSheet.step;
+            Uint8 *t, *dy, *db, *dr;
+            if (index >= gSheet.nframes) {
+                continue;
+            }
+            dy = o->pixels[0] + r * th * o->pitches[0] + c * tw;
+            t = gSheet.thumb[index].data;
+            if (!t) {
+                /* still decoding */
+                for (Uint32 i = 0; i < th; i++) {
+                    memset(dy + i * o->pitches[0], 0x40, tw);
+                }
+                continue;
+            }
+            db = dst_cb + r * th / 2 * o->pitches[2] + c * tw / 2;
+            dr = dst_cr + r * th / 2 * o->pitches[1] + c * tw / 2;
+            for (Uint32 i = 0; i < th; i++) {
+                memcpy(dy + i * o->pitches[0], t + i * tw, tw);
+            }
+            t += tw * th;
+            for (Uint32 i = 0; i < th / 2; i++) {
+                memcpy(db + i * o->pitches[2], t + i * tw / 2, tw / 2);
+                memcpy(dr + i * o->pitches[1], t + (th / 2 + i) * tw / 2, tw / 2);
+            }
+        }
+    }
+    SDL_UnlockMutex(gSheet.lock);
+
+    /* dark 2 pel separators between tiles */
+    for (Uint32 r = 1; r < gSheet.rows; r++) {
+        memset(o->pixels[0] + r * th * o->pitches[0], 0x10, P.width);
+        memset(o->pixels[0] + (r * th - 1) * o->pitches[0], 0x10, P.width);
+    }
+    for (Uint32 c = 1; c < gSheet.cols; c++) {
+        for (Uint32 y = 0; y < P.height; y++) {
+            o->pixels[0][y * o->pitches[0] + c * tw - 1] = 0x10;
+            o->pixels[0][y * o->pitches[0] + c * tw] = 0x10;
+        }
+    }
+    SDL_UnlockYUVOverlay(o);
+
+    set_zoom_rect();
+    video_rect.x = 0;
+    video_rect.y = 0;
+    video_rect.w = P.zoom_width;
+    video_rect.h = P.zoom_height;
+    display_overlay(o);
+}
+
+Uint32 sheet_open(Uint32 first)
+{
+    if (!gSheet.cols) {
+        gSheet.cols = gSheet.rows = 4;
+        gSheet.step = 1;
+    }
+    gSheet.nframes = frame_count(fd);
+    if (!gSheet.nframes || !pool_get()) {
+        return 0;
+    }
+    gSheet.nworker = gPool->nworker;
+    gSheet.fd = calloc(gSheet.nworker, sizeof(FILE *));
+    gSheet.frame = calloc(gSheet.nworker, sizeof(Frame));
+    gSheet.thumb = calloc(gSheet.nframes, sizeof(Thumb));
+    gSheet.lock = SDL_CreateMutex();
+    gSheet.overlay = SDL_CreateYUVOverlay(P.width, P.height,
+                                          SDL_YV12_OVERLAY, screen);
+    if (!gSheet.fd || !gSheet.frame || !gSheet.thumb
+        || !gSheet.lock || !gSheet.overlay) {
+        DIE("Error creating contact sheet\n");
+        sheet_close();
+        return 0;
+    }
+    for (Uint32 i = 0; i < gSheet.nworker; i++) {
+        gSheet.fd[i] = zfopen(P.filename, false);
+        if (!gSheet.fd[i] || !frame_alloc(&P.dec, &gSheet.frame[i])) {
+            DIE("Error opening file=%s\n", P.filename);
+            sheet_close();
+            return 0;
+        }
+    }
+
+    sheet_layout();
+    gSheet.first = first < gSheet.nframes ? first : 0;
+    gSheet.cached = 0;
+    mem_reclaimer(MEM_THUMB, sheet_reclaim);
+    gSheet.redraw_pending = false;
+    gSheet.on = true;
+    sheet_request();
+    sheet_draw();
+    return 1;
+}
+
+void sheet_close(void)
+{
+    mem_reclaimer(MEM_THUMB, NULL);
+    if (gPool && gSheet.thumb) {
+        sheet_flush();
+    }
+    for (Uint32 i = 0; gSheet.fd && i < gSheet.nworker; i++) {
+        if (gSheet.fd[i]) {
+            fclose(gSheet.fd[i]);
+        }
+        frame_free(&gSheet.frame[i]);
+    }
+    free(gSheet.fd);
+    free(gSheet.frame);
+    free(gSheet.thumb);
+    gSheet.fd = NULL;
+    gSheet.frame = NULL;
+    gSheet.thumb = NULL;
+    if (gSheet.lock) {
+        SDL_DestroyMutex(gSheet.lock);
+        gSheet.lock = NULL;
+    }
+    if (gSheet.overlay) {
+        SDL_FreeYUVOverlay(gSheet.overlay);
+        gSheet.overlay = NULL;
+    }
+    gSheet.on = false;
+}
+
+/* keys while the contact sheet is shown, 1 when consumed */
+Uint32 sheet_key(SDLKey key)
+{
+    Uint32 span = gSheet.cols * gSheet.rows * gSheet.step;
+
+    switch (key) {
+        case SDLK_RIGHT: /* next page */
+        case SDLK_PAGEDOWN:
+            if (gSheet.first + span >= gSheet.nframes) {
+                return 1;
+            }
+            SDL_LockMutex(gSheet.lock);
+            gSheet.first += span;
+            SDL_UnlockMutex(gSheet.lock);
+            break;
+        case SDLK_LEFT: /* previous page */
+        case SDLK_PAGEUP:
+            SDL_LockMutex(gSheet.lock);
+            gSheet.first = gSheet.first > span ? gSheet.first - span : 0;
+            SDL_UnlockMutex(gSheet.lock);
+            break;
+        case SDLK_RIGHTBRACKET: /* more, smaller tiles */
+        case SDLK_LEFTBRACKET: /* fewer, bigger tiles */
+            if ((key == SDLK_RIGHTBRACKET && gSheet.cols == SHEET_MAX_DIM)
+                || (key == SDLK_LEFTBRACKET && gSheet.cols == 1)) {
+                return 1;
+            }
+            /* thumbnails have the old tile size */
+            sheet_flush();
+            if (key == SDLK_RIGHTBRACKET) {
+                gSheet.cols++;
+                gSheet.rows++;
+            } else {
+                gSheet.cols--;
+                gSheet.rows--;
+            }
+            sheet_layout();
+            break;
+        case SDLK_EQUALS: /* wider frame range */
+        case SDLK_PLUS:
+            SDL_LockMutex(gSheet.lock);
+            gSheet.step *= 2;
+            SDL_UnlockMutex(gSheet.lock);
+            break;
+        case SDLK_MINUS: /* narrower frame range */
+            if (gSheet.step == 1) {
+                return 1;
+            }
+            SDL_LockMutex(gSheet.lock);
+            gSheet.step /= 2;
+            SDL_UnlockMutex(gSheet.lock);
+            break;
+        case SDLK_q:
+        case SDLK_t: /* closed by event_loop() */
+            return 0;
+        default:
+            return 1;
+    }
+    sheet_request();
+    sheet_draw();
+    return 1;
+}
+
+/* frame index of the tile under the mouse, -1 if none */
+Sint32 sheet_pick(Uint32 mouse_x, Uint32 mouse_y)
+{
+    Uint32 c = mouse_x * P.width / P.zoom_width / gSheet.tw;
+    Uint32 r = mouse_y * P.height / P.zoom_height / gSheet.th;
+    Uint32 index;
+
+    if (c >= gSheet.cols || r >= gSheet.rows) {
+        return -1;
+    }
+    index = gSheet.first + (r * gSheet.cols + c) * gSheet.step;
+    if (index >= gSheet.nframes) {
+        return -1;
+    }
+    return index;
+}
+
+/* Reverse play
+ * Frames before the playhead are decoded by the worker pool into a ring
+ * of REV_DEPTH buffers, the nearest first, each worker reading from its
+ * own input like the contact sheet does. Showing a frame swaps its
+ * buffers with P.frame and queues the next one down, so the playhead
+ * only waits when decoding a frame takes longer than showing one.
+ */
+#define REV_DEPTH 8                  /* frames decoded behind the playhead */
+
+enum {
+    REV_FREE = 0,
+    REV_BUSY,                 /* queued or decoding */
+    REV_READY,
+    REV_ERROR,
+};
+
+struct RevSlot {
+    Frame f;
+    Sint64 index;             /* frame held or being decoded, -1 for none */
+    Uint32 state;
+};
+
+struct rev {
+    bool on;
+    FILE **fd;                /* one input per pool worker */
+    Uint32 nworker;
+    RevSlot slot[REV_DEPTH];
+    Uint32 need;              /* planes the slots are read with */
+    Uint32 jobs;              /* decode jobs queued or running */
+    bool stop;                /* closing, queued jobs return at once */
+    SDL_mutex *lock;          /* slots and jobs */
+    SDL_cond *done;           /* a slot finished decoding */
+};
+
+struct rev gRev;
+
+void rev_job(void *arg, Uint32 worker)
+{
+    RevSlot *s = arg;
+    FILE *fp = gRev.fd[worker];
+    Uint32 ok;
+
+    SDL_LockMutex(gRev.lock);
+    if (gRev.stop) {
+        s->state = REV_FREE;
+        gRev.jobs--;
+        SDL_CondBroadcast(gRev.done);
+        SDL_UnlockMutex(gRev.lock);
+        return;
+    }
+    SDL_UnlockMutex(gRev.lock);
+
+    s->f.need = gRev.need;
+    ok = fseeko(fp, frame_offset(s->index), SEEK_SET) == 0
+         && dec_read(&P.dec, fp, &s->f);
+
+    SDL_LockMutex(gRev.lock);
+    s->state = ok ? REV_READY : REV_ERROR;
+    gRev.jobs--;
+    SDL_CondBroadcast(gRev.done);
+    SDL_UnlockMutex(gRev.lock);
+}
+
+/* called with gRev.lock held, queue frames next, next-1, ... */
+void rev_fill(Sint64 next)
+{
+    for (Sint64 index = next; index >= 0 && index > next - REV_DEPTH; index--) {
+        RevSlot *s = NULL;
+        Uint32 i;
+        for (i = 0; i < REV_DEPTH && gRev.slot[i].index != index; i++) {
+        }
+        if (i < REV_DEPTH) {
+            continue;
+        }
+        /* a free slot, or one already passed or out of the window */
+        for (i = 0; i < REV_DEPTH && !s; i++) {
+            RevSlot *t = &gRev.slot[i];
+            if (t->state != REV_BUSY
+                && (t->index < 0 || t->index > next
+                    || t->index <= next - REV_DEPTH)) {
+                s = t;
+            }
+        }
+        if (!s) {
+            return;
+        }
+        s->index = index;
+        s->state = REV_BUSY;
+        gRev.jobs++;
+        if (!pool_submit(gPool, rev_job, s)) {
+            s->index = -1;
+            s->state = REV_FREE;
+            gRev.jobs--;
+            return;
+        }
+    }
+}
+
+Uint32 rev_open(void)
+{
+    if (!pool_get()) {
+        return 0;
+    }
+    gRev.nworker = gPool->nworker;
+    gRev.fd = calloc(gRev.nworker, sizeof(FILE *));
+    gRev.lock = SDL_CreateMutex();
+    gRev.done = SDL_CreateCond();
+    if (!gRev.fd || !gRev.lock || !gRev.done) {
+        DIE("Error starting reverse play\n");
+        rev_close();
+        return 0;
+    }
+    for (Uint32 i = 0; i < gRev.nworker; i++) {
+        gRev.fd[i] = zfopen(P.filename, false);
+        if (!gRev.fd[i]) {
+            DIE("Error opening file=%s\n", P.filename);
+            rev_close();
+            return 0;
+        }
+    }
+    for (Uint32 i = 0; i < REV_DEPTH; i++) {
+        if (!frame_alloc(&P.dec, &gRev.slot[i].f)) {
+            rev_close();
+            return 0;
+        }
+        gRev.slot[i].index = -1;
+        gRev.slot[i].state = REV_FREE;
+    }
+    gRev.need = view_planes();
+    gRev.jobs = 0;
+    gRev.stop = false;
+    gRev.on = true;
+    return 1;
+}
+
+void rev_close(void)
+{
+    if (gRev.lock) {
+        /* queued jobs still point at the slots, let them drain */
+        SDL_LockMutex(gRev.lock);
+        gRev.stop = true;
+        while (gRev.jobs) {
+            SDL_CondWait(gRev.done, gRev.lock);
+        }
+        SDL_UnlockMutex(gRev.lock);
+    }
+    for (Uint32 i = 0; gRev.fd && i < gRev.nworker; i++) {
+        if (gRev.fd[i]) {
+            fclose(gRev.fd[i]);
+        }
+    }
+    for (Uint32 i = 0; i < REV_DEPTH; i++) {
+        frame_free(&gRev.slot[i].f);
+    }
+    free(gRev.fd);
+    gRev.fd = NULL;
+    if (gRev.done) {
+        SDL_DestroyCond(gRev.done);
+        gRev.done = NULL;
+    }
+    if (gRev.lock) {
+        SDL_DestroyMutex(gRev.lock);
+        gRev.lock = NULL;
+    }
+    gRev.on = false;
+}
+
+/* frame #index into P.frame, the frames before it are queued behind */
+Uint32 rev_read(Uint32 index)
+{
+    RevSlot *s = NULL;
+    Uint32 ok;
+
+    if (!gRev.on || gCmp.on || diff_view()) {
+        /* no prefetch, seek and decode in place */
+        return seek_frame(index) && read_frame();
+    }
+    SDL_LockMutex(gRev.lock);
+    rev_fill(index);
+    for (Uint32 i = 0; i < REV_DEPTH && !s; i++) {
+        if (gRev.slot[i].index == index) {
+            s = &gRev.slot[i];
+        }
+    }
+    if (!s) {
+        SDL_UnlockMutex(gRev.lock);
+        return 0;
+    }
+    while (s->state == REV_BUSY) {
+        SDL_CondWait(gRev.done, gRev.lock);
+    }
+    ok = s->state == REV_READY;
+    if (ok) {
+        SWAP(P.frame, s->f, Frame);
+        P.next = index + 1;
+    }
+    s->index = -1;
+    s->state = REV_FREE;
+    if (index > 0) {
+        rev_fill((Sint64)index - 1);
+    }
+    SDL_UnlockMutex(gRev.lock);
+    if (ok && gLut.custom) {
+        lut_apply();
+    }
+    return ok;
+}
+
+/* Timeline
+ * A bar at the bottom of the window shows where the frame on screen is.
+ * Dragging it with the left button shows a low resolution luma proxy of
+ * the frame under the mouse, the full frame is decoded when the button is
+ * released. Proxies are built by the worker pool for every frame, the one
+ * under the mouse first. 8 bit planar luma is read subsampled, every div
+ * th row only, other formats are decoded and subsampled. Each job builds
+ * PROXY_BATCH frames and queues itself again, so other pool work isn't
+ * starved. Digits followed by return go to that frame.
+ */
+
+/* formats whose first plane is the 8 bit luma, read without decoding */
+bool proxy_direct(void)
+{
+    switch (FORMAT) {
+        case YV12:
+        case IYUV:
+        case YV16:
+        case YUV444P:
+        case MONO:
+        case NV12:
+        case NV21:
+            return true;
+        default:
+            return false;
+    }
+}
+
+Uint32 proxy_build(Uint32 index, Uint32 worker, Uint8 *dst)
+{
+    FILE *fp = gLine.fd[worker];
+    Uint32 w = P.width, div = gLine.div;
+
+    if (proxy_direct()) {
+        Uint8 *row = gLine.row[worker];
+        for (Uint32 r = 0; r < gLine.ph; r++) {
+            off_t pos = frame_offset(index) + P.plane[0].gap
+                        + (off_t)(r * div) * P.plane[0].stride;
+            if (fileno(fp) < 0) {
+                /* decompressing, see zfopen() */
+                if (fseeko(fp, pos, SEEK_SET) != 0 || !rd(fp, row, w)) {
+                    return 0;
+                }
+            } else if (pread(fileno(fp), row, w, pos) != (ssize_t)w) {
+                return 0;
+            }
+            for (Uint32 c = 0; c < gLine.pw; c++) {
+                *dst++ = row[c * div];
+            }
+        }
+        return 1;
+    }
+
+    Frame *f = &gLine.frame[worker];
+    if (fseeko(fp, frame_offset(index), SEEK_SET) != 0
+        || !dec_read(&P.dec, fp, f)) {
+        return 0;
+    }
+    for (Uint32 r = 0; r < gLine.ph; r++) {
+        if (gFmtMap[FORMAT].drawer == draw_422) {
+            /* packed, 4 bytes for 2 pels */
+            Uint8 *row = f->raw + (size_t)(r * div) * w * 2 + P.y_start_pos;
+            for (Uint32 c = 0; c < gLine.pw; c++) {
+                *dst++ = row[c * div * 2];
+            }
+        } else {
+            Uint8 *row = f->y_data + (size_t)(r * div) * w;
+            for (Uint32 c = 0; c < gLine.pw; c++) {
+                *dst++ = row[c * div];
+            }
+        }
+    }
+    return 1;
+}
+
+/* called with gLine.lock held, next frame to build or -1 */
+Sint64 proxy_next(void)
+{
+    if (gLine.want >= 0 && gLine.state[gLine.want] == PROXY_EMPTY) {
+        return gLine.want;
+    }
+    while (gLine.sweep < gLine.nframes
+           && gLine.state[gLine.sweep] != PROXY_EMPTY) {
+        gLine.sweep++;
+    }
+    return gLine.sweep < gLine.nframes ? (Sint64)gLine.sweep : -1;
+}
+
+void proxy_job(void *arg, Uint32 worker)
+{
+    Uint32 size = gLine.pw * gLine.ph;
+    SDL_Event ev;
+    (void)arg;
+
+    for (Uint32 k = 0; k < PROXY_BATCH; k++) {
+        Sint64 index;
+        Uint32 ok;
+
+        SDL_LockMutex(gLine.lock);
+        index = gLine.stop ? -1 : proxy_next();
+        if (index < 0) {
+            SDL_UnlockMutex(gLine.lock);
+            break;
+        }
+        gLine.state[index] = PROXY_PENDING;
+        SDL_UnlockMutex(gLine.lock);
+
+        ok = proxy_build(index, worker, gLine.proxy + (size_t)index * size);
+
+        SDL_LockMutex(gLine.lock);
+        if (!ok) {
+            /* drawn black, not tried again */
+            memset(gLine.proxy + (size_t)index * size, 0x10, size);
+        }
+        gLine.state[index] = PROXY_READY;
+        if (gLine.scrub && index == gLine.scrub_index
+            && !gLine.redraw_pending) {
+            gLine.redraw_pending = true;
+            ev.type = SDL_USEREVENT;
+            ev.user.code = EVENT_PROXY_READY;
+            ev.user.data1 = NULL;
+            ev.user.data2 = NULL;
+            SDL_PushEvent(&ev);
+        }
+        SDL_UnlockMutex(gLine.lock);
+    }
+
+    SDL_LockMutex(gLine.lock);
+    if (gLine.stop || proxy_next() < 0
+        || !pool_submit(gPool, proxy_job, NULL)) {
+        gLine.jobs--;
+        SDL_CondBroadcast(gLine.done);
+    }
+    SDL_UnlockMutex(gLine.lock);
+}
+
+/* start building proxies for every frame */
+Uint32 line_open(void)
+{
+    Uint32 size;
+
+    gLine.nframes = frame_count(fd);
+    if (!gLine.nframes || !pool_get()) {
+        return 0;
+    }
+    gLine.div = PROXY_MIN_DIV;
+    while (gLine.div < PROXY_MAX_DIV
+           && (Uint64)gLine.nframes * (P.width / gLine.div)
+              * (P.height / gLine.div) > mem_cap(PROXY_CACHE_SIZE)) {
+        gLine.div *= 2;
+    }
+    gLine.pw = P.width / gLine.div;
+    gLine.ph = P.height / gLine.div;
+    size = gLine.pw * gLine.ph;
+    gLine.nworker = gPool->nworker;
+    gLine.proxy = mem_alloc((size_t)gLine.nframes * size, MEM_PROXY);
+    gLine.state = calloc(gLine.nframes, 1);
+    gLine.fd = calloc(gLine.nworker, sizeof(FILE *));
+    gLine.frame = calloc(gLine.nworker, sizeof(Frame));
+    gLine.row = calloc(gLine.nworker, sizeof(Uint8 *));
+    gLine.lock = SDL_CreateMutex();
+    gLine.done = SDL_CreateCond();
+    if (!gLine.proxy || !gLine.state || !gLine.fd || !gLine.frame
+        || !gLine.row || !gLine.lock || !gLine.done) {
+        DIE("Error creating timeline\n");
+        line_close();
+        return 0;
+    }
+    for (Uint32 i = 0; i < gLine.nworker; i++) {
+        gLine.fd[i] = zfopen(P.filename, false);
+        gLine.row[i] = malloc(P.width);
+        if (!gLine.fd[i] || !gLine.row[i]
+            || (!proxy_direct() && !frame_alloc(&P.dec, &gLine.frame[i]))) {
+            DIE("Error opening file=%s\n", P.filename);
+            line_close();
+            return 0;
+        }
+        /* proxies are grey */
+        gLine.frame[i].need = PLANE_Y;
+    }
+    gLine.sweep = 0;
+    gLine.want = -1;
+    gLine.stop = false;
+    gLine.redraw_pending = false;
+    SDL_LockMutex(gLine.lock);
+    for (Uint32 i = 0; i < gLine.nworker; i++) {
+        if (pool_submit(gPool, proxy_job, NULL)) {
+            gLine.jobs++;
+        }
+    }
+    SDL_UnlockMutex(gLine.lock);
+    printf("timeline: %d frames, %dx%d proxies\n",
+           gLine.nframes, gLine.pw, gLine.ph);
+    return 1;
+}
+
+/* stop building and forget every proxy */
+void line_close(void)
+{
+    if (gLine.lock) {
+        SDL_LockMutex(gLine.lock);
+        gLine.stop = true;
+        while (gLine.jobs) {
+            SDL_CondWait(gLine.done, gLine.lock);
+        }
+        SDL_UnlockMutex(gLine.lock);
+    }
+    for (Uint32 i = 0; gLine.fd && i < gLine.nworker; i++) {
+        if (gLine.fd[i]) {
+            fclose(gLine.fd[i]);
+        }
+        frame_free(&gLine.frame[i]);
+        free(gLine.row[i]);
+    }
+    free(gLine.fd);
+    free(gLine.frame);
+    free(gLine.row);
+    mem_free(gLine.proxy);
+    free(gLine.state);
+    gLine.fd = NULL;
+    gLine.frame = NULL;
+    gLine.row = NULL;
+    gLine.proxy = NULL;
+    gLine.state = NULL;
+    if (gLine.done) {
+        SDL_DestroyCond(gLine.done);
+        gLine.done = NULL;
+    }
+    if (gLine.lock) {
+        SDL_DestroyMutex(gLine.lock);
+        gLine.lock = NULL;
+    }
+    gLine.scrub = false;
+}
+
+/* luma of pel x, y of the overlay, planar or packed */
+Uint8 *line_pel(SDL_Overlay *o, Uint32 x, Uint32 y)
+{
+    if (o->planes == 1) {
+        Uint32 y0 = o->format == SDL_UYVY_OVERLAY ? 1 : 0;
+        return o->pixels[0] + y * o->pitches[0] + x * 2 + y0;
+    }
+    return o->pixels[0] + y * o->pitches[0] + x;
+}
+
+/* neutral chroma for rows y0..y1 of the overlay */
+void line_grey(SDL_Overlay *o, Uint32 y0, Uint32 y1)
+{
+    if (o->planes == 1) {
+        Uint32 c0 = o->format == SDL_UYVY_OVERLAY ? 0 : 1;
+        for (Uint32 y = y0; y < y1; y++) {
+            Uint8 *p = o->pixels[0] + y * o->pitches[0] + c0;
+            for (Uint32 x = 0; x < (Uint32)o->w; x++) {
+                p[x * 2] = 0x80;
+            }
+        }
+        return;
+    }
+    for (Uint32 y = y0 / 2; y < (y1 + 1) / 2; y++) {
+        memset(o->pixels[1] + y * o->pitches[1], 0x80, o->w / 2);
+        memset(o->pixels[2] + y * o->pitches[2], 0x80, o->w / 2);
+    }
+}
+
+/* bar over the bottom of the locked overlay, index marked */
+void line_bar(SDL_Overlay *o, Uint32 index)
+{
+    Uint32 h = o->h < LINE_BAR ? o->h : LINE_BAR;
+    Uint32 w = o->w;
+    Uint32 n = gLine.nframes;
+    Uint32 pos = n > 1 ? (Uint64)index * (w - 1) / (n - 1) : 0;
+
+    line_grey(o, o->h - h, o->h);
+    SDL_LockMutex(gLine.lock);
+    for (Uint32 y = o->h - h; y < (Uint32)o->h; y++) {
+        for (Uint32 x = 0; x < w; x++) {
+            Uint8 v = x < pos ? 0x90 : 0x30;
+            if (x + 1 >= pos && x <= pos + 1) {
+                v = 0xeb;
+            } else if (y == (Uint32)o->h - 1
+                       && gLine.state[(Uint64)x * n / w] == PROXY_READY) {
+                /* proxies built so far */
+                v = 0xb0;
+            }
+            *line_pel(o, x, y) = v;
+        }
+    }
+    SDL_UnlockMutex(gLine.lock);
+}
+
+/* proxy of frame index, upscaled into the overlay, while scrubbing */
+void line_show(Uint32 index)
+{
+    SDL_Overlay *o = my_overlay;
+    Uint8 *src;
+
+    SDL_LockMutex(gLine.lock);
+    gLine.redraw_pending = false;
+    if (gLine.state[index] != PROXY_READY) {
+        /* keep the last proxy until this one is built */
+        SDL_UnlockMutex(gLine.lock);
+        SDL_LockYUVOverlay(o);
+        line_bar(o, index);
+        SDL_UnlockYUVOverlay(o);
+        display_overlay(o);
+        return;
+    }
+    SDL_UnlockMutex(gLine.lock);
+
+    src = gLine.proxy + (size_t)index * gLine.pw * gLine.ph;
+    dirty_reset();
+    SDL_LockYUVOverlay(o);
+    for (Uint32 y = 0; y < (Uint32)o->h; y++) {
+        Uint32 sy = y / gLine.div < gLine.ph ? y / gLine.div : gLine.ph - 1;
+        Uint8 *row = src + sy * gLine.pw;
+        for (Uint32 x = 0; x < (Uint32)o->w; x++) {
+            Uint32 sx = x / gLine.div < gLine.pw ? x / gLine.div : gLine.pw - 1;
+            *line_pel(o, x, y) = row[sx];
+        }
+    }
+    line_grey(o, 0, o->h);
+    line_bar(o, index);
+    SDL_UnlockYUVOverlay(o);
+    display_overlay(o);
+}
+
+/* frame under mouse x while scrubbing, built next */
+void line_scrub(Uint32 mouse_x)
+{
+    Uint32 x = mouse_x * P.width / P.zoom_width;
+    Uint32 index = (Uint64)x * gLine.nframes / P.width;
+
+    if (index >= gLine.nframes) {
+        index = gLine.nframes - 1;
+    }
+    SDL_LockMutex(gLine.lock);
+    gLine.scrub = true;
+    gLine.scrub_index = index;
+    gLine.want = index;
+    SDL_UnlockMutex(gLine.lock);
+    line_show(index);
+}
+
+/* 1 when mouse y is on the bar */
+bool line_hit(Uint32 mouse_y)
+{
+    return gLine.on && !gSheet.on && !gCmp.on
+           && mouse_y * P.height / P.zoom_height + LINE_BAR >= P.height;
+}
+
+/* show frame #index, clamped to the input */
+Uint32 goto_frame(Uint32 index, Uint32 *frame)
+{
+    Uint32 count = gCmp.on ? gCmp.nframes : frame_count(fd);
+
+    if (!count) {
+        return 0;
+    }
+    if (index >= count) {
+        index = count - 1;
+    }
+    if (gSheet.on) {
+        sheet_close();
+    }
+    if (!seek_frame(index) || !read_frame()) {
+        return 0;
+    }
+    draw_frame();
+    *frame = index + 1;
+    return 1;
+}
+
+/* goto digits and the timeline switch, 1 when consumed */
+Uint32 line_key(SDLKey key, Uint32 *frame)
+{
+    if (key >= SDLK_0 && key <= SDLK_9) {
+        if (gLine.golen + 1 < sizeof(gLine.go)) {
+            gLine.go[gLine.golen++] = '0' + key - SDLK_0;
+            gLine.go[gLine.golen] = '\0';
+        }
+        return 1;
+    }
+    if (key == SDLK_n) {
+        gLine.on = !gLine.on;
+        if (gLine.on && !gLine.proxy && !line_open()) {
+            gLine.on = false;
+        }
+        if (!gSheet.on && *frame) {
+            draw_frame();
+        }
+        return 1;
+    }
+    if (!gLine.golen) {
+        return 0;
+    }
+    switch (key) {
+        case SDLK_RETURN:
+        case SDLK_KP_ENTER:
+            /* frames are numbered from 1, as in the caption */
+            goto_frame(atoi(gLine.go) > 1 ? atoi(gLine.go) - 1 : 0, frame);
+            /* fall through */
+        case SDLK_ESCAPE:
+            gLine.golen = 0;
+            gLine.go[0] = '\0';
+            return 1;
+        case SDLK_BACKSPACE:
+            gLine.go[--gLine.golen] = '\0';
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* Sequence QC
+ * Every frame of the input is decoded by the worker pool, QC_CHUNK
+ * frames per job, and its luma reduced in one pass to mean, variance,
+ * min, max, pels outside 16..235, mean abs difference of neighbouring
+ * pels and mean abs difference to the frame before. qc_flags() marks
+ * black, frozen, repeated and likely corrupt frames from those numbers;
+ * --qc writes them all to a report, PAGEDOWN and PAGEUP jump to the next
+ * and previous flagged frame.
+ */
+#define QC_CHUNK 32                  /* frames per job */
+#define QC_BLACK_MEAN 24.0           /* black: mean luma at most .. */
+#define QC_FLAT_VAR 16.0             /* .. and a variance below */
+#define QC_FROZEN_DIFF 0.25          /* frozen: mean abs diff below */
+#define QC_NOISE_GRAD 40.0           /* corrupt: neighbour diff above */
+#define QC_SPIKE 4.0                 /* corrupt: diff in and out times .. */
+#define QC_SPIKE_MIN 8.0             /* .. the one around, at least this */
+
+enum {
+    QC_BLACK = 1,
+    QC_FROZEN = 2,
+    QC_DUP = 4,                      /* bit exact repeat of the frame before */
+    QC_CORRUPT = 8,
+};
+
+enum {
+    QC_TODO = 0,
+    QC_BUSY,
+    QC_DONE,
+};
+
+struct QcSum {
+    Uint64 sum;
+    Uint64 sq;
+    Uint64 sad;               /* to the frame before */
+    Uint64 grad;              /* to the pel on the right */
+    Uint32 clip;              /* pels outside 16..235 */
+    Uint8 min;
+    Uint8 max;
+};
+
+struct QcStat {
+    double mean;              /* luma */
+    double var;
+    double grad;              /* mean abs diff of horizontal neighbours */
+    double diff;              /* mean abs diff to the frame before, -1 for none */
+    Uint32 clip;
+    Uint8 min;
+    Uint8 max;
+    bool same;                /* every plane equal to the frame before */
+    bool bad;                 /* could not be read */
+};
+
+struct qc {
+    char *report;             /* --qc, file name or - for stdout */
+    Uint32 nframes;
+    Uint32 nchunks;
+    QcStat *stat;             /* per frame */
+    Uint8 *state;             /* per chunk, QC_TODO, QC_BUSY or QC_DONE */
+    Uint32 sweep;             /* next chunk to scan */
+    Uint32 ready;             /* chunks done */
+    FILE **fd;                /* one input per pool worker */
+    Frame *frame;             /* two decode buffers per pool worker */
+    Uint32 nworker;
+    Uint32 jobs;              /* scan jobs queued or running */
+    bool stop;                /* closing, jobs return at once */
+    Uint32 start;             /* SDL_GetTicks() at qc_open() */
+    SDL_mutex *lock;          /* everything above from stat on */
+    SDL_cond *done;           /* a chunk finished */
+};
+
+struct qc gQc;
+
+void qc_luma(const Uint8 *y, const Uint8 *prev, Uint32 n, QcSum *s)
+{
+    Uint32 i = 0;
+
+    memset(s, 0, sizeof(*s));
+    s->min = 0xFF;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    __m128i one = _mm_set1_epi8(1);
+    __m128i lo = _mm_set1_epi8(16);
+    __m128i hi = _mm_set1_epi8((char)235);
+    __m128i vmin = _mm_set1_epi8((char)0xFF);
+    __m128i vmax = zero;
+    __m128i sum = zero, sq = zero, sad = zero, grad = zero, clip = zero;
+    Uint64 lane[2];
+    Uint8 b[16];
+    /* one more for the right neighbours */
+    for (; i + 17 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(y + i));
+        __m128i r = _mm_loadu_si128((const __m128i *)(y + i + 1));
+        __m128i vl = _mm_unpacklo_epi8(v, zero);
+        __m128i vh = _mm_unpackhi_epi8(v, zero);
+        /* 4 x 32 bit, each at most 4 * 255 * 255 */
+        __m128i q = _mm_add_epi32(_mm_madd_epi16(vl, vl),
+                                  _mm_madd_epi16(vh, vh));
+        /* 0 inside 16..235 */
+        __m128i out = _mm_or_si128(_mm_subs_epu8(lo, v),
+                                   _mm_subs_epu8(v, hi));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(v, zero));
+        grad = _mm_add_epi64(grad, _mm_sad_epu8(v, r));
+        sq = _mm_add_epi64(sq, _mm_unpacklo_epi32(q, zero));
+        sq = _mm_add_epi64(sq, _mm_unpackhi_epi32(q, zero));
+        clip = _mm_add_epi64(clip, _mm_sad_epu8(_mm_min_epu8(out, one), zero));
+        vmin = _mm_min_epu8(vmin, v);
+        vmax = _mm_max_epu8(vmax, v);
+        if (prev) {
+            __m128i p = _mm_loadu_si128((const __m128i *)(prev + i));
+            sad = _mm_add_epi64(sad, _mm_sad_epu8(v, p));
+        }
+    }
+    _mm_storeu_si128((__m128i *)lane, sum);
+    s->sum = lane[0] + lane[1];
+    _mm_storeu_si128((__m128i *)lane, sq);
+    s->sq = lane[0] + lane[1];
+    _mm_storeu_si128((__m128i *)lane, sad);
+    s->sad = lane[0] + lane[1];
+    _mm_storeu_si128((__m128i *)lane, grad);
+    s->grad = lane[0] + lane[1];
+    _mm_storeu_si128((__m128i *)lane, clip);
+    s->clip = lane[0] + lane[1];
+    _mm_storeu_si128((__m128i *)b, vmin);
+    for (Uint32 k = 0; k < 16; k++) {
+        s->min = b[k] < s->min ? b[k] : s->min;
+    }
+    _mm_storeu_si128((__m128i *)b, vmax);
+    for (Uint32 k = 0; k < 16; k++) {
+        s->max = b[k] > s->max ? b[k] : s->max;
+    }
+#endif
+    for (; i < n; i++) {
+        Uint8 v = y[i];
+        s->sum += v;
+        s->sq += v * v;
+        s->clip += v < 16 || v > 235;
+        s->min = v < s->min ? v : s->min;
+        s->max = v > s->max ? v : s->max;
+        if (i + 1 < n) {
+            s->grad += abs(v - y[i + 1]);
+        }
+        if (prev) {
+            s->sad += abs(v - prev[i]);
+        }
+    }
+}
+
+/* statistics of f, prev is the frame before or NULL, f NULL if unreadable */
+void qc_frame(const Frame *f, const Frame *prev, QcStat *st)
+{
+    QcSum s;
+
+    memset(st, 0, sizeof(*st));
+    st->diff = -1;
+    if (!f) {
+        st->bad = true;
+        return;
+    }
+    qc_luma(f->y_data, prev ? prev->y_data : NULL, P.y_size, &s);
+    st->mean = (double)s.sum / P.y_size;
+    st->var = (double)s.sq / P.y_size - st->mean * st->mean;
+    st->grad = (double)s.grad / P.y_size;
+    st->min = s.min;
+    st->max = s.max;
+    st->clip = s.clip;
+    if (prev) {
+        st->diff = (double)s.sad / P.y_size;
+        st->same = !s.sad && !memcmp(f->cb_data, prev->cb_data, P.cb_size)
+                   && !memcmp(f->cr_data, prev->cr_data, P.cr_size);
+    }
+}
+
+/* called with gQc.lock held, next chunk from the sweep on, -1 for none */
+Sint64 qc_next(void)
+{
+    for (Uint32 k = 0; k < gQc.nchunks; k++) {
+        Uint32 c = (gQc.sweep + k) % gQc.nchunks;
+        if (gQc.state[c] == QC_TODO) {
+            gQc.sweep = c + 1;
+            return c;
+        }
+    }
+    return -1;
+}
+
+/* called with gQc.lock held, any chunk still to scan, the sweep untouched */
+bool qc_left(void)
+{
+    for (Uint32 c = 0; c < gQc.nchunks; c++) {
+        if (gQc.state[c] == QC_TODO) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void qc_job(void *arg, Uint32 worker)
+{
+    Frame *cur = &gQc.frame[worker * 2];
+    Frame *prev = cur + 1;
+    FILE *fp = gQc.fd[worker];
+    Sint64 c;
+    (void)arg;
+
+    SDL_LockMutex(gQc.lock);
+    c = gQc.stop ? -1 : qc_next();
+    if (c >= 0) {
+        gQc.state[c] = QC_BUSY;
+    }
+    SDL_UnlockMutex(gQc.lock);
+
+    if (c >= 0) {
+        Uint32 first = c * QC_CHUNK;
+        Uint32 last = first + QC_CHUNK < gQc.nframes
+                      ? first + QC_CHUNK : gQc.nframes;
+        /* the frame before the chunk too, for the difference */
+        Uint32 i = first ? first - 1 : 0;
+        bool have = false;
+        Uint32 ok = fseeko(fp, frame_offset(i), SEEK_SET) == 0;
+
+        for (; i < last; i++) {
+            Frame *t;
+            ok = ok && dec_read(&P.dec, fp, cur);
+            if (i >= first) {
+                qc_frame(ok ? cur : NULL, have ? prev : NULL, &gQc.stat[i]);
+            }
+            have = ok;
+            t = cur;
+            cur = prev;
+            prev = t;
+        }
+    }
+
+    SDL_LockMutex(gQc.lock);
+    if (c >= 0) {
+        gQc.state[c] = QC_DONE;
+        gQc.ready++;
+    }
+    if (gQc.stop || !qc_left() || !pool_submit(gPool, qc_job, NULL)) {
+        gQc.jobs--;
+    }
+    SDL_CondBroadcast(gQc.done);
+    SDL_UnlockMutex(gQc.lock);
+}
+
+/* start scanning at frame first, the chunks before it last */
+Uint32 qc_open(Uint32 first)
+{
+    gQc.nframes = frame_count(fd);
+    if (!gQc.nframes || !pool_get()) {
+        return 0;
+    }
+    gQc.nchunks = (gQc.nframes + QC_CHUNK - 1) / QC_CHUNK;
+    gQc.nworker = gPool->nworker;
+    gQc.stat = calloc(gQc.nframes, sizeof(QcStat));
+    gQc.state = calloc(gQc.nchunks, 1);
+    gQc.fd = calloc(gQc.nworker, sizeof(FILE *));
+    gQc.frame = calloc(gQc.nworker * 2, sizeof(Frame));
+    gQc.lock = SDL_CreateMutex();
+    gQc.done = SDL_CreateCond();
+    if (!gQc.stat || !gQc.state || !gQc.fd || !gQc.frame || !gQc.lock
+        || !gQc.done) {
+        DIE("Error starting QC scan\n");
+        qc_close();
+        return 0;
+    }
+    for (Uint32 i = 0; i < gQc.nworker; i++) {
+        gQc.fd[i] = zfopen(P.filename, false);
+        if (!gQc.fd[i] || !frame_alloc(&P.dec, &gQc.frame[i * 2])
+            || !frame_alloc(&P.dec, &gQc.frame[i * 2 + 1])) {
+            DIE("Error opening file=%s\n", P.filename);
+            qc_close();
+            return 0;
+        }
+    }
+    gQc.sweep = first / QC_CHUNK;
+    gQc.ready = 0;
+    gQc.stop = false;
+    gQc.start = SDL_GetTicks();
+    SDL_LockMutex(gQc.lock);
+    for (Uint32 i = 0; i < gQc.nworker && i < gQc.nchunks; i++) {
+        if (pool_submit(gPool, qc_job, NULL)) {
+            gQc.jobs++;
+        }
+    }
+    SDL_UnlockMutex(gQc.lock);
+    return 1;
+}
+
+void qc_close(void)
+{
+    if (gQc.lock) {
+        SDL_LockMutex(gQc.lock);
+        gQc.stop = true;
+        while (gQc.jobs) {
+            SDL_CondWait(gQc.done, gQc.lock);
+        }
+        SDL_UnlockMutex(gQc.lock);
+    }
+    for (Uint32 i = 0; gQc.fd && i < gQc.nworker; i++) {
+        if (gQc.fd[i]) {
+            fclose(gQc.fd[i]);
+        }
+        frame_free(&gQc.frame[i * 2]);
+        frame_free(&gQc.frame[i * 2 + 1]);
+    }
+    free(gQc.fd);
+    free(gQc.frame);
+    free(gQc.stat);
+    free(gQc.state);
+    gQc.fd = NULL;
+    gQc.frame = NULL;
+    gQc.stat = NULL;
+    gQc.state = NULL;
+    if (gQc.done) {
+        SDL_DestroyCond(gQc.done);
+        gQc.done = NULL;
+    }
+    if (gQc.lock) {
+        SDL_DestroyMutex(gQc.lock);
+        gQc.lock = NULL;
+    }
+}
+
+/* difference of frame i to the one before, -1 if not known (yet) */
+double qc_diff(Uint32 i)
+{
+    if (i >= gQc.nframes || gQc.state[i / QC_CHUNK] != QC_DONE) {
+        return -1;
+    }
+    return gQc.stat[i].diff;
+}
+
+/* QC_* flags of scanned frame i, called with gQc.lock held */
+Uint32 qc_flags(Uint32 i)
+{
+    const QcStat *st = &gQc.stat[i];
+    Uint32 flags = 0;
+    double d0 = st->diff;
+    double d1 = qc_diff(i + 1);
+    double around = fmax(qc_diff(i - 1), qc_diff(i + 2));
+
+    if (st->bad) {
+        return QC_CORRUPT;
+    }
+    if (st->mean <= QC_BLACK_MEAN && st->var < QC_FLAT_VAR) {
+        flags |= QC_BLACK;
+    }
+    if (st->same) {
+        flags |= QC_DUP;
+    } else if (d0 >= 0 && d0 < QC_FROZEN_DIFF) {
+        flags |= QC_FROZEN;
+    }
+    if (st->grad > QC_NOISE_GRAD) {
+        /* noise, real pictures are smooth next to most pels */
+        flags |= QC_CORRUPT;
+    }
+    /* one odd frame: big change into it and out of it, little around */
+    if (!(flags & QC_BLACK) && around >= 0 && d0 >= QC_SPIKE_MIN
+        && d1 >= QC_SPIKE_MIN
+        && fmin(d0, d1) > QC_SPIKE * fmax(around, 1.0)) {
+        flags |= QC_CORRUPT;
+    }
+    return flags;
+}
+
+/* flag names joined by '|', "" for none */
+char *qc_names(Uint32 flags, char *buf, Uint32 size)
+{
+    static const char *name[] = {"black", "frozen", "dup", "corrupt"};
+    Uint32 n = 0;
+
+    buf[0] = '\0';
+    for (Uint32 k = 0; k < COUNT_OF(name); k++) {
+        if (flags & (1 << k)) {
+            n += snprintf(buf + n, size - n, "%s%s", n ? "|" : "", name[k]);
+        }
+    }
+    return buf;
+}
+
+/* --qc, scan the whole input and write one CSV line per frame */
+Uint32 qc_run(void)
+{
+    bool to_stdout = !strcmp(gQc.report, "-");
+    FILE *out = to_stdout ? stdout : fopen(gQc.report, "w");
+    FILE *log = to_stdout ? stderr : stdout;
+    Uint32 count[4] = {0};
+    Uint32 ms, ret = 0;
+    char buf[64];
+
+    setup_param();
+    if (!out) {
+        DIE("Error opening %s\n", gQc.report);
+        return 0;
+    }
+    if (gCmp.on || P.diff) {
+        DIE("--qc scans a single input\n");
+        goto cleanup;
+    }
+    if (!qc_open(0)) {
+        DIE("no frames to scan\n");
+        goto cleanup;
+    }
+    SDL_LockMutex(gQc.lock);
+    while (gQc.ready < gQc.nchunks && gQc.jobs) {
+        SDL_CondWait(gQc.done, gQc.lock);
+    }
+    SDL_UnlockMutex(gQc.lock);
+    ms = SDL_GetTicks() - gQc.start;
+
+    fprintf(out, "frame,mean,variance,min,max,clipped,gradient,diff,flags\n");
+    for (Uint32 i = 0; i < gQc.nframes; i++) {
+        const QcStat *st = &gQc.stat[i];
+        Uint32 flags = qc_flags(i);
+        for (Uint32 k = 0; k < COUNT_OF(count); k++) {
+            count[k] += (flags >> k) & 1;
+        }
+        fprintf(out, "%u,%.2f,%.2f,%u,%u,%u,%.2f,", i, st->mean, st->var,
+                st->min, st->max, st->clip, st->grad);
+        if (st->diff >= 0) {
+            fprintf(out, "%.3f", st->diff);
+        }
+        fprintf(out, ",%s\n", qc_names(flags, buf, sizeof(buf)));
+    }
+    fprintf(log, "qc: %d frames in %.2f s, %d black, %d frozen, %d dup, "
+            "%d corrupt\n", gQc.nframes, ms / 1e3, count[0], count[1],
+            count[2], count[3]);
+    ret = 1;
+cleanup:
+    qc_close();
+    if (!to_stdout && fclose(out) != 0) {
+        DIE("Error writing %s\n", gQc.report);
+        ret = 0;
+    }
+    return ret;
+}
+
+/* PAGEDOWN/PAGEUP, next or previous flagged frame, 1 when consumed */
+Uint32 qc_key(SDLKey key, Uint32 *frame)
+{
+    Uint32 cur = *frame ? *frame - 1 : 0;
+    Sint32 step = key == SDLK_PAGEDOWN ? 1 : -1;
+    Sint64 hit = -1;
+    Uint32 i, ready, flags = 0;
+    char buf[64];
+
+    if (key != SDLK_PAGEDOWN && key != SDLK_PAGEUP) {
+        return 0;
+    }
+    if (!gQc.stat && !qc_open(cur)) {
+        return 1;
+    }
+    SDL_LockMutex(gQc.lock);
+    /* only as far as the scan has come */
+    for (i = cur + step; i < gQc.nframes; i += step) {
+        if (gQc.state[i / QC_CHUNK] != QC_DONE) {
+            break;
+        }
+        flags = qc_flags(i);
+        if (flags) {
+            hit = i;
+            break;
+        }
+    }
+    ready = gQc.ready;
+    SDL_UnlockMutex(gQc.lock);
+
+    if (hit < 0) {
+        printf("qc: no flagged frame %s %d yet, %d%% scanned\n",
+               step > 0 ? "after" : "before", cur + 1,
+               ready * 100 / gQc.nchunks);
+        return 1;
+    }
+    if (goto_frame(hit, frame)) {
+        printf("qc: frame %d %s\n", *frame, qc_names(flags, buf, sizeof(buf)));
+    }
+    return 1;
+}
+
+/* Frame hashes
+ * --hash writes a CRC32C or XXH3 of every plane of every frame as it
+ * is stored in the file, padding left out, one "frame plane hash" line
+ * each. --verify hashes the input again and names the first frame and
+ * plane that differ from such a manifest, --verify-view also opens the
+ * viewer there with that plane alone. The worker pool hashes HASH_CHUNK
+ * frames per job, each worker with its own input.
+ */
+#define HASH_CHUNK 16                /* frames per job */
+#define EVENT_GOTO 4                 /* SDL_USEREVENT code, data1 = index */
+
+enum {
+    HASH_CRC32C = 0,
+    HASH_XXH3,                       /* needs libxxhash */
+    HASH_MAX,
+};
+
+const char *gHashName[HASH_MAX] = {"crc32c", "xxh3"};
+
+struct hash {
+    char *out;                /* --hash [ALGO:]FILE, - for stdout */
+    char *manifest;           /* --verify or --verify-view */
+    bool view;                /* --verify-view */
+    Uint32 algo;              /* HASH_* */
+    Uint32 nframes;
+    Uint32 nchunks;
+    Uint32 next;              /* next chunk to hash */
+    Uint64 *sum;              /* nframes x P.nplanes */
+    bool *bad;                /* per frame, could not be read */
+    Uint64 *want;             /* manifest, nframes x P.nplanes */
+    Uint8 *have;              /* plane is in the manifest */
+    Uint32 extra;             /* manifest frames past the end of the input */
+    Sint64 first;             /* first frame that differs, -1 for none */
+    Uint32 first_plane;
+    FILE **fd;                /* one input per pool worker */
+    Uint8 **buf;              /* one plane per pool worker */
+    Uint32 nworker;
+    Uint32 jobs;              /* hash jobs queued or running */
+    SDL_mutex *lock;          /* next and jobs */
+    SDL_cond *done;           /* a job finished */
+};
+
+struct hash gHash;
+
+Uint32 gCrc32c[8][256];
+bool gCrc32cHw;
+
+void crc32c_init(void)
+{
+    for (Uint32 n = 0; n < 256; n++) {
+        Uint32 c = n;
+        for (Uint32 k = 0; k < 8; k++) {
+            c = c & 1 ? 0x82F63B78 ^ (c >> 1) : c >> 1;
+        }
+        gCrc32c[0][n] = c;
+    }
+    /* slicing by 8, table s is a byte followed by s zero bytes */
+    for (Uint32 n = 0; n < 256; n++) {
+        for (Uint32 s = 1; s < 8; s++) {
+            Uint32 c = gCrc32c[s - 1][n];
+            gCrc32c[s][n] = (c >> 8) ^ gCrc32c[0][c & 0xFF];
+        }
+    }
+#ifdef HAVE_CRC32C_HW
+    gCrc32cHw = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+Uint32 crc32c_sw(Uint32 crc, const Uint8 *p, size_t n)
+{
+    crc = ~crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        Uint32 lo = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | (Uint32)p[3] << 24);
+        Uint32 hi = p[4] | p[5] << 8 | p[6] << 16 | (Uint32)p[7] << 24;
+        crc = gCrc32c[7][lo & 0xFF] ^ gCrc32c[6][(lo >> 8) & 0xFF]
+              ^ gCrc32c[5][(lo >> 16) & 0xFF] ^ gCrc32c[4][lo >> 24]
+              ^ gCrc32c[3][hi & 0xFF] ^ gCrc32c[2][(hi >> 8) & 0xFF]
+              ^ gCrc32c[1][(hi >> 16) & 0xFF] ^ gCrc32c[0][hi >> 24];
+    }
+    while (n--) {
+        crc = gCrc32c[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#ifdef HAVE_CRC32C_HW
+__attribute__((target("sse4.2")))
+Uint32 crc32c_hw(Uint32 crc, const Uint8 *p, size_t n)
+{
+    Uint64 c = ~crc;
+
+    for (; n >= 8; n -= 8, p += 8) {
+        Uint64 v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+    }
+    while (n--) {
+        c = _mm_crc32_u8((Uint32)c, *p++);
+    }
+    return ~(Uint32)c;
+}
+#endif
+
+Uint64 hash_data(const Uint8 *p, size_t n)
+{
+#ifdef HAVE_XXHASH
+    if (gHash.algo == HASH_XXH3) {
+        return XXH3_64bits(p, n);
+    }
+#endif
+#ifdef HAVE_CRC32C_HW
+    if (gCrc32cHw) {
+        return crc32c_hw(0, p, n);
+    }
+#endif
+    return crc32c_sw(0, p, n);
+}
+
+/* PLANE_* held by plane p of the file, see setup_planes() */
+Uint32 file_plane(Uint32 p)
+{
+    if (p == 0) {
+        return P.nplanes == 1 && FORMAT != MONO ? PLANE_ALL : PLANE_Y;
+    }
+    if (P.nplanes == 2) {
+        return PLANE_CB | PLANE_CR;
+    }
+    if (FORMAT == YV16 || FORMAT == YUV444P) {
+        /* read_planar_vu(), Cr first */
+        return p == 1 ? PLANE_CR : PLANE_CB;
+    }
+    return p == 1 ? PLANE_CB : PLANE_CR;
+}
+
+const char *plane_name(Uint32 p)
+{
+    switch (file_plane(p)) {
+        case PLANE_Y:
+            return "Y";
+        case PLANE_CB:
+            return "Cb";
+        case PLANE_CR:
+            return "Cr";
+        case PLANE_CB | PLANE_CR:
+            return "CbCr";
+        default:
+            return "YCbCr";
+    }
+}
+
+void hash_job(void *arg, Uint32 worker)
+{
+    FILE *fp = gHash.fd[worker];
+    Uint8 *buf = gHash.buf[worker];
+    Sint64 c;
+    (void)arg;
+
+    SDL_LockMutex(gHash.lock);
+    c = gHash.next < gHash.nchunks ? (Sint64)gHash.next++ : -1;
+    SDL_UnlockMutex(gHash.lock);
+
+    if (c >= 0) {
+        Uint32 first = c * HASH_CHUNK;
+        Uint32 last = first + HASH_CHUNK < gHash.nframes
+                      ? first + HASH_CHUNK : gHash.nframes;
+        for (Uint32 i = first; i < last; i++) {
+            Uint64 *sum = &gHash.sum[(size_t)i * P.nplanes];
+            Uint32 ok = fseeko(fp, frame_offset(i), SEEK_SET) == 0;
+            for (Uint32 p = 0; ok && p < P.nplanes; p++) {
+                ok = rd_plane(&P.dec, fp, buf, p);
+                if (ok) {
+                    sum[p] = hash_data(buf, P.plane[p].row * P.plane[p].rows);
+                }
+            }
+            gHash.bad[i] = !ok;
+        }
+    }
+
+    SDL_LockMutex(gHash.lock);
+    if (gHash.next >= gHash.nchunks || !pool_submit(gPool, hash_job, NULL)) {
+        gHash.jobs--;
+    }
+    SDL_CondBroadcast(gHash.done);
+    SDL_UnlockMutex(gHash.lock);
+}
+
+/* hash all of the input, wait for it */
+Uint32 hash_scan(void)
+{
+    Uint32 size = 0;
+
+    if (!pool_get()) {
+        return 0;
+    }
+    for (Uint32 p = 0; p < P.nplanes; p++) {
+        if (P.plane[p].row * P.plane[p].rows > size) {
+            size = P.plane[p].row * P.plane[p].rows;
+        }
+    }
+    gHash.nchunks = (gHash.nframes + HASH_CHUNK - 1) / HASH_CHUNK;
+    gHash.nworker = gPool->nworker;
+    gHash.sum = calloc((size_t)gHash.nframes * P.nplanes, sizeof(Uint64));
+    gHash.bad = calloc(gHash.nframes, sizeof(bool));
+    gHash.fd = calloc(gHash.nworker, sizeof(FILE *));
+    gHash.buf = calloc(gHash.nworker, sizeof(Uint8 *));
+    gHash.lock = SDL_CreateMutex();
+    gHash.done = SDL_CreateCond();
+    if (!gHash.sum || !gHash.bad || !gHash.fd || !gHash.buf || !gHash.lock
+        || !gHash.done) {
+        DIE("Error starting to hash\n");
+        return 0;
+    }
+    for (Uint32 i = 0; i < gHash.nworker; i++) {
+        gHash.fd[i] = zfopen(P.filename, false);
+        gHash.buf[i] = mem_alloc(size, MEM_SCRATCH);
+        if (!gHash.fd[i] || !gHash.buf[i]) {
+            DIE("Error opening file=%s\n", P.filename);
+            return 0;
+        }
+    }
+    gHash.next = 0;
+    SDL_LockMutex(gHash.lock);
+    for (Uint32 i = 0; i < gHash.nworker && i < gHash.nchunks; i++) {
+        if (pool_submit(gPool, hash_job, NULL)) {
+            gHash.jobs++;
+        }
+    }
+    while (gHash.jobs) {
+        SDL_CondWait(gHash.done, gHash.lock);
+    }
+    SDL_UnlockMutex(gHash.lock);
+    if (gHash.next < gHash.nchunks) {
+        DIE("Error starting to hash\n");
+        return 0;
+    }
+    return 1;
+}
+
+void hash_close(void)
+{
+    for (Uint32 i = 0; gHash.fd && i < gHash.nworker; i++) {
+        if (gHash.fd[i]) {
+            fclose(gHash.fd[i]);
+        }
+        mem_free(gHash.buf[i]);
+    }
+    free(gHash.fd);
+    free(gHash.buf);
+    free(gHash.sum);
+    free(gHash.bad);
+    free(gHash.want);
+    free(gHash.have);
+    gHash.fd = NULL;
+    gHash.buf = NULL;
+    gHash.sum = NULL;
+    gHash.bad = NULL;
+    gHash.want = NULL;
+    gHash.have = NULL;
+    if (gHash.done) {
+        SDL_DestroyCond(gHash.done);
+        gHash.done = NULL;
+    }
+    if (gHash.lock) {
+        SDL_DestroyMutex(gHash.lock);
+        gHash.lock = NULL;
+    }
+}
+
+/* HASH_* for name, HASH_MAX if unknown */
+Uint32 hash_algo(const char *name)
+{
+    Uint32 k;
+
+    for (k = 0; k < HASH_MAX && strcmp(name, gHashName[k]); k++) {
+    }
+    return k;
+}
+
+/* --hash, one line per plane after a header naming algorithm and input */
+Uint32 hash_write(void)
+{
+    bool to_stdout = !strcmp(gHash.out, "-");
+    FILE *out = to_stdout ? stdout : fopen(gHash.out, "w");
+    const char *fmt = showFmt(FORMAT);
+    int digits = gHash.algo == HASH_CRC32C ? 8 : 16;
+    Uint32 ret = 1;
+
+    if (!out) {
+        DIE("Error opening %s\n", gHash.out);
+        return 0;
+    }
+    fprintf(out, "# yv hash %s %ux%u %.*s\n", gHashName[gHash.algo],
+            P.width, P.height, (int)strcspn(fmt, " "), fmt);
+    for (Uint32 i = 0; i < gHash.nframes; i++) {
+        if (gHash.bad[i]) {
+            DIE("frame %u could not be read, not hashed\n", i);
+            ret = 0;
+            continue;
+        }
+        for (Uint32 p = 0; p < P.nplanes; p++) {
+            fprintf(out, "%u %u %0*llx\n", i, p, digits,
+                    (unsigned long long)gHash.sum[(size_t)i * P.nplanes + p]);
+        }
+    }
+    if (!to_stdout && fclose(out) != 0) {
+        DIE("Error writing %s\n", gHash.out);
+        ret = 0;
+    }
+    return ret;
+}
+
+/* read --verify's manifest, it also picks the algorithm */
+Uint32 hash_load(void)
+{
+    FILE *fp = fopen(gHash.manifest, "r");
+    const char *name = showFmt(FORMAT);
+    size_t count = (size_t)gHash.nframes * P.nplanes;
+    char line[256], algo[16], fmt[32];
+    Uint32 w, h, i, p, k, n = 1, ret = 0;
+    unsigned long long sum;
+
+    if (!fp) {
+        DIE("Error opening %s\n", gHash.manifest);
+        return 0;
+    }
+    if (!fgets(line, sizeof(line), fp)
+        || sscanf(line, "# yv hash %15s %ux%u %31s", algo, &w, &h, fmt) != 4
+        || (k = hash_algo(algo)) == HASH_MAX) {
+        DIE("%s is not a yv hash manifest\n", gHash.manifest);
+        goto cleanup;
+    }
+    if (w != P.width || h != P.height || strlen(fmt) != strcspn(name, " ")
+        || strncmp(fmt, name, strlen(fmt))) {
+        DIE("%s is for %ux%u %s, the input is %ux%u %s\n", gHash.manifest,
+            w, h, fmt, P.width, P.height, name);
+        goto cleanup;
+    }
+    gHash.algo = k;
+    gHash.want = calloc(count, sizeof(Uint64));
+    gHash.have = calloc(count, 1);
+    if (!gHash.want || !gHash.have) {
+        DIE("Error loading %s\n", gHash.manifest);
+        goto cleanup;
+    }
+    gHash.extra = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        n++;
+        if (line[0] == '#' || line[0] == '\n') {
+            continue;
+        }
+        if (sscanf(line, "%u %u %llx", &i, &p, &sum) != 3
+            || p >= P.nplanes) {
+            DIE("%s:%u: bad line\n", gHash.manifest, n);
+            goto cleanup;
+        }
+        if (i >= gHash.nframes) {
+            if (i + 1 - gHash.nframes > gHash.extra) {
+                gHash.extra = i + 1 - gHash.nframes;
+            }
+            continue;
+        }
+        gHash.want[(size_t)i * P.nplanes + p] = sum;
+        gHash.have[(size_t)i * P.nplanes + p] = 1;
+    }
+    ret = 1;
+cleanup:
+    fclose(fp);
+    return ret;
+}
+
+/* compare with the manifest, 1 if every plane of every frame matches */
+Uint32 hash_verify(void)
+{
+    FILE *log = gHash.out && !strcmp(gHash.out, "-") ? stderr : stdout;
+    int digits = gHash.algo == HASH_CRC32C ? 8 : 16;
+    Uint32 differ = 0, missing = 0;
+
+    gHash.first = -1;
+    for (Uint32 i = 0; i < gHash.nframes; i++) {
+        bool odd = false;
+        for (Uint32 p = 0; p < P.nplanes; p++) {
+            size_t k = (size_t)i * P.nplanes + p;
+            if (!gHash.have[k]) {
+                missing++;
+                continue;
+            }
+            if (gHash.bad[i] || gHash.sum[k] != gHash.want[k]) {
+                if (gHash.first < 0) {
+                    gHash.first = i;
+                    gHash.first_plane = p;
+                }
+                odd = true;
+            }
+        }
+        differ += odd;
+    }
+    if (gHash.first >= 0) {
+        Uint32 i = gHash.first, p = gHash.first_plane;
+        size_t k = (size_t)i * P.nplanes + p;
+        if (gHash.bad[i]) {
+            fprintf(log, "verify: first mismatch frame %u, could not be read\n",
+                    i);
+        } else {
+            fprintf(log, "verify: first mismatch frame %u plane %u (%s), "
+                    "expected %0*llx got %0*llx\n", i, p, plane_name(p),
+                    digits, (unsigned long long)gHash.want[k],
+                    digits, (unsigned long long)gHash.sum[k]);
+        }
+    }
+    fprintf(log, "verify: %u of %u frames differ", differ, gHash.nframes);
+    if (missing) {
+        fprintf(log, ", %u planes not in the manifest", missing);
+    }
+    if (gHash.extra) {
+        fprintf(log, ", %u frames in the manifest past the end of the input",
+                gHash.extra);
+    }
+    fprintf(log, "\n");
+    return !differ && !missing && !gHash.extra;
+}
+
+/* --hash and --verify, no window */
+Uint32 hash_run(void)
+{
+    FILE *log = gHash.out && !strcmp(gHash.out, "-") ? stderr : stdout;
+    char *colon = gHash.out ? strchr(gHash.out, ':') : NULL;
+    Uint32 algo = HASH_MAX, ms, ret = 0;
+    double mb = 0;
+
+    setup_param();
+    gHash.first = -1;
+    gHash.algo = HASH_CRC32C;
+    if (gCmp.on || P.diff) {
+        DIE("--hash and --verify hash a single input\n");
+        return 0;
+    }
+    if (colon) {
+        /* ALGO:FILE, a plain file name may have a colon too */
+        *colon = '\0';
+        algo = hash_algo(gHash.out);
+        *colon = ':';
+        if (algo < HASH_MAX) {
+            gHash.out = colon + 1;
+            gHash.algo = algo;
+        }
+    }
+    gHash.nframes = frame_count(fd);
+    if (!gHash.nframes) {
+        DIE("no frames to hash\n");
+        return 0;
+    }
+    if (gHash.manifest && !hash_load()) {
+        goto cleanup;
+    }
+    if (algo < HASH_MAX && algo != gHash.algo) {
+        DIE("%s has %s hashes\n", gHash.manifest, gHashName[gHash.algo]);
+        goto cleanup;
+    }
+#ifndef HAVE_XXHASH
+    if (gHash.algo == HASH_XXH3) {
+        DIE("xxh3 needs a build with libxxhash\n");
+        goto cleanup;
+    }
+#endif
+    crc32c_init();
+    ms = SDL_GetTicks();
+    if (!hash_scan()) {
+        goto cleanup;
+    }
+    ms = SDL_GetTicks() - ms;
+    for (Uint32 p = 0; p < P.nplanes; p++) {
+        mb += (double)gHash.nframes * P.plane[p].row * P.plane[p].rows / 1e6;
+    }
+    fprintf(log, "hash: %s%s, %u frames, %.1f MB in %.2f s, %.1f MB/s\n",
+            gHashName[gHash.algo],
+            gHash.algo == HASH_CRC32C && gCrc32cHw ? " (sse4.2)" : "",
+            gHash.nframes, mb, ms / 1e3, ms ? mb * 1e3 / ms : 0.0);
+    ret = 1;
+    if (gHash.out && !hash_write()) {
+        ret = 0;
+    }
+    if (gHash.manifest && !hash_verify()) {
+        ret = 0;
+    }
+cleanup:
+    hash_close();
+    return ret;
+}
+
+/* --verify-view, the first mismatch with its plane alone */
+void hash_show(void)
+{
+    SDL_Event ev;
+
+    switch (file_plane(gHash.first_plane)) {
+        case PLANE_Y:
+            P.y_only = ~P.y_only;
+            break;
+        case PLANE_CB:
+            P.cb_only = ~P.cb_only;
+            break;
+        case PLANE_CR:
+            P.cr_only = ~P.cr_only;
+            break;
+        default:
+            break;
+    }
+    memset(&ev, 0, sizeof(ev));
+    ev.type = SDL_USEREVENT;
+    ev.user.code = EVENT_GOTO;
+    ev.user.data1 = (void *)(uintptr_t)gHash.first;
+    SDL_PushEvent(&ev);
+}
+
+/* Compare view
+ * N inputs of the same size and format in one window, tiled or as a wipe
+ * between the first input and one other. Frame k of every visible input
+ * is decoded by the worker pool at the same time and each pane is then
+ * composed into one YV12 overlay by its own job, so cost follows the
+ * panes on screen. All panes share one frame index, magnification and
+ * pan position.
+ */
+Uint32 parse_compare(int argc, char **argv)
+{
+    Uint32 first;
+
+    if (argc >= 2 && !isdigit(argv[1][0])) {
+        /* FILE FILE2 .., geometry from first name */
+        if (!guess_arg(argv[0])) {
+            return 0;
+        }
+        first = 1;
+    } else if (argc >= 5) {
+        /* FILE WIDTH HEIGHT FORMAT FILE2 .. */
+        P.width = atoi(argv[1]);
+        P.height = atoi(argv[2]);
+        if (!parse_format(argv[3])) {
+            DIE("The format option '%s' is not recognized\n", argv[3]);
+            return 0;
+        }
+        first = 4;
+    } else {
+        return 0;
+    }
+
+    P.filename = argv[0];
+    gCmp.fname[gCmp.n++] = argv[0];
+    for (int i = first; i < argc; i++) {
+        if (gCmp.n == CMP_MAX) {
+            DIE("at most %d inputs to compare\n", CMP_MAX);
+            return 0;
+        }
+        gCmp.fname[gCmp.n++] = argv[i];
+    }
+    gCmp.on = true;
+    gCmp.mag = 1;
+    gCmp.wipe = 1;
+    printf("compare mode: %d inputs\n", gCmp.n);
+    return 1;
+}
+
+Uint32 cmp_open(void)
+{
+    gCmp.fd[0] = fd;
+    for (Uint32 i = 1; i < gCmp.n; i++) {
+        /* read by pool jobs, see fd in open_input() */
+        gCmp.fd[i] = zfopen(gCmp.fname[i], false);
+        if (!gCmp.fd[i]) {
+            DIE("Error opening %s\n", gCmp.fname[i]);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+void cmp_close(void)
+{
+    for (Uint32 i = 0; i < gCmp.n; i++) {
+        if (i && gCmp.fd[i]) {
+            fclose(gCmp.fd[i]);
+        }
+        gCmp.fd[i] = NULL;
+        frame_free(&gCmp.src[i]);
+    }
+    free(gCmp.xs);
+    gCmp.xs = NULL;
+    if (gCmp.overlay) {
+        SDL_FreeYUVOverlay(gCmp.overlay);
+        gCmp.overlay = NULL;
+    }
+}
+
+bool cmp_visible(Uint32 i)
+{
+    return gCmp.view == CMP_TILE || i == 0 || i == gCmp.wipe;
+}
+
+/* frame geometry changed, forget decoded frames */
+Uint32 cmp_reset(void)
+{
+    gCmp.nframes = 0;
+    for (Uint32 i = 0; i < gCmp.n; i++) {
+        Uint32 cnt = frame_count(gCmp.fd[i]);
+        if (i == 0 || cnt < gCmp.nframes) {
+            gCmp.nframes = cnt;
+        }
+        if (gCmp.src[i].raw && !frame_alloc(&P.dec, &gCmp.src[i])) {
+            return 0;
+        }
+        gCmp.have[i] = -1;
+    }
+    gCmp.index = 0;
+    return cmp_layout();
+}
+
+/* pane grid, overlay and window for the current view */
+Uint32 cmp_layout(void)
+{
+    if (gCmp.view == CMP_TILE) {
+        for (gCmp.cols = 1; gCmp.cols * gCmp.cols < gCmp.n; gCmp.cols++) {
+        }
+        gCmp.rows = (gCmp.n + gCmp.cols - 1) / gCmp.cols;
+    } else {
+        gCmp.cols = gCmp.rows = 1;
+    }
+    /* shrink panes until all of them fit in one overlay */
+    for (gCmp.div = 1; gCmp.cols * (P.width / gCmp.div) > CMP_MAX_W
+         || gCmp.rows * (P.height / gCmp.div) > CMP_MAX_H; gCmp.div++) {
+    }
+    gCmp.pw = (P.width / gCmp.div) & ~1;
+    gCmp.ph = (P.height / gCmp.div) & ~1;
+    gCmp.split = (gCmp.pw / 2) & ~1;
+    cmp_clamp();
+
+    free(gCmp.xs);
+    gCmp.xs = malloc(gCmp.pw * sizeof(Uint32));
+    if (gCmp.overlay) {
+        SDL_FreeYUVOverlay(gCmp.overlay);
+    }
+    gCmp.overlay = SDL_CreateYUVOverlay(gCmp.cols * gCmp.pw,
+                                        gCmp.rows * gCmp.ph,
+                                        SDL_YV12_OVERLAY, screen);
+    if (!gCmp.xs || !gCmp.overlay) {
+        DIE("Couldn't create compare overlay\n");
+        return 0;
+    }
+    set_zoom(P.zoom);
+    return 1;
+}
+
+/* keep the shown part of the frame inside the frame */
+void cmp_clamp(void)
+{
+    Sint32 max_x = P.width - gCmp.pw * gCmp.div / gCmp.mag;
+    Sint32 max_y = P.height - gCmp.ph * gCmp.div / gCmp.mag;
+
+    gCmp.pan_x = gCmp.pan_x > max_x ? max_x : gCmp.pan_x;
+    gCmp.pan_y = gCmp.pan_y > max_y ? max_y : gCmp.pan_y;
+    gCmp.pan_x = gCmp.pan_x < 0 ? 0 : gCmp.pan_x;
+    gCmp.pan_y = gCmp.pan_y < 0 ? 0 : gCmp.pan_y;
+}
+
+/* decode frame #index of every visible input not holding it yet */
+Uint32 cmp_decode(Uint32 index)
+{
+    ReadJob job[CMP_MAX];
+    void *arg[CMP_MAX];
+    Uint32 input[CMP_MAX];
+    Uint32 n = 0;
+    Uint32 ret = 1;
+
+    if (index >= gCmp.nframes) {
+        return 0;
+    }
+    for (Uint32 i = 0; i < gCmp.n; i++) {
+        if (!cmp_visible(i) || gCmp.have[i] == (Sint32)index) {
+            continue;
+        }
+        if (!gCmp.src[i].raw && !frame_alloc(&P.dec, &gCmp.src[i])) {
+            return 0;
+        }
+        if (fseeko(gCmp.fd[i], frame_offset(index), SEEK_SET) != 0) {
+            return 0;
+        }
+        job[n].d = &P.dec;
+        job[n].fp = gCmp.fd[i];
+        job[n].f = &gCmp.src[i];
+        job[n].ret = 0;
+        arg[n] = &job[n];
+        input[n++] = i;
+    }
+
+    pool_run(pool_get(), read_job, arg, n);
+    for (Uint32 k = 0; k < n; k++) {
+        gCmp.have[input[k]] = job[k].ret ? (Sint32)index : -1;
+        ret &= job[k].ret;
+    }
+    return ret;
+}
+
+Uint32 cmp_read(void)
+{
+    if (!cmp_decode(gCmp.index)) {
+        return 0;
+    }
+    gCmp.index++;
+    return 1;
+}
+
+/* compose columns x0..x1 of one pane, see cmp_draw() */
+void cmp_pane_job(void *arg, Uint32 worker)
+{
+    CmpPane *p = arg;
+    SDL_Overlay *o = gCmp.overlay;
+    Frame *f = &gCmp.src[p->input];
+    bool packed = gFmtMap[FORMAT].drawer == draw_422;
+    /* YV12 overlay: Y + V + U, same as draw_yv12() */
+    Uint8 *dst_cb = o->pixels[2], *dst_cr = o->pixels[1];
+    Uint32 pitch_cb = o->pitches[2], pitch_cr = o->pitches[1];
+    Uint32 *xs = gCmp.xs;
+    Uint8 *dy, *db, *dr, *row;
+
+    (void)worker;
+    if (P.is_change_uv) {
+        SWAP(dst_cb, dst_cr, Uint8 *);
+        SWAP(pitch_cb, pitch_cr, Uint32);
+    }
+
+    for (Uint32 i = 0; i < gCmp.ph; i++) {
+        Uint32 sy = gCmp.pan_y + i * gCmp.div / gCmp.mag;
+        dy = o->pixels[0] + (p->oy + i) * o->pitches[0] + p->ox;
+        if (gCmp.have[p->input] < 0) {
+            memset(dy + p->x0, 0x10, p->x1 - p->x0);
+        } else if (packed) {
+            row = f->raw + sy * P.width * 2 + P.y_start_pos;
+            for (Uint32 x = p->x0; x < p->x1; x++) {
+                dy[x] = row[xs[x] * 2];
+            }
+        } else if (gCmp.div == 1 && gCmp.mag == 1) {
+            memcpy(dy + p->x0, f->y_data + sy * P.width + xs[p->x0],
+                   p->x1 - p->x0);
+        } else {
+            row = f->y_data + sy * P.width;
+            for (Uint32 x = p->x0; x < p->x1; x++) {
+                dy[x] = row[xs[x]];
+            }
+        }
+    }
+
+    for (Uint32 i = 0; i < gCmp.ph / 2; i++) {
+        Uint32 sy = gCmp.pan_y + i * 2 * gCmp.div / gCmp.mag;
+        db = dst_cb + (p->oy / 2 + i) * pitch_cb + p->ox / 2;
+        dr = dst_cr + (p->oy / 2 + i) * pitch_cr + p->ox / 2;
+        if (gCmp.have[p->input] < 0) {
+            memset(db + p->x0 / 2, 0x80, (p->x1 - p->x0) / 2);
+            memset(dr + p->x0 / 2, 0x80, (p->x1 - p->x0) / 2);
+        } else if (packed) {
+            /* packed 422, take the chroma of the even rows */
+            row = f->raw + sy * P.width * 2;
+            for (Uint32 x = p->x0 / 2; x < p->x1 / 2; x++) {
+                Uint32 c = xs[x * 2] / 2 * 4;
+                db[x] = row[c + P.cb_start_pos];
+                dr[x] = row[c + P.cr_start_pos];
+            }
+        } else {
+            Uint32 off = sy / 2 * (P.width / 2);
+            for (Uint32 x = p->x0 / 2; x < p->x1 / 2; x++) {
+                db[x] = f->cb_data[off + xs[x * 2] / 2];
+                dr[x] = f->cr_data[off + xs[x * 2] / 2];
+            }
+        }
+    }
+}
+
+void cmp_draw(void)
+{
+    SDL_Overlay *o = gCmp.overlay;
+    CmpPane pane[CMP_MAX];
+    void *arg[CMP_MAX];
+    Uint32 n = 0;
+    Uint32 w = o->w, h = o->h;
+
+    if (P.flip_change_uv) {
+        P.flip_change_uv = false;
+        P.is_change_uv = !P.is_change_uv;
+    }
+    for (Uint32 x = 0; x < gCmp.pw; x++) {
+        gCmp.xs[x] = gCmp.pan_x + x * gCmp.div / gCmp.mag;
+    }
+
+    SDL_LockYUVOverlay(o);
+    if (gCmp.view == CMP_TILE) {
+        if (gCmp.n < gCmp.cols * gCmp.rows) {
+            /* blank tiles at the end */
+            memset(o->pixels[0], 0x10, o->pitches[0] * h);
+            memset(o->pixels[1], 0x80, o->pitches[1] * h / 2);
+            memset(o->pixels[2], 0x80, o->pitches[2] * h / 2);
+        }
+        for (n = 0; n < gCmp.n; n++) {
+            pane[n].input = n;
+            pane[n].ox = n % gCmp.cols * gCmp.pw;
+            pane[n].oy = n / gCmp.cols * gCmp.ph;
+            pane[n].x0 = 0;
+            pane[n].x1 = gCmp.pw;
+        }
+    } else {
+        pane[0].input = 0;
+        pane[1].input = gCmp.wipe;
+        pane[0].ox = pane[1].ox = 0;
+        pane[0].oy = pane[1].oy = 0;
+        pane[0].x0 = 0;
+        pane[0].x1 = pane[1].x0 = gCmp.split;
+        pane[1].x1 = gCmp.pw;
+        n = 2;
+    }
+    for (Uint32 i = 0; i < n; i++) {
+        arg[i] = &pane[i];
+    }
+    pool_run(pool_get(), cmp_pane_job, arg, n);
+
+    if (P.y_only) {
+        memset(o->pixels[1], 0x80, o->pitches[1] * h / 2);
+        memset(o->pixels[2], 0x80, o->pitches[2] * h / 2);
+    } else if (P.cb_only || P.cr_only) {
+        memset(o->pixels[0], 0x80, o->pitches[0] * h);
+        /* same planes as cb_only() and cr_only() */
+        memset(o->pixels[P.cb_only ? 1 : 2], 0x80, o->pitches[1] * h / 2);
+    }
+    if (gCmp.view == CMP_WIPE && gCmp.split < w) {
+        for (Uint32 y = 0; y < h; y++) {
+            o->pixels[0][y * o->pitches[0] + gCmp.split] = 0xeb;
+        }
+    }
+    SDL_UnlockYUVOverlay(o);
+
+    set_zoom_rect();
+    video_rect.x = 0;
+    video_rect.y = 0;
+    video_rect.w = P.zoom_width;
+    video_rect.h = P.zoom_height;
+    display_overlay(o);
+}
+
+/* show frame #index again, e.g. after the set of visible panes changed */
+void cmp_refresh(void)
+{
+    if (gCmp.index > 0) {
+        cmp_decode(gCmp.index - 1);
+    }
+    cmp_draw();
+}
+
+/* keys while comparing, 1 when consumed */
+Uint32 cmp_key(SDLKey key)
+{
+    Uint32 mag = gCmp.mag;
+
+    switch (key) {
+        case SDLK_w: /* tiles or wipe */
+            gCmp.view = gCmp.view == CMP_TILE ? CMP_WIPE : CMP_TILE;
+            cmp_layout();
+            break;
+        case SDLK_TAB: /* next input to wipe against */
+            if (gCmp.view != CMP_WIPE) {
+                return 1;
+            }
+            gCmp.wipe = gCmp.wipe + 1 < gCmp.n ? gCmp.wipe + 1 : 1;
+            printf("wipe %s | %s\n", gCmp.fname[0], gCmp.fname[gCmp.wipe]);
+            break;
+        case SDLK_UP: /* magnify all panes */
+        case SDLK_DOWN:
+            if (key == SDLK_UP && mag < CMP_MAX_MAG) {
+                gCmp.mag *= 2;
+            } else if (key == SDLK_DOWN && mag > 1) {
+                gCmp.mag /= 2;
+            } else {
+                return 1;
+            }
+            /* around the centre of the pane */
+            gCmp.pan_x += gCmp.pw * gCmp.div / mag / 2
+                          - gCmp.pw * gCmp.div / gCmp.mag / 2;
+            gCmp.pan_y += gCmp.ph * gCmp.div / mag / 2
+                          - gCmp.ph * gCmp.div / gCmp.mag / 2;
+            cmp_clamp();
+            break;
+        default:
+            return 0;
+    }
+    cmp_refresh();
+    return 1;
+}
+
+/* mouse moved by dx, dy window pels with a button held */
+void cmp_pan(Sint32 dx, Sint32 dy)
+{
+    gCmp.pan_x -= dx * (Sint32)(gCmp.overlay->w * gCmp.div)
+                  / (Sint32)(P.zoom_width * gCmp.mag);
+    gCmp.pan_y -= dy * (Sint32)(gCmp.overlay->h * gCmp.div)
+                  / (Sint32)(P.zoom_height * gCmp.mag);
+    cmp_clamp();
+    cmp_draw();
+}
+
+void cmp_split(Uint32 mouse_x)
+{
+    if (gCmp.view != CMP_WIPE) {
+        return;
+    }
+    gCmp.split = (mouse_x * gCmp.overlay->w / P.zoom_width) & ~1;
+    if (gCmp.split > gCmp.pw) {
+        gCmp.split = gCmp.pw;
+    }
+    cmp_draw();
+}
+
+void setup_param(void)
+{
+    P.wh = P.width * P.height;
+
+    switch (FORMAT) {
+        case YV12:
+        case IYUV:
+        case YV1210:
+        case NV12:
+        case NV1210:
+        case NV21:
+        case NV12TILED:
+        case NV1210TILED:
+        case NV12TILED4X4:
+        case NV12TILED16X16:
+        case NV12TILED64Z32:
+        case NV12TILEDY:
+        case NV12TILEDMT:
+        case MONO:
+            P.y_size = P.wh;
+            P.cb_size = P.cr_size = P.wh / 4;
+            break;
+        case YUY2:
+        case UYVY:
+        case YVYU:
+        case Y42210:
+        case YV16:
+            P.y_size = P.wh;
+            P.cb_size = P.cr_size = P.wh / 2;
+            P.grid_start_pos = 0;
+            break;
+        case YUV444P:
+            P.y_size = P.cb_size = P.cr_size = P.wh;
+            break;
+        default:
+            DIE("unhandled format=%d(%s)\n", FORMAT, showFmt(FORMAT));
+            break;
+    }
+    P.frame_size = P.y_size + P.cb_size + P.cr_size;
+    setup_planes();
+
+    if (FORMAT == YUY2) {
+        /* Y U Y V
+         * 0 1 2 3 */
+        P.y_start_pos = 0;
+        P.cb_start_pos = 1;
+        P.cr_start_pos = 3;
+    } else if (FORMAT == UYVY) {
+        /* U Y V Y
+         * 0 1 2 3 */
+        P.y_start_pos = 1;
+        P.grid_start_pos = 1;
+        P.cb_start_pos = 0;
+        P.cr_start_pos = 2;
+    } else if (FORMAT == YVYU || FORMAT == Y42210) {
+        /* Y V Y U
+         * 0 1 2 3 */
+        P.y_start_pos = 0;
+        P.cb_start_pos = 3;
+        P.cr_start_pos = 1;
+    }
+    dec_setup(&P.dec);
+    printf("format=%d size=%dx%d frame_size=%d y_size=%d cb_size=%d cr_size=%d\n",
+           FORMAT, P.width, P.height, P.frame_size, P.y_size, P.cb_size, P.cr_size);
+}
+
+/* decode context of the current format and geometry */
+void dec_setup(Dec *d)
+{
+    d->format = FORMAT;
+    d->width = P.width;
+    d->height = P.height;
+    d->wh = P.wh;
+    d->frame_size = P.frame_size;
+    d->raw_frame_size = P.raw_frame_size;
+    d->y_size = P.y_size;
+    d->cb_size = P.cb_size;
+    d->cr_size = P.cr_size;
+    d->y_start_pos = P.y_start_pos;
+    d->cb_start_pos = P.cb_start_pos;
+    d->cr_start_pos = P.cr_start_pos;
+    d->nplanes = P.nplanes;
+    memcpy(d->plane, P.plane, sizeof(d->plane));
+    d->tail = P.raw_frame_size;
+    for (Uint32 p = 0; p < P.nplanes; p++) {
+        d->tail -= P.plane[p].gap + P.plane[p].stride * P.plane[p].rows;
+    }
+    lut_setup(bitdepth(d->format));
+    d->lut = gLut.base;
+}
+
+/* Stored plane layout: bytes per row and rows of each plane in file
+ * order, then --stride/--uv-stride/--plane-offset on top. raw_frame_size
+ * is where the last plane ends. */
+void setup_planes(void)
+{
+    Uint32 w = P.width, h = P.height;
+    Uint32 row[3], rows[3];
+    Uint32 th[3] = {1, 1, 1}; /* tiled: one row is a row of tiles */
+    const TileFmt *t = &gTileMap[FORMAT];
+    Uint32 end = 0;
+
+    switch (FORMAT) {
+        case YV12:
+        case IYUV:
+            P.nplanes = 3;
+            row[0] = w;
+            rows[0] = h;
+            row[1] = row[2] = w / 2;
+            rows[1] = rows[2] = h / 2;
+            break;
+        case YV16:
+            P.nplanes = 3;
+            row[0] = w;
+            rows[0] = h;
+            row[1] = row[2] = w / 2;
+            rows[1] = rows[2] = h;
+            break;
+        case YUV444P:
+            P.nplanes = 3;
+            row[0] = row[1] = row[2] = w;
+            rows[0] = rows[1] = rows[2] = h;
+            break;
+        case MONO:
+            P.nplanes = 1;
+            row[0] = w;
+            rows[0] = h;
+            break;
+        case NV12TILED:
+        case NV1210TILED:
+        case NV12TILED4X4:
+        case NV12TILED16X16:
+        case NV12TILED64Z32:
+        case NV12TILEDY:
+        case NV12TILEDMT:
+            /* whole tiles, see tile_grid() */
+            P.nplanes = 2;
+            for (Uint32 p = 0; p < 2; p++) {
+                Uint32 xt, yt;
+                tile_grid(t, p, w, p ? h / 2 : h, &xt, &yt);
+                th[p] = p ? t->ch : t->th;
+                row[p] = xt * (p ? t->cw : t->tw);
+                rows[p] = yt * th[p];
+            }
+            if (FORMAT == NV1210TILED) {
+                row[0] = row[0] * 10 / 8;
+                row[1] = row[1] * 10 / 8;
+            }
+            break;
+        case NV12:
+        case NV21:
+        case NV1210:
+            P.nplanes = 2;
+            row[0] = row[1] = w;
+            rows[0] = h;
+            rows[1] = h / 2;
+            if (FORMAT == NV1210) {
+                /* compact 10 bit, 5 bytes per 4 samples */
+                row[0] = row[1] = w * 10 / 8;
+            }
+            break;
+        case YUY2:
+        case UYVY:
+        case YVYU:
+            P.nplanes = 1;
+            row[0] = w * 2;
+            rows[0] = h;
+            break;
+        case Y42210:
+            /* loose 10 bit, 2 bytes per sample */
+            P.nplanes = 3;
+            row[0] = w * 2;
+            rows[0] = h;
+            row[1] = row[2] = w;
+            rows[1] = rows[2] = h;
+            break;
+        case YV1210:
+            P.nplanes = 3;
+            row[0] = w * 2;
+            rows[0] = h;
+            row[1] = row[2] = w;
+            rows[1] = rows[2] = h / 2;
+            break;
+        default:
+            DIE("unhandled format=%d(%s)\n", FORMAT, showFmt(FORMAT));
+            return;
+    }
+
+    for (Uint32 p = 0; p < P.nplanes; p++) {
+        Plane *pl = &P.plane[p];
+        Uint32 stride = row[p];
+        Uint32 offset = p ? P.plane_offset[p - 1] : 0;
+
+        if (p == 0 && P.stride) {
+            stride = P.stride;
+        } else if (p && P.uv_stride) {
+            stride = P.uv_stride;
+        } else if (p && P.stride) {
+            /* chroma rows scale with the luma padding */
+            stride = (Uint64)P.stride * row[p] / row[0];
+        }
+        if (stride < row[p]) {
+            DIE("stride %d of plane %d is below its %d bytes per row\n",
+                stride, p, row[p]);
+            stride = row[p];
+        }
+        if (offset && offset < end) {
+            DIE("plane %d at offset %d overlaps the plane before it\n",
+                p, offset);
+            offset = 0;
+        }
+        if (!offset && t->align && end % t->align) {
+            offset = end + t->align - end % t->align;
+        }
+        pl->row = row[p] * th[p];
+        pl->rows = rows[p] / th[p];
+        pl->stride = stride * th[p];
+        pl->gap = offset ? offset - end : 0;
+        end += pl->gap + pl->stride * pl->rows;
+    }
+    if (t->align && end % t->align) {
+        end += t->align - end % t->align;
+    }
+    P.raw_frame_size = end;
+}
+
+void check_input(void)
+{
+    Uint32 file_size;
+
+    /* Frame Size is an even multipe of 16x16? */
+    if (P.width % 16 != 0) {
+        DIE("WIDTH not multiple of 16, check input...\n");
+    }
+    if (P.height % 16 != 0) {
+        DIE("HEIGHT not multiple of 16, check input...\n");
+    }
+
+    /* Even number of frames? */
+    fseek(fd, 0L, SEEK_END);
+    file_size = ftell(fd);
+    fseek(fd, 0L, SEEK_SET);
+
+    if (file_size % P.raw_frame_size != 0) {
+        DIE("#FRAMES not an integer, check input...\n");
+    }
+}
+
+/* MASTER/SLAVE sync
+ * The master publishes its absolute view state (frame, zoom, planes, pan)
+ * into one System V shared memory block. The sequence word is a seqlock,
+ * odd while the master writes, and doubles as futex word: slaves sleep on
+ * it in a helper thread and the main loop jumps straight to the latest
+ * state, so any number of slaves stay frame locked and a slave that
+ * missed updates or joined late never drifts.
+ */
+#define SYNC_MAGIC 0x59565331        /* "YVS1" */
+#define SYNC_WAIT_MS 200             /* waiter re-checks stop this often */
+#define EVENT_SYNC 2                 /* SDL_USEREVENT code */
+
+enum {
+    SYNC_Y = 1,
+    SYNC_CB = 2,
+    SYNC_CR = 4,
+};
+
+struct sync_state {
+    Uint32 frame;             /* 1-based frame on screen, 0 before first */
+    Sint32 zoom;
+    Uint32 planes;            /* SYNC_Y, SYNC_CB or SYNC_CR, 0 = all */
+    Uint32 mag;               /* compare view magnification */
+    Sint32 pan_x;             /* compare view pan position */
+    Sint32 pan_y;
+    Uint32 quit;
+};
+
+struct sync_block {
+    Uint32 magic;
+    Uint32 seq;               /* seqlock and futex word */
+    struct sync_state state;
+};
+
+struct sync {
+    int shmid;
+    struct sync_block *blk;
+    struct sync_state last;   /* master: last state published */
+    SDL_Thread *thread;       /* slave: futex waiter */
+    Uint32 stop;
+    Uint32 pending;           /* EVENT_SYNC already queued */
+};
+
+struct sync gSync;
+
+long futex_wait(Uint32 *addr, Uint32 val, Uint32 ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000000L;
+    /* shared between processes, so no FUTEX_PRIVATE_FLAG */
+    return syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, NULL, 0);
+}
+
+long futex_wake(Uint32 *addr)
+{
+    return syscall(SYS_futex, addr, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0);
+}
+
+void sync_post(void)
+{
+    SDL_Event ev;
+
+    if (__atomic_exchange_n(&gSync.pending, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    ev.type = SDL_USEREVENT;
+    ev.user.code = EVENT_SYNC;
+    ev.user.data1 = NULL;
+    ev.user.data2 = NULL;
+    SDL_PushEvent(&ev);
+}
+
+int sync_waiter(void *arg)
+{
+    Uint32 *seq = &gSync.blk->seq;
+    Uint32 seen = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+    Uint32 now;
+
+    (void)arg;
+    /* catch up with the master right after connecting */
+    sync_post();
+    while (!__atomic_load_n(&gSync.stop, __ATOMIC_ACQUIRE)) {
+        futex_wait(seq, seen, SYNC_WAIT_MS);
+        now = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (now != seen && !(now & 1)) {
+            seen = now;
+            sync_post();
+        }
+    }
+    return 0;
+}
+
+/* consistent snapshot of the block, retried while the master writes */
+void sync_read(struct sync_state *s)
+{
+    Uint32 seq;
+
+    do {
+        while ((seq = __atomic_load_n(&gSync.blk->seq, __ATOMIC_ACQUIRE)) & 1) {
+            SDL_Delay(0);
+        }
+        memcpy(s, &gSync.blk->state, sizeof(*s));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while (__atomic_load_n(&gSync.blk->seq, __ATOMIC_RELAXED) != seq);
+}
+
+Uint32 sync_attach(Uint32 mode)
+{
+    key_t key;
+    int flags = 0644;
+
+    sync_detach();
+
+    /* Should probably use argv[0] or similar as pathname
+     * when creating the key;
+     * but let's keep it simple for now. Y for YCbCr
+     */
+    if ((key = ftok("/tmp", 'Y')) == -1) {
+        perror("ftok");
+        return 0;
+    }
+    if (mode == MASTER) {
+        flags |= IPC_CREAT;
+    }
+    if ((gSync.shmid = shmget(key, sizeof(struct sync_block), flags)) == -1) {
+        perror("shmget");
+        return 0;
+    }
+    gSync.blk = shmat(gSync.shmid, NULL, 0);
+    if (gSync.blk == (void *)-1) {
+        perror("shmat");
+        gSync.blk = NULL;
+        return 0;
+    }
+
+    if (mode == MASTER) {
+        if (gSync.blk->magic != SYNC_MAGIC) {
+            memset(gSync.blk, 0, sizeof(struct sync_block));
+            gSync.blk->magic = SYNC_MAGIC;
+        }
+        /* force the first sync_publish() */
+        memset(&gSync.last, 0xff, sizeof(gSync.last));
+    } else {
+        if (gSync.blk->magic != SYNC_MAGIC) {
+            DIE("no master found\n");
+            shmdt(gSync.blk);
+            gSync.blk = NULL;
+            return 0;
+        }
+        gSync.stop = 0;
+        gSync.pending = 0;
+        gSync.thread = SDL_CreateThread(sync_waiter, NULL);
+        if (!gSync.thread) {
+            DIE("SDL_CreateThread: %s\n", SDL_GetError());
+            shmdt(gSync.blk);
+            gSync.blk = NULL;
+            return 0;
+        }
+        printf("Ready to receive messages, captain.\n");
+    }
+    P.mode = mode;
+    return 1;
+}
+
+void sync_detach(void)
+{
+    if (gSync.thread) {
+        __atomic_store_n(&gSync.stop, 1, __ATOMIC_RELEASE);
+        futex_wake(&gSync.blk->seq);
+        SDL_WaitThread(gSync.thread, NULL);
+        gSync.thread = NULL;
+    }
+    if (gSync.blk) {
+        shmdt(gSync.blk);
+        gSync.blk = NULL;
+    }
+    if (P.mode == MASTER) {
+        /* removed once the last slave detached */
+        if (shmctl(gSync.shmid, IPC_RMID, NULL) == -1) {
+            perror("shmctl");
+        }
+        printf("sync block removed\n");
+    }
+    P.mode = NONE;
+}
+
+/* master: publish the view state if it changed since last time */
+void sync_publish(Uint32 frame, Uint32 quit)
+{
+    struct sync_state s;
+    Uint32 seq;
+
+    if (P.mode != MASTER) {
+        return;
+    }
+
+    s.frame = frame;
+    s.zoom = P.zoom;
+    s.planes = (P.y_only ? SYNC_Y : 0) |
+               (P.cb_only ? SYNC_CB : 0) |
+               (P.cr_only ? SYNC_CR : 0);
+    s.mag = gCmp.on ? gCmp.mag : 1;
+    s.pan_x = gCmp.on ? gCmp.pan_x : 0;
+    s.pan_y = gCmp.on ? gCmp.pan_y : 0;
+    s.quit = quit;
+    if (!memcmp(&s, &gSync.last, sizeof(s))) {
+        return;
+    }
+    gSync.last = s;
+
+    seq = gSync.blk->seq;
+    __atomic_store_n(&gSync.blk->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&gSync.blk->state, &s, sizeof(s));
+    __atomic_store_n(&gSync.blk->seq, seq + 2, __ATOMIC_RELEASE);
+    futex_wake(&gSync.blk->seq);
+}
+
+/* slave: jump to the state last published by the master, returns quit */
+Uint32 sync_follow(Uint32 *frame)
+{
+    struct sync_state s;
+    bool dirty = false;
+
+    if (P.mode != SLAVE) {
+        return 0;
+    }
+    /* clear first, so an update arriving while we read posts again */
+    __atomic_store_n(&gSync.pending, 0, __ATOMIC_RELEASE);
+    sync_read(&s);
+    if (s.quit) {
+        return 1;
+    }
+
+    if (s.zoom != P.zoom) {
+        set_zoom(s.zoom);
+        dirty = true;
+    }
+    if ((s.planes & SYNC_Y) != (P.y_only ? SYNC_Y : 0) ||
+        (s.planes & SYNC_CB) != (P.cb_only ? SYNC_CB : 0) ||
+        (s.planes & SYNC_CR) != (P.cr_only ? SYNC_CR : 0)) {
+        P.y_only = (s.planes & SYNC_Y) ? 1 : 0;
+        P.cb_only = (s.planes & SYNC_CB) ? 1 : 0;
+        P.cr_only = (s.planes & SYNC_CR) ? 1 : 0;
+        dirty = true;
+    }
+    if (gCmp.on && (s.mag != gCmp.mag || s.pan_x != gCmp.pan_x
+                    || s.pan_y != gCmp.pan_y)) {
+        gCmp.mag = s.mag;
+        gCmp.pan_x = s.pan_x;
+        gCmp.pan_y = s.pan_y;
+        cmp_clamp();
+        dirty = true;
+    }
+    if (s.frame && s.frame != *frame) {
+        if (gSheet.on) {
+            sheet_close();
+        }
+        /* sequential play reads on, anything else seeks */
+        if (s.frame == *frame + 1 || seek_frame(s.frame - 1)) {
+            if (read_frame()) {
+                *frame = s.frame;
+                dirty = true;
+            }
+        }
+    }
+    if (dirty && !gSheet.on) {
+        draw_frame();
+    }
+    return 0;
+}
+
+void set_caption(char *array, Uint32 frame, Uint32 bytes)
+{
+    snprintf(array, bytes, "%s - %s%s%s%s%s%s%s%s%s%s%s frame %d, size %dx%d%s%s",
+             P.filename,
+             (P.mode == MASTER) ? "[MASTER]" :
+             (P.mode == SLAVE) ? "[SLAVE]" : "",
+             P.grid ? "G" : "",
+             P.mb ? "M" : "",
+             P.diff ? "D" : "",
+             gTemp.on ? "P" : "",
+             P.hist ? "H" : "",
+             P.y_only ? "Y" : "",
+             P.cb_only ? "Cb" : "",
+             P.cr_only ? "Cr" : "",
+             gSheet.on ? "T" : "",
+             !gCmp.on ? "" : gCmp.view == CMP_WIPE ? "W" : "C",
+             frame,
+             P.zoom_width,
+             P.zoom_height,
+             gLine.golen ? ", goto " : "",
+             gLine.go);
+}
+
+void set_zoom_rect(void)
+{
+    Uint32 w = P.width, h = P.height;
+
+    if (gCmp.on && gCmp.overlay) {
+        w = gCmp.overlay->w;
+        h = gCmp.overlay->h;
+    }
+    if (P.zoom > 0) {
+        P.zoom_width = w * P.zoom;
+        P.zoom_height = h * P.zoom;
+    } else if (P.zoom <= 0) {
+        P.zoom_width = w / (abs(P.zoom) + 2);
+        P.zoom_height = h / (abs(P.zoom) + 2);
+    } else {
+        DIE("ERROR in zoom:\n");
+    }
+    // printf("zoom to %dx%d\n", P.zoom_width, P.zoom_height);
+}
+
+void set_zoom(Sint32 zoom)
+{
+    P.zoom = zoom;
+    set_zoom_rect();
+    screen = SDL_SetVideoMode(P.zoom_width, P.zoom_height, P.bpp, P.vflags);
+    video_rect.w = P.zoom_width;
+    video_rect.h = P.zoom_height;
+    display_overlay(gCmp.on ? gCmp.overlay : my_overlay);
+}
+
+Uint32 redraw(void)
+{
+    seek_frame(0);
+    read_frame();
+    draw_frame();
+    return 1;
+}
+
+Uint32 reinit(void)
+{
+    /* Initialize parameters corresponding to YUV-format */
+    setup_param();
+    if (!sdl_init()) {
+        return 0;
+    }
+    if (!allocate_memory()) {
+        return 0;
+    }
+    if (gCmp.on && !cmp_reset()) {
+        return 0;
+    }
+    return 1;
+}
+
+/* change width and height on the fly
+ * SDL and all buffers that are big enough stay, only the overlay is
+ * recreated, and the frame on screen starts at the same byte offset.
+ */
+Uint32 set_geometry(Uint32 width, Uint32 height, Uint32 *frame)
+{
+    off_t pos = frame_offset(*frame > 0 ? *frame - 1 : 0);
+    Uint32 index, count;
+
+    if (width < 16 || height < 16 || width > 4096 || height > 2176) {
+        DIE("size=%dx%d out of range\n", width, height);
+        return 0;
+    }
+    /* proxies, QC and frame count follow the geometry, stop their jobs */
+    line_close();
+    qc_close();
+    P.width = width;
+    P.height = height;
+    setup_param();
+    P.origin = pos % P.raw_frame_size;
+    index = pos / P.raw_frame_size;
+    gUring.gen++;
+
+    heat_free();
+    temp_reset();
+    if (!allocate_memory() || !sdl_overlay()) {
+        return 0;
+    }
+    if (gCmp.on && !cmp_reset()) {
+        return 0;
+    }
+    if (gLine.on && !line_open()) {
+        gLine.on = false;
+    }
+
+    /* a bigger frame may not fit behind the old position */
+    count = frame_count(fd);
+    if (index >= count) {
+        index = count > 0 ? count - 1 : 0;
+    }
+    seek_frame(index);
+    if (read_frame()) {
+        draw_frame();
+        *frame = index + 1;
+    } else {
+        *frame = 0;
+    }
+    return 1;
+}
+
+/* loop inspired by yay
+ * http://freecode.com/projects/yay
+ */
+Uint32 event_loop(void)
+{
+    char caption[256];
+    Uint16 quit = 0;
+    Uint32 frame = 0;
+    int play_yuv = 0;
+    unsigned int start_ticks = 0;
+
+    while (!quit) {
+
+        set_caption(caption, gLine.scrub ? gLine.scrub_index + 1 : frame, 256);
+        SDL_WM_SetCaption(caption, NULL);
+        sync_publish(frame, 0);
+
+        /* wait for SDL event */
+        SDL_WaitEvent(&event);
+
+        switch (event.type) {
+            case SDL_KEYDOWN:
+                if (line_key(event.key.keysym.sym, &frame)) {
+                    break;
+                }
+                if (gSheet.on && sheet_key(event.key.keysym.sym)) {
+                    break;
+                }
+                if (gCmp.on && cmp_key(event.key.keysym.sym)) {
+                    break;
+                }
+                if (qc_key(event.key.keysym.sym, &frame)) {
+                    break;
+                }
+                if (lut_key(event.key.keysym.sym)) {
+                    break;
+                }
+                switch (event.key.keysym.sym) {
+                    case SDLK_SPACE:
+                        play_yuv = 1; /* play it, sam! */
+                        while (play_yuv) {
+                            start_ticks = SDL_GetTicks();
+                            set_caption(caption, frame, 256);
+                            SDL_WM_SetCaption(caption, NULL);
+
+                            /* check for next frame existing */
+                            if (read_frame()) {
+                                draw_frame();
+                                /* insert delay for real time viewing */
+                                if (SDL_GetTicks() - start_ticks < 40) {
+                                    SDL_Delay(40 - (SDL_GetTicks() - start_ticks));
+                                }
+                                frame++;
+                                sync_publish(frame, 0);
+                            } else {
+                                play_yuv = 0;
+                            }
+                            /* check for any key event */
+                            if (SDL_PollEvent(&event)) {
+                                if (event.type == SDL_KEYDOWN) {
+                                    /* stop playing */
+                                    play_yuv = 0;
+                                }
+                            }
+                        }
+                        break;
+                    case SDLK_BACKSPACE: /* play backwards */
+                        play_yuv = frame > 1 && (gCmp.on || diff_view() || rev_open());
+                        while (play_yuv && frame > 1) {
+                            start_ticks = SDL_GetTicks();
+                            set_caption(caption, frame, 256);
+                            SDL_WM_SetCaption(caption, NULL);
+
+                            if (rev_read(frame - 2)) {
+                                draw_frame();
+                                if (SDL_GetTicks() - start_ticks < 40) {
+                                    SDL_Delay(40 - (SDL_GetTicks() - start_ticks));
+                                }
+                                frame--;
+                                sync_publish(frame, 0);
+                            } else {
+                                play_yuv = 0;
+                            }
+                            if (SDL_PollEvent(&event)) {
+                                if (event.type == SDL_KEYDOWN) {
+                                    play_yuv = 0;
+                                }
+                            }
+                        }
+                        play_yuv = 0;
+                        rev_close();
+                        /* next read_frame() continues after the frame shown */
+                        seek_frame(frame);
+                        break;
+                    case SDLK_RIGHT: /* next frame */
+                        /* check for next frame existing */
+                        if (read_frame()) {
+                            draw_frame();
+                            frame++;
+                        }
+                        break;
+                    case SDLK_LEFT: /* previous frame */
+                        if (frame > 1) {
+                            frame--;
+                            seek_frame(frame - 1);
+                            read_frame();
+                            draw_frame();
+                        }
+                        break;
+                    case SDLK_UP: /* zoom in */
+                        set_zoom(P.zoom + 1);
+                        break;
+                    case SDLK_DOWN: /* zoom out */
+                        set_zoom(P.zoom - 1);
+                        break;
+                    case SDLK_r: /* rewind */
+                        if (frame > 1) {
+                            frame = 1;
+                            redraw();
+                        }
+                        break;
+                    case SDLK_l:
+                        set_geometry(P.width + 16, P.height, &frame);
+                        break;
+                    case SDLK_h:
+                        set_geometry(P.width - 16, P.height, &frame);
+                        break;
+                    case SDLK_j:
+                        set_geometry(P.width, P.height + 16, &frame);
+                        break;
+                    case SDLK_k:
+                        set_geometry(P.width, P.height - 16, &frame);
+                        break;
+                    case SDLK_g: /* display grid */
+                        P.grid = ~P.grid;
+                        if (P.zoom < 1) {
+                            P.grid = 0;
+                        }
+                        draw_frame();
+                        break;
+                    case SDLK_i: /* read throughput and memory */
+                        uring_stats();
+                        temporal_stats();
+                        net_stats();
+                        dirty_stats();
+                        mem_stats();
+                        kern_stats();
+                        break;
+                    case SDLK_x:
+                        P.flip_change_uv = true;
+                        draw_frame();
+                        break;
+                    case SDLK_m: /* show mb-data on stdout */
+                        P.mb = ~P.mb;
+                        if (P.zoom < 1) {
+                            P.mb = 0;
+                        }
+                        draw_frame();
+                        break;
+                    case SDLK_F5: /* Luma data only */
+                    case SDLK_y:
+                        P.y_only = ~P.y_only;
+                        P.cb_only = 0;
+                        P.cr_only = 0;
+                        draw_frame();
+                        break;
+                    case SDLK_F6: /* Cb data only */
+                    case SDLK_u:
+                        P.cb_only = ~P.cb_only;
+                        P.y_only = 0;
+                        P.cr_only = 0;
+                        draw_frame();
+                        break;
+                    case SDLK_F7: /* Cr data only */
+                    case SDLK_v:
+                        P.cr_only = ~P.cr_only;
+                        P.y_only = 0;
+                        P.cb_only = 0;
+                        draw_frame();
+                        break;
+                    case SDLK_F8: /* display all color planes */
+                    case SDLK_a:
+                        P.y_only = 0;
+                        P.cb_only = 0;
+                        P.cr_only = 0;
+                        draw_frame();
+                        break;
+                    case SDLK_p: /* frame minus previous frame */
+                        temporal_toggle();
+                        break;
+                    case SDLK_d: /* diff amplification */
+                        if (!diff_view()) {
+                            break;
+                        }
+                        P.diff_amp = P.diff_amp >= 16 ? 1 : P.diff_amp * 2;
+                        printf("diff amplification x%d\n", P.diff_amp);
+                        if (frame > 0) {
+                            Frame *a, *b;
+                            diff_pair(&a, &b);
+                            diff_frames(&P.dec, &P.frame, a, b, P.diff_amp);
+                            draw_frame();
+                        }
+                        break;
+                    case SDLK_e: /* block error heatmap, off/SAD/MSE */
+                        if (!diff_view()) {
+                            break;
+                        }
+                        gHeat.mode = (gHeat.mode + 1) % 3;
+                        draw_frame();
+                        break;
+                    case SDLK_b: /* heatmap block size */
+                        gHeat.level = (gHeat.level + 1) % HEAT_LEVELS;
+                        printf("heatmap block %dx%d\n",
+                               heat_block[gHeat.level], heat_block[gHeat.level]);
+                        draw_frame();
+                        break;
+                    case SDLK_c: /* heatmap colour scale */
+                        gHeat.scale = gHeat.scale >= 32 ? 0 :
+                                      gHeat.scale ? gHeat.scale * 4 : 2;
+                        if (gHeat.scale) {
+                            printf("heatmap full scale %d per pel\n", gHeat.scale);
+                        } else {
+                            printf("heatmap full scale auto\n");
+                        }
+                        draw_frame();
+                        break;
+                    case SDLK_s: /* histogram */
+                        P.hist = ~P.hist;
+                        draw_frame();
+                        break;
+                    case SDLK_t: /* contact sheet */
+                        if (gSheet.on) {
+                            sheet_close();
+                            draw_frame();
+                        } else {
+                            sheet_open(frame > 0 ? frame - 1 : 0);
+                        }
+                        break;
+                    case SDLK_F1: /* MASTER-mode */
+                        sync_attach(MASTER);
+                        break;
+                    case SDLK_F2: /* SLAVE-mode */
+                        sync_attach(SLAVE);
+                        break;
+                    case SDLK_F3: /* NONE-mode */
+                        sync_detach();
+                        break;
+                    case SDLK_q: /* quit */
+                        quit = 1;
+                        sync_publish(frame, 1);
+                        break;
+                    default:
+                        break;
+                } /* switch key */
+                break;
+            case SDL_QUIT:
+                quit = 1;
+                sync_publish(frame, 1);
+                break;
+            case SDL_VIDEOEXPOSE:
+                if (gSheet.on) {
+                    display_overlay(gSheet.overlay);
+                    break;
+                }
+                display_overlay(gCmp.on ? gCmp.overlay : my_overlay);
+                break;
+            case SDL_MOUSEBUTTONDOWN:
+                if (event.button.button == SDL_BUTTON_LEFT
+                    && line_hit(event.button.y)) {
+                    line_scrub(event.button.x);
+                    break;
+                }
+                if (gSheet.on) {
+                    /* jump to the frame of the clicked tile */
+                    Sint32 pick = sheet_pick(event.button.x, event.button.y);
+                    if (event.button.button == SDL_BUTTON_LEFT && pick >= 0) {
+                        sheet_close();
+                        seek_frame(pick);
+                        if (read_frame()) {
+                            draw_frame();
+                            frame = pick + 1;
+                        }
+                    }
+                    break;
+                }
+                if (gCmp.on) {
+                    if (event.button.button == SDL_BUTTON_RIGHT) {
+                        cmp_split(event.button.x);
+                    }
+                    break;
+                }
+                /* If the left mouse button was pressed */
+                if (event.button.button == SDL_BUTTON_LEFT ) {
+                    heat_show(event.button.x, event.button.y);
+                    show_mb(event.button.x, event.button.y);
+                    if (P.mb) {
+                        /* outline the picked MB */
+                        draw_frame();
+                    }
+                }
+                break;
+            case SDL_MOUSEBUTTONUP:
+                if (gLine.scrub && event.button.button == SDL_BUTTON_LEFT) {
+                    /* settled, decode the full frame */
+                    SDL_LockMutex(gLine.lock);
+                    gLine.scrub = false;
+                    SDL_UnlockMutex(gLine.lock);
+                    if (!goto_frame(gLine.scrub_index, &frame)) {
+                        draw_frame();
+                    }
+                }
+                break;
+            case SDL_MOUSEMOTION:
+                if (gLine.scrub) {
+                    line_scrub(event.motion.x);
+                    break;
+                }
+                /* drag to pan all panes, right button drags the wipe */
+                if (!gCmp.on || gSheet.on) {
+                    break;
+                }
+                if (event.motion.state & SDL_BUTTON(SDL_BUTTON_LEFT)) {
+                    cmp_pan(event.motion.xrel, event.motion.yrel);
+                } else if (event.motion.state & SDL_BUTTON(SDL_BUTTON_RIGHT)) {
+                    cmp_split(event.motion.x);
+                }
+                break;
+            case SDL_USEREVENT:
+                if (event.user.code == EVENT_SHEET_READY && gSheet.on) {
+                    sheet_draw();
+                } else if (event.user.code == EVENT_SYNC) {
+                    quit = sync_follow(&frame);
+                } else if (event.user.code == EVENT_PROXY_READY
+                           && gLine.scrub) {
+                    line_show(gLine.scrub_index);
+                } else if (event.user.code == EVENT_GOTO) {
+                    goto_frame((uintptr_t)event.user.data1, &frame);
+                }
+                break;
+
+            default:
+                break;
+
+        } /* switch event type */
+
+    } /* while */
+
+    return quit;
+}
+
+int strfmtcmp(const void *p0, const void *p1) {
+    char *s0 = ((StrFmt *)p0)->str;
+    char *s1 = ((StrFmt *)p1)->str;
+    int l0 = strlen(s0);
+    int l1 = strlen(s1);
+    if (l0 != l1) {
+        return l0 - l1;
+    }
+    return strcmp(s0, s1);
+}
+
+int strfmtcmp_r(const void *p0, const void *p1) {
+    return -1 * strfmtcmp(p0, p1);
+}
+
+static char **gNameLst;
+StrFmt *buildStrFmtLst(Uint32 *pLen) {
+    // fmtnameLst is a list with whitespace delimiter
+    // so split it to list.
+    // and build one dict which map from format name to format
+    Uint32 ft = 0, len = COUNT_OF(gFmtMap);
+    gNameLst = malloc(sizeof(char *) * len);
+    for (ft = 0; ft != len; ft++) {
+        // dup it for writeable string
+        gNameLst[ft] = strdup(showFmt(ft));
+    }
+
+    int toklen = 2 * len, tokidx;
+    char delim[] = " ";
+    char *s, *token;
+    StrFmt *toklst = malloc(sizeof(StrFmt) * toklen);
+    memset(toklst, 0, sizeof(StrFmt) * toklen);
+    for (ft = tokidx = 0; ft != len; ft++) {
+        s = gNameLst[ft];
+        while ((token = strtok(s, delim)) != NULL) {
+            s = NULL;
+            toklst[tokidx].str = token;
+            toklst[tokidx].fmt = ft;
+            tokidx++;
+            if (tokidx > toklen) {
+                DIE("not enough toklst, toklen=%d\n", toklen);
+                goto cleanup;
+            }
+        }
+    }
+    *pLen = tokidx;
+    return toklst;
+cleanup:
+    *pLen = 0;
+    free(toklst);
+    return NULL;
+}
+
+void destoryStrFmtLst() {
+    for (int ft = 0; ft != COUNT_OF(gFmtMap); ft++) {
+        free(gNameLst[ft]);
+    }
+}
+
+Uint32 parse_format(char *fmtstr) {
+    FORMAT = FORMAT_MAX;
+    Uint32 tokidx;
+    StrFmt *toklst = buildStrFmtLst(&tokidx);
+    // sort it for longest match
+    qsort(toklst, tokidx, sizeof(StrFmt), strfmtcmp_r);
+    for (Uint32 i = 0; i != tokidx; i++) {
+        StrFmt *p = toklst + i;
+        if (strcasestr(fmtstr, p->str) != NULL) {
+            FORMAT = p->fmt;
+            goto cleanup;
+        }
+    }
+
+cleanup:
+    destoryStrFmtLst();
+    return FORMAT != FORMAT_MAX;
+}
+
+Uint32 negCondSkip(char *s, int (*cond)(int));
+Uint32 negCondSkip(char *s, int (*cond)(int)) {
+    int i;
+    for (i = 0; s[i] != '\0' && !cond(s[i]); i++) {
+    }
+    return i;
+}
+
+Uint32 guess_arg(char *filename) {
+    /* how to guess
+     * - first number for width
+     * - second number for height
+     * - longest match format string in whole filename
+     */
+    char *s = filename;
+    char *p = s;
+    p += negCondSkip(p, isdigit);
+    if (*p == '\0') {
+        DIE("cannot find width\n");
+        return 0;
+    }
+    int width = strtol(p, &p, 10);
+
+    p += negCondSkip(p, isdigit);
+    if (*p == '\0') {
+        DIE("cannot find height\n");
+        return 0;
+    }
+    int height = strtol(p, &p, 10);
+
+    parse_format(filename);
+    if (FORMAT == FORMAT_MAX) {
+        DIE("cannot find fmt\n");
+        return 0;
+    }
+
+    P.width = width;
+    P.height = height;
+    LOG("guess width=%d height=%d fmt=%d(%s)\n",
+        width, height, FORMAT, showFmt(FORMAT));
+    return 1;
+}
+
+/* Format detection
+ * For raw files without size and format in their name. Every candidate
+ * layout is scored on bytes sampled from a few places of the file:
+ * - row cost, neighbour rows are alike at the right row stride
+ * - frame cost, luma of frame k and k + 1 is alike at the right frame size
+ * - chroma cost, chroma rows are alike as well, and packed chroma is
+ *   smoother than the luma it is interleaved with
+ * Costs are relative to the difference of unrelated samples, and the file
+ * size must be a multiple of the frame size. Lowest total cost wins.
+ */
+#define DETECT_SAMPLES 256           /* places sampled per measurement */
+#define DETECT_SPAN 64               /* bytes compared per place */
+#define DETECT_FRAMES 4              /* frame pairs sampled per candidate */
+#define DETECT_MIN_W 16
+#define DETECT_MAX_W 4096
+#define DETECT_MIN_H 16
+#define DETECT_MAX_H 4096
+#define DETECT_WIDTHS 8              /* best widths kept per format */
+#define DETECT_SHOW 10               /* ranked candidates printed */
+
+typedef struct DetectFmt {
+    Uint32 fmt;
+    bool alias;               /* same layout as an entry before, hint only */
+    Uint32 num, den;          /* frame bytes = w * h * num / den */
+    Uint32 rnum, rden;        /* row bytes = w * rnum / rden */
+    Uint32 cnum, cden;        /* chroma row bytes, 0 for packed or none */
+    Uint32 csub;              /* chroma rows = h / csub */
+    Sint32 ypos;              /* packed luma byte, -1 when planar */
+} DetectFmt;
+
+/* tiled layouts are not raster, so not detected */
+const DetectFmt detect_fmt[] = {
+    {YV12, false, 3, 2, 1, 1, 1, 2, 2, -1},
+    {IYUV, true, 3, 2, 1, 1, 1, 2, 2, -1},
+    {NV12, false, 3, 2, 1, 1, 1, 1, 2, -1},
+    {NV21, true, 3, 2, 1, 1, 1, 1, 2, -1},
+    {MONO, false, 1, 1, 1, 1, 0, 1, 1, -1},
+    {YV16, false, 2, 1, 1, 1, 1, 2, 1, -1},
+    {YUV444P, false, 3, 1, 1, 1, 1, 1, 1, -1},
+    {YUY2, false, 2, 1, 2, 1, 0, 1, 1, 0},
+    {YVYU, true, 2, 1, 2, 1, 0, 1, 1, 0},
+    {UYVY, false, 2, 1, 2, 1, 0, 1, 1, 1},
+    {YV1210, false, 3, 1, 2, 1, 1, 1, 2, -1},
+    {Y42210, false, 4, 1, 4, 1, 0, 1, 1, -1},
+    {NV1210, false, 15, 8, 5, 4, 5, 4, 2, -1},
+};
+
+typedef struct Guess {
+    const DetectFmt *df;
+    Uint32 width;
+    Uint32 height;
+    Uint32 frames;
+    double cost;
+} Guess;
+
+struct detect {
+    const Uint8 *data;        /* whole file, mapped */
+    off_t size;
+    double unrelated;         /* mean abs diff of unrelated samples */
+    Uint32 max_stride;
+    double *row;              /* row cost per row stride in bytes */
+    Guess *guess;
+    Uint32 nguess;
+};
+
+struct detect gDetect;
+
+double detect_mad(off_t a, off_t b)
+{
+    return gKern.sad_u8(gDetect.data + a, gDetect.data + b, DETECT_SPAN)
+           / (double)DETECT_SPAN;
+}
+
+/* row cost of strides first..last */
+void detect_row_job(void *arg, Uint32 worker)
+{
+    DetectJob *job = arg;
+
+    (void)worker;
+    for (Uint32 s = job->first; s < job->last; s++) {
+        off_t range = gDetect.size - s - DETECT_SPAN;
+        double sum = 0;
+        for (Uint32 k = 0; k < DETECT_SAMPLES; k++) {
+            off_t o = range * k / DETECT_SAMPLES;
+            sum += detect_mad(o, o + s);
+        }
+        gDetect.row[s] = sum / DETECT_SAMPLES / gDetect.unrelated;
+    }
+}
+
+double detect_frame_cost(const struct Guess *g, off_t frame, off_t luma)
+{
+    double sum = 0;
+    Uint32 cnt = 0;
+
+    if (g->frames < 2 || luma < DETECT_SPAN) {
+        return 1.0;
+    }
+    for (Uint32 j = 0; j < DETECT_FRAMES; j++) {
+        off_t f = (off_t)(g->frames - 1) * j / DETECT_FRAMES * frame;
+        for (Uint32 k = 0; k < DETECT_SAMPLES / DETECT_FRAMES; k++) {
+            off_t o = f + (luma - DETECT_SPAN) * k / (DETECT_SAMPLES / DETECT_FRAMES);
+            sum += detect_mad(o, o + frame);
+            cnt++;
+        }
+    }
+    return sum / cnt / gDetect.unrelated;
+}
+
+double detect_chroma_cost(const struct Guess *g, off_t luma)
+{
+    const DetectFmt *df = g->df;
+    double sum = 0, ref = 0;
+
+    if (df->ypos >= 0) {
+        /* packed, neighbour pel difference of chroma vs luma bytes */
+        off_t n = (off_t)g->width * 2 - 8;
+        for (Uint32 k = 0; k < DETECT_SAMPLES; k++) {
+            off_t o = (n * k / DETECT_SAMPLES) & ~3;
+            const Uint8 *p = gDetect.data + o;
+            sum += abs(p[1 - df->ypos] - p[5 - df->ypos]);
+            ref += abs(p[df->ypos] - p[df->ypos + 4]);
+        }
+        return (sum + 1) / (ref + 1);
+    }
+    if (!df->cnum) {
+        /* no chroma to look at */
+        return 0.5;
+    } else {
+        off_t cs = (off_t)g->width * df->cnum / df->cden;
+        off_t plane = cs * (g->height / df->csub);
+        if (plane < cs + DETECT_SPAN) {
+            return 1.0;
+        }
+        for (Uint32 k = 0; k < DETECT_SAMPLES; k++) {
+            off_t o = luma + (plane - cs - DETECT_SPAN) * k / DETECT_SAMPLES;
+            sum += detect_mad(o, o + cs);
+        }
+        return sum / DETECT_SAMPLES / gDetect.unrelated;
+    }
+}
+
+/* total cost of guesses first..last */
+void detect_guess_job(void *arg, Uint32 worker)
+{
+    DetectJob *job = arg;
+
+    (void)worker;
+    for (Uint32 i = job->first; i < job->last; i++) {
+        Guess *g = &gDetect.guess[i];
+        const DetectFmt *df = g->df;
+        off_t stride = (off_t)g->width * df->rnum / df->rden;
+        off_t frame = (off_t)g->width * g->height * df->num / df->den;
+        off_t luma = stride * g->height;
+
+        if (luma > frame) {
+            /* packed, luma bytes are spread over the whole frame */
+            luma = frame;
+        }
+        g->cost = gDetect.row[stride]
+                  + detect_frame_cost(g, frame, luma)
+                  + 0.5 * detect_chroma_cost(g, luma);
+        /* tie-break towards macroblock aligned sizes */
+        g->cost += (g->width % 16 ? 0.02 : 0) + (g->height % 16 ? 0.02 : 0);
+    }
+}
+
+int detect_cmp(const void *p0, const void *p1)
+{
+    const Guess *g0 = p0, *g1 = p1;
+
+    return g0->cost < g1->cost ? -1 : g0->cost > g1->cost;
+}
+
+/* split 0..n over the pool, one job per worker and the caller */
+void detect_run(JobFn fn, Uint32 first, Uint32 n)
+{
+    Pool *pool = pool_get();
+    Uint32 nj = pool ? pool->nworker + 1 : 1;
+    DetectJob *job = calloc(nj, sizeof(DetectJob));
+    void **arg = calloc(nj, sizeof(void *));
+
+    if (!job || !arg) {
+        DIE("Error allocating memory...\n");
+        free(job);
+        free(arg);
+        return;
+    }
+    for (Uint32 j = 0; j < nj; j++) {
+        job[j].first = first + (Uint64)n * j / nj;
+        job[j].last = first + (Uint64)n * (j + 1) / nj;
+        arg[j] = &job[j];
+    }
+    if (pool) {
+        pool_run(pool, fn, arg, nj);
+    } else {
+        fn(arg[0], 0);
+    }
+    free(job);
+    free(arg);
+}
+
+/* all candidates with a whole number of frames, best widths per layout */
+Uint32 detect_candidates(Uint32 hint)
+{
+    Uint32 cap = 0;
+
+    for (Uint32 i = 0; i < COUNT_OF(detect_fmt); i++) {
+        const DetectFmt *df = &detect_fmt[i];
+        Uint32 best[DETECT_WIDTHS];
+        Uint32 nbest = 0;
+
+        if (hint == FORMAT_MAX ? df->alias : df->fmt != hint) {
+            continue;
+        }
+        /* the lowest row cost widths, kept sorted */
+        for (Uint32 w = DETECT_MIN_W; w <= DETECT_MAX_W; w += 2) {
+            Uint32 s = w * df->rnum / df->rden, j;
+            if (w * df->rnum % df->rden || s > gDetect.max_stride) {
+                continue;
+            }
+            if (nbest == DETECT_WIDTHS) {
+                Uint32 last = best[nbest - 1] * df->rnum / df->rden;
+                if (gDetect.row[s] >= gDetect.row[last]) {
+                    continue;
+                }
+                nbest--;
+            }
+            for (j = nbest; j > 0; j--) {
+                Uint32 sj = best[j - 1] * df->rnum / df->rden;
+                if (gDetect.row[sj] <= gDetect.row[s]) {
+                    break;
+                }
+                best[j] = best[j - 1];
+            }
+            best[j] = w;
+            nbest++;
+        }
+
+        for (Uint32 b = 0; b < nbest; b++) {
+            Uint64 w = best[b];
+            for (Uint32 h = DETECT_MIN_H; h <= DETECT_MAX_H; h += 2) {
+                Uint64 frame = w * h * df->num / df->den;
+                if (w * h * df->num % df->den || gDetect.size % frame) {
+                    continue;
+                }
+                if (gDetect.nguess == cap) {
+                    Guess *g;
+                    cap = cap ? cap * 2 : 256;
+                    g = realloc(gDetect.guess, cap * sizeof(Guess));
+                    if (!g) {
+                        DIE("Error allocating memory...\n");
+                        return 0;
+                    }
+                    gDetect.guess = g;
+                }
+                gDetect.guess[gDetect.nguess].df = df;
+                gDetect.guess[gDetect.nguess].width = w;
+                gDetect.guess[gDetect.nguess].height = h;
+                gDetect.guess[gDetect.nguess].frames = gDetect.size / frame;
+                gDetect.nguess++;
+            }
+        }
+    }
+    return gDetect.nguess;
+}
+
+void detect_free(void)
+{
+    if (gDetect.data) {
+        munmap((void *)gDetect.data, gDetect.size);
+    }
+    free(gDetect.row);
+    free(gDetect.guess);
+    memset(&gDetect, 0, sizeof(gDetect));
+}
+
+/* rank layouts of filename, hint is a format or FORMAT_MAX, best is kept */
+Uint32 detect_arg(char *filename, Uint32 hint)
+{
+    struct stat st;
+    int fdn;
+    double sum = 0;
+    Uint32 ret = 0;
+
+    fdn = open(filename, O_RDONLY);
+    if (fdn < 0 || fstat(fdn, &st) != 0) {
+        DIE("Error opening file=%s\n", filename);
+        if (fdn >= 0) {
+            close(fdn);
+        }
+        return 0;
+    }
+    gDetect.size = st.st_size;
+    if (gDetect.size >= 8) {
+        Uint8 magic[8];
+        if (pread(fdn, magic, 8, 0) == 8 && zin_magic(magic, 8)) {
+            DIE("file=%s is compressed, name the size and format\n",
+                filename);
+            close(fdn);
+            return 0;
+        }
+    }
+    if (gDetect.size < 4 * DETECT_SPAN) {
+        DIE("file=%s too small to detect its format\n", filename);
+        close(fdn);
+        return 0;
+    }
+    gDetect.data = mmap(NULL, gDetect.size, PROT_READ, MAP_PRIVATE, fdn, 0);
+    close(fdn);
+    if (gDetect.data == MAP_FAILED) {
+        perror("mmap");
+        gDetect.data = NULL;
+        return 0;
+    }
+
+    /* reference, samples half the file apart */
+    for (Uint32 k = 0; k < DETECT_SAMPLES; k++) {
+        off_t o = (gDetect.size / 2 - DETECT_SPAN) * k / DETECT_SAMPLES;
+        sum += detect_mad(o, o + gDetect.size / 2);
+    }
+    gDetect.unrelated = sum / DETECT_SAMPLES + 1;
+
+    gDetect.max_stride = DETECT_MAX_W * 4;
+    if (gDetect.max_stride > gDetect.size - DETECT_SPAN - 1) {
+        gDetect.max_stride = gDetect.size - DETECT_SPAN - 1;
+    }
+    gDetect.row = calloc(gDetect.max_stride + 1, sizeof(double));
+    if (!gDetect.row) {
+        DIE("Error allocating memory...\n");
+        goto cleanup;
+    }
+    detect_run(detect_row_job, 1, gDetect.max_stride);
+
+    if (!detect_candidates(hint)) {
+        DIE("no layout fits the size of file=%s\n", filename);
+        goto cleanup;
+    }
+    detect_run(detect_guess_job, 0, gDetect.nguess);
+    qsort(gDetect.guess, gDetect.nguess, sizeof(Guess), detect_cmp);
+
+    printf("detect %s, %u candidates:\n", filename, gDetect.nguess);
+    printf("  #  width height  format                 stride frames  cost\n");
+    for (Uint32 i = 0; i < gDetect.nguess && i < DETECT_SHOW; i++) {
+        Guess *g = &gDetect.guess[i];
+        printf("%3u  %5u %6u  %-22s %6u %6u  %.3f\n", i + 1,
+               g->width, g->height, showFmt(g->df->fmt),
+               g->width * g->df->rnum / g->df->rden, g->frames, g->cost);
+    }
+
+    P.width = gDetect.guess[0].width;
+    P.height = gDetect.guess[0].height;
+    FORMAT = gDetect.guess[0].df->fmt;
+    ret = 1;
+
+cleanup:
+    detect_free();
+    return ret;
+}
+
+/* strip the --name VALUE options from argv */
+Uint32 parse_options(int *argc, char **argv)
+{
+    static const char *opts[] = {
+        "--stride", "--uv-stride", "--plane-offset", "--out", "--to",
+        "--range", "--io", "--qc", "--hash", "--verify", "--verify-view",
+        "--mem", "--huge", "--serve", "--scale", "--roi", "--window",
+        "--gamma", "--kernels",
+    };
+    int n = 1;
+
+    for (int i = 1; i < *argc; i++) {
+        char *opt = argv[i], *val = argv[i + 1], *end = "";
+        Uint32 k;
+        for (k = 0; k < COUNT_OF(opts) && strcmp(opt, opts[k]); k++) {
+        }
+        if (k == COUNT_OF(opts)) {
+            argv[n++] = opt;
+            continue;
+        }
+        if (i + 1 == *argc) {
+            DIE("%s needs a value\n", opt);
+            return 0;
+        }
+        if (!strcmp(opt, "--stride")) {
+            P.stride = strtoul(val, &end, 0);
+        } else if (!strcmp(opt, "--uv-stride")) {
+            P.uv_stride = strtoul(val, &end, 0);
+        } else if (!strcmp(opt, "--plane-offset")) {
+            /* the second chroma plane follows the first unless given */
+            P.plane_offset[0] = strtoul(val, &end, 0);
+            P.plane_offset[1] = 0;
+            if (*end == ',') {
+                P.plane_offset[1] = strtoul(end + 1, &end, 0);
+            }
+        } else if (!strcmp(opt, "--out")) {
+            gExport.out = val;
+        } else if (!strcmp(opt, "--to")) {
+            gExport.to = val;
+        } else if (!strcmp(opt, "--qc")) {
+            gQc.report = val;
+        } else if (!strcmp(opt, "--hash")) {
+            gHash.out = val;
+        } else if (!strcmp(opt, "--verify") || !strcmp(opt, "--verify-view")) {
+            gHash.manifest = val;
+            gHash.view = !strcmp(opt, "--verify-view");
+        } else if (!strcmp(opt, "--mem")) {
+            /* MB, or with a K, M or G suffix */
+            Uint32 shift = 20;
+            gMem.budget = strtoull(val, &end, 0);
+            if (*end == 'k' || *end == 'K') {
+                shift = 10;
+                end++;
+            } else if (*end == 'm' || *end == 'M') {
+                end++;
+            } else if (*end == 'g' || *end == 'G') {
+                shift = 30;
+                end++;
+            }
+            /* a budget the shift would wrap is refused, not cut short */
+            if (gMem.budget > (UINT64_MAX >> shift)) {
+                gMem.budget = 0;
+            }
+            gMem.budget <<= shift;
+            if (!gMem.budget) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--huge")) {
+            gMem.huge = !strcmp(val, "thp") ? MEM_THP
+                        : !strcmp(val, "hugetlb") ? MEM_HUGETLB
+                        : !strcmp(val, "off") ? MEM_SMALL : MEM_OWNERS;
+            if (gMem.huge == MEM_OWNERS) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--serve")) {
+            gNet.serve = val;
+        } else if (!strcmp(opt, "--scale")) {
+            gNet.scale = strtoul(val, &end, 0);
+            if (!gNet.scale) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--roi")) {
+            /* WxH[+X+Y] */
+            gNet.roi[2] = strtoul(val, &end, 10);
+            if (*end == 'x') {
+                gNet.roi[3] = strtoul(end + 1, &end, 10);
+            }
+            if (*end == '+') {
+                gNet.roi[0] = strtoul(end + 1, &end, 10);
+                if (*end == '+') {
+                    gNet.roi[1] = strtoul(end + 1, &end, 10);
+                }
+            }
+            if (!gNet.roi[2] || !gNet.roi[3]) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--window")) {
+            /* LO:HI, in samples */
+            gLut.lo = strtoul(val, &end, 0);
+            if (*end == ':') {
+                gLut.hi = strtoul(end + 1, &end, 0);
+            }
+            if (gLut.hi <= gLut.lo) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--gamma")) {
+            gLut.gamma = strtod(val, &end);
+            if (gLut.gamma <= 0) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--kernels")) {
+            if (!kern_init(val)) {
+                end = val;
+            }
+        } else if (!strcmp(opt, "--io")) {
+            /* uring[:N] or stdio */
+            gUring.fd = gUring.ring = -1;
+            gUring.depth = 0;
+            if (!strncmp(val, "uring", 5)) {
+                gUring.depth = URING_DEPTH;
+                end = val + 5;
+                if (*end == ':') {
+                    gUring.depth = strtoul(end + 1, &end, 0);
+                }
+                if (!gUring.depth || gUring.depth > URING_MAX) {
+                    end = val;
+                }
+            } else if (strcmp(val, "stdio")) {
+                end = val;
+            }
+        } else {
+            /* checked by export_setup() */
+            gExport.range = val;
+        }
+        if (*end) {
+            DIE("bad value '%s' for %s\n", val, opt);
+            return 0;
+        }
+        i++;
+    }
+    argv[n] = NULL;
+    *argc = n;
+    return 1;
+}
+
+Uint32 parse_input(int argc, char **argv)
+{
+    if (!parse_options(&argc, argv)) {
+        usage(argv[0]);
+        return 0;
+    }
+    if (argc > 2 && !strcmp(argv[1], "-c")) {
+        if (!parse_compare(argc - 2, argv + 2)) {
+            usage(argv[0]);
+            return 0;
+        }
+    } else if (argc > 2 && !strcmp(argv[1], "-a")) {
+        /* -a filename [format hint] */
+        Uint32 hint = FORMAT_MAX;
+        if (argc == 4) {
+            if (!parse_format(argv[3])) {
+                DIE("The format option '%s' is not recognized\n", argv[3]);
+                return 0;
+            }
+            hint = FORMAT;
+        }
+        if (argc > 4 || !detect_arg(argv[2], hint)) {
+            usage(argv[0]);
+            return 0;
+        }
+        P.filename = argv[2];
+    } else if (argc == 2 && !strncmp(argv[1], NET_SCHEME,
+                                     strlen(NET_SCHEME))) {
+        /* viewer of a --serve */
+        if (!net_arg(argv[1])) {
+            return 0;
+        }
+    } else if (argc == 2 && guess_arg(argv[1])) {
+        P.filename = argv[1];
+    } else if (argc == 2) {
+        /* nothing usable in the name, look at the data */
+        Uint32 hint = parse_format(argv[1]) ? FORMAT : FORMAT_MAX;
+        if (!detect_arg(argv[1], hint)) {
+            usage(argv[0]);
+            return 0;
+        }
+        P.filename = argv[1];
+    } else if (argc == 5 || argc == 6) {
+        if (argc == 6) {
+            /* diff mode */
+            P.diff = 1;
+            P.diff_amp = 1;
+            P.fname_diff = argv[5];
+            printf("diff mode: with fn=[%s]\n", P.fname_diff);
+        }
+
+        P.filename = argv[1];
+        P.width = atoi(argv[2]);
+        P.height = atoi(argv[3]);
+        char *fmt = argv[4];
+        parse_format(fmt);
+        if (FORMAT == FORMAT_MAX) {
+            DIE("The format option '%s' is not recognized\n", fmt);
+            return 0;
+        }
+    } else {
+        usage(argv[0]);
+        return 0;
+    }
+    precheck_range(FORMAT, gFmtMap);
+    P.overlay_format = gFmtMap[FORMAT].overlay_fmt;
+    char *cc = (char *)&P.overlay_format;
+    printf("arg %dx%d FORMAT=%d(%s) show overlay_format=%#x(%c%c%c%c)\n",
+           P.width, P.height, FORMAT, showFmt(FORMAT),
+           P.overlay_format, cc[0], cc[1], cc[2], cc[3]);
+    return 1;
+}
+
+Uint32 open_input(void)
+{
+    /* no read-ahead where read_job()s on the pool read the inputs, a job
+     * would wait for chunks queued behind it on the same pool */
+    fd = zfopen(P.filename, !P.diff && !gCmp.on);
+    if (fd == NULL) {
+        DIE("Error opening file=%s\n", P.filename);
+        return 0;
+    }
+
+    if (P.diff) {
+        P.fd2 = zfopen(P.fname_diff, false);
+        if (P.fd2 == NULL) {
+            DIE("Error opening %s\n", P.fname_diff);
+            return 0;
+        }
+    }
+    if (gCmp.on) {
+        return cmp_open();
+    }
+    return 1;
+}
+
+Uint32 sdl_init(void)
+{
+    /* SDL init */
+    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+        DIE("Unable to set video mode: %s\n", SDL_GetError());
+        atexit(SDL_Quit);
+        return 0;
+    }
+
+    info = SDL_GetVideoInfo();
+    if (!info) {
+        DIE("SDL ERROR Video query failed: %s\n", SDL_GetError());
+        SDL_Quit();
+        return 0;
+    }
+
+    P.bpp = info->vfmt->BitsPerPixel;
+
+    if (info->hw_available) {
+        P.vflags = SDL_HWSURFACE;
+    } else {
+        P.vflags = SDL_SWSURFACE;
+    }
+
+    // find SDL_SetVideoMode crash when 32768x320 size
+    if (P.width > 4096 || P.height > 2176) {
+        DIE("SDL cannot support size=%dx%d > 4096x2160\n", P.width, P.height);
+        return 0;
+    }
+
+    if (!sdl_overlay()) {
+        SDL_Quit();
+        return 0;
+    }
+    return 1;
+}
+
+/* Remote view
+ * --serve decodes on the machine that holds the data and streams frames
+ * to viewers opened on yv://HOST:PORT, instead of pushing the whole
+ * overlay through X11 forwarding. A viewer sees the stream as an IYUV
+ * file: reads of its FILE become GET messages for one frame and the
+ * planes the view needs, so stepping and plane toggles travel as a few
+ * bytes and the planes the view hides are never sent. The server crops
+ * every frame to the viewer's --roi, point samples it down by --scale
+ * and sends each plane as the difference to the one it sent before,
+ * zero runs coded as counts and the rest deflated when both ends have
+ * zlib. Zoom and pan stay local. Each connection has its own thread,
+ * input and decode buffers; every message is a NetMsg header, little
+ * endian, and len bytes of payload.
+ */
+Uint8 *put_le32(Uint8 *o, Uint32 v)
+{
+    o[0] = v;
+    o[1] = v >> 8;
+    o[2] = v >> 16;
+    o[3] = v >> 24;
+    return o + 4;
+}
+
+Uint32 put_varint(Uint8 *o, Uint32 v)
+{
+    Uint32 n = 0;
+
+    while (v >= 0x80) {
+        o[n++] = v | 0x80;
+        v >>= 7;
+    }
+    o[n++] = v;
+    return n;
+}
+
+Uint32 get_varint(const Uint8 *src, Uint32 len, Uint32 *pos, Uint32 *v)
+{
+    *v = 0;
+    for (Uint32 shift = 0; shift < 35 && *pos < len; shift += 7) {
+        Uint8 b = src[(*pos)++];
+        *v |= (Uint32)(b & 0x7F) << shift;
+        if (!(b & 0x80)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* dst = a - b, modulo 256 */
+void sub_u8_c(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        dst[i] = a[i] - b[i];
+    }
+}
+
+/* dst += src, modulo 256 */
+void add_u8_c(Uint8 *dst, const Uint8 *src, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        dst[i] += src[i];
+    }
+}
+
+#ifdef __SSE2__
+void sub_u8_sse2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_sub_epi8(va, vb));
+    }
+    sub_u8_c(dst + i, a + i, b + i, n - i);
+}
+
+void add_u8_sse2(Uint8 *dst, const Uint8 *src, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i vd = _mm_loadu_si128((const __m128i *)(dst + i));
+        __m128i vs = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_add_epi8(vd, vs));
+    }
+    add_u8_c(dst + i, src + i, n - i);
+}
+#endif
+
+#ifdef HAVE_AVX2
+__attribute__((target("avx2")))
+void sub_u8_avx2(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_sub_epi8(va, vb));
+    }
+    sub_u8_c(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+void add_u8_avx2(Uint8 *dst, const Uint8 *src, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i vd = _mm256_loadu_si256((const __m256i *)(dst + i));
+        __m256i vs = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_add_epi8(vd, vs));
+    }
+    add_u8_c(dst + i, src + i, n - i);
+}
+#endif
+
+#ifdef HAVE_AVX512
+__attribute__((target("avx512f,avx512bw")))
+void sub_u8_avx512(Uint8 *dst, const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i va = _mm512_loadu_si512((const void *)(a + i));
+        __m512i vb = _mm512_loadu_si512((const void *)(b + i));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_sub_epi8(va, vb));
+    }
+    sub_u8_c(dst + i, a + i, b + i, n - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+void add_u8_avx512(Uint8 *dst, const Uint8 *src, Uint32 n)
+{
+    Uint32 i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i vd = _mm512_loadu_si512((const void *)(dst + i));
+        __m512i vs = _mm512_loadu_si512((const void *)(src + i));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_add_epi8(vd, vs));
+    }
+    add_u8_c(dst + i, src + i, n - i);
+}
+#endif
+
+/* end of the zero run at src[i] */
+Uint32 zero_run(const Uint8 *src, Uint32 i, Uint32 n)
+{
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF) {
+            break;
+        }
+    }
+#endif
+    while (i < n && !src[i]) {
+        i++;
+    }
+    return i;
+}
+
+/* end of the literals at src[i], the next NET_ZRUN zeros or more */
+Uint32 literal_run(const Uint8 *src, Uint32 i, Uint32 n)
+{
+    while (i < n) {
+        Uint32 z;
+#ifdef __SSE2__
+        __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= n; i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero))) {
+                break;
+            }
+        }
+#endif
+        if (i == n || src[i]) {
+            i += i < n;
+            continue;
+        }
+        z = zero_run(src, i, n);
+        if (z - i >= NET_ZRUN || z == n) {
+            return i;
+        }
+        i = z;
+    }
+    return n;
+}
+
+/* src as (zero count, literal count, literals) tokens, 0 when that takes
+ * cap bytes or more */
+Uint32 zrle_encode(const Uint8 *src, Uint32 n, Uint8 *dst, Uint32 cap)
+{
+    Uint32 i = 0, o = 0;
+
+    while (i < n) {
+        Uint32 z = zero_run(src, i, n);
+        Uint32 l = literal_run(src, z, n);
+        if (o + 10 + (l - z) >= cap) {
+            return 0;
+        }
+        o += put_varint(dst + o, z - i);
+        o += put_varint(dst + o, l - z);
+        memcpy(dst + o, src + z, l - z);
+        o += l - z;
+        i = l;
+    }
+    return o;
+}
+
+/* adds the difference in len bytes of tokens to the n bytes of dst */
+Uint32 zrle_apply(Uint8 *dst, Uint32 n, const Uint8 *src, Uint32 len)
+{
+    Uint32 i = 0, o = 0;
+
+    while (o < len) {
+        Uint32 z, l;
+        if (!get_varint(src, len, &o, &z) || !get_varint(src, len, &o, &l)
+            || z > n - i || l > n - i - z || l > len - o) {
+            return 0;
+        }
+        i += z;
+        gKern.add_u8(dst + i, src + o, l);
+        i += l;
+        o += l;
+    }
+    return i == n;
+}
+
+/* all n bytes, or 0 */
+Uint32 net_send(int fd, const void *buf, size_t n, bool more)
+{
+    const Uint8 *p = buf;
+
+    while (n) {
+        ssize_t k = send(fd, p, n, MSG_NOSIGNAL | (more ? MSG_MORE : 0));
+        if (k < 0 && errno == EINTR) {
+            continue;
+        }
+        if (k <= 0) {
+            return 0;
+        }
+        p += k;
+        n -= k;
+    }
+    return 1;
+}
+
+Uint32 net_recv(int fd, void *buf, size_t n)
+{
+    Uint8 *p = buf;
+
+    while (n) {
+        ssize_t k = recv(fd, p, n, 0);
+        if (k < 0 && errno == EINTR) {
+            continue;
+        }
+        if (k <= 0) {
+            return 0;
+        }
+        p += k;
+        n -= k;
+    }
+    return 1;
+}
+
+Uint32 net_put_msg(int fd, const NetMsg *m, const void *payload)
+{
+    Uint8 b[NET_HDR], *o = put_le32(b, m->type);
+
+    for (Uint32 k = 0; k < COUNT_OF(m->arg); k++) {
+        o = put_le32(o, m->arg[k]);
+    }
+    put_le32(o, m->len);
+    return net_send(fd, b, sizeof(b), m->len)
+           && (!m->len || net_send(fd, payload, m->len, false));
+}
+
+/* header only, the payload is left to the caller */
+Uint32 net_get_msg(int fd, NetMsg *m)
+{
+    Uint8 b[NET_HDR];
+
+    if (!net_recv(fd, b, sizeof(b))) {
+        return 0;
+    }
+    m->type = get_le32(b);
+    for (Uint32 k = 0; k < COUNT_OF(m->arg); k++) {
+        m->arg[k] = get_le32(b + 4 + k * 4);
+    }
+    m->len = get_le32(b + 32);
+    return 1;
+}
+
+/* HOST:PORT, [HOST]:PORT or PORT, host NULL for the last */
+Uint32 net_addr(const char *spec, char *host, Uint32 size, const char **port)
+{
+    const char *colon = strrchr(spec, ':');
+    Uint32 n;
+
+    *port = colon ? colon + 1 : spec;
+    if (!colon) {
+        host[0] = '\0';
+        return **port != '\0';
+    }
+    if (*spec == '[' && colon > spec && colon[-1] == ']') {
+        spec++;
+        colon--;
+    }
+    n = colon - spec;
+    if (n >= size || !**port) {
+        return 0;
+    }
+    memcpy(host, spec, n);
+    host[n] = '\0';
+    return 1;
+}
+
+/* connected (listen false) or listening socket for spec, -1 on error */
+int net_socket(const char *spec, bool listen_on)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256];
+    const char *port;
+    int fd = -1, one = 1, err;
+
+    if (!net_addr(spec, host, sizeof(host), &port)) {
+        DIE("bad address '%s', want HOST:PORT\n", spec);
+        return -1;
+    }
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listen_on ? AI_PASSIVE : 0;
+    err = getaddrinfo(host[0] ? host : NULL, port, &hints, &res);
+    if (err) {
+        DIE("%s: %s\n", spec, gai_strerror(err));
+        return -1;
+    }
+    for (ai = res; ai && fd < 0; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC,
+                    ai->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (listen_on) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            err = bind(fd, ai->ai_addr, ai->ai_addrlen) || listen(fd, 16);
+        } else {
+            err = connect(fd, ai->ai_addr, ai->ai_addrlen);
+        }
+        if (err) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        DIE("%s: %s\n", spec, strerror(errno));
+        return -1;
+    }
+    /* small control messages and planes go out at once */
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/* bytes of plane p of a streamed w x h frame */
+Uint32 net_plane_size(Uint32 w, Uint32 h, Uint32 p)
+{
+    return p ? (w / 2) * (h / 2) : w * h;
+}
+
+/* roi and scale from HELLO, clamped to the source, even sizes */
+Uint32 net_geometry(NetConn *c, const NetMsg *m)
+{
+    const Dec *d = &P.dec;
+    Uint32 w, h;
+
+    c->scale = m->arg[1] ? m->arg[1] : 1;
+    c->zlib = m->arg[2] & NET_CAN_ZLIB;
+#ifndef HAVE_ZLIB
+    c->zlib = false;
+#endif
+    c->x = MIN(m->arg[3], d->width - 2) & ~1;
+    c->y = MIN(m->arg[4], d->height - 2) & ~1;
+    w = m->arg[5] ? MIN(m->arg[5], d->width - c->x) : d->width - c->x;
+    h = m->arg[6] ? MIN(m->arg[6], d->height - c->y) : d->height - c->y;
+    c->w = (w / c->scale) & ~1;
+    c->h = (h / c->scale) & ~1;
+    return c->w >= 2 && c->h >= 2;
+}
+
+/* plane p of the decoded frame, cropped and point sampled into c->cur */
+void net_sample(NetConn *c, Uint32 p)
+{
+    const Dec *d = &P.dec;
+    const Uint8 *src = p == 0 ? c->f.y_data : p == 1 ? c->f.cb_data
+                       : c->f.cr_data;
+    Uint32 sub = p ? 2 : 1;
+    Uint32 stride = d->width / sub;
+    /* packed 4:2:2 keeps every chroma row, the others 4:2:0 */
+    Uint32 vstep = p && !isPlanar(d->format) ? 2 : 1;
+    Uint32 ow = c->w / sub, oh = c->h / sub, s = c->scale;
+    Uint8 *dst = c->cur;
+
+    for (Uint32 i = 0; i < oh; i++, dst += ow) {
+        const Uint8 *row = src + (size_t)(c->y / sub + i * s) * vstep * stride
+                           + c->x / sub;
+        if (s == 1) {
+            memcpy(dst, row, ow);
+            continue;
+        }
+        for (Uint32 j = 0; j < ow; j++) {
+            dst[j] = row[j * s];
+        }
+    }
+}
+
+/* plane p of the frame in c->f to the viewer, coded against c->last[p] */
+Uint32 net_put_plane(NetConn *c, Uint32 index, Uint32 p)
+{
+    Uint32 n = net_plane_size(c->w, c->h, p), tlen;
+    NetMsg m = {NET_PLANE, {index, p, NET_RAW, n, 0, 0, 0}, n};
+    const Uint8 *payload = c->cur;
+
+    net_sample(c, p);
+    gKern.sub_u8(c->delta, c->cur, c->last[p], n);
+    tlen = zrle_encode(c->delta, n, c->tokens, n);
+    if (tlen) {
+        m.arg[2] = NET_ZRLE;
+        m.arg[4] = m.len = tlen;
+        payload = c->tokens;
+    }
+#ifdef HAVE_ZLIB
+    if (tlen > NET_ZMIN && c->zlib) {
+        uLongf zlen = tlen - 1;
+        if (compress2(c->out, &zlen, c->tokens, tlen, 1) == Z_OK) {
+            m.arg[2] = NET_ZRLE_Z;
+            m.len = zlen;
+            payload = c->out;
+        }
+    }
+#endif
+    memcpy(c->last[p], c->cur, n);
+    c->raw += n;
+    c->wire += NET_HDR + m.len;
+    return net_put_msg(c->fd, &m, payload);
+}
+
+Uint32 net_error(NetConn *c, const char *msg)
+{
+    NetMsg m = {NET_ERROR, {0}, strlen(msg)};
+
+    return net_put_msg(c->fd, &m, msg);
+}
+
+/* GET: decode what the frame in c->f lacks and send the planes asked */
+Uint32 net_serve_get(NetConn *c, Uint32 index, Uint32 mask)
+{
+    Uint32 need;
+
+    mask &= PLANE_ALL;
+    if (index >= gNet.nframes) {
+        return net_error(c, "frame out of range");
+    }
+    if (index != c->index) {
+        c->index = index;
+        c->have = 0;
+        c->frames++;
+    }
+    need = mask & ~c->have;
+    if (need) {
+        c->f.need = need;
+        if (fseeko(c->in, frame_offset(index), SEEK_SET) != 0
+            || !dec_read(&P.dec, c->in, &c->f)) {
+            c->index = (Uint32)-1;
+            return net_error(c, "cannot read frame");
+        }
+        c->have |= need;
+    }
+    for (Uint32 p = 0; p < 3; p++) {
+        if ((mask & 1 << p) && !net_put_plane(c, index, p)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* one viewer, until it hangs up or serve_run() shuts the socket */
+int net_conn(void *arg)
+{
+    NetConn *c = arg;
+    const Dec *d = &P.dec;
+    NetMsg m;
+    Uint32 ysize;
+
+    c->index = (Uint32)-1;
+    if (!net_get_msg(c->fd, &m) || m.type != NET_HELLO
+        || m.arg[0] != NET_MAGIC || m.len) {
+        DIE("serve: %s is no yv viewer\n", c->peer);
+        goto done;
+    }
+    if (!net_geometry(c, &m)) {
+        net_error(c, "roi or scale leaves no picture");
+        goto done;
+    }
+    ysize = net_plane_size(c->w, c->h, 0);
+    c->in = zfopen(P.filename, false);
+    if (!c->in) {
+        net_error(c, "server cannot open the input");
+        goto done;
+    }
+    for (Uint32 p = 0; p < 3; p++) {
+        c->last[p] = mem_alloc(ysize, MEM_FRAME);
+    }
+    c->cur = mem_alloc(ysize, MEM_SCRATCH);
+    c->delta = mem_alloc(ysize, MEM_SCRATCH);
+    c->tokens = mem_alloc(ysize, MEM_SCRATCH);
+    c->out = mem_alloc(ysize, MEM_SCRATCH);
+    if (!c->last[0] || !c->last[1] || !c->last[2] || !c->cur
+        || !c->delta || !c->tokens || !c->out || !frame_alloc(d, &c->f)) {
+        net_error(c, "server out of memory");
+        goto done;
+    }
+    for (Uint32 p = 0; p < 3; p++) {
+        memset(c->last[p], 0, ysize);
+    }
+    m = (NetMsg){NET_INFO, {NET_MAGIC, c->w, c->h, gNet.nframes, d->width,
+                            d->height, d->format}, 0};
+    if (!net_put_msg(c->fd, &m, NULL)) {
+        goto done;
+    }
+    printf("serve: %s, %ux%u at %u,%u scale %u%s\n", c->peer, c->w, c->h,
+           c->x, c->y, c->scale, c->zlib ? ", zlib" : "");
+    while (net_get_msg(c->fd, &m) && m.type == NET_GET && !m.len
+           && net_serve_get(c, m.arg[0], m.arg[1])) {
+    }
+    printf("serve: %s gone, %u frames, %.1f MB of planes as %.1f MB\n",
+           c->peer, c->frames, c->raw / 1e6, c->wire / 1e6);
+done:
+    if (c->in) {
+        fclose(c->in);
+    }
+    frame_free(&c->f);
+    for (Uint32 p = 0; p < 3; p++) {
+        mem_free(c->last[p]);
+    }
+    mem_free(c->cur);
+    mem_free(c->delta);
+    mem_free(c->tokens);
+    mem_free(c->out);
+    __atomic_store_n(&c->done, true, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/* joins finished connections, all of them when closing */
+void serve_reap(bool all)
+{
+    for (Uint32 i = 0; i < NET_MAX_CONN; i++) {
+        NetConn *c = gNet.conn[i];
+        if (!c || (!all && !__atomic_load_n(&c->done, __ATOMIC_ACQUIRE))) {
+            continue;
+        }
+        /* wakes a thread blocked in recv() */
+        shutdown(c->fd, SHUT_RDWR);
+        SDL_WaitThread(c->thread, NULL);
+        close(c->fd);
+        free(c);
+        gNet.conn[i] = NULL;
+    }
+}
+
+void serve_stop(int sig)
+{
+    (void)sig;
+    gNet.stop = 1;
+}
+
+Uint32 serve_run(void)
+{
+    struct sigaction sa;
+    int lfd;
+
+    setup_param();
+    if (gCmp.on || P.diff) {
+        DIE("--serve streams a single input\n");
+        return 0;
+    }
+    gNet.nframes = frame_count(fd);
+    if (!gNet.nframes) {
+        DIE("no frames to serve\n");
+        return 0;
+    }
+    lfd = net_socket(gNet.serve, true);
+    if (lfd < 0) {
+        return 0;
+    }
+    /* no SA_RESTART, poll() returns at once */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    /* connection threads log as viewers come and go */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("serve: %s, %u frames %dx%d %s on %s\n", P.filename,
+           gNet.nframes, P.width, P.height, showFmt(FORMAT), gNet.serve);
+
+    while (!gNet.stop) {
+        struct pollfd pfd = {lfd, POLLIN, 0};
+        struct sockaddr_storage sa_peer;
+        socklen_t len = sizeof(sa_peer);
+        char host[INET6_ADDRSTRLEN], port[8];
+        NetConn *c;
+        Uint32 i;
+        int cfd, one = 1;
+
+        serve_reap(false);
+        if (poll(&pfd, 1, NET_POLL_MS) <= 0) {
+            continue;
+        }
+        cfd = accept4(lfd, (struct sockaddr *)&sa_peer, &len, SOCK_CLOEXEC);
+        if (cfd < 0) {
+            continue;
+        }
+        for (i = 0; i < NET_MAX_CONN && gNet.conn[i]; i++) {
+        }
+        c = i < NET_MAX_CONN ? calloc(1, sizeof(NetConn)) : NULL;
+        if (!c) {
+            DIE("serve: too many viewers\n");
+            close(cfd);
+            continue;
+        }
+        setsockopt(cfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (getnameinfo((struct sockaddr *)&sa_peer, len, host, sizeof(host),
+                        port, sizeof(port),
+                        NI_NUMERICHOST | NI_NUMERICSERV) == 0) {
+            snprintf(c->peer, sizeof(c->peer), "%s:%s", host, port);
+        }
+        c->fd = cfd;
+        c->thread = SDL_CreateThread(net_conn, c);
+        if (!c->thread) {
+            DIE("SDL_CreateThread: %s\n", SDL_GetError());
+            close(cfd);
+            free(c);
+            continue;
+        }
+        gNet.conn[i] = c;
+    }
+    printf("serve: stopping\n");
+    close(lfd);
+    serve_reap(true);
+    return 1;
+}
+
+/* connects c to a server, HELLO with --scale and --roi, INFO back */
+Uint32 net_connect(const char *name, NetIn *c)
+{
+    NetMsg m = {NET_HELLO, {NET_MAGIC, gNet.scale, 0, gNet.roi[0],
+                            gNet.roi[1], gNet.roi[2], gNet.roi[3]}, 0};
+    char err[256];
+
+#ifdef HAVE_ZLIB
+    m.arg[2] |= NET_CAN_ZLIB;
+#endif
+    memset(c, 0, sizeof(*c));
+    c->fd = net_socket(name + strlen(NET_SCHEME), false);
+    if (c->fd < 0) {
+        return 0;
+    }
+    if (!net_put_msg(c->fd, &m, NULL) || !net_get_msg(c->fd, &m)) {
+        DIE("%s: no answer\n", name);
+        goto fail;
+    }
+    if (m.type == NET_ERROR) {
+        Uint32 n = MIN(m.len, sizeof(err) - 1);
+        err[net_recv(c->fd, err, n) ? n : 0] = '\0';
+        DIE("%s: %s\n", name, err);
+        goto fail;
+    }
+    if (m.type != NET_INFO || m.arg[0] != NET_MAGIC || m.len) {
+        DIE("%s: not a yv server\n", name);
+        goto fail;
+    }
+    c->w = m.arg[1];
+    c->h = m.arg[2];
+    c->nframes = m.arg[3];
+    c->fsize = c->w * c->h * 3 / 2;
+    c->src_w = m.arg[4];
+    c->src_h = m.arg[5];
+    c->src_format = m.arg[6];
+    c->index = (Uint32)-1;
+    c->want = PLANE_ALL;
+    if (!c->nframes || c->w < 2 || c->h < 2 || c->w > 16384
+        || c->h > 16384) {
+        DIE("%s: bad stream %ux%u\n", name, c->w, c->h);
+        goto fail;
+    }
+    return 1;
+fail:
+    close(c->fd);
+    c->fd = -1;
+    return 0;
+}
+
+/* geometry of a yv:// input, the viewer shows it as IYUV */
+Uint32 net_arg(char *name)
+{
+    NetIn c;
+
+    P.filename = name;
+    if (!net_connect(name, &c)) {
+        return 0;
+    }
+    close(c.fd);
+    printf("%s: %ux%u %s, %u frames, streamed as %ux%u\n", name, c.src_w,
+           c.src_h, showFmt(c.src_format), c.nframes, c.w, c.h);
+    P.width = c.w;
+    P.height = c.h;
+    FORMAT = IYUV;
+    return 1;
+}
+
+/* plane p of frame index into c->buf[p], with the planes the frame
+ * before was read for, in one GET */
+Uint32 net_fetch(NetIn *c, Uint32 index, Uint32 p)
+{
+    Uint32 mask, got = 0;
+    Uint64 start = now_ns(), wire = 0, raw = 0;
+    NetMsg m = {NET_GET, {index, 0}, 0};
+
+    if (index != c->index) {
+        if (c->used) {
+            c->want = c->used;
+        }
+        c->index = index;
+        c->have = c->used = 0;
+    }
+    c->used |= 1 << p;
+    if (c->have & 1 << p) {
+        return 1;
+    }
+    mask = (c->want | 1 << p) & ~c->have;
+    m.arg[1] = mask;
+    if (!net_put_msg(c->fd, &m, NULL)) {
+        goto lost;
+    }
+    while (got != mask) {
+        Uint32 q, n;
+        if (!net_get_msg(c->fd, &m)) {
+            goto lost;
+        }
+        q = m.arg[1];
+        if (m.type == NET_ERROR) {
+            char err[256];
+            n = MIN(m.len, sizeof(err) - 1);
+            err[net_recv(c->fd, err, n) ? n : 0] = '\0';
+            DIE("yv://: frame %u: %s\n", index, err);
+            c->index = (Uint32)-1;
+            return 0;
+        }
+        n = q < 3 ? net_plane_size(c->w, c->h, q) : 0;
+        if (m.type != NET_PLANE || m.arg[0] != index || q >= 3
+            || !(mask & 1 << q)
+            || m.arg[3] != n || m.len > n || m.arg[4] > n
+            || !net_recv(c->fd, c->payload, m.len)) {
+            goto lost;
+        }
+        if (m.arg[2] == NET_RAW && m.len == n) {
+            memcpy(c->buf[q], c->payload, n);
+        } else if (m.arg[2] == NET_ZRLE) {
+            if (!zrle_apply(c->buf[q], n, c->payload, m.len)) {
+                goto lost;
+            }
+#ifdef HAVE_ZLIB
+        } else if (m.arg[2] == NET_ZRLE_Z) {
+            uLongf tlen = m.arg[4];
+            if (uncompress(c->tokens, &tlen, c->payload, m.len) != Z_OK
+                || tlen != m.arg[4]
+                || !zrle_apply(c->buf[q], n, c->tokens, tlen)) {
+                goto lost;
+            }
+#endif
+        } else {
+            goto lost;
+        }
+        got |= 1 << q;
+        raw += n;
+        wire += NET_HDR + m.len;
+    }
+    c->have |= got;
+    __atomic_add_fetch(&gNet.gets, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gNet.planes, __builtin_popcount(got),
+                       __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gNet.raw, raw, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gNet.wire, wire + NET_HDR, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&gNet.wait_ns, now_ns() - start, __ATOMIC_RELAXED);
+    return 1;
+lost:
+    /* out of step with the server, the delta bases are gone too */
+    DIE("yv://: connection lost\n");
+    shutdown(c->fd, SHUT_RDWR);
+    c->index = (Uint32)-1;
+    return 0;
+}
+
+ssize_t net_read(void *cookie, char *buf, size_t size)
+{
+    NetIn *c = cookie;
+    Uint64 end = (Uint64)c->nframes * c->fsize;
+    size_t done = 0;
+
+    while (done < size && c->pos < end) {
+        Uint32 index = c->pos / c->fsize;
+        Uint32 off = c->pos % c->fsize, p = 0, n;
+        while (off >= net_plane_size(c->w, c->h, p)) {
+            off -= net_plane_size(c->w, c->h, p++);
+        }
+        if (!net_fetch(c, index, p)) {
+            return done ? (ssize_t)done : -1;
+        }
+        n = MIN(size - done, net_plane_size(c->w, c->h, p) - off);
+        memcpy(buf + done, c->buf[p] + off, n);
+        done += n;
+        c->pos += n;
+    }
+    return done;
+}
+
+int net_seek(void *cookie, off64_t *off, int whence)
+{
+    NetIn *c = cookie;
+    Sint64 pos = *off;
+
+    if (whence == SEEK_CUR) {
+        pos += c->pos;
+    } else if (whence == SEEK_END) {
+        pos += (Uint64)c->nframes * c->fsize;
+    }
+    if (pos < 0) {
+        return -1;
+    }
+    c->pos = pos;
+    *off = pos;
+    return 0;
+}
+
+int net_close(void *cookie)
+{
+    NetIn *c = cookie;
+
+    if (c->fd >= 0) {
+        close(c->fd);
+    }
+    for (Uint32 p = 0; p < 3; p++) {
+        mem_free(c->buf[p]);
+    }
+    mem_free(c->payload);
+    mem_free(c->tokens);
+    free(c);
+    return 0;
+}
+
+/* FILE reading the IYUV stream of a server, see zfopen() */
+FILE *net_open(const char *name)
+{
+    cookie_io_functions_t io = {net_read, NULL, net_seek, net_close};
+    NetIn *c = calloc(1, sizeof(NetIn));
+    Uint32 ysize;
+    FILE *fp;
+
+    if (!c) {
+        return NULL;
+    }
+    if (!net_connect(name, c)) {
+        free(c);
+        return NULL;
+    }
+    ysize = net_plane_size(c->w, c->h, 0);
+    for (Uint32 p = 0; p < 3; p++) {
+        c->buf[p] = mem_alloc(ysize, MEM_FRAME);
+    }
+    c->payload = mem_alloc(ysize, MEM_SCRATCH);
+    c->tokens = mem_alloc(ysize, MEM_SCRATCH);
+    if (!c->buf[0] || !c->buf[1] || !c->buf[2] || !c->payload
+        || !c->tokens) {
+        DIE("Error allocating memory...\n");
+        net_close(c);
+        return NULL;
+    }
+    for (Uint32 p = 0; p < 3; p++) {
+        memset(c->buf[p], 0, ysize);
+    }
+    fp = fopencookie(c, "rb", io);
+    if (!fp) {
+        net_close(c);
+        return NULL;
+    }
+    /* every read is a GET for exactly the planes it covers */
+    setvbuf(fp, NULL, _IONBF, 0);
+    return fp;
+}
+
+void net_stats(void)
+{
+    Uint64 gets = __atomic_load_n(&gNet.gets, __ATOMIC_RELAXED);
+    Uint64 raw = __atomic_load_n(&gNet.raw, __ATOMIC_RELAXED);
+    Uint64 wire = __atomic_load_n(&gNet.wire, __ATOMIC_RELAXED);
+
+    if (!gets) {
+        return;
+    }
+    printf("net: %llu requests, %.2f ms each, %llu planes, %.1f MB as"
+           " %.1f MB on the wire (%.1fx)\n", (unsigned long long)gets,
+           __atomic_load_n(&gNet.wait_ns, __ATOMIC_RELAXED) / 1e6 / gets,
+           (unsigned long long)__atomic_load_n(&gNet.planes,
+                                               __ATOMIC_RELAXED),
+           raw / 1e6, wire / 1e6, wire ? (double)raw / wire : 0.0);
+}
+
+/* Export
+ * Converts a frame range of the input to raw (any format yv reads), Y4M
+ * or PNG snapshots without opening a window. A reader thread decodes
+ * into a ring of EXPORT_DEPTH slots, the main thread converts everything
+ * read so far in one pool_run() batch and a writer thread streams the
+ * results through an EXPORT_BUF stdio buffer. Reading, converting and
+ * writing overlap, and the output is written sequentially in big chunks.
+ */
+Uint32 gCrcTable[256];
+
+void crc32_init(void)
+{
+    for (Uint32 n = 0; n < 256; n++) {
+        Uint32 c = n;
+        for (Uint32 k = 0; k < 8; k++) {
+            c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+        }
+        gCrcTable[n] = c;
+    }
+}
+
+Uint32 crc32_u8(Uint32 crc, const Uint8 *p, Uint32 n)
+{
+    crc = ~crc;
+    while (n--) {
+        crc = gCrcTable[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+Uint32 adler32_u8(Uint32 adler, const Uint8 *p, Uint32 n)
+{
+    Uint32 a = adler & 0xFFFF, b = adler >> 16;
+
+    while (n) {
+        /* largest run before b can overflow */
+        Uint32 run = n < 5552 ? n : 5552;
+        n -= run;
+        while (run--) {
+            a += *p++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return b << 16 | a;
+}
+
+Uint8 *put_be32(Uint8 *o, Uint32 v)
+{
+    o[0] = v >> 24;
+    o[1] = v >> 16;
+    o[2] = v >> 8;
+    o[3] = v;
+    return o + 4;
+}
+
+Uint8 *put_bytes(Uint8 *o, const Uint8 *src, Uint32 n)
+{
+    memcpy(o, src, n);
+    return o + n;
+}
+
+/* decoded chroma (width / 2 x srows) to cw x ch, nearest sample */
+void ex_chroma(const Uint8 *src, Uint32 srows, Uint8 *dst, Uint32 cw,
+               Uint32 ch)
+{
+    Uint32 sw = P.width / 2;
+
+    for (Uint32 r = 0; r < ch; r++) {
+        const Uint8 *s = src + (Uint64)r * srows / ch * sw;
+        if (cw == sw) {
+            memcpy(dst, s, sw);
+        } else {
+            for (Uint32 c = 0; c < cw; c++) {
+                dst[c] = s[c * sw / cw];
+            }
+        }
+        dst += cw;
+    }
+}
+
+Uint8 *ex_interleave(Uint8 *o, const Uint8 *a, const Uint8 *b, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        *o++ = a[i];
+        *o++ = b[i];
+    }
+    return o;
+}
+
+/* 4:2:2 packed, ypos/cbpos/crpos as in setup_param() */
+Uint8 *ex_pack422(Uint8 *o, const Uint8 *y, const Uint8 *cb,
+                  const Uint8 *cr, Uint32 ypos, Uint32 cbpos, Uint32 crpos)
+{
+    for (Uint32 i = 0; i < P.wh / 2; i++) {
+        o[ypos] = y[i * 2];
+        o[ypos + 2] = y[i * 2 + 1];
+        o[cbpos] = cb[i];
+        o[crpos] = cr[i];
+        o += 4;
+    }
+    return o;
+}
+
+/* 8 bit samples as loose 10 bit, inverse of unpack16_c() */
+Uint8 *ex_loose10(Uint8 *o, const Uint8 *src, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i++) {
+        Uint32 v = src[i] << 2;
+        *o++ = v;
+        *o++ = v >> 8;
+    }
+    return o;
+}
+
+/* 8 bit samples as compact 10 bit, 4 in 5 bytes LSB first, see unpack10_c() */
+Uint8 *ex_compact10(Uint8 *o, const Uint8 *src, Uint32 n)
+{
+    for (Uint32 i = 0; i < n; i += 4) {
+        Uint32 v0 = src[i] << 2, v1 = src[i + 1] << 2;
+        Uint32 v2 = src[i + 2] << 2, v3 = src[i + 3] << 2;
+        *o++ = v0;
+        *o++ = v0 >> 8 | v1 << 2;
+        *o++ = v1 >> 6 | v2 << 4;
+        *o++ = v2 >> 4 | v3 << 6;
+        *o++ = v3 >> 2;
+    }
+    return o;
+}
+
+/* inverse of detile(), w bytes x h rows into plane p at o, padding 0 */
+Uint8 *ex_tile(Uint8 *o, const TileFmt *t, Uint32 p, const Uint8 *src,
+               Uint32 w, Uint32 h)
+{
+    Uint32 tw = p ? t->cw : t->tw;
+    Uint32 th = p ? t->ch : t->th;
+    Uint32 span = t->span < tw ? t->span : tw;
+    Uint32 xt, yt;
+
+    tile_grid(t, p, w, h, &xt, &yt);
+    memset(o, 0, (size_t)xt * yt * tw * th);
+    for (Uint32 ty = 0; ty < yt; ty++) {
+        Uint32 rows = h - ty * th < th ? h - ty * th : th;
+        for (Uint32 tx = 0; tx * tw < w; tx++) {
+            Uint8 *tile = o + (size_t)tile_index(t, tx, ty, xt, yt) * tw * th;
+            const Uint8 *in = src + (size_t)ty * th * w + tx * tw;
+            Uint32 cols = w - tx * tw < tw ? w - tx * tw : tw;
+            for (Uint32 c = 0; c < cols; c += span) {
+                Uint32 n = cols - c < span ? cols - c : span;
+                for (Uint32 k = 0; k < rows; k++) {
+                    memcpy(tile + c * th + k * span, in + (size_t)k * w + c, n);
+                }
             }
         }
     }
-    *pLen = tokidx;
-    return toklst;
-cleanup:
-    *pLen = 0;
-    free(toklst);
-    return NULL;
+    return o + (size_t)xt * yt * tw * th;
 }
 
-void destoryStrFmtLst() {
-    for (int ft = 0; ft != COUNT_OF(gFmtMap); ft++) {
-        free(gNameLst[ft]);
+/* the frame as tiled gExport.fmt, inverse of read_semi_planar_tiled() */
+Uint8 *ex_tiled(ExportSlot *s, Uint8 *o)
+{
+    const TileFmt *t = &gTileMap[gExport.fmt];
+    Uint32 w = P.width, h = P.height;
+    Uint8 *start = o;
+    Uint8 *uv = s->tmp;
+    Uint8 *tiled = s->tmp + w * (h / 2);
+
+    if (t->vu) {
+        ex_interleave(uv, s->cr, s->cb, w / 2 * (h / 2));
+    } else {
+        ex_interleave(uv, s->cb, s->cr, w / 2 * (h / 2));
+    }
+    for (Uint32 p = 0; p < 2; p++) {
+        const Uint8 *src = p ? uv : s->f.y_data;
+        Uint32 rows = p ? h / 2 : h;
+        if (bitdepth(gExport.fmt) == 10) {
+            Uint8 *e = ex_tile(tiled, t, p, src, w, rows);
+            o = ex_compact10(o, tiled, e - tiled);
+        } else {
+            o = ex_tile(o, t, p, src, w, rows);
+        }
+        if (t->align && (o - start) % t->align) {
+            Uint32 pad = t->align - (o - start) % t->align;
+            memset(o, 0, pad);
+            o += pad;
+        }
     }
+    return o;
 }
 
-Uint32 parse_format(char *fmtstr) {
-    FORMAT = FORMAT_MAX;
-    Uint32 tokidx;
-    StrFmt *toklst = buildStrFmtLst(&tokidx);
-    // sort it for longest match
-    qsort(toklst, tokidx, sizeof(StrFmt), strfmtcmp_r);
-    for (Uint32 i = 0; i != tokidx; i++) {
-        StrFmt *p = toklst + i;
-        if (strcasestr(fmtstr, p->str) != NULL) {
-            FORMAT = p->fmt;
-            goto cleanup;
+/* the decoded frame as gExport.fmt, the inverse of its reader */
+Uint8 *ex_raw(ExportSlot *s, Uint32 srows, Uint8 *o)
+{
+    Frame *f = &s->f;
+    Uint32 w = P.width, h = P.height;
+    Uint32 cw = w / 2, ch = h / 2;
+
+    switch (gExport.fmt) {
+        case YV16:
+        case YUY2:
+        case UYVY:
+        case YVYU:
+        case Y42210:
+            ch = h;
+            break;
+        case YUV444P:
+            cw = w;
+            ch = h;
+            break;
+        default:
+            break;
+    }
+    ex_chroma(f->cb_data, srows, s->cb, cw, ch);
+    ex_chroma(f->cr_data, srows, s->cr, cw, ch);
+
+    switch (gExport.fmt) {
+        case YV12:
+        case IYUV:
+            o = put_bytes(o, f->y_data, P.wh);
+            o = put_bytes(o, s->cb, cw * ch);
+            o = put_bytes(o, s->cr, cw * ch);
+            break;
+        case YV16:
+        case YUV444P:
+            o = put_bytes(o, f->y_data, P.wh);
+            o = put_bytes(o, s->cr, cw * ch);
+            o = put_bytes(o, s->cb, cw * ch);
+            break;
+        case MONO:
+            o = put_bytes(o, f->y_data, P.wh);
+            break;
+        case NV12:
+            o = put_bytes(o, f->y_data, P.wh);
+            o = ex_interleave(o, s->cb, s->cr, cw * ch);
+            break;
+        case NV21:
+            o = put_bytes(o, f->y_data, P.wh);
+            o = ex_interleave(o, s->cr, s->cb, cw * ch);
+            break;
+        case YUY2:
+            o = ex_pack422(o, f->y_data, s->cb, s->cr, 0, 1, 3);
+            break;
+        case UYVY:
+            o = ex_pack422(o, f->y_data, s->cb, s->cr, 1, 0, 2);
+            break;
+        case YVYU:
+            o = ex_pack422(o, f->y_data, s->cb, s->cr, 0, 3, 1);
+            break;
+        case YV1210:
+        case Y42210:
+            o = ex_loose10(o, f->y_data, P.wh);
+            o = ex_loose10(o, s->cb, cw * ch);
+            o = ex_loose10(o, s->cr, cw * ch);
+            break;
+        case NV1210:
+            o = ex_compact10(o, f->y_data, P.wh);
+            ex_interleave(s->tmp, s->cb, s->cr, cw * ch);
+            o = ex_compact10(o, s->tmp, cw * ch * 2);
+            break;
+        case NV12TILED:
+        case NV1210TILED:
+        case NV12TILED4X4:
+        case NV12TILED16X16:
+        case NV12TILED64Z32:
+        case NV12TILEDY:
+        case NV12TILEDMT:
+            o = ex_tiled(s, o);
+            break;
+        default:
+            DIE("unhandled format=%d(%s)\n", gExport.fmt,
+                showFmt(gExport.fmt));
+            s->ok = 0;
+            break;
+    }
+    return o;
+}
+
+Uint8 clamp_u8(Sint32 v)
+{
+    return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* BT.601 limited range to RGB, PNG with stored deflate blocks: bigger
+ * files, but no zlib and no compression time in the pipeline */
+Uint8 *ex_png(ExportSlot *s, Uint32 srows, Uint8 *o)
+{
+    static const Uint8 sig[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+    Frame *f = &s->f;
+    Uint32 w = P.width, h = P.height;
+    Uint32 line = w * 3 + 1;
+    Uint32 size = line * h;
+    Uint8 *t = s->tmp;
+    Uint8 *chunk;
+
+    for (Uint32 r = 0; r < h; r++) {
+        const Uint8 *y = f->y_data + r * w;
+        const Uint8 *cb = f->cb_data + (Uint64)r * srows / h * (w / 2);
+        const Uint8 *cr = f->cr_data + (Uint64)r * srows / h * (w / 2);
+        *t++ = 0;             /* filter: none */
+        for (Uint32 c = 0; c < w; c++) {
+            Sint32 l = 298 * (y[c] - 16) + 128;
+            Sint32 u = cb[c / 2] - 128, v = cr[c / 2] - 128;
+            *t++ = clamp_u8((l + 409 * v) >> 8);
+            *t++ = clamp_u8((l - 100 * u - 208 * v) >> 8);
+            *t++ = clamp_u8((l + 516 * u) >> 8);
         }
     }
 
-cleanup:
-    destoryStrFmtLst();
-    return FORMAT != FORMAT_MAX;
+    o = put_bytes(o, sig, sizeof(sig));
+    chunk = o;
+    o = put_bytes(o + 4, (const Uint8 *)"IHDR", 4);
+    o = put_be32(o, w);
+    o = put_be32(o, h);
+    *o++ = 8;                 /* bit depth */
+    *o++ = 2;                 /* RGB */
+    *o++ = 0;
+    *o++ = 0;
+    *o++ = 0;
+    put_be32(chunk, o - chunk - 8);
+    o = put_be32(o, crc32_u8(0, chunk + 4, o - chunk - 4));
+
+    chunk = o;
+    o = put_bytes(o + 4, (const Uint8 *)"IDAT", 4);
+    *o++ = 0x78;
+    *o++ = 0x01;
+    for (Uint32 done = 0; done < size;) {
+        Uint32 n = size - done < 65535 ? size - done : 65535;
+        *o++ = done + n == size;
+        *o++ = n;
+        *o++ = n >> 8;
+        *o++ = ~n;
+        *o++ = ~n >> 8;
+        o = put_bytes(o, s->tmp + done, n);
+        done += n;
+    }
+    o = put_be32(o, adler32_u8(1, s->tmp, size));
+    put_be32(chunk, o - chunk - 8);
+    o = put_be32(o, crc32_u8(0, chunk + 4, o - chunk - 4));
+
+    chunk = o;
+    o = put_bytes(o + 4, (const Uint8 *)"IEND", 4);
+    put_be32(chunk, 0);
+    return put_be32(o, crc32_u8(0, chunk + 4, 4));
 }
 
-Uint32 negCondSkip(char *s, int (*cond)(int));
-Uint32 negCondSkip(char *s, int (*cond)(int)) {
-    int i;
-    for (i = 0; s[i] != '\0' && !cond(s[i]); i++) {
+void ex_convert_job(void *arg, Uint32 worker)
+{
+    ExportSlot *s = arg;
+    Frame *f = &s->f;
+    /* readers leave 4:2:2 chroma for packed formats, 4:2:0 otherwise */
+    Uint32 srows = isPlanar(FORMAT) ? P.height / 2 : P.height;
+    Uint32 csize = P.width / 2 * srows;
+    Uint8 *o = s->out;
+
+    (void)worker;
+    switch (gExport.kind) {
+        case EXPORT_Y4M:
+            o = put_bytes(o, (const Uint8 *)"FRAME\n", 6);
+            o = put_bytes(o, f->y_data, P.wh);
+            if (FORMAT != MONO) {
+                o = put_bytes(o, f->cb_data, csize);
+                o = put_bytes(o, f->cr_data, csize);
+            }
+            break;
+        case EXPORT_PNG:
+            o = ex_png(s, srows, o);
+            break;
+        default:
+            o = ex_raw(s, srows, o);
+            break;
     }
-    return i;
+    s->out_size = o - s->out;
 }
 
-Uint32 guess_arg(char *filename) {
-    /* how to guess
-     * - first number for width
-     * - second number for height
-     * - longest match format string in whole filename
-     */
-    char *s = filename;
-    char *p = s;
-    p += negCondSkip(p, isdigit);
-    if (*p == '\0') {
-        DIE("cannot find width\n");
-        return 0;
+Uint32 ex_png_name(char *buf, Uint32 size, Uint32 index)
+{
+    char *dot = strrchr(gExport.out, '.');
+    Uint32 n;
+
+    if (strchr(gExport.out, '%')) {
+        n = snprintf(buf, size, gExport.out, index);
+    } else {
+        /* out.png -> out_00042.png */
+        n = snprintf(buf, size, "%.*s_%05d%s", (int)(dot - gExport.out),
+                     gExport.out, index, dot);
     }
-    int width = strtol(p, &p, 10);
+    return n < size;
+}
 
-    p += negCondSkip(p, isdigit);
-    if (*p == '\0') {
-        DIE("cannot find height\n");
+Uint32 ex_write(ExportSlot *s)
+{
+    char name[4096];
+    FILE *fp = gExport.fp;
+    Uint32 ok;
+
+    if (gExport.kind == EXPORT_PNG) {
+        if (!ex_png_name(name, sizeof(name), s->index)
+            || !(fp = fopen(name, "wb"))) {
+            DIE("Error opening %s\n", name);
+            return 0;
+        }
+    }
+    ok = fwrite(s->out, 1, s->out_size, fp) == s->out_size;
+    if (gExport.kind == EXPORT_PNG) {
+        ok = !fclose(fp) && ok;
+    }
+    if (!ok) {
+        DIE("Error writing %s\n", gExport.out);
         return 0;
     }
-    int height = strtol(p, &p, 10);
+    gExport.bytes += s->out_size;
+    return 1;
+}
 
-    parse_format(filename);
-    if (FORMAT == FORMAT_MAX) {
-        DIE("cannot find fmt\n");
-        return 0;
+void ex_fail(void)
+{
+    SDL_mutexP(gExport.lock);
+    gExport.failed = true;
+    SDL_CondBroadcast(gExport.cond);
+    SDL_mutexV(gExport.lock);
+}
+
+/* wait until slot of frame #index is in state, false once failed */
+ExportSlot *ex_wait(Uint32 index, Uint32 state)
+{
+    ExportSlot *s = &gExport.slot[(index - gExport.first) % EXPORT_DEPTH];
+    ExportSlot *ret;
+
+    SDL_mutexP(gExport.lock);
+    while (s->state != state && !gExport.failed) {
+        SDL_CondWait(gExport.cond, gExport.lock);
     }
+    ret = gExport.failed ? NULL : s;
+    SDL_mutexV(gExport.lock);
+    return ret;
+}
 
-    P.width = width;
-    P.height = height;
-    LOG("guess width=%d height=%d fmt=%d(%s)\n",
-        width, height, FORMAT, showFmt(FORMAT));
-    return 1;
+void ex_post(ExportSlot *s, Uint32 state)
+{
+    SDL_mutexP(gExport.lock);
+    s->state = state;
+    SDL_CondBroadcast(gExport.cond);
+    SDL_mutexV(gExport.lock);
 }
 
-Uint32 parse_input(int argc, char **argv)
+int ex_reader(void *arg)
 {
-    if (argc == 2 && guess_arg(argv[1])) {
-        P.filename = argv[1];
-    } else if (argc == 5 || argc == 6) {
-        if (argc == 6) {
-            /* diff mode */
-            P.diff = 1;
-            P.fname_diff = argv[5];
-            printf("diff mode: with fn=[%s]\n", P.fname_diff);
+    (void)arg;
+    for (Uint32 i = gExport.first; i <= gExport.last; i++) {
+        ExportSlot *s = ex_wait(i, SLOT_FREE);
+        if (!s) {
+            break;
         }
-
-        P.filename = argv[1];
-        P.width = atoi(argv[2]);
-        P.height = atoi(argv[3]);
-        char *fmt = argv[4];
-        parse_format(fmt);
-        if (FORMAT == FORMAT_MAX) {
-            DIE("The format option '%s' is not recognized\n", fmt);
-            return 0;
+        s->index = i;
+        s->ok = dec_read(&P.dec, fd, &s->f);
+        ex_post(s, SLOT_READ);
+        if (!s->ok) {
+            break;
         }
-    } else {
-        usage(argv[0]);
-        return 0;
     }
-    precheck_range(FORMAT, gFmtMap);
-    P.overlay_format = gFmtMap[FORMAT].overlay_fmt;
-    char *cc = (char *)&P.overlay_format;
-    printf("arg %dx%d FORMAT=%d(%s) show overlay_format=%#x(%c%c%c%c)\n",
-           P.width, P.height, FORMAT, showFmt(FORMAT),
-           P.overlay_format, cc[0], cc[1], cc[2], cc[3]);
-    return 1;
+    return 0;
 }
 
-Uint32 open_input(void)
+int ex_writer(void *arg)
 {
-    fd = fopen(P.filename, "rb");
-    if (fd == NULL) {
-        DIE("Error opening file=%s\n", P.filename);
-        return 0;
+    (void)arg;
+    for (Uint32 i = gExport.first; i <= gExport.last; i++) {
+        ExportSlot *s = ex_wait(i, SLOT_DONE);
+        if (!s) {
+            break;
+        }
+        if (!ex_write(s)) {
+            ex_fail();
+            break;
+        }
+        ex_post(s, SLOT_FREE);
     }
+    return 0;
+}
 
-    if (P.diff) {
-        P.fd2 = fopen(P.fname_diff, "rb");
-        if (P.fd2 == NULL) {
-            DIE("Error opening %s\n", P.fname_diff);
+/* kind, output format and frame range from the options */
+Uint32 export_setup(void)
+{
+    char *ext = strrchr(gExport.out, '.');
+    Uint32 nframes = frame_count(fd);
+    Uint32 in = FORMAT;
+    char *end;
+
+    gExport.kind = EXPORT_RAW;
+    if (ext && !strcasecmp(ext, ".y4m")) {
+        gExport.kind = EXPORT_Y4M;
+    } else if (ext && !strcasecmp(ext, ".png")) {
+        gExport.kind = EXPORT_PNG;
+    }
+    gExport.fmt = FORMAT;
+    if (gExport.to) {
+        if (!parse_format(gExport.to)) {
+            DIE("The format option '%s' is not recognized\n", gExport.to);
+            FORMAT = in;
+            return 0;
+        }
+        gExport.fmt = FORMAT;
+        FORMAT = in;
+    }
+
+    gExport.first = 0;
+    gExport.last = nframes - 1;
+    if (gExport.range) {
+        gExport.first = strtoul(gExport.range, &end, 0);
+        if (*end == ':' && end[1]) {
+            gExport.last = strtoul(end + 1, &end, 0);
+        } else if (*end == ':') {
+            end++;
+        }
+        if (*end) {
+            DIE("bad value '%s' for --range\n", gExport.range);
             return 0;
         }
     }
+    if (gExport.last >= nframes) {
+        gExport.last = nframes - 1;
+    }
+    if (!nframes || gExport.first > gExport.last) {
+        DIE("no frames to export, the input has %d\n", nframes);
+        return 0;
+    }
     return 1;
 }
 
-Uint32 sdl_init(void)
+Uint32 export_run(void)
 {
-    /* SDL init */
-    if (SDL_Init(SDL_INIT_VIDEO) < 0) {
-        DIE("Unable to set video mode: %s\n", SDL_GetError());
-        atexit(SDL_Quit);
+    SDL_Thread *reader, *writer;
+    Uint32 start = SDL_GetTicks();
+    Uint32 ms, ret = 0;
+    Uint32 tiled;
+
+    setup_param();
+    if (gCmp.on || P.diff) {
+        DIE("--out exports a single input\n");
         return 0;
     }
-
-    info = SDL_GetVideoInfo();
-    if (!info) {
-        DIE("SDL ERROR Video query failed: %s\n", SDL_GetError());
-        SDL_Quit();
+    if (!export_setup()) {
         return 0;
     }
+    crc32_init();
+    /* tiled output is padded to whole tiles */
+    tiled = tile_frame_size(&gTileMap[gExport.fmt], P.width, P.height);
+    for (Uint32 i = 0; i < EXPORT_DEPTH; i++) {
+        ExportSlot *s = &gExport.slot[i];
+        /* Y42210 is the biggest raster output, 4 bytes per pel */
+        s->out = mem_alloc(P.wh * 4 + tiled * 2 + 1024, MEM_SCRATCH);
+        s->cb = mem_alloc(P.wh, MEM_SCRATCH);
+        s->cr = mem_alloc(P.wh, MEM_SCRATCH);
+        s->tmp = mem_alloc(P.wh * 3 + P.height + tiled, MEM_SCRATCH);
+        if (!frame_alloc(&P.dec, &s->f) || !s->out || !s->cb || !s->cr || !s->tmp) {
+            DIE("Error allocating memory...\n");
+            goto cleanup;
+        }
+    }
+    if (gExport.kind != EXPORT_PNG) {
+        gExport.fp = fopen(gExport.out, "wb");
+        if (!gExport.fp) {
+            DIE("Error opening %s\n", gExport.out);
+            goto cleanup;
+        }
+        setvbuf(gExport.fp, NULL, _IOFBF, EXPORT_BUF);
+    }
+    if (gExport.kind == EXPORT_Y4M) {
+        const char *c = FORMAT == MONO ? "mono"
+                        : isPlanar(FORMAT) ? "420jpeg" : "422";
+        fprintf(gExport.fp, "YUV4MPEG2 W%d H%d F" EXPORT_FPS " Ip A1:1 C%s\n",
+                P.width, P.height, c);
+    }
+    if (fseeko(fd, frame_offset(gExport.first), SEEK_SET) != 0) {
+        perror("fseeko");
+        goto cleanup;
+    }
 
-    P.bpp = info->vfmt->BitsPerPixel;
+    gExport.lock = SDL_CreateMutex();
+    gExport.cond = SDL_CreateCond();
+    if (!gExport.lock || !gExport.cond) {
+        DIE("SDL_CreateMutex: %s\n", SDL_GetError());
+        SDL_DestroyCond(gExport.cond);
+        SDL_DestroyMutex(gExport.lock);
+        goto cleanup;
+    }
+    reader = SDL_CreateThread(ex_reader, NULL);
+    writer = reader ? SDL_CreateThread(ex_writer, NULL) : NULL;
+    if (!writer) {
+        DIE("SDL_CreateThread: %s\n", SDL_GetError());
+        /* the reader stops at its next slot */
+        ex_fail();
+        SDL_WaitThread(reader, NULL);
+        SDL_DestroyCond(gExport.cond);
+        SDL_DestroyMutex(gExport.lock);
+        goto cleanup;
+    }
 
-    if (info->hw_available) {
-        P.vflags = SDL_HWSURFACE;
-    } else {
-        P.vflags = SDL_SWSURFACE;
+    /* convert whatever has been read, one batch across the pool */
+    for (Uint32 i = gExport.first; i <= gExport.last;) {
+        void *batch[EXPORT_DEPTH];
+        Uint32 n = 0;
+        ExportSlot *s = ex_wait(i, SLOT_READ);
+        if (!s) {
+            break;
+        }
+        SDL_mutexP(gExport.lock);
+        while (i + n <= gExport.last && n < EXPORT_DEPTH) {
+            s = &gExport.slot[(i + n - gExport.first) % EXPORT_DEPTH];
+            if (s->state != SLOT_READ || !s->ok) {
+                break;
+            }
+            batch[n++] = s;
+        }
+        SDL_mutexV(gExport.lock);
+        if (!n) {
+            /* read error */
+            ex_fail();
+            break;
+        }
+        pool_run(pool_get(), ex_convert_job, batch, n);
+        for (Uint32 k = 0; k < n; k++) {
+            s = batch[k];
+            if (!s->ok) {
+                ex_fail();
+            }
+            ex_post(s, SLOT_DONE);
+        }
+        i += n;
+    }
+    SDL_WaitThread(reader, NULL);
+    SDL_WaitThread(writer, NULL);
+    SDL_DestroyCond(gExport.cond);
+    SDL_DestroyMutex(gExport.lock);
+    ret = !gExport.failed;
+
+    ms = SDL_GetTicks() - start;
+    printf("exported frames %d..%d to %s, %.1f MB in %.2f s, %.1f MB/s\n",
+           gExport.first, gExport.last, gExport.out, gExport.bytes / 1e6,
+           ms / 1e3, ms ? gExport.bytes / 1e3 / ms : 0.0);
+cleanup:
+    if (gExport.fp && fclose(gExport.fp) != 0) {
+        DIE("Error writing %s\n", gExport.out);
+        ret = 0;
     }
+    gExport.fp = NULL;
+    for (Uint32 i = 0; i < EXPORT_DEPTH; i++) {
+        ExportSlot *s = &gExport.slot[i];
+        frame_free(&s->f);
+        mem_free(s->out);
+        mem_free(s->cb);
+        mem_free(s->cr);
+        mem_free(s->tmp);
+    }
+    return ret;
+}
 
-    // find SDL_SetVideoMode crash when 32768x320 size
-    if (P.width > 4096 || P.height > 2176) {
-        DIE("SDL cannot support size=%dx%d > 4096x2160\n", P.width, P.height);
-        return 0;
+/* window and overlay for the current size and zoom, SDL stays up */
+Uint32 sdl_overlay(void)
+{
+    if (my_overlay) {
+        SDL_FreeYUVOverlay(my_overlay);
+        my_overlay = NULL;
     }
 
-    if ((screen = SDL_SetVideoMode(P.width, P.height, P.bpp, P.vflags)) == 0) {
+    set_zoom_rect();
+    screen = SDL_SetVideoMode(P.zoom_width, P.zoom_height, P.bpp, P.vflags);
+    if (!screen) {
         DIE("SDL ERROR Video mode set failed: %s\n", SDL_GetError());
-        SDL_Quit();
         return 0;
     }
 
@@ -1873,6 +11872,10 @@ Uint32 sdl_init(void)
         DIE("Couldn't create overlay\n");
         return 0;
     }
+    /* layers and dirty blocks follow the new geometry on the next draw */
+    layers_free();
+    dirty_free();
+    gLayers.mb = 0;
     return 1;
 }
 
@@ -1882,15 +11885,46 @@ int main(int argc, char **argv)
 
     /* Initialize param struct to zero */
     memset(&P, 0, sizeof(P));
+    P.zoom = 1;
 
+    if (!kern_init(getenv("YV_KERNELS"))) {
+        DIE("bad value '%s' for YV_KERNELS\n", getenv("YV_KERNELS"));
+        return EXIT_FAILURE;
+    }
     if (!parse_input(argc, argv)) {
         return EXIT_FAILURE;
     }
+    mem_init();
 
     if (!open_input()) {
         return EXIT_FAILURE;
     }
 
+    uring_open();
+
+    if (gExport.out) {
+        /* batch conversion, no window */
+        ret = export_run() ? EXIT_SUCCESS : EXIT_FAILURE;
+        goto cleanup;
+    }
+    if (gNet.serve) {
+        /* streams to yv:// viewers until SIGINT or SIGTERM, no window */
+        ret = serve_run() ? EXIT_SUCCESS : EXIT_FAILURE;
+        goto cleanup;
+    }
+    if (gQc.report) {
+        /* batch scan, no window */
+        ret = qc_run() ? EXIT_SUCCESS : EXIT_FAILURE;
+        goto cleanup;
+    }
+    if (gHash.out || gHash.manifest) {
+        /* batch hashing, a window only to show a --verify-view mismatch */
+        ret = hash_run() ? EXIT_SUCCESS : EXIT_FAILURE;
+        if (!gHash.view || gHash.first < 0) {
+            goto cleanup;
+        }
+    }
+
     if (!reinit()) {
         goto cleanup;
     }
@@ -1898,17 +11932,28 @@ int main(int argc, char **argv)
     /* Lets do some basic consistency check on input */
     check_input();
 
-    /* send event to display first frame */
-    event.type = SDL_KEYDOWN;
-    event.key.keysym.sym = SDLK_RIGHT;
-    SDL_PushEvent(&event);
+    if (gHash.view) {
+        hash_show();
+    } else {
+        /* send event to display first frame */
+        event.type = SDL_KEYDOWN;
+        event.key.keysym.sym = SDLK_RIGHT;
+        SDL_PushEvent(&event);
+    }
 
     /* while true */
     event_loop();
 
 cleanup:
-    destroy_message_queue();
+    sheet_close();
+    line_close();
+    qc_close();
+    sync_detach();
+    cmp_close();
+    uring_close();
     SDL_FreeYUVOverlay(my_overlay);
+    layers_free();
+    dirty_free();
     check_free_memory();
     if (fd) {
         fclose(fd);
@@ -1916,6 +11961,9 @@ cleanup:
     if (P.fd2) {
         fclose(P.fd2);
     }
+    /* after the inputs, compressed ones wait for their decode jobs */
+    pool_destroy(gPool);
+    mem_close();
 
     return ret;
 }